@@ -0,0 +1,538 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib/adaptive.h"
+#include "lib/foveated.h"
+#include "lib/camera.h"
+#include "lib/constants.h"
+#include "lib/hdr.h"
+#include "lib/raytracer.h"
+#include "lib/scene.h"
+#include "lib/scene_generator.h"
+#include "lib/timer.h"
+#include "lib/vector_batch.h"
+#include "lib/wavefront.h"
+
+#define BENCH_FIELD_SIZE_X 20
+#define BENCH_FIELD_SIZE_Y 5
+#define BENCH_FIELD_SIZE_Z 10
+
+#define SCALING_SEED 1
+#define SCALING_LIGHTS 4      /* Lights while the sphere count varies */
+#define SCALING_SPHERES 10000 /* Spheres while the light count varies;
+                                 one of scaling_sphere_counts */
+
+#define BENCH_REFLECTION_DEPTH 2
+
+typedef struct {
+  const char *name;
+  Vector3D position;
+  float yaw;
+  float pitch;
+} BenchPose;
+
+typedef struct {
+  const char *name;
+  Scene *(*create)(void);
+} BenchScene;
+
+typedef struct {
+  const char *name;
+  void (*render)(Scene *scene, Camera *camera, uint32_t *framebuffer);
+} BenchMode;
+
+typedef struct {
+  double median_ms;
+  double p95_ms;
+  double mean_ms;
+} Summary;
+
+typedef struct {
+  int warmup;
+  int trials;
+  int thread_count;
+  SimdLevel simd;
+  const char *json_path;
+  bool scaling;
+  int max_spheres;
+  const char *csv_path;
+} Options;
+
+/* A regular grid of small spheres over the demo floor, so that the
+ * numbers reflect acceleration structure traversal and not just the five
+ * demo spheres. */
+static Scene *create_field_scene(void) {
+  Scene *scene = calloc(1, sizeof(Scene));
+  if (!scene) {
+    return NULL;
+  }
+
+  scene->spheres_count =
+      BENCH_FIELD_SIZE_X * BENCH_FIELD_SIZE_Y * BENCH_FIELD_SIZE_Z + 1;
+  scene->spheres = malloc(sizeof(Sphere) * scene->spheres_count);
+  scene->lights_count = 3;
+  scene->lights = malloc(sizeof(Light) * scene->lights_count);
+  if (!scene->spheres || !scene->lights) {
+    scene_destroy(scene);
+    return NULL;
+  }
+
+  const VectorColor palette[] = {vector_color_red(), vector_color_green(),
+                                 vector_color_blue(), vector_color_cyan(),
+                                 vector_color_magenta()};
+  int count = 0;
+  for (int x = 0; x < BENCH_FIELD_SIZE_X; x++) {
+    for (int y = 0; y < BENCH_FIELD_SIZE_Y; y++) {
+      for (int z = 0; z < BENCH_FIELD_SIZE_Z; z++) {
+        Vector3D center = vector_3d_init(x - BENCH_FIELD_SIZE_X / 2.0f,
+                                         y * 0.8f - 0.6f, z * 1.2f + 2.0f);
+        scene->spheres[count] =
+            (Sphere){center, 0.3f, palette[count % 5], false, 100, 0.3f};
+        count++;
+      }
+    }
+  }
+  scene->spheres[count] = (Sphere){vector_3d_init(0, -5001, 0), 5000,
+                                   vector_color_yellow(), false, 1000, 0.5f};
+
+  scene->lights[0] = (Light){0.2f, AMBIENT, vector_3d_init(0, 0, 0)};
+  scene->lights[1] = (Light){0.6f, POINT, vector_3d_init(2, 3, 0)};
+  scene->lights[2] = (Light){0.2f, DIRECTIONAL, vector_3d_init(1, 4, 4)};
+  scene->default_background_color = vector_color_black();
+
+  scene->bvh = bvh_build(scene->spheres, scene->spheres_count);
+  if (!scene->bvh || !scene_build_light_tree(scene)) {
+    scene_destroy(scene);
+    return NULL;
+  }
+
+  return scene;
+}
+
+static const BenchScene bench_scenes[] = {
+    {"demo", scene_create_demo},
+    {"field", create_field_scene},
+};
+
+static const BenchPose bench_poses[] = {
+    {"front", {0.0f, 0.0f, -3.0f}, 0.0f, 0.0f},
+    {"high", {0.0f, 3.0f, -6.0f}, 0.0f, -25.0f},
+    {"side", {-5.0f, 0.5f, 2.0f}, 60.0f, 0.0f},
+};
+
+static void render_low(Scene *scene, Camera *camera, uint32_t *framebuffer) {
+  main_raytracer(scene, camera, framebuffer, true);
+}
+
+static void render_full(Scene *scene, Camera *camera, uint32_t *framebuffer) {
+  main_raytracer(scene, camera, framebuffer, false);
+}
+
+/* Full resolution with shadows, for comparison with the full mode. */
+static void render_shadows(Scene *scene, Camera *camera,
+                           uint32_t *framebuffer) {
+  bool shadows = scene->shadows;
+  scene->shadows = true;
+  main_raytracer(scene, camera, framebuffer, false);
+  scene->shadows = shadows;
+}
+
+/* Moving frames for a viewer looking at the centre. */
+static void render_foveated(Scene *scene, Camera *camera,
+                            uint32_t *framebuffer) {
+  FoveatedConfig config = foveated_default_config();
+  foveated_render(scene, camera, framebuffer, &config);
+}
+
+static HdrImage *bench_hdr = NULL;
+
+/* Full resolution into linear pixels plus the packing pass, for
+ * comparison with the full mode. */
+static void render_hdr(Scene *scene, Camera *camera, uint32_t *framebuffer) {
+  hdr_image_fill(bench_hdr, scene->default_background_color);
+  main_raytracer_hdr(scene, camera, bench_hdr, NULL, false);
+  hdr_image_tonemap(bench_hdr, framebuffer, 1.0f, HDR_TONEMAP_CLAMP);
+}
+
+static Wavefront *bench_wavefront = NULL;
+
+/* The hdr mode plus two bounces of reflection. */
+static void render_reflections(Scene *scene, Camera *camera,
+                               uint32_t *framebuffer) {
+  WavefrontConfig config = {.max_depth = BENCH_REFLECTION_DEPTH};
+  hdr_image_fill(bench_hdr, scene->default_background_color);
+  wavefront_render(bench_wavefront, scene, camera, bench_hdr, &config);
+  hdr_image_tonemap(bench_hdr, framebuffer, 1.0f, HDR_TONEMAP_CLAMP);
+}
+
+static const BenchMode bench_modes[] = {
+    {"low", render_low},
+    {"full", render_full},
+    {"adapt", adaptive_render},
+    {"fovea", render_foveated},
+    {"shadow", render_shadows},
+    {"hdr", render_hdr},
+    {"mirror", render_reflections},
+};
+
+static const int scaling_sphere_counts[] = {1000, 10000, 100000, 1000000,
+                                            10000000};
+static const int scaling_light_counts[] = {1, 4, 16, 64};
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentiles over the sorted samples. */
+static Summary summarize(double *samples, int count) {
+  qsort(samples, count, sizeof(double), compare_doubles);
+
+  double sum = 0.0;
+  for (int i = 0; i < count; i++) {
+    sum += samples[i];
+  }
+
+  int p95_rank = (95 * count + 99) / 100;
+  return (Summary){
+      .median_ms = count % 2
+                       ? samples[count / 2]
+                       : (samples[count / 2 - 1] + samples[count / 2]) / 2,
+      .p95_ms = samples[p95_rank - 1],
+      .mean_ms = sum / count};
+}
+
+static void clear_framebuffer(uint32_t *framebuffer, size_t count,
+                              VectorColor color) {
+  uint32_t pixel = vector_color_to_rgb_color(color);
+  for (size_t i = 0; i < count; i++) {
+    framebuffer[i] = pixel;
+  }
+}
+
+static bool parse_options(int argc, char *argv[], Options *options) {
+  *options = (Options){.warmup = 2,
+                       .trials = 10,
+                       .thread_count = RENDER_THREADS,
+                       .simd = SIMD_AVX512,
+                       .json_path = NULL,
+                       .max_spheres = 1000000};
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--scaling") == 0) {
+      options->scaling = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      return false;
+    }
+
+    const char *name = argv[i];
+    const char *value = argv[++i];
+    if (strcmp(name, "--warmup") == 0) {
+      options->warmup = atoi(value);
+    } else if (strcmp(name, "--trials") == 0) {
+      options->trials = atoi(value);
+    } else if (strcmp(name, "--threads") == 0) {
+      options->thread_count = atoi(value);
+    } else if (strcmp(name, "--simd") == 0) {
+      if (!vector_batch_level_parse(value, &options->simd)) {
+        return false;
+      }
+    } else if (strcmp(name, "--json") == 0) {
+      options->json_path = value;
+    } else if (strcmp(name, "--max-spheres") == 0) {
+      options->max_spheres = atoi(value);
+    } else if (strcmp(name, "--csv") == 0) {
+      options->csv_path = value;
+    } else {
+      return false;
+    }
+  }
+
+  return options->warmup >= 0 && options->trials > 0 &&
+         options->thread_count >= 0;
+}
+
+/* Full resolution frame times of one generated scene, as a table row and
+ * a CSV line. */
+static bool run_scaling_scene(const Options *options,
+                              SceneDistribution distribution,
+                              int spheres_count, int lights_count,
+                              uint32_t *framebuffer, double *samples,
+                              FILE *csv) {
+  Scene *scene = scene_generate(distribution, spheres_count, lights_count,
+                                SCALING_SEED);
+  if (!scene) {
+    fprintf(stderr, "Out of memory (%s scene, %d spheres)\n",
+            scene_distribution_name(distribution), spheres_count);
+    return false;
+  }
+
+  Camera camera;
+  camera_init(&camera, WINDOW_WIDTH, WINDOW_HEIGHT);
+
+  for (int i = 0; i < options->warmup; i++) {
+    main_raytracer(scene, &camera, framebuffer, false);
+  }
+  for (int i = 0; i < options->trials; i++) {
+    double start = timer_now_ms();
+    main_raytracer(scene, &camera, framebuffer, false);
+    samples[i] = timer_now_ms() - start;
+  }
+
+  RenderCounters counters = raytracer_frame_counters();
+  Summary trace = summarize(samples, options->trials);
+  double rays_per_second = counters.primary_rays / (trace.median_ms / 1000);
+  double tests_per_ray =
+      (double)counters.sphere_tests / counters.primary_rays;
+
+  printf("%-9s %9d %6d %10.2f %10.2f %10.2f %10.2f %10.1f\n",
+         scene_distribution_name(distribution), spheres_count, lights_count,
+         scene->bvh->build_time_ms, trace.median_ms, trace.p95_ms,
+         rays_per_second / 1e6, tests_per_ray);
+  if (csv) {
+    fprintf(csv, "%s,%d,%d,%.4f,%.4f,%.4f,%.1f,%.2f\n",
+            scene_distribution_name(distribution), spheres_count,
+            lights_count, scene->bvh->build_time_ms, trace.median_ms,
+            trace.p95_ms, rays_per_second, tests_per_ray);
+  }
+  fflush(stdout);
+
+  scene_destroy(scene);
+  return true;
+}
+
+/* Frame time against sphere count at SCALING_LIGHTS lights, then against
+ * light count at SCALING_SPHERES spheres, for every distribution. Sphere
+ * counts above --max-spheres are skipped, and the SCALING_LIGHTS point of
+ * the light sweep is the one the sphere sweep measured. */
+static int run_scaling(const Options *options) {
+  FILE *csv = NULL;
+  if (options->csv_path) {
+    csv = fopen(options->csv_path, "w");
+    if (!csv) {
+      perror(options->csv_path);
+      return 1;
+    }
+    fprintf(csv, "distribution,spheres,lights,build_ms,trace_median_ms,"
+                 "trace_p95_ms,rays_per_second,tests_per_ray\n");
+  }
+
+  size_t pixel_count = (size_t)WINDOW_WIDTH * WINDOW_HEIGHT;
+  uint32_t *framebuffer = malloc(sizeof(uint32_t) * pixel_count);
+  double *samples = malloc(sizeof(double) * options->trials);
+  if (!framebuffer || !samples) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  raytracer_init(options->thread_count);
+
+  printf("%d thread(s), %s kernels, %d warm-up run(s), %d trial(s), "
+         "%dx%d\n",
+         raytracer_thread_count(), vector_batch_level_name(options->simd),
+         options->warmup, options->trials, WINDOW_WIDTH, WINDOW_HEIGHT);
+  printf("%-9s %9s %6s %10s %10s %10s %10s %10s\n", "scene", "spheres",
+         "lights", "build ms", "median ms", "p95 ms", "Mrays/s",
+         "tests/ray");
+
+  size_t spheres_steps =
+      sizeof(scaling_sphere_counts) / sizeof(scaling_sphere_counts[0]);
+  size_t lights_steps =
+      sizeof(scaling_light_counts) / sizeof(scaling_light_counts[0]);
+  bool ok = true;
+
+  for (int d = 0; d < SCENE_DISTRIBUTIONS_COUNT && ok; d++) {
+    for (size_t i = 0; i < spheres_steps && ok; i++) {
+      if (scaling_sphere_counts[i] <= options->max_spheres) {
+        ok = run_scaling_scene(options, (SceneDistribution)d,
+                               scaling_sphere_counts[i], SCALING_LIGHTS,
+                               framebuffer, samples, csv);
+      }
+    }
+    for (size_t i = 0; i < lights_steps && ok; i++) {
+      if (SCALING_SPHERES <= options->max_spheres &&
+          scaling_light_counts[i] != SCALING_LIGHTS) {
+        ok = run_scaling_scene(options, (SceneDistribution)d,
+                               SCALING_SPHERES, scaling_light_counts[i],
+                               framebuffer, samples, csv);
+      }
+    }
+  }
+
+  if (csv) {
+    fclose(csv);
+  }
+  raytracer_quit();
+  free(framebuffer);
+  free(samples);
+
+  return ok ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!parse_options(argc, argv, &options)) {
+    fprintf(stderr,
+            "Usage: %s [--warmup N] [--trials N] [--threads N] "
+            "[--simd LEVEL] [--json PATH]\n"
+            "       %s --scaling [--max-spheres N] [--csv PATH] "
+            "[--warmup N] [--trials N] [--threads N] [--simd LEVEL]\n",
+            argv[0], argv[0]);
+    return 1;
+  }
+
+  /* From here on, the level actually used. */
+  options.simd = vector_batch_select(options.simd);
+
+  if (options.scaling) {
+    return run_scaling(&options);
+  }
+
+  FILE *json = NULL;
+  if (options.json_path) {
+    json = fopen(options.json_path, "w");
+    if (!json) {
+      perror(options.json_path);
+      return 1;
+    }
+  }
+
+  size_t pixel_count = (size_t)WINDOW_WIDTH * WINDOW_HEIGHT;
+  uint32_t *framebuffer = malloc(sizeof(uint32_t) * pixel_count);
+  double *trace_samples = malloc(sizeof(double) * options.trials);
+  double *clear_samples = malloc(sizeof(double) * options.trials);
+  bench_hdr = hdr_image_create(WINDOW_WIDTH, WINDOW_HEIGHT);
+  bench_wavefront = wavefront_create(WINDOW_WIDTH, WINDOW_HEIGHT);
+  if (!framebuffer || !trace_samples || !clear_samples || !bench_hdr ||
+      !bench_wavefront) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  raytracer_init(options.thread_count);
+
+  printf("%d thread(s), %s kernels, %d warm-up run(s), %d trial(s), "
+         "%dx%d\n",
+         raytracer_thread_count(), vector_batch_level_name(options.simd),
+         options.warmup, options.trials, WINDOW_WIDTH, WINDOW_HEIGHT);
+  printf("%-6s %-6s %-6s %10s %10s %10s %8s %10s %12s\n", "scene", "pose",
+         "mode", "clear ms", "median ms", "p95 ms", "rays %", "Mrays/s",
+         "Mtests/s");
+
+  if (json) {
+    fprintf(json,
+            "{\n  \"threads\": %d,\n  \"simd\": \"%s\",\n"
+            "  \"warmup\": %d,\n  \"trials\": %d,\n"
+            "  \"width\": %d,\n  \"height\": %d,\n  \"results\": [",
+            raytracer_thread_count(), vector_batch_level_name(options.simd),
+            options.warmup, options.trials, WINDOW_WIDTH, WINDOW_HEIGHT);
+  }
+
+  bool first_result = true;
+  size_t scenes_count = sizeof(bench_scenes) / sizeof(bench_scenes[0]);
+  size_t poses_count = sizeof(bench_poses) / sizeof(bench_poses[0]);
+  size_t modes_count = sizeof(bench_modes) / sizeof(bench_modes[0]);
+
+  for (size_t s = 0; s < scenes_count; s++) {
+    Scene *scene = bench_scenes[s].create();
+    if (!scene) {
+      fprintf(stderr, "Out of memory (Scene %s)\n", bench_scenes[s].name);
+      return 1;
+    }
+
+    for (size_t p = 0; p < poses_count; p++) {
+      const BenchPose *pose = &bench_poses[p];
+
+      Camera camera;
+      camera_init(&camera, WINDOW_WIDTH, WINDOW_HEIGHT);
+      camera.position = pose->position;
+      camera.yaw = pose->yaw * (float)(MATH_PI / 180.0);
+      camera.pitch = pose->pitch * (float)(MATH_PI / 180.0);
+      camera_update_orientation(&camera);
+
+      for (size_t m = 0; m < modes_count; m++) {
+        const BenchMode *mode = &bench_modes[m];
+
+        for (int i = 0; i < options.warmup; i++) {
+          clear_framebuffer(framebuffer, pixel_count,
+                            scene->default_background_color);
+          mode->render(scene, &camera, framebuffer);
+        }
+
+        /* From the totals, as a mode may make several render calls. */
+        RenderCounters counters = {0};
+        for (int i = 0; i < options.trials; i++) {
+          double start = timer_now_ms();
+          clear_framebuffer(framebuffer, pixel_count,
+                            scene->default_background_color);
+          double cleared = timer_now_ms();
+          RenderCounters before = raytracer_total_counters();
+          mode->render(scene, &camera, framebuffer);
+          double traced = timer_now_ms();
+          counters =
+              raytracer_counters_subtract(raytracer_total_counters(), before);
+
+          clear_samples[i] = cleared - start;
+          trace_samples[i] = traced - cleared;
+        }
+
+        Summary clear = summarize(clear_samples, options.trials);
+        Summary trace = summarize(trace_samples, options.trials);
+        double trace_seconds = trace.median_ms / 1000;
+        double rays_per_second =
+            (counters.primary_rays + counters.reflection_rays) /
+            trace_seconds;
+        double tests_per_second = counters.sphere_tests / trace_seconds;
+        /* Share of the pixels that got their own ray. */
+        double rays_percent = 100.0 * counters.primary_rays / pixel_count;
+
+        printf("%-6s %-6s %-6s %10.2f %10.2f %10.2f %8.1f %10.2f %12.2f\n",
+               bench_scenes[s].name, pose->name, mode->name, clear.median_ms,
+               trace.median_ms, trace.p95_ms, rays_percent,
+               rays_per_second / 1e6, tests_per_second / 1e6);
+
+        if (json) {
+          fprintf(json,
+                  "%s\n    {\"scene\": \"%s\", \"pose\": \"%s\", "
+                  "\"mode\": \"%s\", \"spheres\": %d,\n"
+                  "     \"clear_median_ms\": %.4f, \"trace_median_ms\": %.4f, "
+                  "\"trace_p95_ms\": %.4f, \"trace_mean_ms\": %.4f,\n"
+                  "     \"primary_rays\": %llu, \"sphere_tests\": %llu, "
+                  "\"shadow_rays\": %llu, \"reflection_rays\": %llu,\n"
+                  "     \"rays_per_second\": %.1f, \"tests_per_second\": %.1f}",
+                  first_result ? "" : ",", bench_scenes[s].name, pose->name,
+                  mode->name, scene->spheres_count, clear.median_ms,
+                  trace.median_ms, trace.p95_ms, trace.mean_ms,
+                  (unsigned long long)counters.primary_rays,
+                  (unsigned long long)counters.sphere_tests,
+                  (unsigned long long)counters.shadow_rays,
+                  (unsigned long long)counters.reflection_rays,
+                  rays_per_second, tests_per_second);
+          first_result = false;
+        }
+      }
+    }
+
+    scene_destroy(scene);
+  }
+
+  if (json) {
+    fprintf(json, "\n  ]\n}\n");
+    fclose(json);
+  }
+
+  raytracer_quit();
+  wavefront_destroy(bench_wavefront);
+  hdr_image_destroy(bench_hdr);
+  free(framebuffer);
+  free(trace_samples);
+  free(clear_samples);
+
+  return 0;
+}
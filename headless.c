@@ -0,0 +1,1008 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "lib/adaptive.h"
+#include "lib/animation.h"
+#include "lib/camera.h"
+#include "lib/camera_path.h"
+#include "lib/constants.h"
+#include "lib/distributed.h"
+#include "lib/dynamic_resolution.h"
+#include "lib/foveated.h"
+#include "lib/hdr.h"
+#include "lib/image.h"
+#include "lib/incremental.h"
+#include "lib/raytracer.h"
+#include "lib/scene.h"
+#include "lib/scene_file.h"
+#include "lib/scene_generator.h"
+#include "lib/tiled_output.h"
+#include "lib/timer.h"
+#include "lib/vector_batch.h"
+#include "lib/video.h"
+#include "lib/wavefront.h"
+
+typedef struct {
+  int width;
+  int height;
+  Vector3D position;
+  float yaw;
+  float pitch;
+  float roll;
+  bool pose_set;
+  int thread_count;
+  int workers_count; /* Worker processes, 0 renders in this one */
+  int worker_threads;
+  SimdLevel simd;
+  bool low_resolution;
+  bool adaptive;
+  bool foveated;
+  FoveatedConfig fovea;
+  bool shadows;
+  float light_cutoff; /* Negative keeps the scene's */
+  WavefrontConfig reflections;
+  const char *output_path;
+  const char *tiled_output_path;
+  const char *hdr_output_path;
+  float exposure;
+  HdrTonemap tonemap;
+  const char *scene_path;
+  const char *generate_spec;
+  const char *save_scene_path;
+  bool move_sphere;
+  int sphere_index;
+  Vector3D sphere_center;
+  bool set_light;
+  int light_index;
+  float light_intensity;
+  const char *replay_path;
+  float replay_timestep; /* Seconds, 0 for the recorded ones */
+  const char *replay_log_path;
+  double target_frame_ms; /* Replay moving frames by dynamic resolution */
+  const char *animation_path;
+  int fps;
+  const char *stream_path; /* "-" for stdout */
+  VideoFormat stream_format;
+} Options;
+
+static void print_usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --width N          image width (default %d)\n"
+          "  --height N         image height (default %d)\n"
+          "  --position X,Y,Z   camera position (default 0,0,-3, or the\n"
+          "                     scene file's camera)\n"
+          "  --yaw DEG          camera yaw in degrees (default 0)\n"
+          "  --pitch DEG        camera pitch in degrees (default 0)\n"
+          "  --roll DEG         camera roll in degrees (default 0)\n"
+          "  --threads N        render threads, 0 = all CPUs (default 0)\n"
+          "  --distribute N     render the tiles in N worker processes\n"
+          "  --worker-threads N render threads per worker, 0 = all CPUs\n"
+          "                     (default 1)\n"
+          "  --simd LEVEL       widest vector kernels to use: scalar,\n"
+          "                     sse4.1, avx2 or avx512 (default: the\n"
+          "                     widest the CPU supports)\n"
+          "  --low-resolution   trace one ray per 8x8 block\n"
+          "  --adaptive         subdivide 8x8 cells only where they differ\n"
+          "  --foveated         trace fewer rays away from the centre\n"
+          "  --fovea X,Y,INNER,OUTER\n"
+          "                     foveated, around X,Y (fractions of the\n"
+          "                     size) at full rate within INNER and half\n"
+          "                     rate within OUTER (fractions of half the\n"
+          "                     diagonal; default 0.5,0.5,%g,%g)\n"
+          "  --shadows          cast shadows from point and directional\n"
+          "                     lights\n"
+          "  --light-cutoff C   evaluate distant point lights by cluster,\n"
+          "                     allowing an error of about C per cluster\n"
+          "                     (default: the scene's, 0 = every light)\n"
+          "  --reflections N    trace up to N bounces of mirror reflection\n"
+          "                     (at most %d, default 0)\n"
+          "  --ray-budget N     reflection rays per frame, 0 = no limit\n"
+          "  --output PATH      .png or .ppm file (default render.ppm)\n"
+          "  --tiled-output PATH\n"
+          "                     render tile by tile into a memory-mapped\n"
+          "                     .ppm file, for images too large for memory\n"
+          "  --hdr-output PATH  also write the linear image as a .pfm file\n"
+          "  --exposure EV      exposure in stops (default 0)\n"
+          "  --tonemap NAME     clamp or reinhard (default clamp)\n"
+          "  --scene PATH       text or binary scene file (default: demo)\n"
+          "  --generate DIST,SPHERES,LIGHTS[,SEED]\n"
+          "                     generate a uniform, clustered or layered\n"
+          "                     scene\n"
+          "  --save-scene PATH  also write the scene as a binary file\n"
+          "  --move-sphere I,X,Y,Z\n"
+          "                     after rendering, move sphere I and render\n"
+          "                     again incrementally\n"
+          "  --set-light I,INTENSITY\n"
+          "                     after rendering, change light I and render\n"
+          "                     again incrementally\n"
+          "  --replay PATH      fly the recorded camera path, timing every\n"
+          "                     frame at low and full resolution\n"
+          "  --replay-timestep MS\n"
+          "                     advance each replayed frame by MS (default:\n"
+          "                     the recorded frame times)\n"
+          "  --replay-log PATH  write the replay's frame times as CSV\n"
+          "  --target-frame-time MS\n"
+          "                     replay moving frames at the resolution\n"
+          "                     that takes MS instead of at low resolution\n"
+          "  --animation PATH   render a keyframed camera animation as a\n"
+          "                     video stream\n"
+          "  --fps N            animation frame rate (default 30)\n"
+          "  --stream PATH      video output file or pipe, - = stdout\n"
+          "                     (default -)\n"
+          "  --stream-format NAME\n"
+          "                     y4m or argb (default y4m)\n",
+          program, WINDOW_WIDTH, WINDOW_HEIGHT, FOVEATED_INNER_RADIUS,
+          FOVEATED_OUTER_RADIUS, WAVEFRONT_MAX_DEPTH);
+}
+
+static bool parse_int(const char *text, int *value) {
+  char *end;
+  long parsed = strtol(text, &end, 10);
+  *value = (int)parsed;
+  return *text != '\0' && *end == '\0';
+}
+
+static bool parse_degrees(const char *text, float *radians) {
+  char *end;
+  float degrees = strtof(text, &end);
+  *radians = degrees * (float)(MATH_PI / 180.0);
+  return *text != '\0' && *end == '\0';
+}
+
+static bool parse_position(const char *text, Vector3D *position) {
+  return sscanf(text, "%f,%f,%f", &position->x, &position->y,
+                &position->z) == 3;
+}
+
+/* I,X,Y,Z */
+static bool parse_sphere_move(const char *text, int *index,
+                              Vector3D *center) {
+  return sscanf(text, "%d,%f,%f,%f", index, &center->x, &center->y,
+                &center->z) == 4 &&
+         *index >= 0;
+}
+
+/* X,Y,INNER,OUTER */
+static bool parse_fovea(const char *text, FoveatedConfig *config) {
+  return sscanf(text, "%f,%f,%f,%f", &config->center_x, &config->center_y,
+                &config->inner_radius, &config->outer_radius) == 4 &&
+         config->inner_radius >= 0.0f &&
+         config->outer_radius >= config->inner_radius;
+}
+
+/* I,INTENSITY */
+static bool parse_light_change(const char *text, int *index,
+                               float *intensity) {
+  return sscanf(text, "%d,%f", index, intensity) == 2 && *index >= 0;
+}
+
+/* DIST,SPHERES,LIGHTS[,SEED] */
+static Scene *generate_scene(const char *spec) {
+  char name[16];
+  int spheres_count;
+  int lights_count;
+  unsigned long long seed = 1;
+  SceneDistribution distribution;
+
+  int fields = sscanf(spec, "%15[^,],%d,%d,%llu", name, &spheres_count,
+                      &lights_count, &seed);
+  if (fields < 3 || !scene_distribution_parse(name, &distribution)) {
+    fprintf(stderr, "Invalid scene: %s\n", spec);
+    return NULL;
+  }
+
+  Scene *scene =
+      scene_generate(distribution, spheres_count, lights_count, seed);
+  if (!scene) {
+    fprintf(stderr, "Cannot generate %s\n", spec);
+    return NULL;
+  }
+
+  fprintf(stderr, "Generated %d spheres and %d lights, BVH in %.2f ms\n",
+          scene->spheres_count, scene->lights_count,
+          scene->bvh->build_time_ms);
+  return scene;
+}
+
+static bool parse_options(int argc, char *argv[], Options *options) {
+  *options = (Options){.width = WINDOW_WIDTH,
+                       .height = WINDOW_HEIGHT,
+                       .position = vector_3d_init(0.0f, 0.0f, -3.0f),
+                       .thread_count = RENDER_THREADS,
+                       .worker_threads = 1,
+                       .simd = SIMD_AVX512,
+                       .light_cutoff = -1.0f,
+                       .fovea = foveated_default_config(),
+                       .output_path = "render.ppm",
+                       .fps = 30,
+                       .stream_path = "-"};
+
+  for (int i = 1; i < argc; i++) {
+    const char *name = argv[i];
+
+    if (strcmp(name, "--low-resolution") == 0) {
+      options->low_resolution = true;
+      continue;
+    }
+    if (strcmp(name, "--adaptive") == 0) {
+      options->adaptive = true;
+      continue;
+    }
+    if (strcmp(name, "--foveated") == 0) {
+      options->foveated = true;
+      continue;
+    }
+    if (strcmp(name, "--shadows") == 0) {
+      options->shadows = true;
+      continue;
+    }
+    if (strcmp(name, "--help") == 0 || i + 1 >= argc) {
+      return false;
+    }
+
+    const char *value = argv[++i];
+    bool ok;
+    if (strcmp(name, "--width") == 0) {
+      ok = parse_int(value, &options->width) && options->width > 0;
+    } else if (strcmp(name, "--height") == 0) {
+      ok = parse_int(value, &options->height) && options->height > 0;
+    } else if (strcmp(name, "--position") == 0) {
+      ok = parse_position(value, &options->position);
+    } else if (strcmp(name, "--yaw") == 0) {
+      ok = parse_degrees(value, &options->yaw);
+    } else if (strcmp(name, "--pitch") == 0) {
+      ok = parse_degrees(value, &options->pitch);
+    } else if (strcmp(name, "--roll") == 0) {
+      ok = parse_degrees(value, &options->roll);
+    } else if (strcmp(name, "--threads") == 0) {
+      ok = parse_int(value, &options->thread_count) &&
+           options->thread_count >= 0;
+    } else if (strcmp(name, "--distribute") == 0) {
+      ok = parse_int(value, &options->workers_count) &&
+           options->workers_count > 0;
+    } else if (strcmp(name, "--worker-threads") == 0) {
+      ok = parse_int(value, &options->worker_threads) &&
+           options->worker_threads >= 0;
+    } else if (strcmp(name, "--simd") == 0) {
+      ok = vector_batch_level_parse(value, &options->simd);
+    } else if (strcmp(name, "--output") == 0) {
+      options->output_path = value;
+      ok = true;
+    } else if (strcmp(name, "--light-cutoff") == 0) {
+      char *end;
+      options->light_cutoff = strtof(value, &end);
+      ok = *value != '\0' && *end == '\0' && options->light_cutoff >= 0.0f;
+    } else if (strcmp(name, "--reflections") == 0) {
+      ok = parse_int(value, &options->reflections.max_depth) &&
+           options->reflections.max_depth >= 0 &&
+           options->reflections.max_depth <= WAVEFRONT_MAX_DEPTH;
+    } else if (strcmp(name, "--ray-budget") == 0) {
+      ok = parse_int(value, &options->reflections.ray_budget) &&
+           options->reflections.ray_budget >= 0;
+    } else if (strcmp(name, "--hdr-output") == 0) {
+      options->hdr_output_path = value;
+      ok = true;
+    } else if (strcmp(name, "--exposure") == 0) {
+      char *end;
+      options->exposure = strtof(value, &end);
+      ok = *value != '\0' && *end == '\0' && isfinite(options->exposure);
+    } else if (strcmp(name, "--tonemap") == 0) {
+      ok = hdr_tonemap_parse(value, &options->tonemap);
+    } else if (strcmp(name, "--scene") == 0) {
+      options->scene_path = value;
+      ok = true;
+    } else if (strcmp(name, "--generate") == 0) {
+      options->generate_spec = value;
+      ok = true;
+    } else if (strcmp(name, "--save-scene") == 0) {
+      options->save_scene_path = value;
+      ok = true;
+    } else if (strcmp(name, "--fovea") == 0) {
+      ok = parse_fovea(value, &options->fovea);
+      options->foveated = true;
+    } else if (strcmp(name, "--move-sphere") == 0) {
+      ok = parse_sphere_move(value, &options->sphere_index,
+                             &options->sphere_center);
+      options->move_sphere = true;
+    } else if (strcmp(name, "--set-light") == 0) {
+      ok = parse_light_change(value, &options->light_index,
+                              &options->light_intensity);
+      options->set_light = true;
+    } else if (strcmp(name, "--replay") == 0) {
+      options->replay_path = value;
+      ok = true;
+    } else if (strcmp(name, "--replay-timestep") == 0) {
+      char *end;
+      options->replay_timestep = strtof(value, &end) / 1000.0f;
+      ok = *value != '\0' && *end == '\0' &&
+           options->replay_timestep > 0.0f;
+    } else if (strcmp(name, "--replay-log") == 0) {
+      options->replay_log_path = value;
+      ok = true;
+    } else if (strcmp(name, "--target-frame-time") == 0) {
+      char *end;
+      options->target_frame_ms = strtod(value, &end);
+      ok = *value != '\0' && *end == '\0' && options->target_frame_ms > 0.0;
+    } else if (strcmp(name, "--tiled-output") == 0) {
+      options->tiled_output_path = value;
+      ok = true;
+    } else if (strcmp(name, "--animation") == 0) {
+      options->animation_path = value;
+      ok = true;
+    } else if (strcmp(name, "--fps") == 0) {
+      ok = parse_int(value, &options->fps) && options->fps > 0;
+    } else if (strcmp(name, "--stream") == 0) {
+      options->stream_path = value;
+      ok = true;
+    } else if (strcmp(name, "--stream-format") == 0) {
+      ok = video_format_parse(value, &options->stream_format);
+    } else {
+      ok = false;
+    }
+
+    if (!ok) {
+      fprintf(stderr, "Invalid option: %s %s\n", name, value);
+      return false;
+    }
+
+    options->pose_set |= strcmp(name, "--position") == 0 ||
+                         strcmp(name, "--yaw") == 0 ||
+                         strcmp(name, "--pitch") == 0 ||
+                         strcmp(name, "--roll") == 0;
+  }
+
+  return true;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* Median, nearest-rank 95th percentile and maximum; sorts the samples. */
+static void print_frame_times(const char *label, double *samples,
+                              int count) {
+  qsort(samples, count, sizeof(double), compare_doubles);
+  int p95_rank = (95 * count + 99) / 100;
+  double median = count % 2
+                      ? samples[count / 2]
+                      : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+  fprintf(stderr, "  %-15s median %8.2f  p95 %8.2f  max %8.2f ms\n", label,
+          median, samples[p95_rank - 1], samples[count - 1]);
+}
+
+/* Flies the recorded path and renders every frame at low resolution (or
+ * by dynamic resolution) and at full resolution, as the interactive mode's
+ * first and last passes do.
+ * The camera advances by the recorded frame times or the fixed timestep,
+ * never by the wall clock, so every run sees the same poses. */
+static int replay_camera_path(const Options *options, Scene *scene,
+                              Camera *camera, uint32_t *framebuffer) {
+  int error_line;
+  CameraPath *path = camera_path_load(options->replay_path, &error_line);
+  if (!path) {
+    if (error_line > 0) {
+      fprintf(stderr, "%s:%d: invalid line\n", options->replay_path,
+              error_line);
+    } else {
+      fprintf(stderr, "Cannot load %s: %s\n", options->replay_path,
+              strerror(errno));
+    }
+    return 1;
+  }
+
+  DynamicResolution *dynamic = NULL;
+  if (options->target_frame_ms > 0.0) {
+    dynamic = dynamic_resolution_create(options->width, options->height,
+                                        options->target_frame_ms);
+    if (!dynamic) {
+      fprintf(stderr, "Out of memory\n");
+      camera_path_destroy(path);
+      return 1;
+    }
+  }
+
+  FILE *log = NULL;
+  if (options->replay_log_path) {
+    log = fopen(options->replay_log_path, "w");
+    if (!log) {
+      fprintf(stderr, "Cannot write %s: %s\n", options->replay_log_path,
+              strerror(errno));
+      dynamic_resolution_destroy(dynamic);
+      camera_path_destroy(path);
+      return 1;
+    }
+    fprintf(log, "frame,time_ms,delta_ms,%s,full_ms,primary_rays,"
+                 "sphere_tests%s\n",
+            dynamic ? "dynamic_ms" : "low_resolution_ms",
+            dynamic ? ",scale" : "");
+  }
+
+  int count = path->frames_count > 0 ? path->frames_count : 1;
+  double *low_samples = malloc(sizeof(double) * count);
+  double *full_samples = malloc(sizeof(double) * count);
+  double *scale_samples = malloc(sizeof(double) * count);
+  if (!low_samples || !full_samples || !scale_samples) {
+    fprintf(stderr, "Out of memory\n");
+    if (log) {
+      fclose(log);
+    }
+    dynamic_resolution_destroy(dynamic);
+    camera_path_destroy(path);
+    return 1;
+  }
+
+  camera_path_start(path, camera);
+  int slowest = 0;
+  for (int i = 0; i < path->frames_count; i++) {
+    const CameraPathFrame *frame = &path->frames[i];
+    float delta_time = options->replay_timestep > 0.0f
+                           ? options->replay_timestep
+                           : frame->delta_time;
+    camera_apply_controls(camera, frame->controls, delta_time);
+    camera_update_orientation(camera);
+
+    double start = timer_now_ms();
+    if (dynamic) {
+      scale_samples[i] = dynamic->scale;
+      dynamic_resolution_render(dynamic, scene, camera, framebuffer);
+    } else {
+      main_raytracer(scene, camera, framebuffer, true);
+    }
+    double low_end = timer_now_ms();
+    main_raytracer(scene, camera, framebuffer, false);
+    double full_end = timer_now_ms();
+    RenderCounters counters = raytracer_frame_counters();
+
+    low_samples[i] = low_end - start;
+    full_samples[i] = full_end - low_end;
+    if (full_samples[i] > full_samples[slowest]) {
+      slowest = i;
+    }
+    if (log) {
+      fprintf(log, "%d,%.3f,%.3f,%.4f,%.4f,%llu,%llu", i, frame->time_ms,
+              delta_time * 1000.0, low_samples[i], full_samples[i],
+              (unsigned long long)counters.primary_rays,
+              (unsigned long long)counters.sphere_tests);
+      if (dynamic) {
+        fprintf(log, ",%.4f", scale_samples[i]);
+      }
+      fputc('\n', log);
+    }
+  }
+
+  fprintf(stderr, "Replayed %d frames of %s at %dx%d\n", path->frames_count,
+          options->replay_path, options->width, options->height);
+  if (path->frames_count > 0) {
+    fprintf(stderr, "  slowest full frame: %d (%.2f ms)\n", slowest,
+            full_samples[slowest]);
+    print_frame_times(dynamic ? "dynamic" : "low resolution", low_samples,
+                      path->frames_count);
+    print_frame_times("full resolution", full_samples, path->frames_count);
+    if (dynamic) {
+      int frames_count = path->frames_count;
+      qsort(scale_samples, frames_count, sizeof(double), compare_doubles);
+      fprintf(stderr, "  scale: median %.3f, min %.3f, max %.3f\n",
+              scale_samples[frames_count / 2], scale_samples[0],
+              scale_samples[frames_count - 1]);
+    }
+  }
+
+  int status = 0;
+  if (log && fclose(log) != 0) {
+    fprintf(stderr, "Cannot write %s: %s\n", options->replay_log_path,
+            strerror(errno));
+    status = 1;
+  }
+  if (!image_write(options->output_path, framebuffer, options->width,
+                   options->height)) {
+    fprintf(stderr, "Cannot write %s: %s\n", options->output_path,
+            strerror(errno));
+    status = 1;
+  }
+
+  free(low_samples);
+  free(full_samples);
+  free(scale_samples);
+  dynamic_resolution_destroy(dynamic);
+  camera_path_destroy(path);
+  return status;
+}
+
+/* Ships the scene to forked workers and assembles the frame from the
+ * tiles they return. The coordinator's own render threads only trace
+ * tiles left over once every worker has failed. */
+static int render_distributed(const Options *options, Scene *scene,
+                              Camera *camera, uint32_t *framebuffer) {
+  double start = timer_now_ms();
+  Distributed *distributed =
+      distributed_start(options->workers_count, options->worker_threads);
+  if (!distributed) {
+    fprintf(stderr, "Cannot start workers: %s\n", strerror(errno));
+    return 1;
+  }
+  distributed_send_scene(distributed, scene);
+  double shipped = timer_now_ms();
+  fprintf(stderr, "Started %d workers and sent the scene in %.2f ms\n",
+          options->workers_count, shipped - start);
+
+  raytracer_init(options->thread_count);
+  uint32_t background =
+      vector_color_to_rgb_color(scene->default_background_color);
+  size_t pixel_count = (size_t)options->width * options->height;
+  for (size_t i = 0; i < pixel_count; i++) {
+    framebuffer[i] = background;
+  }
+
+  DistributedStats stats;
+  distributed_render(distributed, scene, camera, framebuffer, &stats);
+  fprintf(stderr, "Rendered %d tiles of %dx%d on %d workers in %.2f ms\n",
+          stats.tiles_count, options->width, options->height,
+          options->workers_count, timer_now_ms() - shipped);
+  if (stats.failed_workers > 0) {
+    fprintf(stderr,
+            "%d workers failed; reassigned %d tiles, traced %d here\n",
+            stats.failed_workers, stats.reassigned_tiles,
+            stats.local_tiles);
+  }
+
+  distributed_stop(distributed);
+  raytracer_quit();
+
+  if (!image_write(options->output_path, framebuffer, options->width,
+                   options->height)) {
+    fprintf(stderr, "Cannot write %s: %s\n", options->output_path,
+            strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+/* Renders into the output file band by band, without a framebuffer, and
+ * reports the peak resident memory to show it did not grow with the
+ * image. */
+static int render_tiled_output(const Options *options, Scene *scene,
+                               Camera *camera) {
+  raytracer_init(options->thread_count);
+
+  int tiles_count;
+  double start = timer_now_ms();
+  bool ok = tiled_output_render(scene, camera, options->tiled_output_path,
+                                &tiles_count);
+  double elapsed = timer_now_ms() - start;
+  int thread_count = raytracer_thread_count();
+  raytracer_quit();
+
+  if (!ok) {
+    fprintf(stderr, "Cannot write %s: %s\n", options->tiled_output_path,
+            strerror(errno));
+    return 1;
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  fprintf(stderr,
+          "Rendered %dx%d in %d tiles with %d thread(s) in %.2f ms, "
+          "peak resident %.1f MiB\n",
+          options->width, options->height, tiles_count, thread_count,
+          elapsed, usage.ru_maxrss / 1024.0);
+  return 0;
+}
+
+/* Traces every frame of the animation into a free stream buffer and
+ * hands it to the writer thread, so frame N + 1 is traced while frame N
+ * is written. */
+static int render_animation(const Options *options, Scene *scene,
+                            Camera *camera) {
+  int error_line;
+  Animation *animation =
+      animation_load(options->animation_path, &error_line);
+  if (!animation) {
+    if (error_line > 0) {
+      fprintf(stderr, "%s:%d: invalid line\n", options->animation_path,
+              error_line);
+    } else {
+      fprintf(stderr, "Cannot load %s: %s\n", options->animation_path,
+              strerror(errno));
+    }
+    return 1;
+  }
+
+  bool to_stdout = strcmp(options->stream_path, "-") == 0;
+  FILE *file = to_stdout ? stdout : fopen(options->stream_path, "wb");
+  if (!file) {
+    fprintf(stderr, "Cannot write %s: %s\n", options->stream_path,
+            strerror(errno));
+    animation_destroy(animation);
+    return 1;
+  }
+
+  bool reflections = options->reflections.max_depth > 0;
+  HdrImage *hdr = hdr_image_create(options->width, options->height);
+  Wavefront *wavefront =
+      reflections ? wavefront_create(options->width, options->height) : NULL;
+  VideoStream *stream =
+      video_stream_create(file, options->stream_format, options->width,
+                          options->height, options->fps);
+  if (!hdr || (reflections && !wavefront) || !stream) {
+    fprintf(stderr, "Cannot start the stream: %s\n", strerror(errno));
+    if (stream) {
+      video_stream_close(stream, NULL);
+    }
+    if (!to_stdout) {
+      fclose(file);
+    }
+    wavefront_destroy(wavefront);
+    hdr_image_destroy(hdr);
+    animation_destroy(animation);
+    return 1;
+  }
+  hdr_image_fill(hdr, scene->default_background_color);
+
+  raytracer_init(options->thread_count);
+
+  int frames_count =
+      (int)(animation_duration(animation) * options->fps) + 1;
+  double trace_ms = 0.0;
+  double start = timer_now_ms();
+  for (int i = 0; i < frames_count; i++) {
+    uint32_t *framebuffer = video_stream_acquire(stream);
+    if (!framebuffer) {
+      break;
+    }
+
+    animation_pose(animation, (float)i / options->fps, camera);
+    double frame_start = timer_now_ms();
+    if (reflections) {
+      wavefront_render(wavefront, scene, camera, hdr, &options->reflections);
+    } else {
+      main_raytracer_hdr(scene, camera, hdr, NULL, false);
+    }
+    hdr_image_tonemap(hdr, framebuffer, exp2f(options->exposure),
+                      options->tonemap);
+    trace_ms += timer_now_ms() - frame_start;
+
+    video_stream_submit(stream);
+  }
+
+  VideoStreamStats stats;
+  int status = 0;
+  if (!video_stream_close(stream, &stats)) {
+    fprintf(stderr, "Cannot write %s: %s\n", options->stream_path,
+            strerror(errno));
+    status = 1;
+  }
+  fprintf(stderr,
+          "Streamed %d of %d frames at %dx%d in %.2f ms: traced %.2f ms, "
+          "wrote %.2f ms, waited %.2f ms for the writer\n",
+          stats.frames, frames_count, options->width, options->height,
+          timer_now_ms() - start, trace_ms, stats.write_ms, stats.wait_ms);
+
+  if (!to_stdout && fclose(file) != 0 && status == 0) {
+    fprintf(stderr, "Cannot write %s: %s\n", options->stream_path,
+            strerror(errno));
+    status = 1;
+  }
+  raytracer_quit();
+  wavefront_destroy(wavefront);
+  hdr_image_destroy(hdr);
+  animation_destroy(animation);
+  return status;
+}
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!parse_options(argc, argv, &options)) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  SimdLevel simd = vector_batch_select(options.simd);
+  fprintf(stderr, "Vector kernels: %s\n", vector_batch_level_name(simd));
+
+  Camera camera;
+  camera_init(&camera, options.width, options.height);
+
+  Scene *scene;
+  if (options.scene_path) {
+    int error_line;
+    double start = timer_now_ms();
+    scene = scene_load(options.scene_path, &camera, &error_line);
+    if (!scene) {
+      if (error_line > 0) {
+        fprintf(stderr, "%s:%d: invalid line\n", options.scene_path,
+                error_line);
+      } else {
+        fprintf(stderr, "Cannot load %s: %s\n", options.scene_path,
+                strerror(errno));
+      }
+      return 1;
+    }
+    fprintf(stderr, "Loaded %d spheres and %d lights in %.2f ms\n",
+            scene->spheres_count, scene->lights_count,
+            timer_now_ms() - start);
+  } else if (options.generate_spec) {
+    scene = generate_scene(options.generate_spec);
+    if (!scene) {
+      return 1;
+    }
+  } else {
+    scene = scene_create_demo();
+  }
+
+  if (!scene) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  if (options.shadows) {
+    scene->shadows = true;
+  }
+  if (options.light_cutoff >= 0.0f) {
+    scene->light_cutoff = options.light_cutoff;
+    if (!scene_build_light_tree(scene)) {
+      fprintf(stderr, "Out of memory\n");
+      return 1;
+    }
+  }
+
+  const LightTree *light_tree = scene->light_tree;
+  if (light_tree->bvh) {
+    fprintf(stderr,
+            "Clustered %d point lights for a cutoff of %g in %.2f ms\n",
+            light_tree->bvh->spheres_count, light_tree->cutoff,
+            light_tree->build_time_ms);
+  }
+
+  if ((options.move_sphere &&
+       options.sphere_index >= scene->spheres_count) ||
+      (options.set_light && options.light_index >= scene->lights_count)) {
+    fprintf(stderr, "The scene has %d spheres and %d lights\n",
+            scene->spheres_count, scene->lights_count);
+    return 1;
+  }
+
+  /* A pose on the command line replaces the one from the scene file. */
+  if (options.pose_set || !options.scene_path) {
+    camera.position = options.position;
+    camera.yaw = options.yaw;
+    camera.pitch = options.pitch;
+    camera.roll = options.roll;
+    camera_update_orientation(&camera);
+  }
+
+  if (options.save_scene_path &&
+      !scene_save_binary(scene, &camera, options.save_scene_path)) {
+    fprintf(stderr, "Cannot write %s: %s\n", options.save_scene_path,
+            strerror(errno));
+    return 1;
+  }
+
+  bool edit = options.move_sphere || options.set_light;
+
+  if (options.animation_path) {
+    if (edit || options.adaptive || options.foveated ||
+        options.low_resolution ||
+        options.hdr_output_path || options.replay_path ||
+        options.workers_count > 0 || options.tiled_output_path) {
+      fprintf(stderr, "--animation renders plain frames only\n");
+      return 1;
+    }
+    int status = render_animation(&options, scene, &camera);
+    scene_destroy(scene);
+    return status;
+  }
+
+  if (options.tiled_output_path) {
+    if (edit || options.adaptive || options.foveated ||
+        options.low_resolution ||
+        options.hdr_output_path || options.reflections.max_depth > 0 ||
+        options.exposure != 0.0f || options.tonemap != HDR_TONEMAP_CLAMP ||
+        options.replay_path || options.workers_count > 0) {
+      fprintf(stderr, "--tiled-output renders plain frames only\n");
+      return 1;
+    }
+    int status = render_tiled_output(&options, scene, &camera);
+    scene_destroy(scene);
+    return status;
+  }
+
+  size_t pixel_count = (size_t)options.width * options.height;
+  uint32_t *framebuffer = malloc(sizeof(uint32_t) * pixel_count);
+  if (!framebuffer) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  if (options.workers_count > 0) {
+    if (edit || options.adaptive || options.foveated ||
+        options.low_resolution ||
+        options.hdr_output_path || options.reflections.max_depth > 0 ||
+        options.exposure != 0.0f || options.tonemap != HDR_TONEMAP_CLAMP ||
+        options.replay_path) {
+      fprintf(stderr, "--distribute renders plain frames only\n");
+      return 1;
+    }
+    int status = render_distributed(&options, scene, &camera, framebuffer);
+    free(framebuffer);
+    scene_destroy(scene);
+    return status;
+  }
+
+  if (options.replay_path) {
+    if (edit || options.adaptive || options.foveated ||
+        options.low_resolution ||
+        options.hdr_output_path || options.reflections.max_depth > 0) {
+      fprintf(stderr, "--replay renders plain frames only\n");
+      return 1;
+    }
+    raytracer_init(options.thread_count);
+    int status = replay_camera_path(&options, scene, &camera, framebuffer);
+    raytracer_quit();
+    free(framebuffer);
+    scene_destroy(scene);
+    return status;
+  }
+
+  /* Plain renders trace into linear pixels and pack them afterwards;
+   * adaptive, foveated and incremental renders write packed pixels
+   * directly. */
+  bool sparse = options.adaptive || options.foveated;
+  HdrImage *hdr = NULL;
+  if (!edit && !sparse) {
+    hdr = hdr_image_create(options.width, options.height);
+    if (!hdr) {
+      fprintf(stderr, "Out of memory\n");
+      return 1;
+    }
+    hdr_image_fill(hdr, scene->default_background_color);
+  } else if (options.hdr_output_path ||
+             options.reflections.max_depth > 0) {
+    fprintf(stderr, "--hdr-output and --reflections need a plain render\n");
+    return 1;
+  } else {
+    uint32_t background =
+        vector_color_to_rgb_color(scene->default_background_color);
+    for (size_t i = 0; i < pixel_count; i++) {
+      framebuffer[i] = background;
+    }
+  }
+
+  raytracer_init(options.thread_count);
+
+  IncrementalRenderer *incremental = NULL;
+  if (edit) {
+    incremental = incremental_create(options.width, options.height);
+    if (!incremental) {
+      fprintf(stderr, "Out of memory\n");
+      return 1;
+    }
+  }
+
+  bool reflections = options.reflections.max_depth > 0;
+  if (reflections && options.low_resolution) {
+    fprintf(stderr, "--reflections needs full resolution\n");
+    return 1;
+  }
+  Wavefront *wavefront = NULL;
+  if (reflections) {
+    wavefront = wavefront_create(options.width, options.height);
+    if (!wavefront) {
+      fprintf(stderr, "Out of memory\n");
+      return 1;
+    }
+  }
+  WavefrontStats wavefront_stats = {0};
+
+  double start = timer_now_ms();
+  if (edit) {
+    incremental_render(incremental, scene, &camera, framebuffer);
+  } else if (options.adaptive) {
+    adaptive_render(scene, &camera, framebuffer);
+  } else if (options.foveated) {
+    foveated_render(scene, &camera, framebuffer, &options.fovea);
+  } else if (reflections) {
+    wavefront_stats = wavefront_render(wavefront, scene, &camera, hdr,
+                                       &options.reflections);
+  } else {
+    main_raytracer_hdr(scene, &camera, hdr, NULL, options.low_resolution);
+  }
+  double elapsed = timer_now_ms() - start;
+  RenderCounters counters =
+      reflections ? wavefront_stats.counters : raytracer_frame_counters();
+
+  fprintf(stderr, "Rendered %dx%d with %d thread(s) in %.2f ms\n",
+          options.width, options.height, raytracer_thread_count(), elapsed);
+
+  if (hdr) {
+    start = timer_now_ms();
+    hdr_image_tonemap(hdr, framebuffer, exp2f(options.exposure),
+                      options.tonemap);
+    fprintf(stderr, "Tonemapped in %.2f ms\n", timer_now_ms() - start);
+  }
+
+  if (reflections) {
+    fprintf(stderr, "Traced %llu reflection rays:",
+            (unsigned long long)counters.reflection_rays);
+    for (int depth = 0; depth < options.reflections.max_depth; depth++) {
+      fprintf(stderr, " %d", wavefront_stats.rays[depth]);
+    }
+    fprintf(stderr, " per bounce%s\n",
+            wavefront_stats.budget_exhausted ? " (budget exhausted)" : "");
+  }
+
+  if (light_tree->bvh && counters.hits > 0) {
+    fprintf(stderr, "Evaluated %.1f of %d lights per hit\n",
+            (double)counters.lighting_evaluations / counters.hits,
+            scene->lights_count);
+  }
+
+  if (sparse) {
+    uint64_t rays = counters.primary_rays;
+    fprintf(stderr, "Traced %llu rays for %zu pixels (%.1f%% saved)\n",
+            (unsigned long long)rays, pixel_count,
+            100.0 * (1.0 - (double)rays / pixel_count));
+  }
+
+  if (scene->shadows) {
+    fprintf(stderr, "Traced %llu shadow rays, %.2f sphere tests per ray\n",
+            (unsigned long long)counters.shadow_rays,
+            (double)counters.sphere_tests /
+                (counters.primary_rays + counters.shadow_rays +
+                 counters.reflection_rays));
+  }
+
+  if (edit) {
+    if (options.move_sphere) {
+      Sphere sphere = scene->spheres[options.sphere_index];
+      sphere.center = options.sphere_center;
+      scene_set_sphere(scene, options.sphere_index, sphere);
+    }
+    if (options.set_light) {
+      Light light = scene->lights[options.light_index];
+      light.intensity = options.light_intensity;
+      scene_set_light(scene, options.light_index, light);
+    }
+
+    start = timer_now_ms();
+    incremental_render(incremental, scene, &camera, framebuffer);
+    fprintf(stderr,
+            "Re-rendered after the edit in %.2f ms: traced %d pixels, "
+            "re-shaded %d\n",
+            timer_now_ms() - start, incremental->traced_pixels,
+            incremental->reshaded_pixels);
+    incremental_destroy(incremental);
+  }
+
+  int status = 0;
+  if (!image_write(options.output_path, framebuffer, options.width,
+                   options.height)) {
+    fprintf(stderr, "Cannot write %s: %s\n", options.output_path,
+            strerror(errno));
+    status = 1;
+  }
+  if (options.hdr_output_path &&
+      !image_write_pfm(options.hdr_output_path, hdr)) {
+    fprintf(stderr, "Cannot write %s: %s\n", options.hdr_output_path,
+            strerror(errno));
+    status = 1;
+  }
+
+  raytracer_quit();
+  wavefront_destroy(wavefront);
+  hdr_image_destroy(hdr);
+  free(framebuffer);
+  scene_destroy(scene);
+
+  return status;
+}
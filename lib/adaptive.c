@@ -0,0 +1,238 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "adaptive.h"
+#include "constants.h"
+#include "raytracer.h"
+#include "vector_color.h"
+
+#define ADAPTIVE_GRID_SIZE (RENDER_TILE_SIZE + 1)
+#define ADAPTIVE_UNTRACED -2
+#define ADAPTIVE_PENDING -3
+
+typedef struct {
+  VectorColor color;
+  int sphere; /**< Hit sphere, -1 for a miss, ADAPTIVE_UNTRACED, or
+                   ADAPTIVE_PENDING until its level is traced */
+} AdaptiveSample;
+
+typedef struct {
+  Scene *scene;
+  Camera *camera;
+  uint32_t *framebuffer;
+  int width;
+  int height;
+  int tiles_x;
+} AdaptiveJob;
+
+/* A cell of the current subdivision level, by its top left sample. */
+typedef struct {
+  int i;
+  int j;
+} AdaptiveCell;
+
+/* Sample grid of one tile: its pixels plus the row and column of corners
+ * shared with the next tiles. */
+typedef struct {
+  AdaptiveJob *job;
+  RenderCounters *counters;
+  ShadowCache shadows;
+  int x_begin;
+  int y_begin;
+  AdaptiveSample samples[ADAPTIVE_GRID_SIZE][ADAPTIVE_GRID_SIZE];
+  AdaptiveCell cells[2][RENDER_TILE_SIZE * RENDER_TILE_SIZE];
+} AdaptiveTile;
+
+static void request_sample(AdaptiveTile *tile, int i, int j) {
+  AdaptiveSample *sample = &tile->samples[j][i];
+  if (sample->sphere == ADAPTIVE_UNTRACED) {
+    sample->sphere = ADAPTIVE_PENDING;
+  }
+}
+
+/* Traces and shades the count samples at xs and ys. */
+static void trace_batch(AdaptiveTile *tile, const int *xs, const int *ys,
+                        int count) {
+  AdaptiveJob *job = tile->job;
+  Vector3D directions[ADAPTIVE_GRID_SIZE];
+  RayHit hits[ADAPTIVE_GRID_SIZE];
+  VectorColor colors[ADAPTIVE_GRID_SIZE];
+
+  raytracer_trace_pixels(job->scene, job->camera, xs, ys, count, directions,
+                         hits, tile->counters);
+  raytracer_shade_pixels(job->scene, job->camera, directions, hits, count,
+                         colors, &tile->shadows, tile->counters);
+  for (int k = 0; k < count; k++) {
+    AdaptiveSample *sample =
+        &tile->samples[ys[k] - tile->y_begin][xs[k] - tile->x_begin];
+    sample->sphere = hits[k].sphere;
+    sample->color = colors[k];
+  }
+}
+
+/* Requested samples, all on multiples of step, are traced column by
+ * column in batches, so each packet holds vertically neighbouring rays
+ * as in a full frame, or the next columns' rays where a level is sparse. */
+static void trace_requested(AdaptiveTile *tile, int step) {
+  int xs[ADAPTIVE_GRID_SIZE];
+  int ys[ADAPTIVE_GRID_SIZE];
+  int count = 0;
+
+  for (int i = 0; i < ADAPTIVE_GRID_SIZE; i += step) {
+    for (int j = 0; j < ADAPTIVE_GRID_SIZE; j += step) {
+      if (tile->samples[j][i].sphere != ADAPTIVE_PENDING) {
+        continue;
+      }
+      xs[count] = tile->x_begin + i;
+      ys[count++] = tile->y_begin + j;
+      if (count == ADAPTIVE_GRID_SIZE) {
+        trace_batch(tile, xs, ys, count);
+        count = 0;
+      }
+    }
+  }
+  trace_batch(tile, xs, ys, count);
+}
+
+static void tile_put_pixel(AdaptiveTile *tile, int i, int j,
+                           VectorColor color) {
+  AdaptiveJob *job = tile->job;
+  int x = tile->x_begin + i;
+  int y = tile->y_begin + j;
+  if (x < job->width && y < job->height) {
+    job->framebuffer[y * job->width + x] = vector_color_to_rgb_color(color);
+  }
+}
+
+static VectorColor lerp_color(VectorColor a, VectorColor b, float t) {
+  return vector_color_init(a.red + (b.red - a.red) * t,
+                           a.green + (b.green - a.green) * t,
+                           a.blue + (b.blue - a.blue) * t);
+}
+
+/* Fills a cell of size whose corners are traced from them if they agree;
+ * otherwise adds its four quarters to next and returns their count. */
+static int subdivide(AdaptiveTile *tile, int i, int j, int size,
+                     AdaptiveCell *next) {
+  AdaptiveSample *corners[4] = {
+      &tile->samples[j][i], &tile->samples[j][i + size],
+      &tile->samples[j + size][i], &tile->samples[j + size][i + size]};
+
+  bool uniform = true;
+  for (int k = 1; k < 4 && uniform; k++) {
+    uniform = corners[k]->sphere == corners[0]->sphere &&
+              vector_color_equal(corners[k]->color, corners[0]->color,
+                                 ADAPTIVE_COLOR_THRESHOLD);
+  }
+
+  if (!uniform) {
+    int half = size / 2;
+    next[0] = (AdaptiveCell){i, j};
+    next[1] = (AdaptiveCell){i + half, j};
+    next[2] = (AdaptiveCell){i, j + half};
+    next[3] = (AdaptiveCell){i + half, j + half};
+    return 4;
+  }
+
+  /* Clipped to the screen once per cell rather than per pixel. size is a
+   * power of two, so multiplying by its inverse is exact. */
+  AdaptiveJob *job = tile->job;
+  int x = tile->x_begin + i;
+  int y = tile->y_begin + j;
+  int columns = job->width - x < size ? job->width - x : size;
+  int rows = job->height - y < size ? job->height - y : size;
+  float inverse = 1.0f / size;
+  for (int dy = 0; dy < rows; dy++) {
+    float v = dy * inverse;
+    VectorColor left = lerp_color(corners[0]->color, corners[2]->color, v);
+    VectorColor right = lerp_color(corners[1]->color, corners[3]->color, v);
+    uint32_t *row = &job->framebuffer[(y + dy) * job->width + x];
+    for (int dx = 0; dx < columns; dx++) {
+      row[dx] = vector_color_to_rgb_color(
+          lerp_color(left, right, dx * inverse));
+    }
+  }
+  return 0;
+}
+
+/* Tiles cover the screen pixels from (1, 1), the ones main_raytracer
+ * writes. Corners on a tile edge are traced by both tiles. */
+static void render_adaptive_tile(void *context, int task_index,
+                                 RenderCounters *counters) {
+  AdaptiveJob *job = context;
+  /* Filled field by field: zeroing the whole sample grid and cell lists
+   * first would cost as much as a level of tracing. */
+  AdaptiveTile tile;
+  tile.job = job;
+  tile.counters = counters;
+  tile.x_begin = 1 + (task_index % job->tiles_x) * RENDER_TILE_SIZE;
+  tile.y_begin = 1 + (task_index / job->tiles_x) * RENDER_TILE_SIZE;
+  raytracer_shadow_cache_init(&tile.shadows);
+
+  for (int j = 0; j < ADAPTIVE_GRID_SIZE; j++) {
+    for (int i = 0; i < ADAPTIVE_GRID_SIZE; i++) {
+      tile.samples[j][i].sphere = ADAPTIVE_UNTRACED;
+    }
+  }
+
+  AdaptiveCell *cells = tile.cells[0];
+  int count = 0;
+  for (int j = 0; j < RENDER_TILE_SIZE; j += ADAPTIVE_CELL_SIZE) {
+    if (tile.y_begin + j >= job->height) {
+      break;
+    }
+    for (int i = 0; i < RENDER_TILE_SIZE; i += ADAPTIVE_CELL_SIZE) {
+      if (tile.x_begin + i >= job->width) {
+        break;
+      }
+      cells[count++] = (AdaptiveCell){i, j};
+    }
+  }
+
+  /* One level at a time, so the corners of all of a level's cells are
+   * traced together in packets. Cells of one pixel need only the pixel. */
+  for (int size = ADAPTIVE_CELL_SIZE; size > 1 && count > 0; size /= 2) {
+    for (int k = 0; k < count; k++) {
+      request_sample(&tile, cells[k].i, cells[k].j);
+      request_sample(&tile, cells[k].i + size, cells[k].j);
+      request_sample(&tile, cells[k].i, cells[k].j + size);
+      request_sample(&tile, cells[k].i + size, cells[k].j + size);
+    }
+    trace_requested(&tile, size);
+
+    AdaptiveCell *next = cells == tile.cells[0] ? tile.cells[1] : tile.cells[0];
+    int next_count = 0;
+    for (int k = 0; k < count; k++) {
+      next_count +=
+          subdivide(&tile, cells[k].i, cells[k].j, size, &next[next_count]);
+    }
+    cells = next;
+    count = next_count;
+  }
+
+  for (int k = 0; k < count; k++) {
+    request_sample(&tile, cells[k].i, cells[k].j);
+  }
+  trace_requested(&tile, 1);
+  for (int k = 0; k < count; k++) {
+    tile_put_pixel(&tile, cells[k].i, cells[k].j,
+                   tile.samples[cells[k].j][cells[k].i].color);
+  }
+}
+
+void adaptive_render(Scene *scene, Camera *camera, uint32_t *framebuffer) {
+  int width = (int)camera->width;
+  int height = (int)camera->height;
+  int tiles_x = (width - 1 + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  int tiles_y = (height - 1 + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+
+  AdaptiveJob job = {.scene = scene,
+                     .camera = camera,
+                     .framebuffer = framebuffer,
+                     .width = width,
+                     .height = height,
+                     .tiles_x = tiles_x};
+
+  raytracer_prepare_frame(scene, camera);
+  raytracer_run(tiles_x * tiles_y, render_adaptive_tile, &job);
+}
@@ -0,0 +1,31 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include <stdint.h>
+
+#include "camera.h"
+#include "scene.h"
+
+/**
+ * @file adaptive.h
+ * @brief Adaptive sampling by quad subdivision.
+ *
+ * The image is traced on a grid of ADAPTIVE_CELL_SIZE cells. A cell whose
+ * four corners hit the same sphere (or all miss) with colours within
+ * ADAPTIVE_COLOR_THRESHOLD is filled by bilinear interpolation of the
+ * corners; any other cell is split into four and the test repeats, down
+ * to single pixels. Traced pixels get exactly their full resolution
+ * colour.
+ *
+ * Detail that fits between the corners of a cell, such as a sphere
+ * smaller than a cell, can be missed.
+ */
+
+/**
+ * @brief Render the pixels main_raytracer writes, adaptively.
+ *
+ * raytracer_frame_counters afterwards gives the rays traced.
+ */
+void adaptive_render(Scene *scene, Camera *camera, uint32_t *framebuffer);
+
+#endif /* ADAPTIVE_H */
@@ -0,0 +1,169 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "animation.h"
+#include "constants.h"
+#include "line_file.h"
+
+#define ANIMATION_CHANNELS 6
+
+typedef struct {
+  Animation *animation;
+  int capacity;
+} AnimationReader;
+
+static bool parse_line(void *context, const char *keyword,
+                       const char *values) {
+  AnimationReader *reader = context;
+  Animation *animation = reader->animation;
+
+  float v[7] = {0};
+  char extra;
+  int count = sscanf(values, "%f %f %f %f %f %f %f %c", &v[0], &v[1],
+                     &v[2], &v[3], &v[4], &v[5], &v[6], &extra);
+  const Keyframe *last =
+      animation->keyframes_count > 0
+          ? &animation->keyframes[animation->keyframes_count - 1]
+          : NULL;
+  if (strcmp(keyword, "key") != 0 || (count != 4 && count != 7) ||
+      (last && !(v[0] > last->time))) {
+    errno = EINVAL;
+    return false;
+  }
+
+  if (animation->keyframes_count == reader->capacity) {
+    int grown = reader->capacity > 0 ? reader->capacity * 2 : 16;
+    Keyframe *keyframes =
+        realloc(animation->keyframes, sizeof(Keyframe) * (size_t)grown);
+    if (!keyframes) {
+      errno = ENOMEM;
+      return false;
+    }
+    animation->keyframes = keyframes;
+    reader->capacity = grown;
+  }
+
+  const float radians = (float)(MATH_PI / 180.0);
+  animation->keyframes[animation->keyframes_count++] =
+      (Keyframe){.time = v[0],
+                 .position = vector_3d_init(v[1], v[2], v[3]),
+                 .yaw = v[4] * radians,
+                 .pitch = v[5] * radians,
+                 .roll = v[6] * radians};
+  return true;
+}
+
+Animation *animation_load(const char *path, int *error_line) {
+  if (error_line) {
+    *error_line = 0;
+  }
+
+  AnimationReader reader = {.animation = calloc(1, sizeof(Animation))};
+  if (!reader.animation) {
+    return NULL;
+  }
+
+  bool ok = line_file_read(path, parse_line, &reader, error_line);
+  if (ok && reader.animation->keyframes_count == 0) {
+    ok = false;
+    errno = EINVAL;
+  }
+
+  if (!ok) {
+    int error = errno;
+    animation_destroy(reader.animation);
+    errno = error;
+    return NULL;
+  }
+  return reader.animation;
+}
+
+float animation_duration(const Animation *animation) {
+  return animation->keyframes[animation->keyframes_count - 1].time -
+         animation->keyframes[0].time;
+}
+
+static void keyframe_channels(const Keyframe *keyframe,
+                              float channels[ANIMATION_CHANNELS]) {
+  channels[0] = keyframe->position.x;
+  channels[1] = keyframe->position.y;
+  channels[2] = keyframe->position.z;
+  channels[3] = keyframe->yaw;
+  channels[4] = keyframe->pitch;
+  channels[5] = keyframe->roll;
+}
+
+/* Slope of every channel at keyframe index, from its neighbours, or
+ * one-sided at either end. */
+static void keyframe_tangents(const Animation *animation, int index,
+                              float tangents[ANIMATION_CHANNELS]) {
+  int before = index > 0 ? index - 1 : index;
+  int after = index + 1 < animation->keyframes_count ? index + 1 : index;
+  float before_channels[ANIMATION_CHANNELS];
+  float after_channels[ANIMATION_CHANNELS];
+  keyframe_channels(&animation->keyframes[before], before_channels);
+  keyframe_channels(&animation->keyframes[after], after_channels);
+
+  float span =
+      animation->keyframes[after].time - animation->keyframes[before].time;
+  for (int c = 0; c < ANIMATION_CHANNELS; c++) {
+    tangents[c] =
+        span > 0.0f ? (after_channels[c] - before_channels[c]) / span : 0.0f;
+  }
+}
+
+void animation_pose(const Animation *animation, float time, Camera *camera) {
+  const Keyframe *keyframes = animation->keyframes;
+  int last = animation->keyframes_count - 1;
+  float t = keyframes[0].time + time;
+
+  float channels[ANIMATION_CHANNELS];
+  if (t <= keyframes[0].time || last == 0) {
+    keyframe_channels(&keyframes[0], channels);
+  } else if (t >= keyframes[last].time) {
+    keyframe_channels(&keyframes[last], channels);
+  } else {
+    int segment = 0;
+    while (keyframes[segment + 1].time <= t) {
+      segment++;
+    }
+
+    /* Cubic Hermite between the two keys. */
+    float span = keyframes[segment + 1].time - keyframes[segment].time;
+    float s = (t - keyframes[segment].time) / span;
+    float s2 = s * s;
+    float s3 = s2 * s;
+    float h00 = 2.0f * s3 - 3.0f * s2 + 1.0f;
+    float h10 = s3 - 2.0f * s2 + s;
+    float h01 = -2.0f * s3 + 3.0f * s2;
+    float h11 = s3 - s2;
+
+    float from[ANIMATION_CHANNELS], to[ANIMATION_CHANNELS];
+    float from_tangent[ANIMATION_CHANNELS], to_tangent[ANIMATION_CHANNELS];
+    keyframe_channels(&keyframes[segment], from);
+    keyframe_channels(&keyframes[segment + 1], to);
+    keyframe_tangents(animation, segment, from_tangent);
+    keyframe_tangents(animation, segment + 1, to_tangent);
+    for (int c = 0; c < ANIMATION_CHANNELS; c++) {
+      channels[c] = h00 * from[c] + h10 * span * from_tangent[c] +
+                    h01 * to[c] + h11 * span * to_tangent[c];
+    }
+  }
+
+  camera->position = vector_3d_init(channels[0], channels[1], channels[2]);
+  camera->yaw = channels[3];
+  camera->pitch = channels[4];
+  camera->roll = channels[5];
+  camera_update_orientation(camera);
+}
+
+void animation_destroy(Animation *animation) {
+  if (!animation) {
+    return;
+  }
+
+  free(animation->keyframes);
+  free(animation);
+}
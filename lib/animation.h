@@ -0,0 +1,55 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "camera.h"
+#include "vector_3d.h"
+
+/**
+ * @file animation.h
+ * @brief Keyframed camera motion for rendering clips.
+ *
+ * A text file with one keyframe per line, in increasing time:
+ *
+ *   key TIME X Y Z [YAW PITCH ROLL]   (seconds, angles in degrees)
+ *
+ * Lines starting with '#' are comments. Between keyframes the position
+ * and the angles follow a Catmull-Rom spline, with tangents scaled to
+ * the keyframe spacing so unevenly spaced keys still move smoothly; the
+ * pose holds still before the first and after the last key.
+ */
+
+typedef struct {
+  float time;
+  Vector3D position;
+  float yaw; /**< Radians, as in Camera */
+  float pitch;
+  float roll;
+} Keyframe;
+
+typedef struct {
+  Keyframe *keyframes;
+  int keyframes_count;
+} Animation;
+
+/**
+ * @param error_line Set to the first malformed line, or 0 when the file
+ *                   cannot be read (may be NULL)
+ * @return Animation with at least one keyframe, or NULL with errno set
+ *         (EINVAL for a malformed file)
+ */
+Animation *animation_load(const char *path, int *error_line);
+
+/**
+ * @return Seconds from the first keyframe to the last
+ */
+float animation_duration(const Animation *animation);
+
+/**
+ * @brief Pose the camera at time seconds after the first keyframe and
+ *        update its orientation.
+ */
+void animation_pose(const Animation *animation, float time, Camera *camera);
+
+void animation_destroy(Animation *animation);
+
+#endif /* ANIMATION_H */
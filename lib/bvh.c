@@ -0,0 +1,784 @@
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "bvh.h"
+#include "constants.h"
+#include "timer.h"
+
+/* Below this depth splits fall back to halving the index range, which
+ * bounds the tree depth by BVH_STACK_SIZE for any input. */
+#define BVH_MEDIAN_SPLIT_DEPTH 64
+
+/* Sphere bounds are padded by this fraction of their magnitude so that
+ * float rounding in the box test never culls a node holding a hit. */
+#define BVH_BOUNDS_PADDING 1e-4f
+
+typedef struct {
+  Vector3D min;
+  Vector3D max;
+} Bounds;
+
+typedef struct {
+  Bounds bounds;
+  int count;
+} Bin;
+
+/* Build records are partitioned in place instead of sphere indices so
+ * that every pass over a node's spheres reads memory sequentially. */
+typedef struct {
+  Bounds bounds;
+  Vector3D centroid;
+  int sphere;
+} BuildRecord;
+
+typedef struct {
+  BuildRecord *records;
+  BVH *bvh;
+} Builder;
+
+static inline float axis_of(Vector3D v, int axis) {
+  return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+static inline Bounds bounds_empty(void) {
+  return (Bounds){vector_3d_init(FLT_MAX, FLT_MAX, FLT_MAX),
+                  vector_3d_init(-FLT_MAX, -FLT_MAX, -FLT_MAX)};
+}
+
+static inline float min_of(float a, float b) { return a < b ? a : b; }
+static inline float max_of(float a, float b) { return a > b ? a : b; }
+
+static inline Bounds bounds_grow(Bounds b, Vector3D min, Vector3D max) {
+  return (Bounds){{min_of(b.min.x, min.x), min_of(b.min.y, min.y),
+                   min_of(b.min.z, min.z)},
+                  {max_of(b.max.x, max.x), max_of(b.max.y, max.y),
+                   max_of(b.max.z, max.z)}};
+}
+
+static inline float bounds_area(Bounds b) {
+  Vector3D extent = vector_3d_subtract(b.max, b.min);
+  if (extent.x < 0 || extent.y < 0 || extent.z < 0) {
+    return 0.0f;
+  }
+  return 2.0f * (extent.x * extent.y + extent.y * extent.z +
+                 extent.z * extent.x);
+}
+
+static inline Bounds sphere_bounds(const Sphere *sphere) {
+  float magnitude = fabsf(sphere->radius) + fabsf(sphere->center.x) +
+                    fabsf(sphere->center.y) + fabsf(sphere->center.z);
+  float r = fabsf(sphere->radius) + magnitude * BVH_BOUNDS_PADDING;
+  Vector3D extent = vector_3d_init(r, r, r);
+
+  return (Bounds){vector_3d_subtract(sphere->center, extent),
+                  vector_3d_add(sphere->center, extent)};
+}
+
+static int make_leaf(Builder *builder, int node_index, int first, int count) {
+  BVHNode *node = &builder->bvh->nodes[node_index];
+  node->offset = first;
+  node->count = (uint16_t)count;
+  node->axis = 0;
+  return node_index;
+}
+
+/* Binned SAH: returns the best axis and bin boundary, or false when no
+ * split is cheaper than a leaf (or centroids cannot be separated). */
+static bool find_sah_split(Builder *builder, int first, int count,
+                           Bounds node_bounds, Bounds centroid_bounds,
+                           int *best_axis, float *best_position) {
+  const BuildRecord *records = builder->records;
+  float best_cost = INFINITY;
+
+  for (int axis = 0; axis < 3; axis++) {
+    float low = axis_of(centroid_bounds.min, axis);
+    float high = axis_of(centroid_bounds.max, axis);
+    if (!(high > low)) {
+      continue;
+    }
+
+    Bin bins[BVH_BINS];
+    for (int b = 0; b < BVH_BINS; b++) {
+      bins[b] = (Bin){bounds_empty(), 0};
+    }
+
+    float scale = BVH_BINS / (high - low);
+    for (int i = first; i < first + count; i++) {
+      int b = (int)((axis_of(records[i].centroid, axis) - low) * scale);
+      if (b >= BVH_BINS) {
+        b = BVH_BINS - 1;
+      }
+      bins[b].bounds = bounds_grow(bins[b].bounds, records[i].bounds.min,
+                                   records[i].bounds.max);
+      bins[b].count++;
+    }
+
+    float right_area[BVH_BINS];
+    int right_count[BVH_BINS];
+    Bounds right = bounds_empty();
+    int running = 0;
+    for (int b = BVH_BINS - 1; b > 0; b--) {
+      right = bounds_grow(right, bins[b].bounds.min, bins[b].bounds.max);
+      running += bins[b].count;
+      right_area[b] = bounds_area(right);
+      right_count[b] = running;
+    }
+
+    Bounds left = bounds_empty();
+    running = 0;
+    for (int b = 0; b < BVH_BINS - 1; b++) {
+      left = bounds_grow(left, bins[b].bounds.min, bins[b].bounds.max);
+      running += bins[b].count;
+      if (running == 0 || right_count[b + 1] == 0) {
+        continue;
+      }
+
+      float cost = running * bounds_area(left) +
+                   right_count[b + 1] * right_area[b + 1];
+      if (cost < best_cost) {
+        best_cost = cost;
+        *best_axis = axis;
+        *best_position = low + (b + 1) / scale;
+      }
+    }
+  }
+
+  if (best_cost == INFINITY) {
+    return false;
+  }
+
+  /* Split when C_traversal + (nL*AL + nR*AR) / A < n, with unit costs. */
+  float leaf_cost = (count - 1) * bounds_area(node_bounds);
+  return count > BVH_MAX_LEAF_SIZE || best_cost < leaf_cost;
+}
+
+static int build_node(Builder *builder, int first, int count, int depth) {
+  BVH *bvh = builder->bvh;
+  BuildRecord *records = builder->records;
+  int node_index = bvh->nodes_count++;
+
+  Bounds node_bounds = bounds_empty();
+  Bounds centroid_bounds = bounds_empty();
+  for (int i = first; i < first + count; i++) {
+    node_bounds = bounds_grow(node_bounds, records[i].bounds.min,
+                              records[i].bounds.max);
+    centroid_bounds = bounds_grow(centroid_bounds, records[i].centroid,
+                                  records[i].centroid);
+  }
+
+  bvh->nodes[node_index].bounds_min = node_bounds.min;
+  bvh->nodes[node_index].bounds_max = node_bounds.max;
+
+  if (count <= 2) {
+    return make_leaf(builder, node_index, first, count);
+  }
+
+  int axis = 0;
+  float position = 0.0f;
+  int middle = first;
+
+  if (depth < BVH_MEDIAN_SPLIT_DEPTH &&
+      find_sah_split(builder, first, count, node_bounds, centroid_bounds,
+                     &axis, &position)) {
+    int right = first + count - 1;
+    while (middle <= right) {
+      if (axis_of(records[middle].centroid, axis) < position) {
+        middle++;
+      } else {
+        BuildRecord swap = records[middle];
+        records[middle] = records[right];
+        records[right--] = swap;
+      }
+    }
+  } else if (count <= BVH_MAX_LEAF_SIZE) {
+    return make_leaf(builder, node_index, first, count);
+  }
+
+  if (middle == first || middle == first + count) {
+    middle = first + count / 2;
+  }
+
+  build_node(builder, first, middle - first, depth + 1);
+  int right_child = build_node(builder, middle, first + count - middle,
+                               depth + 1);
+
+  BVHNode *node = &bvh->nodes[node_index];
+  node->offset = right_child;
+  node->count = 0;
+  node->axis = (uint16_t)axis;
+  return node_index;
+}
+
+BVH *bvh_build(const Sphere *spheres, int spheres_count) {
+  if (spheres_count <= 0) {
+    return NULL;
+  }
+
+  double start = timer_now_ms();
+
+  BVH *bvh = calloc(1, sizeof(BVH));
+  if (!bvh) {
+    return NULL;
+  }
+
+  Builder builder = {malloc(sizeof(BuildRecord) * (size_t)spheres_count),
+                     bvh};
+  bvh->nodes = malloc(sizeof(BVHNode) * (2 * (size_t)spheres_count - 1));
+  bvh->sphere_indices = malloc(sizeof(int) * (size_t)spheres_count);
+
+  if (!builder.records || !bvh->nodes || !bvh->sphere_indices) {
+    free(builder.records);
+    bvh_destroy(bvh);
+    return NULL;
+  }
+
+  for (int i = 0; i < spheres_count; i++) {
+    builder.records[i] =
+        (BuildRecord){sphere_bounds(&spheres[i]), spheres[i].center, i};
+  }
+  bvh->spheres_count = spheres_count;
+
+  build_node(&builder, 0, spheres_count, 0);
+
+  for (int i = 0; i < spheres_count; i++) {
+    bvh->sphere_indices[i] = builder.records[i].sphere;
+  }
+  free(builder.records);
+
+  bvh->build_time_ms = timer_now_ms() - start;
+  return bvh;
+}
+
+void bvh_destroy(BVH *bvh) {
+  if (!bvh) {
+    return;
+  }
+
+  if (!bvh->borrowed) {
+    free(bvh->nodes);
+    free(bvh->sphere_indices);
+  }
+  free(bvh);
+}
+
+bool bvh_is_valid(const BVH *bvh) {
+  if (bvh->nodes_count < 1 || bvh->spheres_count < 1) {
+    return false;
+  }
+  for (int i = 0; i < bvh->spheres_count; i++) {
+    if (bvh->sphere_indices[i] < 0 ||
+        bvh->sphere_indices[i] >= bvh->spheres_count) {
+      return false;
+    }
+  }
+
+  /* Walks the tree as the traversals do and checks that it visits node
+   * next, next + 1, ... in turn: each node is then reached exactly once,
+   * in depth-first order. A traversal holds at most one pending sibling
+   * per level beside the node it pops, hence the depth limit. */
+  int stack[BVH_STACK_SIZE];
+  int depths[BVH_STACK_SIZE];
+  int stack_size = 0;
+  int next = 0;
+  stack[stack_size] = 0;
+  depths[stack_size++] = 0;
+
+  while (stack_size > 0) {
+    stack_size--;
+    int i = stack[stack_size];
+    int depth = depths[stack_size];
+    if (i != next++) {
+      return false;
+    }
+
+    const BVHNode *node = &bvh->nodes[i];
+    if (node->count > 0) {
+      if (node->offset < 0 ||
+          node->offset > bvh->spheres_count - node->count) {
+        return false;
+      }
+      continue;
+    }
+
+    if (depth + 2 >= BVH_STACK_SIZE || i + 1 >= bvh->nodes_count ||
+        node->offset <= i + 1 || node->offset >= bvh->nodes_count) {
+      return false;
+    }
+    stack[stack_size] = node->offset;
+    depths[stack_size++] = depth + 1;
+    stack[stack_size] = i + 1;
+    depths[stack_size++] = depth + 1;
+  }
+  return next == bvh->nodes_count;
+}
+
+void bvh_refit(BVH *bvh, const Sphere *spheres) {
+  /* Children always follow their parent in the array. */
+  for (int i = bvh->nodes_count - 1; i >= 0; i--) {
+    BVHNode *node = &bvh->nodes[i];
+    Bounds bounds = bounds_empty();
+
+    if (node->count > 0) {
+      for (int j = node->offset; j < node->offset + node->count; j++) {
+        Bounds sphere = sphere_bounds(&spheres[bvh->sphere_indices[j]]);
+        bounds = bounds_grow(bounds, sphere.min, sphere.max);
+      }
+    } else {
+      const BVHNode *left = &bvh->nodes[i + 1];
+      const BVHNode *right = &bvh->nodes[node->offset];
+      bounds = bounds_grow(bounds, left->bounds_min, left->bounds_max);
+      bounds = bounds_grow(bounds, right->bounds_min, right->bounds_max);
+    }
+
+    node->bounds_min = bounds.min;
+    node->bounds_max = bounds.max;
+  }
+}
+
+/* fminf and fmaxf, which return the other operand when one is NaN, as
+ * compares and selects. Without -ffast-math the compiler keeps fminf and
+ * fmaxf as libm calls, several per lane and node. NaN slab distances come
+ * from 0 * inf, a ray parallel to a slab starting on its plane. */
+static inline float slab_min(float a, float b) {
+  return a < b || b != b ? a : b;
+}
+
+static inline float slab_max(float a, float b) {
+  return a > b || b != b ? a : b;
+}
+
+/*
+ * calculate_sphere_intersection reports distances as true ray parameter
+ * times |d|^4 (its "/ 2 * quadratic_a" grouping), so slab distances are
+ * scaled by the same factor before comparing them with a hit distance.
+ */
+static inline bool ray_enters_box(const BVHNode *node, Vector3D origin,
+                                  Vector3D inverse_direction, float scale,
+                                  float padding, float closest_t) {
+  float tx1 = (node->bounds_min.x - padding - origin.x) * inverse_direction.x;
+  float tx2 = (node->bounds_max.x + padding - origin.x) * inverse_direction.x;
+  float ty1 = (node->bounds_min.y - padding - origin.y) * inverse_direction.y;
+  float ty2 = (node->bounds_max.y + padding - origin.y) * inverse_direction.y;
+  float tz1 = (node->bounds_min.z - padding - origin.z) * inverse_direction.z;
+  float tz2 = (node->bounds_max.z + padding - origin.z) * inverse_direction.z;
+
+  float entry = slab_max(slab_max(slab_min(tx1, tx2), slab_min(ty1, ty2)),
+                         slab_min(tz1, tz2));
+  float exit = slab_min(slab_min(slab_max(tx1, tx2), slab_max(ty1, ty2)),
+                        slab_max(tz1, tz2));
+
+  return entry <= exit && exit >= 0.0f && entry * scale <= closest_t;
+}
+
+/*
+ * The full sphere test reports hits up to sqrt(TILE_BINS_MARGIN * (|oc|^2
+ * + r^2)) beyond a sphere's radius, oc the centre relative to the camera
+ * (see tile_bins.c). For a sphere in the node that is at most
+ * sqrt(TILE_BINS_MARGIN) times the distance from the camera to the node's
+ * farthest corner.
+ */
+static inline float camera_padding(const BVHNode *node, Vector3D position) {
+  float x = max_of(fabsf(position.x - node->bounds_min.x),
+                   fabsf(node->bounds_max.x - position.x));
+  float y = max_of(fabsf(position.y - node->bounds_min.y),
+                   fabsf(node->bounds_max.y - position.y));
+  float z = max_of(fabsf(position.z - node->bounds_min.z),
+                   fabsf(node->bounds_max.z - position.z));
+  return sqrtf((float)TILE_BINS_MARGIN * (x * x + y * y + z * z));
+}
+
+static inline Vector3D inverse_of(Vector3D v) {
+  return vector_3d_init(1.0f / v.x, 1.0f / v.y, 1.0f / v.z);
+}
+
+/* Lanes of the widest packet: a primary RayPacket, a SecondaryRayPacket
+ * or a packet of shadow rays. */
+#define SLAB_RAYS_SIZE                                                      \
+  (RAY_PACKET_SIZE > BVH_PACKET_SIZE ? RAY_PACKET_SIZE : BVH_PACKET_SIZE)
+
+/* The rays of a packet in structure-of-arrays form, so that one box test
+ * covers four lanes at a time. */
+typedef struct {
+  _Alignas(16) float origin_x[SLAB_RAYS_SIZE];
+  _Alignas(16) float origin_y[SLAB_RAYS_SIZE];
+  _Alignas(16) float origin_z[SLAB_RAYS_SIZE];
+  _Alignas(16) float inverse_x[SLAB_RAYS_SIZE];
+  _Alignas(16) float inverse_y[SLAB_RAYS_SIZE];
+  _Alignas(16) float inverse_z[SLAB_RAYS_SIZE];
+  _Alignas(16) float scale[SLAB_RAYS_SIZE];
+} SlabRays;
+
+static inline void slab_rays_set(SlabRays *rays, int lane, Vector3D origin,
+                                 Vector3D direction, float scale) {
+  Vector3D inverse_direction = inverse_of(direction);
+  rays->origin_x[lane] = origin.x;
+  rays->origin_y[lane] = origin.y;
+  rays->origin_z[lane] = origin.z;
+  rays->inverse_x[lane] = inverse_direction.x;
+  rays->inverse_y[lane] = inverse_direction.y;
+  rays->inverse_z[lane] = inverse_direction.z;
+  rays->scale[lane] = scale;
+}
+
+#if defined(__SSE2__)
+
+_Static_assert(RAY_PACKET_SIZE % 4 == 0 && BVH_PACKET_SIZE % 4 == 0 &&
+                   SECONDARY_RAY_PACKET_SIZE <= SLAB_RAYS_SIZE,
+               "packets fill whole SSE registers");
+
+/* slab_min and slab_max on four lanes. */
+static inline __m128 slab_min4(__m128 a, __m128 b) {
+  __m128 take_a = _mm_or_ps(_mm_cmplt_ps(a, b), _mm_cmpunord_ps(b, b));
+  return _mm_or_ps(_mm_and_ps(take_a, a), _mm_andnot_ps(take_a, b));
+}
+
+static inline __m128 slab_max4(__m128 a, __m128 b) {
+  __m128 take_a = _mm_or_ps(_mm_cmpgt_ps(a, b), _mm_cmpunord_ps(b, b));
+  return _mm_or_ps(_mm_and_ps(take_a, a), _mm_andnot_ps(take_a, b));
+}
+
+static inline __m128 slab_distance(float bound, const float *origin,
+                                   const float *inverse_direction) {
+  return _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bound), _mm_load_ps(origin)),
+                    _mm_load_ps(inverse_direction));
+}
+
+/* Bit l is set when ray_enters_box holds for lane l of the first
+ * lanes_count, with the same operations in the same order. */
+static inline int rays_enter_box(const BVHNode *node, const SlabRays *rays,
+                                 float padding, const float *closest_t,
+                                 int lanes_count) {
+  float min_x = node->bounds_min.x - padding;
+  float max_x = node->bounds_max.x + padding;
+  float min_y = node->bounds_min.y - padding;
+  float max_y = node->bounds_max.y + padding;
+  float min_z = node->bounds_min.z - padding;
+  float max_z = node->bounds_max.z + padding;
+  int lanes = 0;
+  for (int first = 0; first < lanes_count; first += 4) {
+    __m128 tx1 =
+        slab_distance(min_x, &rays->origin_x[first], &rays->inverse_x[first]);
+    __m128 tx2 =
+        slab_distance(max_x, &rays->origin_x[first], &rays->inverse_x[first]);
+    __m128 ty1 =
+        slab_distance(min_y, &rays->origin_y[first], &rays->inverse_y[first]);
+    __m128 ty2 =
+        slab_distance(max_y, &rays->origin_y[first], &rays->inverse_y[first]);
+    __m128 tz1 =
+        slab_distance(min_z, &rays->origin_z[first], &rays->inverse_z[first]);
+    __m128 tz2 =
+        slab_distance(max_z, &rays->origin_z[first], &rays->inverse_z[first]);
+
+    __m128 entry =
+        slab_max4(slab_max4(slab_min4(tx1, tx2), slab_min4(ty1, ty2)),
+                  slab_min4(tz1, tz2));
+    __m128 exit =
+        slab_min4(slab_min4(slab_max4(tx1, tx2), slab_max4(ty1, ty2)),
+                  slab_max4(tz1, tz2));
+
+    __m128 enters = _mm_and_ps(
+        _mm_and_ps(_mm_cmple_ps(entry, exit),
+                   _mm_cmpge_ps(exit, _mm_setzero_ps())),
+        _mm_cmple_ps(_mm_mul_ps(entry, _mm_load_ps(&rays->scale[first])),
+                     _mm_loadu_ps(&closest_t[first])));
+    lanes |= _mm_movemask_ps(enters) << first;
+  }
+  return lanes;
+}
+
+#else
+
+static inline int rays_enter_box(const BVHNode *node, const SlabRays *rays,
+                                 float padding, const float *closest_t,
+                                 int lanes_count) {
+  int lanes = 0;
+  for (int lane = 0; lane < lanes_count; lane++) {
+    Vector3D origin = vector_3d_init(rays->origin_x[lane],
+                                     rays->origin_y[lane],
+                                     rays->origin_z[lane]);
+    Vector3D inverse_direction = vector_3d_init(rays->inverse_x[lane],
+                                                rays->inverse_y[lane],
+                                                rays->inverse_z[lane]);
+    if (ray_enters_box(node, origin, inverse_direction, rays->scale[lane],
+                       padding, closest_t[lane])) {
+      lanes |= 1 << lane;
+    }
+  }
+  return lanes;
+}
+
+#endif
+
+int bvh_intersect_ray(const BVH *bvh, const Camera *camera,
+                      const Sphere *spheres, Vector3D ray_direction,
+                      float *closest_t, int *closest_sphere) {
+  Vector3D inverse_direction = inverse_of(ray_direction);
+  float quadratic_a = vector_3d_dot_product(ray_direction, ray_direction);
+  float scale = quadratic_a * quadratic_a;
+
+  int spheres_tested = 0;
+  int stack[BVH_STACK_SIZE];
+  int stack_size = 0;
+  stack[stack_size++] = 0;
+
+  while (stack_size > 0) {
+    const BVHNode *node = &bvh->nodes[stack[--stack_size]];
+    if (!ray_enters_box(node, camera->position, inverse_direction, scale,
+                        camera_padding(node, camera->position),
+                        *closest_t)) {
+      continue;
+    }
+
+    if (node->count > 0) {
+      spheres_tested += node->count;
+      for (int i = node->offset; i < node->offset + node->count; i++) {
+        int index = bvh->sphere_indices[i];
+        SphereIntersections sphere_intersections =
+            calculate_sphere_intersection((Camera *)camera,
+                                          (Sphere *)&spheres[index],
+                                          ray_direction);
+
+        if (in_camera_range(*camera, sphere_intersections.t1) &&
+            sphere_hit_is_nearer(sphere_intersections.t1, index, *closest_t,
+                                 *closest_sphere)) {
+          *closest_t = sphere_intersections.t1;
+          *closest_sphere = index;
+        }
+
+        if (in_camera_range(*camera, sphere_intersections.t2) &&
+            sphere_hit_is_nearer(sphere_intersections.t2, index, *closest_t,
+                                 *closest_sphere)) {
+          *closest_t = sphere_intersections.t2;
+          *closest_sphere = index;
+        }
+      }
+      continue;
+    }
+
+    int left = (int)(node - bvh->nodes) + 1;
+    int right = node->offset;
+    bool left_first = axis_of(ray_direction, node->axis) >= 0.0f;
+
+    stack[stack_size++] = left_first ? right : left;
+    stack[stack_size++] = left_first ? left : right;
+  }
+
+  return spheres_tested;
+}
+
+int bvh_intersect_packet(const BVH *bvh, const Camera *camera,
+                         const Sphere *spheres, RayPacket *packet) {
+  SlabRays rays;
+
+  for (int lane = 0; lane < RAY_PACKET_SIZE; lane++) {
+    Vector3D direction =
+        vector_3d_init(packet->direction_x[lane], packet->direction_y[lane],
+                       packet->direction_z[lane]);
+    float quadratic_a = vector_3d_dot_product(direction, direction);
+    slab_rays_set(&rays, lane, camera->position, direction,
+                  quadratic_a * quadratic_a);
+  }
+
+  int spheres_tested = 0;
+  int stack[BVH_STACK_SIZE];
+  int stack_size = 0;
+  stack[stack_size++] = 0;
+
+  while (stack_size > 0) {
+    const BVHNode *node = &bvh->nodes[stack[--stack_size]];
+
+    if (!rays_enter_box(node, &rays, camera_padding(node, camera->position),
+                        packet->closest_t, RAY_PACKET_SIZE)) {
+      continue;
+    }
+
+    if (node->count > 0) {
+      spheres_tested += node->count;
+      ray_packet_intersect_spheres(packet, camera, spheres,
+                                   &bvh->sphere_indices[node->offset],
+                                   node->count);
+      continue;
+    }
+
+    int left = (int)(node - bvh->nodes) + 1;
+    int right = node->offset;
+    bool left_first = axis_of(vector_3d_init(packet->direction_x[0],
+                                             packet->direction_y[0],
+                                             packet->direction_z[0]),
+                              node->axis) >= 0.0f;
+
+    stack[stack_size++] = left_first ? right : left;
+    stack[stack_size++] = left_first ? left : right;
+  }
+
+  return spheres_tested;
+}
+
+int bvh_intersect_closest_packet(const BVH *bvh, const Sphere *spheres,
+                                 SecondaryRayPacket *packet, float t_min) {
+  SlabRays rays;
+  for (int lane = 0; lane < SECONDARY_RAY_PACKET_SIZE; lane++) {
+    slab_rays_set(&rays, lane,
+                  vector_3d_init(packet->origin_x[lane],
+                                 packet->origin_y[lane],
+                                 packet->origin_z[lane]),
+                  vector_3d_init(packet->direction_x[lane],
+                                 packet->direction_y[lane],
+                                 packet->direction_z[lane]),
+                  1.0f);
+  }
+  Vector3D first_direction = vector_3d_init(
+      packet->direction_x[0], packet->direction_y[0], packet->direction_z[0]);
+
+  int spheres_tested = 0;
+  int stack[BVH_STACK_SIZE];
+  int stack_size = 0;
+  stack[stack_size++] = 0;
+
+  while (stack_size > 0) {
+    const BVHNode *node = &bvh->nodes[stack[--stack_size]];
+    int lanes = rays_enter_box(node, &rays, 0.0f, packet->closest_t,
+                               SECONDARY_RAY_PACKET_SIZE);
+    if (!lanes) {
+      continue;
+    }
+
+    if (node->count > 0) {
+      for (int lane = 0; lane < SECONDARY_RAY_PACKET_SIZE; lane++) {
+        if (lanes & (1 << lane)) {
+          spheres_tested += node->count;
+        }
+      }
+      secondary_ray_packet_intersect(packet, spheres,
+                                     &bvh->sphere_indices[node->offset],
+                                     node->count, t_min, lanes);
+      continue;
+    }
+
+    int left = (int)(node - bvh->nodes) + 1;
+    int right = node->offset;
+    bool left_first = axis_of(first_direction, node->axis) >= 0.0f;
+
+    stack[stack_size++] = left_first ? right : left;
+    stack[stack_size++] = left_first ? left : right;
+  }
+
+  return spheres_tested;
+}
+
+int bvh_intersect_shadow_ray(const BVH *bvh, const Sphere *spheres,
+                             Vector3D origin, Vector3D direction,
+                             float t_min, float t_max, int *occluder) {
+  Vector3D inverse_direction = inverse_of(direction);
+  *occluder = -1;
+
+  int spheres_tested = 0;
+  int stack[BVH_STACK_SIZE];
+  int stack_size = 0;
+  stack[stack_size++] = 0;
+
+  while (stack_size > 0) {
+    const BVHNode *node = &bvh->nodes[stack[--stack_size]];
+    if (!ray_enters_box(node, origin, inverse_direction, 1.0f, 0.0f, t_max)) {
+      continue;
+    }
+
+    if (node->count > 0) {
+      for (int i = node->offset; i < node->offset + node->count; i++) {
+        int index = bvh->sphere_indices[i];
+        if (spheres[index].is_light_source) {
+          continue;
+        }
+
+        spheres_tested++;
+        if (sphere_blocks_ray(&spheres[index], origin, direction, t_min,
+                              t_max)) {
+          *occluder = index;
+          return spheres_tested;
+        }
+      }
+      continue;
+    }
+
+    int left = (int)(node - bvh->nodes) + 1;
+    int right = node->offset;
+    bool left_first = axis_of(direction, node->axis) >= 0.0f;
+
+    stack[stack_size++] = left_first ? right : left;
+    stack[stack_size++] = left_first ? left : right;
+  }
+
+  return spheres_tested;
+}
+
+int bvh_intersect_shadow_packet(const BVH *bvh, const Sphere *spheres,
+                                const Vector3D *origins,
+                                const Vector3D *directions, int count,
+                                float t_min, const float *t_max,
+                                int *occluder) {
+  /* Lanes past count repeat the first ray and are never active. */
+  SlabRays rays;
+  float lane_t[BVH_PACKET_SIZE];
+  for (int lane = 0; lane < BVH_PACKET_SIZE; lane++) {
+    int ray = lane < count ? lane : 0;
+    slab_rays_set(&rays, lane, origins[ray], directions[ray], 1.0f);
+    lane_t[lane] = t_max[ray];
+    if (lane < count) {
+      occluder[lane] = -1;
+    }
+  }
+
+  int active = (1 << count) - 1;
+  int spheres_tested = 0;
+  int stack[BVH_STACK_SIZE];
+  int stack_size = 0;
+  stack[stack_size++] = 0;
+
+  while (stack_size > 0 && active) {
+    const BVHNode *node = &bvh->nodes[stack[--stack_size]];
+    int lanes = rays_enter_box(node, &rays, 0.0f, lane_t, BVH_PACKET_SIZE) &
+                active;
+    if (!lanes) {
+      continue;
+    }
+
+    if (node->count > 0) {
+      for (int lane = 0; lane < count; lane++) {
+        if (!(lanes & (1 << lane))) {
+          continue;
+        }
+
+        for (int i = node->offset; i < node->offset + node->count; i++) {
+          int index = bvh->sphere_indices[i];
+          if (spheres[index].is_light_source) {
+            continue;
+          }
+
+          spheres_tested++;
+          if (sphere_blocks_ray(&spheres[index], origins[lane],
+                                directions[lane], t_min, t_max[lane])) {
+            occluder[lane] = index;
+            active &= ~(1 << lane);
+            break;
+          }
+        }
+      }
+      continue;
+    }
+
+    int left = (int)(node - bvh->nodes) + 1;
+    int right = node->offset;
+    bool left_first = axis_of(directions[0], node->axis) >= 0.0f;
+
+    stack[stack_size++] = left_first ? right : left;
+    stack[stack_size++] = left_first ? left : right;
+  }
+
+  return spheres_tested;
+}
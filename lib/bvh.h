@@ -0,0 +1,152 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "camera.h"
+#include "ray_packet.h"
+#include "sphere.h"
+#include "vector_3d.h"
+
+/**
+ * @file bvh.h
+ * @brief Bounding volume hierarchy over the scene spheres.
+ *
+ * Built top-down with a binned surface area heuristic and stored as a
+ * flat depth-first array: an interior node's left child is the next
+ * node, its right child is at node.offset. The sphere array itself is
+ * never reordered; leaves index it through sphere_indices.
+ */
+
+#define BVH_BINS 16
+#define BVH_MAX_LEAF_SIZE 8
+#define BVH_STACK_SIZE 128
+#define BVH_PACKET_SIZE 4
+
+/**
+ * @struct BVHNode
+ * @brief One 32 byte node.
+ */
+typedef struct {
+  Vector3D bounds_min;
+  Vector3D bounds_max;
+  int32_t offset;  /**< Leaf: first entry in sphere_indices; interior:
+                        index of the right child */
+  uint16_t count;  /**< Spheres in a leaf, 0 for interior nodes */
+  uint16_t axis;   /**< Split axis of an interior node (0 = x) */
+} BVHNode;
+
+typedef struct {
+  BVHNode *nodes;
+  int nodes_count;
+  int *sphere_indices;
+  int spheres_count;
+  double build_time_ms;
+  bool borrowed; /**< nodes and sphere_indices are owned elsewhere, e.g.
+                      by a mapped scene file */
+} BVH;
+
+/**
+ * @brief Build a BVH over spheres.
+ *
+ * @return BVH, or NULL on allocation failure or an empty sphere array
+ */
+BVH *bvh_build(const Sphere *spheres, int spheres_count);
+
+void bvh_destroy(BVH *bvh);
+
+/**
+ * @brief Whether nodes and sphere_indices, such as read from a file, are
+ *        safe to traverse.
+ *
+ * Checks in one pass that the nodes form a tree in the layout above, no
+ * deeper than BVH_STACK_SIZE allows, and that leaves and sphere_indices
+ * stay within spheres_count.
+ */
+bool bvh_is_valid(const BVH *bvh);
+
+/**
+ * @brief Recompute every node's bounds after spheres moved or resized.
+ *
+ * The tree keeps its shape, so traversal stays exact but slows down as
+ * spheres drift from where the tree was built.
+ */
+void bvh_refit(BVH *bvh, const Sphere *spheres);
+
+/**
+ * @brief Nearest hit of one ray from the camera position.
+ *
+ * @param closest_t In: current nearest distance; out: nearest distance
+ * @param closest_sphere In/out: index of the nearest sphere, -1 if none
+ * @return Number of spheres tested
+ *
+ * Gives the result of testing every sphere in index order. Cancellation
+ * in the float quadratic makes the full test report grazing hits just
+ * outside distant spheres, so boxes are widened with their distance from
+ * the camera by the margin tile_bins.h uses, and still hold those hits.
+ */
+int bvh_intersect_ray(const BVH *bvh, const Camera *camera,
+                      const Sphere *spheres, Vector3D ray_direction,
+                      float *closest_t, int *closest_sphere);
+
+/**
+ * @brief Nearest hits of a packet of rays from the camera position.
+ *
+ * A node is entered when any lane can still find a nearer hit in it.
+ * Boxes are widened as for bvh_intersect_ray.
+ *
+ * @return Number of spheres tested against the whole packet
+ */
+int bvh_intersect_packet(const BVH *bvh, const Camera *camera,
+                         const Sphere *spheres, RayPacket *packet);
+
+/**
+ * @brief Nearest hits of a packet of rays starting anywhere, such as
+ *        reflections.
+ *
+ * Meant for rays with similar origins and directions. A node is entered
+ * when any lane can still find a nearer hit in it; a leaf's spheres are
+ * only tested against the lanes that reach the leaf.
+ *
+ * @param packet Packet whose nearest hits are updated
+ * @param t_min Smallest true ray parameter accepted
+ * @return Number of ray-sphere tests
+ */
+int bvh_intersect_closest_packet(const BVH *bvh, const Sphere *spheres,
+                                 SecondaryRayPacket *packet, float t_min);
+
+/**
+ * @brief Any sphere blocking a shadow ray, which is all a shadow needs.
+ *
+ * Traversal stops at the first blocker found rather than the nearest one.
+ * Light source spheres never block.
+ *
+ * @param t_min, t_max Range of the true ray parameter to test
+ * @param occluder Out: index of the blocking sphere, -1 if none
+ * @return Number of spheres tested
+ */
+int bvh_intersect_shadow_ray(const BVH *bvh, const Sphere *spheres,
+                             Vector3D origin, Vector3D direction,
+                             float t_min, float t_max, int *occluder);
+
+/**
+ * @brief Which of up to BVH_PACKET_SIZE shadow rays are blocked, traversed
+ *        together.
+ *
+ * Each ray gets the answer bvh_intersect_shadow_ray gives it, though not
+ * necessarily the same blocker. A ray drops out of the packet at its
+ * first blocker, and traversal ends once every ray has one.
+ *
+ * @param t_min Smallest true ray parameter tested
+ * @param t_max Per ray, largest true ray parameter tested
+ * @param occluder Out: per ray, index of a blocking sphere, -1 if none
+ * @return Number of ray-sphere tests
+ */
+int bvh_intersect_shadow_packet(const BVH *bvh, const Sphere *spheres,
+                                const Vector3D *origins,
+                                const Vector3D *directions, int count,
+                                float t_min, const float *t_max,
+                                int *occluder);
+
+#endif /* BVH_H */
@@ -4,6 +4,34 @@
 #include "./constants.h"
 #include "vector_3d.h"
 
+void camera_init(Camera *camera, int width, int height) {
+  camera->position = vector_3d_init(0.0f, 0.0f, -3.0f);
+
+  camera->width = width;
+  camera->height = height;
+
+  /* Keep the vertical field of view and widen the viewport to match the
+   * image aspect ratio. */
+  camera->viewport_width = VIEWPORT_HEIGHT * width / height;
+  camera->viewport_height = VIEWPORT_HEIGHT;
+  camera->viewport_distance = VIEWPORT_DISTANCE;
+
+  camera->ray_t_min = RAY_T_MIN;
+  camera->ray_t_max = RAY_T_MAX;
+
+  camera->yaw = 0.0f;
+  camera->pitch = 0.0f;
+  camera->roll = 0.0f;
+
+  camera->pitch_range = MATH_PI / 3.0f; /* ±60° */
+  camera->roll_range = MATH_PI / 4.0f;  /* ±45° */
+
+  camera->move_speed = CAMERA_MOVE_SPEED;
+  camera->rotate_speed = CAMERA_ROTATE_SPEED;
+
+  camera_update_orientation(camera);
+}
+
 bool in_camera_range(Camera camera, float ray_parameter) {
   return camera.ray_t_min <= ray_parameter && camera.ray_t_max >= ray_parameter;
 }
@@ -86,6 +114,52 @@ void camera_roll_right(Camera *camera, float rotate) {
   }
 }
 
+bool camera_apply_controls(Camera *camera, uint32_t controls,
+                           float delta_time) {
+  float move = camera->move_speed * delta_time;
+  float rotate = camera->rotate_speed * delta_time;
+
+  if (controls & CAMERA_MOVE_FRONT) {
+    camera_move_front(camera, move);
+  }
+  if (controls & CAMERA_MOVE_BACK) {
+    camera_move_back(camera, move);
+  }
+  if (controls & CAMERA_MOVE_LEFT) {
+    camera_move_left(camera, move);
+  }
+  if (controls & CAMERA_MOVE_RIGHT) {
+    camera_move_right(camera, move);
+  }
+  if (controls & CAMERA_MOVE_UP) {
+    camera_move_up(camera, move);
+  }
+  if (controls & CAMERA_MOVE_DOWN) {
+    camera_move_down(camera, move);
+  }
+
+  if (controls & CAMERA_PITCH_UP) {
+    camera_pitch_up(camera, rotate);
+  }
+  if (controls & CAMERA_PITCH_DOWN) {
+    camera_pitch_down(camera, rotate);
+  }
+  if (controls & CAMERA_YAW_LEFT) {
+    camera_yaw_left(camera, rotate);
+  }
+  if (controls & CAMERA_YAW_RIGHT) {
+    camera_yaw_right(camera, rotate);
+  }
+  if (controls & CAMERA_ROLL_LEFT) {
+    camera_roll_left(camera, rotate);
+  }
+  if (controls & CAMERA_ROLL_RIGHT) {
+    camera_roll_right(camera, rotate);
+  }
+
+  return controls != 0;
+}
+
 void camera_update_orientation(Camera *camera) {
   const Vector3D world_up = vector_3d_init(0.0f, 1.0f, 0.0f);
 
@@ -1,6 +1,8 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include <stdint.h>
+
 #include "./vector_3d.h"
 
 typedef struct {
@@ -31,6 +33,14 @@ typedef struct {
   Vector3D up;
 } Camera;
 
+/**
+ * @brief Set up the default camera for a width x height image.
+ *
+ * Places the camera at (0, 0, -3) looking down +z, with the viewport
+ * widened or narrowed to the image aspect ratio.
+ */
+void camera_init(Camera *camera, int width, int height);
+
 bool in_camera_range(Camera camera, float ray_parameter);
 
 void camera_move_up(Camera *camera, float move);
@@ -47,5 +57,34 @@ void camera_yaw_right(Camera *camera, float rotate);
 void camera_roll_left(Camera *camera, float rotate);
 void camera_roll_right(Camera *camera, float rotate);
 
+/**
+ * @brief Camera movements, one bit each, as held down during a frame.
+ */
+typedef enum {
+  CAMERA_MOVE_FRONT = 1 << 0,
+  CAMERA_MOVE_BACK = 1 << 1,
+  CAMERA_MOVE_LEFT = 1 << 2,
+  CAMERA_MOVE_RIGHT = 1 << 3,
+  CAMERA_MOVE_UP = 1 << 4,
+  CAMERA_MOVE_DOWN = 1 << 5,
+  CAMERA_PITCH_UP = 1 << 6,
+  CAMERA_PITCH_DOWN = 1 << 7,
+  CAMERA_YAW_LEFT = 1 << 8,
+  CAMERA_YAW_RIGHT = 1 << 9,
+  CAMERA_ROLL_LEFT = 1 << 10,
+  CAMERA_ROLL_RIGHT = 1 << 11
+} CameraControl;
+
+/**
+ * @brief Move and turn the camera by its speeds times delta_time seconds
+ *        for every CameraControl bit set in controls.
+ *
+ * The orientation is left for camera_update_orientation.
+ *
+ * @return Whether any control was set
+ */
+bool camera_apply_controls(Camera *camera, uint32_t controls,
+                           float delta_time);
+
 void camera_update_orientation(Camera *camera);
 #endif /* CAMERA_H */
@@ -0,0 +1,148 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "camera_path.h"
+#include "line_file.h"
+
+CameraRecorder *camera_recorder_open(const char *path, const Camera *camera) {
+  CameraRecorder *recorder = calloc(1, sizeof(CameraRecorder));
+  if (!recorder) {
+    return NULL;
+  }
+
+  recorder->file = fopen(path, "w");
+  if (!recorder->file) {
+    free(recorder);
+    return NULL;
+  }
+
+  fprintf(recorder->file,
+          "# camera path: start X Y Z YAW PITCH ROLL, then\n"
+          "# frame TIME_MS DELTA_S CONTROLS\n"
+          "start %.9g %.9g %.9g %.9g %.9g %.9g\n",
+          camera->position.x, camera->position.y, camera->position.z,
+          camera->yaw, camera->pitch, camera->roll);
+  return recorder;
+}
+
+bool camera_recorder_write(CameraRecorder *recorder, double time_ms,
+                           float delta_time, uint32_t controls) {
+  if (!recorder->started) {
+    recorder->start_ms = time_ms;
+    recorder->started = true;
+  }
+
+  return fprintf(recorder->file, "frame %.3f %.9g 0x%03x\n",
+                 time_ms - recorder->start_ms, delta_time,
+                 (unsigned)controls) > 0 &&
+         !ferror(recorder->file);
+}
+
+bool camera_recorder_close(CameraRecorder *recorder) {
+  if (!recorder) {
+    return true;
+  }
+
+  /* Lines are buffered, so a full disk may only show here. */
+  bool ok = !ferror(recorder->file);
+  int error = EIO;
+  if (fclose(recorder->file) != 0 && ok) {
+    ok = false;
+    error = errno;
+  }
+  free(recorder);
+
+  if (!ok) {
+    errno = error;
+  }
+  return ok;
+}
+
+typedef struct {
+  CameraPath *path;
+  int capacity;
+  bool has_start;
+} CameraPathReader;
+
+static bool parse_line(void *context, const char *keyword,
+                       const char *values) {
+  CameraPathReader *reader = context;
+  CameraPath *path = reader->path;
+  char extra;
+
+  if (strcmp(keyword, "start") == 0 && !reader->has_start &&
+      sscanf(values, "%f %f %f %f %f %f %c", &path->position.x,
+             &path->position.y, &path->position.z, &path->yaw, &path->pitch,
+             &path->roll, &extra) == 6) {
+    reader->has_start = true;
+    return true;
+  }
+
+  CameraPathFrame frame;
+  unsigned controls;
+  if (strcmp(keyword, "frame") != 0 || !reader->has_start ||
+      sscanf(values, "%lf %f %x %c", &frame.time_ms, &frame.delta_time,
+             &controls, &extra) != 3) {
+    errno = EINVAL;
+    return false;
+  }
+  frame.controls = controls;
+
+  if (path->frames_count == reader->capacity) {
+    int grown = reader->capacity > 0 ? reader->capacity * 2 : 256;
+    CameraPathFrame *frames =
+        realloc(path->frames, sizeof(CameraPathFrame) * (size_t)grown);
+    if (!frames) {
+      errno = ENOMEM;
+      return false;
+    }
+    path->frames = frames;
+    reader->capacity = grown;
+  }
+  path->frames[path->frames_count++] = frame;
+  return true;
+}
+
+CameraPath *camera_path_load(const char *path, int *error_line) {
+  if (error_line) {
+    *error_line = 0;
+  }
+
+  CameraPathReader reader = {.path = calloc(1, sizeof(CameraPath))};
+  if (!reader.path) {
+    return NULL;
+  }
+
+  bool ok = line_file_read(path, parse_line, &reader, error_line);
+  if (ok && !reader.has_start) {
+    ok = false;
+    errno = EINVAL;
+  }
+
+  if (!ok) {
+    int error = errno;
+    camera_path_destroy(reader.path);
+    errno = error;
+    return NULL;
+  }
+  return reader.path;
+}
+
+void camera_path_start(const CameraPath *path, Camera *camera) {
+  camera->position = path->position;
+  camera->yaw = path->yaw;
+  camera->pitch = path->pitch;
+  camera->roll = path->roll;
+  camera_update_orientation(camera);
+}
+
+void camera_path_destroy(CameraPath *path) {
+  if (!path) {
+    return;
+  }
+
+  free(path->frames);
+  free(path);
+}
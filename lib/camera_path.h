@@ -0,0 +1,83 @@
+#ifndef CAMERA_PATH_H
+#define CAMERA_PATH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "camera.h"
+#include "vector_3d.h"
+
+/**
+ * @file camera_path.h
+ * @brief Recorded camera controls, for replaying a fly-through exactly.
+ *
+ * A path is a text file: a start line with the camera pose, then one
+ * frame line per displayed frame with its timestamp, the seconds it
+ * advanced the camera by and the CameraControl bits held.
+ *
+ *   start X Y Z YAW PITCH ROLL       (angles in radians)
+ *   frame TIME_MS DELTA_S CONTROLS   (controls in hex)
+ *
+ * Lines starting with '#' are comments. Values are written with enough
+ * digits to read back the same floats, so replaying every frame through
+ * camera_apply_controls retraces the recorded poses bit for bit.
+ */
+
+typedef struct {
+  double time_ms;   /**< Since the recording started */
+  float delta_time; /**< Seconds the frame moved the camera by */
+  uint32_t controls;
+} CameraPathFrame;
+
+typedef struct {
+  Vector3D position; /**< Start pose */
+  float yaw;
+  float pitch;
+  float roll;
+  CameraPathFrame *frames;
+  int frames_count;
+} CameraPath;
+
+typedef struct {
+  FILE *file;
+  double start_ms;
+  bool started;
+} CameraRecorder;
+
+/**
+ * @brief Create a path file starting at the camera's current pose.
+ *
+ * @return Recorder, or NULL with errno set
+ */
+CameraRecorder *camera_recorder_open(const char *path, const Camera *camera);
+
+/**
+ * @param time_ms Any clock in milliseconds; the first frame is time 0
+ * @return false with errno set when the line cannot be written
+ */
+bool camera_recorder_write(CameraRecorder *recorder, double time_ms,
+                           float delta_time, uint32_t controls);
+
+/**
+ * @brief Write the buffered lines, close the file and free the recorder.
+ *
+ * @return false with errno set when any line could not be written
+ */
+bool camera_recorder_close(CameraRecorder *recorder);
+
+/**
+ * @param error_line Set to the first malformed line, or 0 when the file
+ *                   cannot be read (may be NULL)
+ * @return Path, or NULL with errno set (EINVAL for a malformed file)
+ */
+CameraPath *camera_path_load(const char *path, int *error_line);
+
+/**
+ * @brief Put the camera at the path's start pose.
+ */
+void camera_path_start(const CameraPath *path, Camera *camera);
+
+void camera_path_destroy(CameraPath *path);
+
+#endif /* CAMERA_PATH_H */
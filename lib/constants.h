@@ -3,6 +3,7 @@
 
 #include <math.h>
 
+/* Default resolution; --width and --height override it at run time. */
 #define WINDOW_WIDTH 1920
 #define WINDOW_HEIGHT 1080
 
@@ -18,4 +19,50 @@
 #define CAMERA_MOVE_SPEED 2.0f
 #define CAMERA_ROTATE_SPEED MATH_PI / 10
 
+#define RENDER_TILE_SIZE 64
+#define RENDER_THREADS 0
+#define RENDER_COARSEST_STRIDE 8
+
+#define TILE_BINS_MAX_SPHERES 1024
+#define TILE_BINS_MARGIN 4e-6
+
+#define PROGRESSIVE_FRAME_BUDGET_MS 16.0
+#define PROGRESSIVE_TILES_PER_THREAD 2
+
+#define TEMPORAL_BAND_HEIGHT 16
+#define TEMPORAL_MAX_AGE 16
+#define TEMPORAL_DEPTH_TOLERANCE 0.02f
+#define TEMPORAL_OCCLUDER_RADIUS 2
+
+#define DYNAMIC_RESOLUTION_MIN_SCALE 0.125f
+#define DYNAMIC_RESOLUTION_MAX_GROWTH 1.1f
+#define DYNAMIC_RESOLUTION_SMOOTHING 0.3
+#define DYNAMIC_RESOLUTION_BAND_HEIGHT 16
+
+#define FOVEATED_INNER_RADIUS 0.3f
+#define FOVEATED_OUTER_RADIUS 0.6f
+#define FOVEATED_BLEND_WIDTH 0.1f
+
+#define ADAPTIVE_CELL_SIZE 8
+#define ADAPTIVE_COLOR_THRESHOLD 0.02f
+
+#define SHADOW_RAY_T_MIN 0.001f
+#define SHADOW_CACHE_SIZE 64
+#define REFLECTION_RAY_T_MIN 0.001f
+
+#define WAVEFRONT_MAX_DEPTH 8
+#define WAVEFRONT_BATCH_SIZE 4096
+
+#define DISTRIBUTED_TILES_IN_FLIGHT 2
+#define DISTRIBUTED_TILE_TIMEOUT_MS 30000
+#define DISTRIBUTED_STRIP_WIDTH 8
+
+#define SCENE_MAX_EDITS 16
+#define INCREMENTAL_BAND_HEIGHT 16
+#define INCREMENTAL_MARGIN 2
+
+#define OVERLAY_SCALE 2.0f
+#define OVERLAY_MARGIN 4.0f
+#define STATS_LOG_DEFAULT_PATH "frame_stats.csv"
+
 #endif
@@ -0,0 +1,564 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bvh.h"
+#include "distributed.h"
+#include "timer.h"
+
+/* Every message is a header followed by size bytes of payload. */
+typedef enum {
+  MESSAGE_SCENE,  /* SceneMessage, spheres, lights */
+  MESSAGE_CAMERA, /* Camera */
+  MESSAGE_TILE,   /* int32_t tile */
+  MESSAGE_PIXELS, /* PixelsMessage, width * height ARGB8888 pixels */
+  MESSAGE_QUIT
+} MessageType;
+
+typedef struct {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t size;
+} MessageHeader;
+
+typedef struct {
+  int32_t spheres_count;
+  int32_t lights_count;
+  VectorColor background;
+  float light_cutoff;
+  int32_t shadows;
+} SceneMessage;
+
+typedef struct {
+  int32_t tile;
+  int32_t x;
+  int32_t y;
+  int32_t width;
+  int32_t height;
+  RenderCounters counters;
+} PixelsMessage;
+
+/* ------------------------------------------------------------------------
+ * Socket I/O
+ * ------------------------------------------------------------------------ */
+
+/* MSG_NOSIGNAL turns a dead peer into EPIPE rather than SIGPIPE. */
+static bool send_all(int fd, const void *data, size_t size) {
+  const char *bytes = data;
+  while (size > 0) {
+    ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return false;
+    }
+    bytes += sent;
+    size -= (size_t)sent;
+  }
+  return true;
+}
+
+static bool receive_all(int fd, void *data, size_t size) {
+  char *bytes = data;
+  while (size > 0) {
+    ssize_t received = recv(fd, bytes, size, 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      return false;
+    }
+    bytes += received;
+    size -= (size_t)received;
+  }
+  return true;
+}
+
+/* receive_all that gives up at deadline_ms (timer_now_ms time). */
+static bool receive_before(int fd, void *data, size_t size,
+                           double deadline_ms) {
+  char *bytes = data;
+  while (size > 0) {
+    int left = (int)(deadline_ms - timer_now_ms());
+    struct pollfd readable = {.fd = fd, .events = POLLIN};
+    int ready = poll(&readable, 1, left > 0 ? left : 0);
+    if (ready < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ready <= 0) {
+      return false;
+    }
+
+    ssize_t received = recv(fd, bytes, size, 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      return false;
+    }
+    bytes += received;
+    size -= (size_t)received;
+  }
+  return true;
+}
+
+static bool send_header(int fd, MessageType type, uint64_t size) {
+  MessageHeader header = {.type = type, .size = size};
+  return send_all(fd, &header, sizeof(header));
+}
+
+/* ------------------------------------------------------------------------
+ * Worker
+ * ------------------------------------------------------------------------ */
+
+/* Returns the scene with its BVH and light tree built, or NULL. */
+static Scene *receive_scene(int fd, uint64_t size) {
+  SceneMessage message;
+  if (size < sizeof(message) || !receive_all(fd, &message, sizeof(message))) {
+    return NULL;
+  }
+  if (message.spheres_count <= 0 || message.lights_count < 0 ||
+      size != sizeof(message) +
+                  sizeof(Sphere) * (uint64_t)message.spheres_count +
+                  sizeof(Light) * (uint64_t)message.lights_count) {
+    return NULL;
+  }
+
+  Scene *scene = calloc(1, sizeof(Scene));
+  if (!scene) {
+    return NULL;
+  }
+  scene->spheres_count = message.spheres_count;
+  scene->lights_count = message.lights_count;
+  scene->default_background_color = message.background;
+  scene->light_cutoff = message.light_cutoff;
+  scene->shadows = message.shadows != 0;
+  scene->spheres = malloc(sizeof(Sphere) * (size_t)scene->spheres_count);
+  scene->lights =
+      malloc(sizeof(Light) * (size_t)(scene->lights_count > 0
+                                          ? scene->lights_count
+                                          : 1));
+  if (!scene->spheres || !scene->lights ||
+      !receive_all(fd, scene->spheres,
+                   sizeof(Sphere) * (size_t)scene->spheres_count) ||
+      !receive_all(fd, scene->lights,
+                   sizeof(Light) * (size_t)scene->lights_count)) {
+    scene_destroy(scene);
+    return NULL;
+  }
+
+  scene->bvh = bvh_build(scene->spheres, scene->spheres_count);
+  if (!scene->bvh || !scene_build_light_tree(scene)) {
+    scene_destroy(scene);
+    return NULL;
+  }
+  return scene;
+}
+
+typedef struct {
+  Scene *scene;
+  Camera *camera;
+  int tile;
+  uint32_t *pixels;
+} TileStrips;
+
+static void render_strip(void *context, int task_index,
+                         RenderCounters *counters) {
+  TileStrips *strips = context;
+  raytracer_render_tile_columns(strips->scene, strips->camera, strips->tile,
+                                task_index * DISTRIBUTED_STRIP_WIDTH,
+                                DISTRIBUTED_STRIP_WIDTH, strips->pixels,
+                                counters);
+}
+
+/* Renders one tile, split into strips of columns over the worker's render
+ * threads, and sends its pixels back. */
+static bool render_tile(int fd, Scene *scene, Camera *camera,
+                        uint32_t *pixels, int tile) {
+  PixelsMessage message = {.tile = tile};
+  int x, y, width, height;
+  raytracer_tile_rect(camera, tile, &x, &y, &width, &height);
+  message.x = x;
+  message.y = y;
+  message.width = width;
+  message.height = height;
+
+  TileStrips strips = {
+      .scene = scene, .camera = camera, .tile = tile, .pixels = pixels};
+  raytracer_run(RENDER_TILE_SIZE / DISTRIBUTED_STRIP_WIDTH, render_strip,
+                &strips);
+  message.counters = raytracer_frame_counters();
+
+  size_t pixels_size = sizeof(uint32_t) * (size_t)width * height;
+  return send_header(fd, MESSAGE_PIXELS, sizeof(message) + pixels_size) &&
+         send_all(fd, &message, sizeof(message)) &&
+         send_all(fd, pixels, pixels_size);
+}
+
+/* Serves messages until the coordinator quits or goes away. */
+static void run_worker(int fd, int threads) {
+  raytracer_init(threads);
+
+  Scene *scene = NULL;
+  Camera camera;
+  bool has_camera = false;
+  uint32_t *pixels =
+      malloc(sizeof(uint32_t) * RENDER_TILE_SIZE * RENDER_TILE_SIZE);
+  bool ok = pixels != NULL;
+
+  while (ok) {
+    MessageHeader header;
+    if (!receive_all(fd, &header, sizeof(header))) {
+      break;
+    }
+
+    if (header.type == MESSAGE_SCENE) {
+      scene_destroy(scene);
+      scene = receive_scene(fd, header.size);
+      ok = scene != NULL;
+    } else if (header.type == MESSAGE_CAMERA &&
+               header.size == sizeof(Camera)) {
+      ok = has_camera = receive_all(fd, &camera, sizeof(Camera));
+    } else if (header.type == MESSAGE_TILE &&
+               header.size == sizeof(int32_t)) {
+      int32_t tile;
+      ok = receive_all(fd, &tile, sizeof(tile)) && scene && has_camera &&
+           tile >= 0 && tile < raytracer_tiles_count(&camera) &&
+           render_tile(fd, scene, &camera, pixels, tile);
+    } else {
+      ok = false;
+    }
+
+    /* Each new scene or camera starts a frame. */
+    if (ok && scene && has_camera && header.type != MESSAGE_TILE) {
+      raytracer_prepare_frame(scene, &camera);
+    }
+  }
+
+  free(pixels);
+  scene_destroy(scene);
+  raytracer_quit();
+  close(fd);
+}
+
+/* ------------------------------------------------------------------------
+ * Coordinator
+ * ------------------------------------------------------------------------ */
+
+Distributed *distributed_start(int workers_count, int worker_threads) {
+  Distributed *distributed = calloc(1, sizeof(Distributed));
+  if (!distributed) {
+    return NULL;
+  }
+
+  distributed->workers =
+      calloc((size_t)workers_count, sizeof(DistributedWorker));
+  distributed->pixels =
+      malloc(sizeof(uint32_t) * RENDER_TILE_SIZE * RENDER_TILE_SIZE);
+  if (!distributed->workers || !distributed->pixels) {
+    distributed_stop(distributed);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  for (int i = 0; i < workers_count; i++) {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+      int error = errno;
+      distributed_stop(distributed);
+      errno = error;
+      return NULL;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+      int error = errno;
+      close(sockets[0]);
+      close(sockets[1]);
+      distributed_stop(distributed);
+      errno = error;
+      return NULL;
+    }
+
+    if (pid == 0) {
+      /* Holding the other workers' sockets would keep them open after
+       * the coordinator exits. */
+      close(sockets[0]);
+      for (int j = 0; j < i; j++) {
+        close(distributed->workers[j].fd);
+      }
+      run_worker(sockets[1], worker_threads);
+      _exit(0);
+    }
+
+    close(sockets[1]);
+    DistributedWorker *worker = &distributed->workers[i];
+    worker->fd = sockets[0];
+    worker->pid = pid;
+    for (int slot = 0; slot < DISTRIBUTED_TILES_IN_FLIGHT; slot++) {
+      worker->tiles[slot] = -1;
+    }
+    distributed->workers_count++;
+    distributed->live_count++;
+  }
+
+  return distributed;
+}
+
+/* Kills the worker and returns its tiles to the queue. */
+static void fail_worker(Distributed *distributed, DistributedWorker *worker,
+                        int *pending, int *pending_count,
+                        DistributedStats *stats) {
+  for (int slot = 0; slot < DISTRIBUTED_TILES_IN_FLIGHT; slot++) {
+    if (worker->tiles[slot] >= 0) {
+      pending[(*pending_count)++] = worker->tiles[slot];
+      worker->tiles[slot] = -1;
+      if (stats) {
+        stats->reassigned_tiles++;
+      }
+    }
+  }
+  worker->tiles_count = 0;
+
+  kill(worker->pid, SIGKILL);
+  close(worker->fd);
+  worker->fd = -1;
+  distributed->live_count--;
+  if (stats) {
+    stats->failed_workers++;
+  }
+}
+
+bool distributed_send_scene(Distributed *distributed, const Scene *scene) {
+  SceneMessage message = {.spheres_count = scene->spheres_count,
+                          .lights_count = scene->lights_count,
+                          .background = scene->default_background_color,
+                          .light_cutoff = scene->light_cutoff,
+                          .shadows = scene->shadows};
+  size_t spheres_size = sizeof(Sphere) * (size_t)scene->spheres_count;
+  size_t lights_size = sizeof(Light) * (size_t)scene->lights_count;
+
+  for (int i = 0; i < distributed->workers_count; i++) {
+    DistributedWorker *worker = &distributed->workers[i];
+    if (worker->fd >= 0 &&
+        !(send_header(worker->fd, MESSAGE_SCENE,
+                      sizeof(message) + spheres_size + lights_size) &&
+          send_all(worker->fd, &message, sizeof(message)) &&
+          send_all(worker->fd, scene->spheres, spheres_size) &&
+          send_all(worker->fd, scene->lights, lights_size))) {
+      fail_worker(distributed, worker, NULL, NULL, NULL);
+    }
+  }
+  return distributed->live_count > 0;
+}
+
+static int find_tile(const DistributedWorker *worker, int tile) {
+  for (int slot = 0; slot < DISTRIBUTED_TILES_IN_FLIGHT; slot++) {
+    if (worker->tiles[slot] == tile) {
+      return slot;
+    }
+  }
+  return -1;
+}
+
+/* Receives one tile from the worker into the framebuffer. The whole
+ * message has to arrive within the worker's tile timeout, so a worker
+ * that stops partway through cannot stall the frame. */
+static bool receive_pixels(Distributed *distributed,
+                           DistributedWorker *worker, Camera *camera,
+                           uint32_t *framebuffer, DistributedStats *stats) {
+  double deadline_ms = worker->busy_since_ms + DISTRIBUTED_TILE_TIMEOUT_MS;
+  MessageHeader header;
+  PixelsMessage message;
+  if (!receive_before(worker->fd, &header, sizeof(header), deadline_ms) ||
+      header.type != MESSAGE_PIXELS || header.size < sizeof(message) ||
+      !receive_before(worker->fd, &message, sizeof(message), deadline_ms)) {
+    return false;
+  }
+
+  int slot = find_tile(worker, message.tile);
+  if (slot < 0) {
+    return false;
+  }
+
+  int x, y, width, height;
+  raytracer_tile_rect(camera, message.tile, &x, &y, &width, &height);
+  size_t pixels_size = sizeof(uint32_t) * (size_t)width * height;
+  if (message.x != x || message.y != y || message.width != width ||
+      message.height != height ||
+      header.size != sizeof(message) + pixels_size ||
+      !receive_before(worker->fd, distributed->pixels, pixels_size,
+                      deadline_ms)) {
+    return false;
+  }
+
+  int stride = (int)camera->width;
+  for (int row = 0; row < height; row++) {
+    memcpy(&framebuffer[(y + row) * stride + x],
+           &distributed->pixels[row * width],
+           sizeof(uint32_t) * (size_t)width);
+  }
+
+  worker->tiles[slot] = -1;
+  worker->tiles_count--;
+  raytracer_counters_add(&stats->counters, &message.counters);
+  return true;
+}
+
+/* Tops the worker up to DISTRIBUTED_TILES_IN_FLIGHT tiles. */
+static bool send_tiles(DistributedWorker *worker, int *pending,
+                       int *pending_count, double now) {
+  while (worker->tiles_count < DISTRIBUTED_TILES_IN_FLIGHT &&
+         *pending_count > 0) {
+    int32_t tile = pending[*pending_count - 1];
+    if (!send_header(worker->fd, MESSAGE_TILE, sizeof(tile)) ||
+        !send_all(worker->fd, &tile, sizeof(tile))) {
+      return false;
+    }
+
+    (*pending_count)--;
+    int slot = find_tile(worker, -1);
+    worker->tiles[slot] = tile;
+    if (worker->tiles_count++ == 0) {
+      worker->busy_since_ms = now;
+    }
+  }
+  return true;
+}
+
+void distributed_render(Distributed *distributed, Scene *scene,
+                        Camera *camera, uint32_t *framebuffer,
+                        DistributedStats *stats) {
+  int tiles_count = raytracer_tiles_count(camera);
+  *stats = (DistributedStats){.tiles_count = tiles_count};
+
+  int workers_count = distributed->workers_count;
+  int *pending = malloc(sizeof(int) * (size_t)tiles_count);
+  struct pollfd *fds = malloc(sizeof(struct pollfd) * (size_t)workers_count);
+  int *polled = malloc(sizeof(int) * (size_t)workers_count);
+  if (!pending || !fds || !polled) {
+    free(pending);
+    free(fds);
+    free(polled);
+    main_raytracer(scene, camera, framebuffer, false);
+    stats->local_tiles = tiles_count;
+    stats->counters = raytracer_frame_counters();
+    return;
+  }
+
+  /* Popped from the end, so tiles go out in order. */
+  int pending_count = tiles_count;
+  for (int i = 0; i < tiles_count; i++) {
+    pending[i] = tiles_count - 1 - i;
+  }
+
+  for (int i = 0; i < workers_count; i++) {
+    DistributedWorker *worker = &distributed->workers[i];
+    if (worker->fd >= 0 &&
+        !(send_header(worker->fd, MESSAGE_CAMERA, sizeof(Camera)) &&
+          send_all(worker->fd, camera, sizeof(Camera)))) {
+      fail_worker(distributed, worker, pending, &pending_count, stats);
+    }
+  }
+
+  int done = 0;
+  while (done < tiles_count && distributed->live_count > 0) {
+    double now = timer_now_ms();
+    int polled_count = 0;
+    int timeout = -1;
+
+    for (int i = 0; i < workers_count; i++) {
+      DistributedWorker *worker = &distributed->workers[i];
+      if (worker->fd < 0) {
+        continue;
+      }
+      if (!send_tiles(worker, pending, &pending_count, now)) {
+        fail_worker(distributed, worker, pending, &pending_count, stats);
+        continue;
+      }
+      if (worker->tiles_count == 0) {
+        continue;
+      }
+
+      int left = (int)(worker->busy_since_ms + DISTRIBUTED_TILE_TIMEOUT_MS -
+                       now);
+      left = left > 0 ? left : 0;
+      timeout = timeout < 0 || left < timeout ? left : timeout;
+      fds[polled_count] = (struct pollfd){.fd = worker->fd,
+                                          .events = POLLIN};
+      polled[polled_count++] = i;
+    }
+    if (polled_count == 0) {
+      continue;
+    }
+
+    if (poll(fds, (nfds_t)polled_count, timeout) < 0 && errno != EINTR) {
+      break;
+    }
+
+    now = timer_now_ms();
+    for (int i = 0; i < polled_count; i++) {
+      DistributedWorker *worker = &distributed->workers[polled[i]];
+      if (fds[i].revents) {
+        if (receive_pixels(distributed, worker, camera, framebuffer,
+                           stats)) {
+          done++;
+          worker->busy_since_ms = now;
+        } else {
+          fail_worker(distributed, worker, pending, &pending_count, stats);
+        }
+      } else if (now - worker->busy_since_ms >=
+                 DISTRIBUTED_TILE_TIMEOUT_MS) {
+        fail_worker(distributed, worker, pending, &pending_count, stats);
+      }
+    }
+  }
+
+  /* Without workers, what is left is traced here. */
+  if (done < tiles_count) {
+    for (int i = 0; i < workers_count; i++) {
+      DistributedWorker *worker = &distributed->workers[i];
+      if (worker->fd >= 0) {
+        fail_worker(distributed, worker, pending, &pending_count, stats);
+      }
+    }
+    for (int i = 0; i < pending_count; i++) {
+      raytracer_render_pass(scene, camera, framebuffer, 1, false,
+                            pending[i], 1);
+      RenderCounters counters = raytracer_frame_counters();
+      raytracer_counters_add(&stats->counters, &counters);
+    }
+    stats->local_tiles = pending_count;
+  }
+
+  free(pending);
+  free(fds);
+  free(polled);
+}
+
+void distributed_stop(Distributed *distributed) {
+  if (!distributed) {
+    return;
+  }
+
+  for (int i = 0; i < distributed->workers_count; i++) {
+    DistributedWorker *worker = &distributed->workers[i];
+    if (worker->fd >= 0) {
+      send_header(worker->fd, MESSAGE_QUIT, 0);
+      close(worker->fd);
+    }
+    waitpid(worker->pid, NULL, 0);
+  }
+
+  free(distributed->workers);
+  free(distributed->pixels);
+  free(distributed);
+}
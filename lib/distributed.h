@@ -0,0 +1,95 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "camera.h"
+#include "constants.h"
+#include "raytracer.h"
+#include "scene.h"
+
+/**
+ * @file distributed.h
+ * @brief Rendering a frame's tiles in worker processes.
+ *
+ * The coordinator forks worker processes, each connected to it by a Unix
+ * stream socket. It sends each worker the scene's spheres, lights and
+ * settings once. Workers build their own BVH and light tree from them,
+ * which gives the same trees as the coordinator's. For each frame the
+ * coordinator sends the camera, then hands out RENDER_TILE_SIZE tiles on
+ * demand, DISTRIBUTED_TILES_IN_FLIGHT per worker, and copies the pixels
+ * each worker returns into the framebuffer. A worker splits each tile into
+ * strips of DISTRIBUTED_STRIP_WIDTH columns over its render threads. Workers
+ * run the same tile code as main_raytracer, so the frame is identical to a
+ * local render.
+ *
+ * A worker that closes its socket, fails a send or does not return a whole
+ * tile within DISTRIBUTED_TILE_TIMEOUT_MS while it holds some is killed,
+ * and its tiles go back to the queue for the others. Once every worker has
+ * failed, the coordinator renders the remaining tiles itself.
+ *
+ * Workers are forked, so start them before the render thread pool or any
+ * other thread exists.
+ */
+
+typedef struct {
+  int fd;         /**< -1 once the worker has failed */
+  pid_t pid;
+  int tiles[DISTRIBUTED_TILES_IN_FLIGHT]; /**< -1 for a free slot */
+  int tiles_count;
+  double busy_since_ms; /**< Last tile received, or first one sent */
+} DistributedWorker;
+
+typedef struct {
+  DistributedWorker *workers;
+  int workers_count;
+  int live_count;
+  uint32_t *pixels; /**< One tile, as received */
+} Distributed;
+
+/**
+ * @struct DistributedStats
+ * @brief One distributed_render call.
+ */
+typedef struct {
+  int tiles_count;
+  int reassigned_tiles; /**< Sent again after their worker failed */
+  int failed_workers;
+  int local_tiles; /**< Rendered by the coordinator */
+  RenderCounters counters; /**< Summed over the tiles */
+} DistributedStats;
+
+/**
+ * @brief Fork workers_count workers with worker_threads render threads
+ *        each (0 = every CPU).
+ *
+ * @return Coordinator, or NULL with errno set
+ */
+Distributed *distributed_start(int workers_count, int worker_threads);
+
+/**
+ * @brief Send the scene to every live worker.
+ *
+ * @return false once no worker is left
+ */
+bool distributed_send_scene(Distributed *distributed, const Scene *scene);
+
+/**
+ * @brief Render camera width x height into framebuffer.
+ *
+ * scene must be the one last sent; the coordinator traces with it when
+ * no worker is left. As with main_raytracer, the first row and column are
+ * not written.
+ */
+void distributed_render(Distributed *distributed, Scene *scene,
+                        Camera *camera, uint32_t *framebuffer,
+                        DistributedStats *stats);
+
+/**
+ * @brief Stop and reap the workers.
+ */
+void distributed_stop(Distributed *distributed);
+
+#endif /* DISTRIBUTED_H */
@@ -0,0 +1,189 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "constants.h"
+#include "dynamic_resolution.h"
+#include "timer.h"
+
+typedef struct {
+  DynamicResolution *dynamic;
+  uint32_t *framebuffer;
+} UpscaleJob;
+
+DynamicResolution *dynamic_resolution_create(int width, int height,
+                                             double target_ms) {
+  DynamicResolution *dynamic = calloc(1, sizeof(DynamicResolution));
+  if (!dynamic) {
+    return NULL;
+  }
+
+  dynamic->width = width;
+  dynamic->height = height;
+  dynamic->target_ms = target_ms;
+  dynamic->scale = DYNAMIC_RESOLUTION_MIN_SCALE;
+  dynamic->scaled = malloc(sizeof(uint32_t) * (size_t)width * height);
+  dynamic->widened = malloc(sizeof(uint32_t) * (size_t)width * height);
+  dynamic->source_x = malloc(sizeof(int) * (size_t)width);
+  if (!dynamic->scaled || !dynamic->widened || !dynamic->source_x) {
+    dynamic_resolution_destroy(dynamic);
+    return NULL;
+  }
+
+  return dynamic;
+}
+
+void dynamic_resolution_destroy(DynamicResolution *dynamic) {
+  if (!dynamic) {
+    return;
+  }
+
+  free(dynamic->scaled);
+  free(dynamic->widened);
+  free(dynamic->source_x);
+  free(dynamic);
+}
+
+/* Position in the scaled image, in 1/256 pixels, of the point pixel i of
+ * a full size row or column shows. Both images put canvas 0 at half their
+ * size and span the same viewport, so canvas coordinates scale with the
+ * image size. Clamped to the traced pixels, which skip index 0. */
+static int source_position(int i, int size, int scaled_size) {
+  int64_t numerator = ((int64_t)(scaled_size / 2) * size -
+                       (int64_t)(size / 2 - i) * scaled_size) *
+                      256;
+  int64_t position = numerator > 0 ? numerator / size : 0;
+  if (position < 256) {
+    return 256;
+  }
+  if (position > 256 * (int64_t)(scaled_size - 1)) {
+    return 256 * (scaled_size - 1);
+  }
+  return (int)position;
+}
+
+/* weight / 256 of the way from a to b, red and blue in one multiply. */
+static inline uint32_t blend(uint32_t a, uint32_t b, uint32_t weight) {
+  uint32_t red_blue =
+      ((a & 0xFF00FF) * (256 - weight) + (b & 0xFF00FF) * weight) >> 8;
+  uint32_t green =
+      ((a & 0x00FF00) * (256 - weight) + (b & 0x00FF00) * weight) >> 8;
+  return (a & 0xFF000000) | (red_blue & 0xFF00FF) | (green & 0x00FF00);
+}
+
+/* Rows [begin, end) of size rows, without the first one, which keeps
+ * the background as in a full frame. */
+static void band_rows(int band, int size, int *begin, int *end) {
+  *begin = band * DYNAMIC_RESOLUTION_BAND_HEIGHT;
+  *end = *begin + DYNAMIC_RESOLUTION_BAND_HEIGHT;
+  if (*begin < 1) {
+    *begin = 1;
+  }
+  if (*end > size) {
+    *end = size;
+  }
+}
+
+/* Bilinear upscaling is separable: traced rows are first widened to the
+ * full width, then every output row blends the two widened rows around
+ * it, so each output pixel costs about one blend instead of three. */
+static void widen_band(void *context, int band, RenderCounters *counters) {
+  (void)counters;
+  UpscaleJob *job = context;
+  DynamicResolution *dynamic = job->dynamic;
+  int width = dynamic->width;
+
+  int y_begin, y_end;
+  band_rows(band, dynamic->scaled_height, &y_begin, &y_end);
+  for (int y = y_begin; y < y_end; y++) {
+    const uint32_t *source =
+        &dynamic->scaled[(size_t)y * dynamic->scaled_width];
+    uint32_t *row = &dynamic->widened[(size_t)y * width];
+    for (int x = 1; x < width; x++) {
+      int source_x = dynamic->source_x[x];
+      uint32_t weight = (uint32_t)source_x & 0xFF;
+      int left = source_x >> 8;
+      row[x] = blend(source[left], source[weight ? left + 1 : left], weight);
+    }
+  }
+}
+
+static void upscale_band(void *context, int band, RenderCounters *counters) {
+  (void)counters;
+  UpscaleJob *job = context;
+  const DynamicResolution *dynamic = job->dynamic;
+  int width = dynamic->width;
+
+  int y_begin, y_end;
+  band_rows(band, dynamic->height, &y_begin, &y_end);
+  for (int y = y_begin; y < y_end; y++) {
+    int source_y =
+        source_position(y, dynamic->height, dynamic->scaled_height);
+    uint32_t weight = (uint32_t)source_y & 0xFF;
+    const uint32_t *top = &dynamic->widened[(size_t)(source_y >> 8) * width];
+    const uint32_t *bottom = weight ? top + width : top;
+    uint32_t *row = &job->framebuffer[(size_t)y * width];
+    for (int x = 1; x < width; x++) {
+      row[x] = blend(top[x], bottom[x], weight);
+    }
+  }
+}
+
+/* The frame time at scale s is about full_frame_ms * s^2, tracing
+ * dominating; the smoothed estimate settles where frames take target_ms
+ * even though upscaling does not shrink with the scale. */
+static void govern(DynamicResolution *dynamic) {
+  double area = (double)dynamic->scale * dynamic->scale;
+  double full_frame_ms = dynamic->frame_ms / area;
+  dynamic->full_frame_ms =
+      dynamic->full_frame_ms > 0.0
+          ? dynamic->full_frame_ms + DYNAMIC_RESOLUTION_SMOOTHING *
+                                         (full_frame_ms -
+                                          dynamic->full_frame_ms)
+          : full_frame_ms;
+
+  float scale = dynamic->full_frame_ms > 0.0
+                    ? (float)sqrt(dynamic->target_ms / dynamic->full_frame_ms)
+                    : 1.0f;
+  if (scale > dynamic->scale * DYNAMIC_RESOLUTION_MAX_GROWTH) {
+    scale = dynamic->scale * DYNAMIC_RESOLUTION_MAX_GROWTH;
+  }
+  if (scale < DYNAMIC_RESOLUTION_MIN_SCALE) {
+    scale = DYNAMIC_RESOLUTION_MIN_SCALE;
+  }
+  if (scale > 1.0f) {
+    scale = 1.0f;
+  }
+  dynamic->scale = scale;
+}
+
+void dynamic_resolution_render(DynamicResolution *dynamic, Scene *scene,
+                               Camera *camera, uint32_t *framebuffer) {
+  double start = timer_now_ms();
+
+  int scaled_width = (int)lroundf(dynamic->width * dynamic->scale);
+  int scaled_height = (int)lroundf(dynamic->height * dynamic->scale);
+  dynamic->scaled_width = scaled_width > 2 ? scaled_width : 2;
+  dynamic->scaled_height = scaled_height > 2 ? scaled_height : 2;
+
+  Camera scaled_camera = *camera;
+  scaled_camera.width = dynamic->scaled_width;
+  scaled_camera.height = dynamic->scaled_height;
+  main_raytracer(scene, &scaled_camera, dynamic->scaled, false);
+  dynamic->counters = raytracer_frame_counters();
+
+  for (int x = 0; x < dynamic->width; x++) {
+    dynamic->source_x[x] =
+        source_position(x, dynamic->width, dynamic->scaled_width);
+  }
+  UpscaleJob job = {.dynamic = dynamic, .framebuffer = framebuffer};
+  raytracer_run((dynamic->scaled_height + DYNAMIC_RESOLUTION_BAND_HEIGHT - 1) /
+                    DYNAMIC_RESOLUTION_BAND_HEIGHT,
+                widen_band, &job);
+  raytracer_run((dynamic->height + DYNAMIC_RESOLUTION_BAND_HEIGHT - 1) /
+                    DYNAMIC_RESOLUTION_BAND_HEIGHT,
+                upscale_band, &job);
+
+  dynamic->frame_ms = timer_now_ms() - start;
+  govern(dynamic);
+}
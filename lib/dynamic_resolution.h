@@ -0,0 +1,65 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <stdint.h>
+
+#include "camera.h"
+#include "raytracer.h"
+#include "scene.h"
+
+/**
+ * @file dynamic_resolution.h
+ * @brief Frames during camera motion traced at whatever resolution fits a
+ *        frame time target.
+ *
+ * Each frame is traced at a fraction of the full width and height and
+ * upscaled bilinearly into the full size framebuffer. After every frame a
+ * governor divides its time by the square of its scale, which estimates
+ * the time of a full resolution frame, smooths that estimate over recent
+ * frames and picks the scale whose frame would take the target time.
+ * Scales are fractional, so heavy scenes and slow machines drop only as
+ * far below full resolution as they need to, and fast ones stay at it.
+ * The scale falls as soon as the estimate rises but grows by at most
+ * DYNAMIC_RESOLUTION_MAX_GROWTH per frame, so one cheap frame does not
+ * cause a slow one.
+ */
+
+typedef struct {
+  int width; /**< Full resolution */
+  int height;
+  double target_ms;
+  float scale;          /**< Of width and height, for the next frame */
+  double full_frame_ms; /**< Smoothed estimate at scale 1, 0 until known */
+  uint32_t *scaled;     /**< Last frame as traced */
+  uint32_t *widened;    /**< Its rows upscaled to the full width */
+  int scaled_width;     /**< Of the last frame */
+  int scaled_height;
+  int *source_x;           /**< Per column: scaled position, 1/256 pixels */
+  double frame_ms;         /**< Last frame, tracing and upscaling */
+  RenderCounters counters; /**< Of the last frame's tracing */
+} DynamicResolution;
+
+/**
+ * @brief Allocate a governor for width x height frames.
+ *
+ * The first frame is traced at DYNAMIC_RESOLUTION_MIN_SCALE, so it is
+ * never the slow one.
+ *
+ * @return Governor, or NULL on allocation failure
+ */
+DynamicResolution *dynamic_resolution_create(int width, int height,
+                                             double target_ms);
+
+void dynamic_resolution_destroy(DynamicResolution *dynamic);
+
+/**
+ * @brief Render a frame at the current scale into framebuffer and adjust
+ *        the scale by its time.
+ *
+ * Writes every pixel main_raytracer writes. The camera image must have
+ * the governor's full size; at scale 1 the frame equals main_raytracer's.
+ */
+void dynamic_resolution_render(DynamicResolution *dynamic, Scene *scene,
+                               Camera *camera, uint32_t *framebuffer);
+
+#endif /* DYNAMIC_RESOLUTION_H */
@@ -0,0 +1,357 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "foveated.h"
+#include "raytracer.h"
+#include "vector_color.h"
+
+#define FOVEATED_GRID_SIZE (RENDER_TILE_SIZE + 1)
+#define FOVEATED_MAX_LEVEL 2
+#define FOVEATED_CELL_SIZE (1 << FOVEATED_MAX_LEVEL)
+
+typedef struct {
+  Scene *scene;
+  Camera *camera;
+  uint32_t *framebuffer;
+  const FoveatedConfig *config;
+  int width;
+  int height;
+  int tiles_x;
+  float center_x; /* Pixels */
+  float center_y;
+  float radius_unit; /* Pixels per unit of the config radii */
+  int tiles_y;
+
+  /* Samples on tile edges, which up to four tiles share: edge_rows holds
+   * the grid rows at every multiple of RENDER_TILE_SIZE from y = 1, each
+   * edge_row_length long, and edge_columns the grid columns likewise. */
+  VectorColor *edge_rows;
+  VectorColor *edge_columns;
+  int edge_row_length;
+  int edge_column_length;
+
+  /* Per tile, the work of tracing its edge samples, added to the frame's
+   * counters with the rest of the tile. */
+  RenderCounters *edge_counters;
+} FoveatedJob;
+
+/* Sample grid of one tile: its pixels plus the row and column of corners
+ * shared with the next tiles. needed is offset by a cell so it also holds
+ * the marks of the cells left of and above the tile. */
+typedef struct {
+  FoveatedJob *job;
+  int column;
+  int row;
+  int x_begin;
+  int y_begin;
+  int rows;
+  int columns;
+  bool needed[FOVEATED_GRID_SIZE + FOVEATED_CELL_SIZE]
+             [FOVEATED_GRID_SIZE + FOVEATED_CELL_SIZE];
+  VectorColor colors[FOVEATED_GRID_SIZE][FOVEATED_GRID_SIZE];
+} FoveatedTile;
+
+FoveatedConfig foveated_default_config(void) {
+  return (FoveatedConfig){.center_x = 0.5f,
+                          .center_y = 0.5f,
+                          .inner_radius = FOVEATED_INNER_RADIUS,
+                          .outer_radius = FOVEATED_OUTER_RADIUS,
+                          .blend_width = FOVEATED_BLEND_WIDTH};
+}
+
+static VectorColor lerp_color(VectorColor a, VectorColor b, float t) {
+  return vector_color_init(a.red + (b.red - a.red) * t,
+                           a.green + (b.green - a.green) * t,
+                           a.blue + (b.blue - a.blue) * t);
+}
+
+/* Pixel (i, j) interpolated from the samples every step pixels. */
+static VectorColor reconstruct(const FoveatedTile *tile, int i, int j,
+                               int step) {
+  int i0 = i & -step;
+  int j0 = j & -step;
+  float u = (float)(i - i0) / step;
+  float v = (float)(j - j0) / step;
+
+  VectorColor top = tile->colors[j0][i0];
+  if (u > 0.0f) {
+    top = lerp_color(top, tile->colors[j0][i0 + step], u);
+  }
+  if (v == 0.0f) {
+    return top;
+  }
+
+  VectorColor bottom = tile->colors[j0 + step][i0];
+  if (u > 0.0f) {
+    bottom = lerp_color(bottom, tile->colors[j0 + step][i0 + step], u);
+  }
+  return lerp_color(top, bottom, v);
+}
+
+static float clamp_unit(float value) {
+  return value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value;
+}
+
+/* 0 traces the pixel, 1 and 2 interpolate it from every second and every
+ * fourth pixel, and fractions mix the two levels around them. */
+static float point_level(const FoveatedJob *job, float x, float y) {
+  const FoveatedConfig *config = job->config;
+  float dx = x - job->center_x;
+  float dy = y - job->center_y;
+  float radius = sqrtf(dx * dx + dy * dy) / job->radius_unit;
+  return clamp_unit((radius - config->inner_radius) / config->blend_width) +
+         clamp_unit((radius - config->outer_radius) / config->blend_width);
+}
+
+/* Of the cell's pixels along one axis from first, the one nearest to or
+ * farthest from center. */
+static float cell_extreme(float center, float first, bool farthest) {
+  float last = first + FOVEATED_CELL_SIZE - 1;
+  if (farthest) {
+    return 2.0f * center > first + last ? first : last;
+  }
+  return center < first ? first : center > last ? last : center;
+}
+
+/* Levels grow with the distance from the centre, so a cell's lowest level
+ * is at its point nearest the centre and its highest at its farthest. */
+static float cell_level(const FoveatedJob *job, float x, float y,
+                        bool farthest) {
+  return point_level(job, cell_extreme(job->center_x, x, farthest),
+                     cell_extreme(job->center_y, y, farthest));
+}
+
+/* Every pixel of a cell can be reconstructed from the cell's corners and
+ * the grid at the step of its lowest level. */
+static void mark_cell(FoveatedTile *tile, int i, int j) {
+  const FoveatedJob *job = tile->job;
+  float x = tile->x_begin + i;
+  float y = tile->y_begin + j;
+  int step = 1 << (int)cell_level(job, x, y, false);
+
+  for (int dj = 0; dj <= FOVEATED_CELL_SIZE; dj += step) {
+    for (int di = 0; di <= FOVEATED_CELL_SIZE; di += step) {
+      tile->needed[FOVEATED_CELL_SIZE + j + dj][FOVEATED_CELL_SIZE + i + di] =
+          true;
+    }
+  }
+}
+
+static bool sample_needed(const FoveatedTile *tile, int i, int j) {
+  return tile->needed[FOVEATED_CELL_SIZE + j][FOVEATED_CELL_SIZE + i];
+}
+
+/* Marks the samples of the tile's cells and of the neighbouring cells
+ * left of and above it, which share its first column and row. */
+static void mark_samples(FoveatedTile *tile) {
+  int i_begin = tile->column > 0 ? -FOVEATED_CELL_SIZE : 0;
+  int j_begin = tile->row > 0 ? -FOVEATED_CELL_SIZE : 0;
+  for (int j = j_begin; j < tile->rows; j += FOVEATED_CELL_SIZE) {
+    for (int i = i_begin; i < tile->columns; i += FOVEATED_CELL_SIZE) {
+      mark_cell(tile, i, j);
+    }
+  }
+}
+
+static bool on_edge(int i, int j) {
+  return i == 0 || j == 0 || i == RENDER_TILE_SIZE || j == RENDER_TILE_SIZE;
+}
+
+/* Edge samples a tile traces for all the tiles sharing them: its first
+ * row and column, and its last ones at the bottom and right of the frame,
+ * with each corner traced once. */
+static bool owns_edge_sample(const FoveatedTile *tile, int i, int j) {
+  bool last_column = tile->column == tile->job->tiles_x - 1;
+  bool last_row = tile->row == tile->job->tiles_y - 1;
+  if (j == 0 || (j == RENDER_TILE_SIZE && last_row)) {
+    return i < RENDER_TILE_SIZE || last_column;
+  }
+  return i == 0 || (i == RENDER_TILE_SIZE && last_column);
+}
+
+/* Where the colour of on-edge sample (i, j) is kept. */
+static VectorColor *edge_sample(const FoveatedTile *tile, int i, int j) {
+  const FoveatedJob *job = tile->job;
+  if (j == 0 || j == RENDER_TILE_SIZE) {
+    int row = tile->row + j / RENDER_TILE_SIZE;
+    return &job->edge_rows[(size_t)row * job->edge_row_length +
+                           tile->x_begin - 1 + i];
+  }
+  int column = tile->column + i / RENDER_TILE_SIZE;
+  return &job->edge_columns[(size_t)column * job->edge_column_length +
+                            tile->y_begin - 1 + j];
+}
+
+static bool traced_in_pass(const FoveatedTile *tile, int i, int j,
+                           bool edges) {
+  return edges ? on_edge(i, j) && owns_edge_sample(tile, i, j)
+               : !on_edge(i, j);
+}
+
+/* Needed samples of one pass, the owned edge samples or the tile's
+ * interior, are traced a grid column at a time, so each packet holds
+ * vertically neighbouring rays as in a full frame. */
+static void trace_samples(FoveatedTile *tile, bool edges,
+                          RenderCounters *counters) {
+  FoveatedJob *job = tile->job;
+  ShadowCache shadows;
+  raytracer_shadow_cache_init(&shadows);
+  Vector3D directions[FOVEATED_GRID_SIZE];
+  RayHit hits[FOVEATED_GRID_SIZE];
+  VectorColor colors[FOVEATED_GRID_SIZE];
+  int rows[FOVEATED_GRID_SIZE];
+  int xs[FOVEATED_GRID_SIZE];
+  int ys[FOVEATED_GRID_SIZE];
+
+  for (int i = 0; i < FOVEATED_GRID_SIZE; i++) {
+    int count = 0;
+    for (int j = 0; j < FOVEATED_GRID_SIZE; j++) {
+      if (sample_needed(tile, i, j) && traced_in_pass(tile, i, j, edges)) {
+        xs[count] = tile->x_begin + i;
+        ys[count] = tile->y_begin + j;
+        rows[count++] = j;
+      }
+    }
+
+    raytracer_trace_pixels(job->scene, job->camera, xs, ys, count,
+                           directions, hits, counters);
+    raytracer_shade_pixels(job->scene, job->camera, directions, hits, count,
+                           colors, &shadows, counters);
+    for (int k = 0; k < count; k++) {
+      if (edges) {
+        *edge_sample(tile, i, rows[k]) = colors[k];
+      } else {
+        tile->colors[rows[k]][i] = colors[k];
+      }
+    }
+  }
+}
+
+/* Tiles cover the screen pixels from (1, 1), the ones main_raytracer
+ * writes, and are a multiple of every step, so all tiles share one
+ * sample grid. */
+static void tile_init(FoveatedTile *tile, FoveatedJob *job, int task_index) {
+  tile->job = job;
+  tile->column = task_index % job->tiles_x;
+  tile->row = task_index / job->tiles_x;
+  tile->x_begin = 1 + tile->column * RENDER_TILE_SIZE;
+  tile->y_begin = 1 + tile->row * RENDER_TILE_SIZE;
+  tile->rows = job->height - tile->y_begin < RENDER_TILE_SIZE
+                   ? job->height - tile->y_begin
+                   : RENDER_TILE_SIZE;
+  tile->columns = job->width - tile->x_begin < RENDER_TILE_SIZE
+                      ? job->width - tile->x_begin
+                      : RENDER_TILE_SIZE;
+  memset(tile->needed, 0, sizeof(tile->needed));
+  mark_samples(tile);
+}
+
+static void trace_foveated_edges(void *context, int task_index,
+                                 RenderCounters *counters) {
+  (void)counters;
+  FoveatedJob *job = context;
+  FoveatedTile tile;
+  tile_init(&tile, job, task_index);
+  job->edge_counters[task_index] = (RenderCounters){0};
+  trace_samples(&tile, true, &job->edge_counters[task_index]);
+}
+
+/* Cells whose nearest and farthest pixels share a level, such as all of
+ * the fovea and the periphery, skip computing it per pixel. */
+static void render_cell(const FoveatedTile *tile, int i_begin, int j_begin) {
+  const FoveatedJob *job = tile->job;
+  float x_begin = tile->x_begin + i_begin;
+  float y_begin = tile->y_begin + j_begin;
+  float lowest = cell_level(job, x_begin, y_begin, false);
+  bool uniform = lowest == cell_level(job, x_begin, y_begin, true);
+  int j_end = j_begin + FOVEATED_CELL_SIZE < tile->rows
+                  ? j_begin + FOVEATED_CELL_SIZE
+                  : tile->rows;
+  int i_end = i_begin + FOVEATED_CELL_SIZE < tile->columns
+                  ? i_begin + FOVEATED_CELL_SIZE
+                  : tile->columns;
+
+  for (int j = j_begin; j < j_end; j++) {
+    int y = tile->y_begin + j;
+    uint32_t *row = &job->framebuffer[(size_t)y * job->width];
+    for (int i = i_begin; i < i_end; i++) {
+      int x = tile->x_begin + i;
+      float level = uniform ? lowest : point_level(job, x, y);
+      int base = (int)level;
+      float blend = level - base;
+      VectorColor color = reconstruct(tile, i, j, 1 << base);
+      if (blend > 0.0f && base < FOVEATED_MAX_LEVEL) {
+        color = lerp_color(color, reconstruct(tile, i, j, 2 << base), blend);
+      }
+      row[x] = vector_color_to_rgb_color(color);
+    }
+  }
+}
+
+static void render_foveated_tile(void *context, int task_index,
+                                 RenderCounters *counters) {
+  FoveatedJob *job = context;
+  FoveatedTile tile;
+  tile_init(&tile, job, task_index);
+  raytracer_counters_add(counters, &job->edge_counters[task_index]);
+  trace_samples(&tile, false, counters);
+  for (int j = 0; j < FOVEATED_GRID_SIZE; j++) {
+    for (int i = 0; i < FOVEATED_GRID_SIZE; i++) {
+      if (on_edge(i, j) && sample_needed(&tile, i, j)) {
+        tile.colors[j][i] = *edge_sample(&tile, i, j);
+      }
+    }
+  }
+
+  for (int j = 0; j < tile.rows; j += FOVEATED_CELL_SIZE) {
+    for (int i = 0; i < tile.columns; i += FOVEATED_CELL_SIZE) {
+      render_cell(&tile, i, j);
+    }
+  }
+}
+
+void foveated_render(Scene *scene, Camera *camera, uint32_t *framebuffer,
+                     const FoveatedConfig *config) {
+  int width = (int)camera->width;
+  int height = (int)camera->height;
+  int tiles_x = (width - 1 + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  int tiles_y = (height - 1 + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+
+  FoveatedJob job = {
+      .scene = scene,
+      .camera = camera,
+      .framebuffer = framebuffer,
+      .config = config,
+      .width = width,
+      .height = height,
+      .tiles_x = tiles_x,
+      .center_x = config->center_x * width,
+      .center_y = config->center_y * height,
+      .radius_unit = 0.5f * sqrtf((float)width * width +
+                                  (float)height * height),
+      .tiles_y = tiles_y,
+      .edge_row_length = tiles_x * RENDER_TILE_SIZE + 1,
+      .edge_column_length = tiles_y * RENDER_TILE_SIZE + 1};
+
+  job.edge_rows = malloc(sizeof(VectorColor) * (size_t)(tiles_y + 1) *
+                         (size_t)job.edge_row_length);
+  job.edge_columns = malloc(sizeof(VectorColor) * (size_t)(tiles_x + 1) *
+                            (size_t)job.edge_column_length);
+  job.edge_counters =
+      malloc(sizeof(RenderCounters) * (size_t)tiles_x * (size_t)tiles_y);
+  if (job.edge_rows && job.edge_columns && job.edge_counters) {
+    /* Edge samples first, so every tile can read the ones it shares. */
+    raytracer_prepare_frame(scene, camera);
+    raytracer_run(tiles_x * tiles_y, trace_foveated_edges, &job);
+    raytracer_run(tiles_x * tiles_y, render_foveated_tile, &job);
+  } else {
+    main_raytracer(scene, camera, framebuffer, false);
+  }
+  free(job.edge_rows);
+  free(job.edge_columns);
+  free(job.edge_counters);
+}
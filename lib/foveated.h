@@ -0,0 +1,49 @@
+#ifndef FOVEATED_H
+#define FOVEATED_H
+
+#include <stdint.h>
+
+#include "camera.h"
+#include "scene.h"
+
+/**
+ * @file foveated.h
+ * @brief Variable-rate rendering around a point of attention.
+ *
+ * Pixels within inner_radius of the centre are traced one by one. Beyond
+ * it only every second pixel in x and y is traced, and beyond
+ * outer_radius every fourth, with the pixels between filled by bilinear
+ * interpolation. Rates do not switch abruptly: over blend_width past
+ * each radius a pixel is a mix of the two rates, weighted by how far
+ * into the band it lies, so sharpness falls off smoothly. The sparser
+ * sample grids are subsets of the denser ones, which keeps the blend free
+ * of seams. Every rate is decided per pixel within one frame.
+ *
+ * Radii are fractions of half the image diagonal, so the same regions
+ * cover the same share of the screen at any resolution.
+ */
+
+typedef struct {
+  float center_x;     /**< Fraction of the width, 0.5 for the middle */
+  float center_y;     /**< Fraction of the height */
+  float inner_radius; /**< Full rate inside */
+  float outer_radius; /**< Half rate inside, quarter rate beyond */
+  float blend_width;  /**< Rates mix over this distance past each radius */
+} FoveatedConfig;
+
+/**
+ * @brief Centred regions with the FOVEATED_* radii from constants.h.
+ */
+FoveatedConfig foveated_default_config(void);
+
+/**
+ * @brief Render the pixels main_raytracer writes, at rates falling off
+ *        away from the centre.
+ *
+ * Pixels traced at full rate get exactly their full resolution colour.
+ * raytracer_frame_counters afterwards gives the rays traced.
+ */
+void foveated_render(Scene *scene, Camera *camera, uint32_t *framebuffer,
+                     const FoveatedConfig *config);
+
+#endif /* FOVEATED_H */
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame_stats.h"
+
+static bool has_suffix(const char *path, const char *suffix) {
+  size_t length = strlen(path);
+  size_t suffix_length = strlen(suffix);
+  return length >= suffix_length &&
+         strcmp(path + length - suffix_length, suffix) == 0;
+}
+
+int frame_stats_format(const FrameStats *stats, char *buffer, size_t size) {
+  const RenderCounters *counters = &stats->counters;
+  double fps = stats->frame_ms > 0 ? 1000.0 / stats->frame_ms : 0.0;
+
+  return snprintf(
+      buffer, size,
+      "frame %llu  %.2f ms  %.1f fps\n"
+      "trace %.2f  clear %.2f  upload %.2f  present %.2f ms\n"
+      "rays %llu  hits %llu  shadow %llu\n"
+      "sphere tests %llu  lighting %llu",
+      (unsigned long long)stats->frame, stats->frame_ms, fps,
+      stats->trace_ms, stats->clear_ms, stats->upload_ms, stats->present_ms,
+      (unsigned long long)counters->primary_rays,
+      (unsigned long long)counters->hits,
+      (unsigned long long)counters->shadow_rays,
+      (unsigned long long)counters->sphere_tests,
+      (unsigned long long)counters->lighting_evaluations);
+}
+
+FrameLog *frame_log_open(const char *path) {
+  FrameLog *log = malloc(sizeof(FrameLog));
+  if (!log) {
+    return NULL;
+  }
+
+  log->file = fopen(path, "w");
+  if (!log->file) {
+    free(log);
+    return NULL;
+  }
+
+  log->json = has_suffix(path, ".json") || has_suffix(path, ".jsonl");
+  if (!log->json) {
+    fprintf(log->file,
+            "frame,frame_ms,trace_ms,clear_ms,upload_ms,present_ms,"
+            "primary_rays,hits,shadow_rays,sphere_tests,"
+            "lighting_evaluations\n");
+  }
+  return log;
+}
+
+bool frame_log_write(FrameLog *log, const FrameStats *stats) {
+  const RenderCounters *counters = &stats->counters;
+
+  return fprintf(
+             log->file,
+             log->json
+                 ? "{\"frame\": %llu, \"frame_ms\": %.4f, \"trace_ms\": %.4f, "
+                   "\"clear_ms\": %.4f, \"upload_ms\": %.4f, "
+                   "\"present_ms\": %.4f, \"primary_rays\": %llu, "
+                   "\"hits\": %llu, \"shadow_rays\": %llu, "
+                   "\"sphere_tests\": %llu, \"lighting_evaluations\": %llu}\n"
+                 : "%llu,%.4f,%.4f,%.4f,%.4f,%.4f,%llu,%llu,%llu,%llu,%llu\n",
+             (unsigned long long)stats->frame, stats->frame_ms,
+             stats->trace_ms, stats->clear_ms, stats->upload_ms,
+             stats->present_ms, (unsigned long long)counters->primary_rays,
+             (unsigned long long)counters->hits,
+             (unsigned long long)counters->shadow_rays,
+             (unsigned long long)counters->sphere_tests,
+             (unsigned long long)counters->lighting_evaluations) > 0;
+}
+
+void frame_log_close(FrameLog *log) {
+  if (!log) {
+    return;
+  }
+
+  fclose(log->file);
+  free(log);
+}
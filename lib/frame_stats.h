@@ -0,0 +1,59 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "raytracer.h"
+
+/**
+ * @file frame_stats.h
+ * @brief Per-frame timings and render counters, as overlay text or a log.
+ *
+ * A log is CSV with a header row, or one JSON object per line when the
+ * path ends in ".json" or ".jsonl".
+ */
+
+/**
+ * @struct FrameStats
+ * @brief One displayed frame. Stage times are in milliseconds.
+ */
+typedef struct {
+  uint64_t frame;
+  double frame_ms;   /**< Time since the previous frame started */
+  double trace_ms;   /**< Render thread time since the previous frame */
+  double clear_ms;   /**< Clearing the render target */
+  double upload_ms;  /**< Framebuffer to texture; 0 if nothing changed */
+  double present_ms; /**< Drawing the texture and overlay, presenting */
+  RenderCounters counters; /**< Every render pass of the frame */
+} FrameStats;
+
+typedef struct {
+  FILE *file;
+  bool json;
+} FrameLog;
+
+/**
+ * @brief Format stats as a few lines of overlay text.
+ *
+ * @return Length the full text would have, as snprintf
+ */
+int frame_stats_format(const FrameStats *stats, char *buffer, size_t size);
+
+/**
+ * @brief Create a log file, writing the CSV header if needed.
+ *
+ * @return Log, or NULL with errno set
+ */
+FrameLog *frame_log_open(const char *path);
+
+/**
+ * @return false with errno set when the line cannot be written
+ */
+bool frame_log_write(FrameLog *log, const FrameStats *stats);
+
+void frame_log_close(FrameLog *log);
+
+#endif /* FRAME_STATS_H */
@@ -0,0 +1,80 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hdr.h"
+#include "vector_batch.h"
+
+static const char *tonemap_names[HDR_TONEMAPS_COUNT] = {"clamp",
+                                                        "reinhard"};
+
+HdrImage *hdr_image_create(int width, int height) {
+  HdrImage *image = calloc(1, sizeof(HdrImage));
+  if (!image) {
+    return NULL;
+  }
+
+  size_t pixel_count = (size_t)width * height;
+  image->width = width;
+  image->height = height;
+  image->red = malloc(sizeof(float) * pixel_count);
+  image->green = malloc(sizeof(float) * pixel_count);
+  image->blue = malloc(sizeof(float) * pixel_count);
+  if (!image->red || !image->green || !image->blue) {
+    hdr_image_destroy(image);
+    return NULL;
+  }
+
+  return image;
+}
+
+void hdr_image_destroy(HdrImage *image) {
+  if (!image) {
+    return;
+  }
+
+  free(image->red);
+  free(image->green);
+  free(image->blue);
+  free(image);
+}
+
+void hdr_image_fill(HdrImage *image, VectorColor color) {
+  size_t pixel_count = (size_t)image->width * image->height;
+  for (size_t i = 0; i < pixel_count; i++) {
+    hdr_image_set(image, i, color);
+  }
+}
+
+bool hdr_tonemap_parse(const char *name, HdrTonemap *tonemap) {
+  for (int i = 0; i < HDR_TONEMAPS_COUNT; i++) {
+    if (strcmp(name, tonemap_names[i]) == 0) {
+      *tonemap = (HdrTonemap)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+void hdr_image_tonemap(const HdrImage *image, uint32_t *framebuffer,
+                       float exposure, HdrTonemap tonemap) {
+  vector_batch_pack_colors(image->red, image->green, image->blue,
+                           (size_t)image->width * image->height, exposure,
+                           tonemap == HDR_TONEMAP_REINHARD, framebuffer);
+}
+
+void hdr_image_tonemap_rect(const HdrImage *image, uint32_t *framebuffer,
+                            int x, int y, int width, int height,
+                            float exposure, HdrTonemap tonemap) {
+  if (width <= 0) {
+    return;
+  }
+  for (int row = y; row < y + height; row++) {
+    size_t first = (size_t)row * image->width + x;
+    vector_batch_pack_colors(&image->red[first], &image->green[first],
+                             &image->blue[first], (size_t)width, exposure,
+                             tonemap == HDR_TONEMAP_REINHARD,
+                             &framebuffer[first]);
+  }
+}
@@ -0,0 +1,77 @@
+#ifndef HDR_H
+#define HDR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vector_color.h"
+
+/**
+ * @file hdr.h
+ * @brief Linear float framebuffer and the pass that packs it for display.
+ *
+ * Render passes store each pixel's colour unclamped, one float per
+ * channel in separate planes. hdr_image_tonemap then scales the whole
+ * frame by the exposure, maps it to [0, 1] and packs ARGB8888 in one
+ * vectorised loop (vector_batch_pack_colors), so no conversion happens
+ * while tracing. With exposure 1 and HDR_TONEMAP_CLAMP the packed pixels
+ * equal vector_color_to_rgb_color.
+ */
+
+typedef enum {
+  HDR_TONEMAP_CLAMP,    /**< Clip to [0, 1] */
+  HDR_TONEMAP_REINHARD, /**< c / (1 + c), keeps detail in highlights */
+  HDR_TONEMAPS_COUNT
+} HdrTonemap;
+
+/**
+ * @struct HdrImage
+ * @brief Planar linear RGB, row-major, top row first.
+ */
+typedef struct {
+  int width;
+  int height;
+  float *red;
+  float *green;
+  float *blue;
+} HdrImage;
+
+/**
+ * @return Image with undefined pixels, or NULL on allocation failure
+ */
+HdrImage *hdr_image_create(int width, int height);
+
+void hdr_image_destroy(HdrImage *image);
+
+void hdr_image_fill(HdrImage *image, VectorColor color);
+
+static inline void hdr_image_set(HdrImage *image, size_t pixel,
+                                 VectorColor color) {
+  image->red[pixel] = color.red;
+  image->green[pixel] = color.green;
+  image->blue[pixel] = color.blue;
+}
+
+/**
+ * @brief Look up a tonemap by name ("clamp" or "reinhard").
+ */
+bool hdr_tonemap_parse(const char *name, HdrTonemap *tonemap);
+
+/**
+ * @brief Pack the whole image into width * height ARGB8888 pixels.
+ *
+ * @param exposure Linear factor applied before tonemapping
+ */
+void hdr_image_tonemap(const HdrImage *image, uint32_t *framebuffer,
+                       float exposure, HdrTonemap tonemap);
+
+/**
+ * @brief hdr_image_tonemap for columns [x, x + width) of rows
+ *        [y, y + height) only, leaving the other pixels as they are.
+ */
+void hdr_image_tonemap_rect(const HdrImage *image, uint32_t *framebuffer,
+                            int x, int y, int width, int height,
+                            float exposure, HdrTonemap tonemap);
+
+#endif /* HDR_H */
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image.h"
+
+static void pixel_to_rgb(uint32_t pixel, uint8_t *rgb) {
+  rgb[0] = (pixel >> 16) & 0xFF;
+  rgb[1] = (pixel >> 8) & 0xFF;
+  rgb[2] = pixel & 0xFF;
+}
+
+bool image_write_ppm(const char *path, const uint32_t *pixels, int width,
+                     int height) {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    return false;
+  }
+
+  uint8_t *row = malloc((size_t)width * 3);
+  bool ok = row && fprintf(file, "P6\n%d %d\n255\n", width, height) > 0;
+
+  for (int y = 0; ok && y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      pixel_to_rgb(pixels[(size_t)y * width + x], &row[x * 3]);
+    }
+    ok = fwrite(row, 3, width, file) == (size_t)width;
+  }
+
+  free(row);
+  return fclose(file) == 0 && ok;
+}
+
+/* -------------------------------------------------------------------------
+ * PNG
+ * ------------------------------------------------------------------------- */
+
+#define DEFLATE_STORED_MAX 65535
+
+typedef struct {
+  FILE *file;
+  uint32_t crc;
+  bool ok;
+} PngWriter;
+
+static uint32_t crc_table[256];
+
+static void crc_table_init(void) {
+  for (uint32_t n = 0; n < 256; n++) {
+    uint32_t c = n;
+    for (int k = 0; k < 8; k++) {
+      c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    }
+    crc_table[n] = c;
+  }
+}
+
+static void put_bytes(PngWriter *writer, const void *data, size_t size) {
+  const uint8_t *bytes = data;
+  for (size_t i = 0; i < size; i++) {
+    writer->crc = crc_table[(writer->crc ^ bytes[i]) & 0xFF] ^
+                  (writer->crc >> 8);
+  }
+  if (writer->ok && fwrite(data, 1, size, writer->file) != size) {
+    writer->ok = false;
+  }
+}
+
+static void put_u32(PngWriter *writer, uint32_t value) {
+  uint8_t bytes[4] = {value >> 24, value >> 16, value >> 8, value};
+  put_bytes(writer, bytes, 4);
+}
+
+static void chunk_begin(PngWriter *writer, const char *type,
+                        uint32_t length) {
+  put_u32(writer, length);
+  writer->crc = 0xFFFFFFFFu;
+  put_bytes(writer, type, 4);
+}
+
+static void chunk_end(PngWriter *writer) {
+  put_u32(writer, writer->crc ^ 0xFFFFFFFFu);
+}
+
+bool image_write_png(const char *path, const uint32_t *pixels, int width,
+                     int height) {
+  static const uint8_t signature[8] = {0x89, 'P',  'N',  'G',
+                                       '\r', '\n', 0x1A, '\n'};
+
+  if (crc_table[1] == 0) {
+    crc_table_init();
+  }
+
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    return false;
+  }
+
+  PngWriter writer = {file, 0, true};
+  size_t row_size = (size_t)width * 3 + 1;
+  size_t raw_size = row_size * height;
+  size_t blocks = (raw_size + DEFLATE_STORED_MAX - 1) / DEFLATE_STORED_MAX;
+  uint8_t *row = malloc(row_size);
+  if (!row) {
+    fclose(file);
+    return false;
+  }
+
+  put_bytes(&writer, signature, sizeof(signature));
+
+  chunk_begin(&writer, "IHDR", 13);
+  put_u32(&writer, width);
+  put_u32(&writer, height);
+  /* 8 bits per channel, truecolour, deflate, adaptive filter, no interlace */
+  put_bytes(&writer, (uint8_t[]){8, 2, 0, 0, 0}, 5);
+  chunk_end(&writer);
+
+  /* zlib header + stored blocks (5 byte header each) + adler32 */
+  chunk_begin(&writer, "IDAT", 2 + blocks * 5 + raw_size + 4);
+  put_bytes(&writer, (uint8_t[]){0x78, 0x01}, 2);
+
+  uint32_t adler_a = 1;
+  uint32_t adler_b = 0;
+  size_t block_left = 0;
+  size_t written = 0;
+
+  for (int y = 0; y < height; y++) {
+    row[0] = 0; /* filter type: none */
+    for (int x = 0; x < width; x++) {
+      pixel_to_rgb(pixels[(size_t)y * width + x], &row[1 + x * 3]);
+    }
+
+    for (size_t i = 0; i < row_size; i++) {
+      adler_a = (adler_a + row[i]) % 65521;
+      adler_b = (adler_b + adler_a) % 65521;
+    }
+
+    size_t offset = 0;
+    while (offset < row_size) {
+      if (block_left == 0) {
+        size_t remaining = raw_size - written;
+        uint16_t length = remaining > DEFLATE_STORED_MAX ? DEFLATE_STORED_MAX
+                                                         : remaining;
+        uint8_t final = remaining <= DEFLATE_STORED_MAX;
+        uint8_t header[5] = {final, length & 0xFF, length >> 8,
+                             ~length & 0xFF, (~length >> 8) & 0xFF};
+        put_bytes(&writer, header, 5);
+        block_left = length;
+      }
+
+      size_t count = row_size - offset;
+      if (count > block_left) {
+        count = block_left;
+      }
+      put_bytes(&writer, row + offset, count);
+      offset += count;
+      block_left -= count;
+      written += count;
+    }
+  }
+
+  put_u32(&writer, (adler_b << 16) | adler_a);
+  chunk_end(&writer);
+
+  chunk_begin(&writer, "IEND", 0);
+  chunk_end(&writer);
+
+  free(row);
+  return fclose(file) == 0 && writer.ok;
+}
+
+/* -------------------------------------------------------------------------
+ * PFM
+ * ------------------------------------------------------------------------- */
+
+bool image_write_pfm(const char *path, const HdrImage *image) {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    return false;
+  }
+
+  /* A negative scale marks little-endian data. */
+  const uint16_t probe = 1;
+  bool little_endian = *(const uint8_t *)&probe == 1;
+
+  int width = image->width;
+  float *row = malloc(sizeof(float) * 3 * width);
+  bool ok = row && fprintf(file, "PF\n%d %d\n%s\n", width, image->height,
+                           little_endian ? "-1.0" : "1.0") > 0;
+
+  /* Rows run bottom to top. */
+  for (int y = image->height - 1; ok && y >= 0; y--) {
+    for (int x = 0; x < width; x++) {
+      size_t pixel = (size_t)y * width + x;
+      row[x * 3] = image->red[pixel];
+      row[x * 3 + 1] = image->green[pixel];
+      row[x * 3 + 2] = image->blue[pixel];
+    }
+    ok = fwrite(row, sizeof(float) * 3, width, file) == (size_t)width;
+  }
+
+  free(row);
+  return fclose(file) == 0 && ok;
+}
+
+bool image_write(const char *path, const uint32_t *pixels, int width,
+                 int height) {
+  size_t length = strlen(path);
+  if (length >= 4 && strcmp(path + length - 4, ".png") == 0) {
+    return image_write_png(path, pixels, width, height);
+  }
+  return image_write_ppm(path, pixels, width, height);
+}
@@ -0,0 +1,44 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hdr.h"
+
+/**
+ * @file image.h
+ * @brief Write ARGB8888 framebuffers to image files.
+ *
+ * Pixels are 0xAARRGGBB, row-major, top row first; alpha is dropped.
+ * image_write_pfm writes linear float pixels instead. All writers return
+ * false and leave errno set when the file cannot be written.
+ */
+
+/**
+ * @brief Write a binary PPM (P6).
+ */
+bool image_write_ppm(const char *path, const uint32_t *pixels, int width,
+                     int height);
+
+/**
+ * @brief Write an 8-bit RGB PNG.
+ *
+ * The image data is stored uncompressed (deflate "stored" blocks), so no
+ * compression library is needed.
+ */
+bool image_write_png(const char *path, const uint32_t *pixels, int width,
+                     int height);
+
+/**
+ * @brief Write a linear RGB Portable Float Map (PF), in host byte order.
+ */
+bool image_write_pfm(const char *path, const HdrImage *image);
+
+/**
+ * @brief Write PNG if path ends in ".png", PPM otherwise.
+ */
+bool image_write(const char *path, const uint32_t *pixels, int width,
+                 int height);
+
+#endif /* IMAGE_H */
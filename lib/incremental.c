@@ -0,0 +1,378 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "incremental.h"
+#include "raytracer.h"
+#include "vector_3d.h"
+
+/* Screen pixels [x_begin, x_end) x [y_begin, y_end). */
+typedef struct {
+  int x_begin;
+  int y_begin;
+  int x_end;
+  int y_end;
+} ScreenRect;
+
+/* Around a point light edit, the points whose lighting it can change by
+ * more than the cutoff. */
+typedef struct {
+  Vector3D center;
+  float radius;
+} LightReach;
+
+typedef struct {
+  IncrementalRenderer *incremental;
+  Scene *scene;
+  Camera *camera;
+  uint32_t *framebuffer;
+  ScreenRect rects[SCENE_MAX_EDITS];
+  int rects_count;
+  bool reshade_rest;
+  LightReach reaches[2 * SCENE_MAX_EDITS];
+  int reaches_count; /* -1 when every lit pixel is re-lit */
+  atomic_int reshaded_pixels;
+} IncrementalJob;
+
+IncrementalRenderer *incremental_create(int width, int height) {
+  IncrementalRenderer *incremental = calloc(1, sizeof(IncrementalRenderer));
+  if (!incremental) {
+    return NULL;
+  }
+
+  size_t pixel_count = (size_t)width * height;
+  incremental->width = width;
+  incremental->height = height;
+  incremental->hits = malloc(sizeof(RayHit) * pixel_count);
+  incremental->point = malloc(sizeof(Vector3D) * pixel_count);
+  incremental->normal = malloc(sizeof(Vector3D) * pixel_count);
+  incremental->color = malloc(sizeof(VectorColor) * pixel_count);
+  if (!incremental->hits || !incremental->point || !incremental->normal ||
+      !incremental->color) {
+    incremental_destroy(incremental);
+    return NULL;
+  }
+
+  return incremental;
+}
+
+void incremental_destroy(IncrementalRenderer *incremental) {
+  if (!incremental) {
+    return;
+  }
+
+  free(incremental->hits);
+  free(incremental->point);
+  free(incremental->normal);
+  free(incremental->color);
+  free(incremental);
+}
+
+static int clamp_to_screen(float coordinate, int size) {
+  return coordinate < 1 ? 1 : (coordinate > size ? size : (int)coordinate);
+}
+
+/* Screen rectangle covering a world box, padded by INCREMENTAL_MARGIN
+ * pixels for rounding. A box reaching behind the camera may cover any
+ * pixel, so it gets the whole screen. */
+static ScreenRect project_bounds(const IncrementalRenderer *incremental,
+                                 const Camera *camera, Vector3D min,
+                                 Vector3D max) {
+  ScreenRect screen = {1, 1, incremental->width, incremental->height};
+  float pixels_per_unit_x = camera->width / camera->viewport_width;
+  float pixels_per_unit_y = camera->height / camera->viewport_height;
+
+  float low_x = INFINITY;
+  float high_x = -INFINITY;
+  float low_y = INFINITY;
+  float high_y = -INFINITY;
+  for (int corner = 0; corner < 8; corner++) {
+    Vector3D point = vector_3d_init(corner & 1 ? max.x : min.x,
+                                    corner & 2 ? max.y : min.y,
+                                    corner & 4 ? max.z : min.z);
+    Vector3D relative = vector_3d_subtract(point, camera->position);
+    float depth = vector_3d_dot_product(relative, camera->forward);
+    if (!(depth > 0)) {
+      return screen;
+    }
+
+    float scale = camera->viewport_distance / depth;
+    float canvas_x = vector_3d_dot_product(relative, camera->right) * scale *
+                     pixels_per_unit_x;
+    float canvas_y = vector_3d_dot_product(relative, camera->up) * scale *
+                     pixels_per_unit_y;
+    low_x = fminf(low_x, canvas_x);
+    high_x = fmaxf(high_x, canvas_x);
+    low_y = fminf(low_y, canvas_y);
+    high_y = fmaxf(high_y, canvas_y);
+  }
+
+  /* Screen coordinates run opposite to canvas ones. */
+  float half_width = (float)(incremental->width / 2);
+  float half_height = (float)(incremental->height / 2);
+  return (ScreenRect){
+      clamp_to_screen(floorf(half_width - high_x) - INCREMENTAL_MARGIN,
+                      incremental->width),
+      clamp_to_screen(floorf(half_height - high_y) - INCREMENTAL_MARGIN,
+                      incremental->height),
+      clamp_to_screen(ceilf(half_width - low_x) + INCREMENTAL_MARGIN + 1,
+                      incremental->width),
+      clamp_to_screen(ceilf(half_height - low_y) + INCREMENTAL_MARGIN + 1,
+                      incremental->height)};
+}
+
+static bool in_rects(const IncrementalJob *job, int x, int y) {
+  for (int i = 0; i < job->rects_count; i++) {
+    const ScreenRect *rect = &job->rects[i];
+    if (x >= rect->x_begin && x < rect->x_end && y >= rect->y_begin &&
+        y < rect->y_end) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool in_reach(const IncrementalJob *job, Vector3D point) {
+  if (job->reaches_count < 0) {
+    return true;
+  }
+  for (int i = 0; i < job->reaches_count; i++) {
+    Vector3D offset = vector_3d_subtract(point, job->reaches[i].center);
+    if (vector_3d_dot_product(offset, offset) <
+        job->reaches[i].radius * job->reaches[i].radius) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool is_lit(const Scene *scene, RayHit hit) {
+  return hit.sphere >= 0 && !scene->spheres[hit.sphere].is_light_source;
+}
+
+/* Keeps a pixel's hit and what lighting it again takes. */
+static void keep_hit(IncrementalRenderer *incremental, Scene *scene,
+                     Camera *camera, int x, int y, RayHit hit) {
+  int pixel = y * incremental->width + x;
+  incremental->hits[pixel] = hit;
+  if (hit.sphere < 0) {
+    incremental->color[pixel] = scene->default_background_color;
+    return;
+  }
+
+  const Sphere *sphere = &scene->spheres[hit.sphere];
+  incremental->color[pixel] = sphere->color;
+  if (!sphere->is_light_source) {
+    Vector3D surface_point;
+    raytracer_hit_point(camera, sphere, raytracer_pixel_ray(camera, x, y),
+                        hit.t, &incremental->point[pixel],
+                        &incremental->normal[pixel], &surface_point);
+  }
+}
+
+/* Traces and shades the count pixels of row y at xs, in packets. */
+static void trace_run(IncrementalJob *job, int y, const int *xs, int count,
+                      ShadowCache *shadows, RenderCounters *counters) {
+  IncrementalRenderer *incremental = job->incremental;
+  int ys[RENDER_TILE_SIZE];
+  Vector3D directions[RENDER_TILE_SIZE];
+  RayHit hits[RENDER_TILE_SIZE];
+  VectorColor colors[RENDER_TILE_SIZE];
+  for (int k = 0; k < RENDER_TILE_SIZE; k++) {
+    ys[k] = y;
+  }
+
+  raytracer_trace_pixels(job->scene, job->camera, xs, ys, count, directions,
+                         hits, counters);
+  raytracer_shade_pixels(job->scene, job->camera, directions, hits, count,
+                         colors, shadows, counters);
+  for (int k = 0; k < count; k++) {
+    keep_hit(incremental, job->scene, job->camera, xs[k], y, hits[k]);
+    job->framebuffer[y * incremental->width + xs[k]] =
+        vector_color_to_rgb_color(colors[k]);
+  }
+}
+
+/* Kept pixels of one row waiting to be lit again. */
+typedef struct {
+  int pixel[RENDER_TILE_SIZE];
+  Vector3D point[RENDER_TILE_SIZE];
+  Vector3D normal[RENDER_TILE_SIZE];
+  Vector3D surface_point[RENDER_TILE_SIZE];
+  int count;
+} RelightRun;
+
+static void relight_add(IncrementalJob *job, RelightRun *run, int x, int y) {
+  IncrementalRenderer *incremental = job->incremental;
+  int pixel = y * incremental->width + x;
+  Vector3D direction = raytracer_pixel_ray(job->camera, x, y);
+
+  int k = run->count++;
+  run->pixel[k] = pixel;
+  run->point[k] = incremental->point[pixel];
+  run->normal[k] = incremental->normal[pixel];
+  run->surface_point[k] = vector_3d_add(
+      job->camera->position,
+      vector_3d_multiply_scalar(
+          direction,
+          raytracer_true_t(direction, incremental->hits[pixel].t)));
+}
+
+static void relight_flush(IncrementalJob *job, RelightRun *run,
+                          ShadowCache *shadows, RenderCounters *counters) {
+  IncrementalRenderer *incremental = job->incremental;
+  float intensities[RENDER_TILE_SIZE];
+  raytracer_light_points(job->scene, run->point, run->normal,
+                         run->surface_point, run->count, intensities,
+                         shadows, counters);
+  for (int k = 0; k < run->count; k++) {
+    int pixel = run->pixel[k];
+    job->framebuffer[pixel] = vector_color_to_rgb_color(
+        vector_color_multiply_scalar(incremental->color[pixel],
+                                     intensities[k]));
+  }
+  run->count = 0;
+}
+
+/* Pixels inside an edited sphere's rectangle are traced again, and with
+ * reshade_rest the lit pixels within reach of the light edits are lit
+ * again, up to RENDER_TILE_SIZE pixels of a row at a time. */
+static void render_band(void *context, int band, RenderCounters *counters) {
+  IncrementalJob *job = context;
+  IncrementalRenderer *incremental = job->incremental;
+  Scene *scene = job->scene;
+
+  ShadowCache shadows;
+  raytracer_shadow_cache_init(&shadows);
+  int traced[RENDER_TILE_SIZE];
+  RelightRun relit;
+  relit.count = 0;
+  int reshaded_pixels = 0;
+
+  int y_begin = band * INCREMENTAL_BAND_HEIGHT;
+  int y_end = y_begin + INCREMENTAL_BAND_HEIGHT;
+  if (y_end > incremental->height) {
+    y_end = incremental->height;
+  }
+
+  for (int y = y_begin > 0 ? y_begin : 1; y < y_end; y++) {
+    int traced_count = 0;
+    for (int x = 1; x < incremental->width; x++) {
+      int pixel = y * incremental->width + x;
+      if (in_rects(job, x, y)) {
+        traced[traced_count++] = x;
+      } else if (job->reshade_rest &&
+                 is_lit(scene, incremental->hits[pixel]) &&
+                 in_reach(job, incremental->point[pixel])) {
+        relight_add(job, &relit, x, y);
+        reshaded_pixels++;
+      }
+
+      if (traced_count == RENDER_TILE_SIZE) {
+        trace_run(job, y, traced, traced_count, &shadows, counters);
+        traced_count = 0;
+      }
+      if (relit.count == RENDER_TILE_SIZE) {
+        relight_flush(job, &relit, &shadows, counters);
+      }
+    }
+
+    if (traced_count > 0) {
+      trace_run(job, y, traced, traced_count, &shadows, counters);
+    }
+    if (relit.count > 0) {
+      relight_flush(job, &relit, &shadows, counters);
+    }
+  }
+
+  atomic_fetch_add_explicit(&job->reshaded_pixels, reshaded_pixels,
+                            memory_order_relaxed);
+}
+
+/* Where the light edits can change lighting by more than the cutoff, or
+ * reaches_count -1 when they can change it anywhere. */
+static void find_reaches(IncrementalJob *job, const Scene *scene) {
+  const SceneChanges *changes = &scene->changes;
+  const LightTree *tree = scene->light_tree;
+  job->reaches_count = 0;
+  if (!tree || !(tree->cutoff > 0.0f) ||
+      changes->lights_count > SCENE_MAX_EDITS) {
+    job->reaches_count = changes->lights_count > 0 ? -1 : 0;
+    return;
+  }
+
+  for (int i = 0; i < changes->lights_count; i++) {
+    Light before = changes->light_before[i];
+    Light after = changes->light_after[i];
+    if (before.type != POINT || after.type != POINT) {
+      job->reaches_count = -1;
+      return;
+    }
+
+    Vector3D offset = vector_3d_subtract(after.position, before.position);
+    if (vector_3d_dot_product(offset, offset) == 0.0f) {
+      job->reaches[job->reaches_count++] = (LightReach){
+          after.position, fabsf(after.intensity - before.intensity) /
+                              tree->cutoff};
+    } else {
+      job->reaches[job->reaches_count++] = (LightReach){
+          before.position, fabsf(before.intensity) / tree->cutoff};
+      job->reaches[job->reaches_count++] = (LightReach){
+          after.position, fabsf(after.intensity) / tree->cutoff};
+    }
+  }
+}
+
+void incremental_render(IncrementalRenderer *incremental, Scene *scene,
+                        Camera *camera, uint32_t *framebuffer) {
+  const SceneChanges *changes = &scene->changes;
+  IncrementalJob job = {.incremental = incremental,
+                        .scene = scene,
+                        .camera = camera,
+                        .framebuffer = framebuffer};
+  atomic_init(&job.reshaded_pixels, 0);
+  int bands = (incremental->height + INCREMENTAL_BAND_HEIGHT - 1) /
+              INCREMENTAL_BAND_HEIGHT;
+
+  incremental->traced_pixels = 0;
+  incremental->reshaded_pixels = 0;
+  bool trace_all = !incremental->valid ||
+                   memcmp(&incremental->camera, camera, sizeof(Camera)) != 0 ||
+                   changes->spheres_count > SCENE_MAX_EDITS;
+  if (trace_all) {
+    raytracer_render_hits(scene, camera, framebuffer, incremental->hits,
+                          incremental->point, incremental->normal,
+                          incremental->color);
+    incremental->traced_pixels =
+        (int)raytracer_frame_counters().primary_rays;
+  } else {
+    for (int i = 0; i < changes->spheres_count; i++) {
+      job.rects[job.rects_count++] =
+          project_bounds(incremental, camera, changes->sphere_min[i],
+                         changes->sphere_max[i]);
+    }
+
+    find_reaches(&job, scene);
+    /* A sphere edit can move shadows anywhere. */
+    if (scene->shadows && changes->spheres_count > 0) {
+      job.reaches_count = -1;
+    }
+    job.reshade_rest = job.reaches_count != 0;
+
+    if (job.rects_count > 0 || job.reshade_rest) {
+      raytracer_prepare_frame(scene, camera);
+      raytracer_run(bands, render_band, &job);
+      incremental->traced_pixels =
+          (int)raytracer_frame_counters().primary_rays;
+      incremental->reshaded_pixels = atomic_load(&job.reshaded_pixels);
+    }
+  }
+
+  incremental->camera = *camera;
+  incremental->valid = true;
+  scene_clear_changes(scene);
+}
@@ -0,0 +1,68 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "camera.h"
+#include "raytracer.h"
+#include "scene.h"
+#include "vector_3d.h"
+#include "vector_color.h"
+
+/**
+ * @file incremental.h
+ * @brief Re-render only what scene edits changed, for a still camera.
+ *
+ * Every pixel's hit is kept, with the point, normal and sphere colour it
+ * is shaded from. After scene_set_sphere, the bounds the sphere had
+ * before and after the edit are projected to a screen rectangle and only
+ * the pixels inside it are traced again. After scene_set_light, pixels
+ * are re-lit from their kept points without intersecting anything. With
+ * shadows on, a sphere edit can move shadows anywhere, so the pixels
+ * outside its rectangle are re-lit as well.
+ *
+ * Under a light cutoff, a point light edit only re-lits the pixels it can
+ * change by more than the cutoff. Lighting falls off as 1 / distance, so
+ * those lie within |intensity| / cutoff of the light, before or after the
+ * edit, or within |change| / cutoff when it stayed in place. The other
+ * pixels stay within about the cutoff of a full render, as clustered
+ * lights do. Without a cutoff every pixel is re-lit.
+ *
+ * Full traces, after a camera change, too many edits or before the first
+ * frame, go through the packet render passes of main_raytracer. Apart
+ * from the pixels a cutoff leaves, the result equals main_raytracer.
+ */
+
+typedef struct {
+  int width;
+  int height;
+  Camera camera; /**< Pose of the kept hits */
+  bool valid;    /**< The kept hits are of a frame rendered from camera */
+  RayHit *hits;        /**< Per pixel, rows of screen pixels */
+  Vector3D *point;     /**< Per lit pixel, where lighting is evaluated */
+  Vector3D *normal;    /**< Per lit pixel, the unit normal there */
+  VectorColor *color;  /**< Per pixel, the sphere or background colour */
+  int traced_pixels;   /**< Pixels the last render traced */
+  int reshaded_pixels; /**< Pixels the last render only re-lit */
+} IncrementalRenderer;
+
+/**
+ * @brief Allocate a renderer for width x height frames.
+ *
+ * @return Renderer without a hit buffer, or NULL on allocation failure
+ */
+IncrementalRenderer *incremental_create(int width, int height);
+
+void incremental_destroy(IncrementalRenderer *incremental);
+
+/**
+ * @brief Bring framebuffer up to date with scene and camera.
+ *
+ * framebuffer must hold the previous incremental_render output for the
+ * same renderer. Clears the scene changes.
+ */
+void incremental_render(IncrementalRenderer *incremental, Scene *scene,
+                        Camera *camera, uint32_t *framebuffer);
+
+#endif /* INCREMENTAL_H */
@@ -0,0 +1,124 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "light_tree.h"
+#include "sphere.h"
+#include "timer.h"
+
+/* The sphere BVH builder clusters the lights as points. */
+static bool build_clusters(LightTree *tree, const Light *lights,
+                           int point_count) {
+  Sphere *points = malloc(sizeof(Sphere) * (size_t)point_count);
+  if (!points) {
+    return false;
+  }
+  for (int i = 0; i < point_count; i++) {
+    points[i] = (Sphere){lights[tree->point_lights[i]].position, 0.0f,
+                         vector_color_black(), false, -1, 0.0f};
+  }
+  tree->bvh = bvh_build(points, point_count);
+  free(points);
+  if (!tree->bvh) {
+    return false;
+  }
+
+  int nodes_count = tree->bvh->nodes_count;
+  tree->intensity = malloc(sizeof(float) * (size_t)nodes_count);
+  tree->bound = malloc(sizeof(float) * (size_t)nodes_count);
+  tree->centroid = malloc(sizeof(Vector3D) * (size_t)nodes_count);
+  if (!tree->intensity || !tree->bound || !tree->centroid) {
+    return false;
+  }
+
+  /* Children always follow their parent in the array. */
+  for (int i = nodes_count - 1; i >= 0; i--) {
+    const BVHNode *node = &tree->bvh->nodes[i];
+    float intensity = 0.0f;
+    float bound = 0.0f;
+    Vector3D weighted = vector_3d_init(0, 0, 0);
+
+    if (node->count > 0) {
+      for (int j = node->offset; j < node->offset + node->count; j++) {
+        Light light =
+            lights[tree->point_lights[tree->bvh->sphere_indices[j]]];
+        intensity += light.intensity;
+        bound += fabsf(light.intensity);
+        weighted = vector_3d_add(
+            weighted, vector_3d_multiply_scalar(light.position,
+                                                fabsf(light.intensity)));
+      }
+    } else {
+      int children[2] = {i + 1, node->offset};
+      for (int c = 0; c < 2; c++) {
+        intensity += tree->intensity[children[c]];
+        bound += tree->bound[children[c]];
+        weighted = vector_3d_add(
+            weighted, vector_3d_multiply_scalar(tree->centroid[children[c]],
+                                                tree->bound[children[c]]));
+      }
+    }
+
+    tree->intensity[i] = intensity;
+    tree->bound[i] = bound;
+    /* Clusters of unlit lights are skipped; any centre will do. */
+    tree->centroid[i] = bound > 0.0f
+                            ? vector_3d_multiply_scalar(weighted, 1.0f / bound)
+                            : vector_3d_multiply_scalar(
+                                  vector_3d_add(node->bounds_min,
+                                                node->bounds_max),
+                                  0.5f);
+  }
+  return true;
+}
+
+LightTree *light_tree_build(const Light *lights, int lights_count,
+                            float cutoff) {
+  double start = timer_now_ms();
+
+  LightTree *tree = calloc(1, sizeof(LightTree));
+  if (!tree) {
+    return NULL;
+  }
+
+  size_t slots = lights_count > 0 ? (size_t)lights_count : 1;
+  tree->global_lights = malloc(sizeof(int) * slots);
+  tree->point_lights = malloc(sizeof(int) * slots);
+  if (!tree->global_lights || !tree->point_lights) {
+    light_tree_destroy(tree);
+    return NULL;
+  }
+
+  tree->cutoff = cutoff > 0.0f ? cutoff : 0.0f;
+  int point_count = 0;
+  for (int i = 0; i < lights_count; i++) {
+    if (lights[i].type == AMBIENT) {
+      tree->ambient += lights[i].intensity;
+    } else if (lights[i].type == POINT && tree->cutoff > 0.0f) {
+      tree->point_lights[point_count++] = i;
+    } else {
+      tree->global_lights[tree->global_count++] = i;
+    }
+  }
+
+  if (point_count > 0 && !build_clusters(tree, lights, point_count)) {
+    light_tree_destroy(tree);
+    return NULL;
+  }
+
+  tree->build_time_ms = timer_now_ms() - start;
+  return tree;
+}
+
+void light_tree_destroy(LightTree *tree) {
+  if (!tree) {
+    return;
+  }
+
+  free(tree->global_lights);
+  free(tree->point_lights);
+  bvh_destroy(tree->bvh);
+  free(tree->intensity);
+  free(tree->bound);
+  free(tree->centroid);
+  free(tree);
+}
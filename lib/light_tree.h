@@ -0,0 +1,51 @@
+#ifndef LIGHT_TREE_H
+#define LIGHT_TREE_H
+
+#include "bvh.h"
+#include "light.h"
+#include "vector_3d.h"
+
+/**
+ * @file light_tree.h
+ * @brief Point lights clustered in a BVH, for scenes with many of them.
+ *
+ * Lighting here falls off as 1 / distance, so a cluster of point lights
+ * adds at most its summed intensity over its distance to a shading
+ * point. Replacing the cluster by one light with that intensity at the
+ * lights' centre is off by roughly that bound times the cluster's size
+ * over its distance. Shading walks the tree from the root and evaluates
+ * a node as one light once this estimate is below the scene's light
+ * cutoff, and opens it otherwise, down to single lights. Far lights thus
+ * cost one evaluation per cluster; they are approximated rather than
+ * dropped, because with 1 / distance falloff many individually faint
+ * lights still add up.
+ *
+ * Ambient lights are summed into one constant, and directional lights, or
+ * every point light when the cutoff is 0, are evaluated everywhere.
+ */
+
+typedef struct {
+  float ambient;        /**< Sum of the ambient lights */
+  int *global_lights;   /**< Lights evaluated at every point, in order */
+  int global_count;
+  BVH *bvh;             /**< Over the point lights, NULL when there are
+                             none or the cutoff is 0 */
+  int *point_lights;    /**< Scene index of each light in the BVH */
+  float *intensity;     /**< Per node, summed intensity */
+  float *bound;         /**< Per node, summed absolute intensity */
+  Vector3D *centroid;   /**< Per node, weighted by absolute intensity */
+  float cutoff;
+  double build_time_ms;
+} LightTree;
+
+/**
+ * @param cutoff Largest error estimate of a cluster evaluated as one
+ *               light, or 0 to evaluate every light everywhere
+ * @return Tree, or NULL on allocation failure
+ */
+LightTree *light_tree_build(const Light *lights, int lights_count,
+                            float cutoff);
+
+void light_tree_destroy(LightTree *tree);
+
+#endif /* LIGHT_TREE_H */
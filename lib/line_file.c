@@ -0,0 +1,50 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "line_file.h"
+
+#define LINE_FILE_LINE_SIZE 512
+
+bool line_file_read(const char *path, LineFileParse parse, void *context,
+                    int *error_line) {
+  if (error_line) {
+    *error_line = 0;
+  }
+
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    return false;
+  }
+
+  char line[LINE_FILE_LINE_SIZE];
+  int line_number = 0;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), file)) {
+    line_number++;
+    char *comment = strchr(line, '#');
+    if (comment) {
+      *comment = '\0';
+    }
+
+    char keyword[16];
+    int consumed = 0;
+    if (sscanf(line, "%15s%n", keyword, &consumed) != 1) {
+      continue;
+    }
+
+    ok = parse(context, keyword, line + consumed);
+    if (!ok && errno == EINVAL && error_line) {
+      *error_line = line_number;
+    }
+  }
+  if (ok && ferror(file)) {
+    ok = false;
+    errno = EIO;
+  }
+
+  int error = errno;
+  fclose(file);
+  errno = error;
+  return ok;
+}
@@ -0,0 +1,37 @@
+#ifndef LINE_FILE_H
+#define LINE_FILE_H
+
+#include <stdbool.h>
+
+/**
+ * @file line_file.h
+ * @brief Reader for the text formats with one keyword and its values per
+ *        line: scene files, camera paths and animations.
+ *
+ * '#' starts a comment running to the end of the line, and lines that
+ * are blank after removing it are skipped.
+ */
+
+/**
+ * @brief Handle one line.
+ *
+ * @param keyword First word of the line, at most 15 characters
+ * @param values Rest of the line after the keyword
+ * @return false with errno set: EINVAL for a malformed line
+ */
+typedef bool (*LineFileParse)(void *context, const char *keyword,
+                              const char *values);
+
+/**
+ * @brief Pass every line of the file at path to parse, in order, until
+ *        one fails.
+ *
+ * @param error_line Set to the line parse rejected with EINVAL, or 0
+ *                   (may be NULL)
+ * @return false with errno set: as fopen, EIO for a read error, or as
+ *         parse
+ */
+bool line_file_read(const char *path, LineFileParse parse, void *context,
+                    int *error_line);
+
+#endif /* LINE_FILE_H */
@@ -0,0 +1,125 @@
+#include "progressive.h"
+#include "constants.h"
+#include "raytracer.h"
+#include "timer.h"
+
+void progressive_init(ProgressiveRenderer *progressive, double budget_ms) {
+  progressive->budget_ms = budget_ms;
+  progressive_restart(progressive);
+}
+
+void progressive_restart(ProgressiveRenderer *progressive) {
+  progressive_restart_at(progressive, RENDER_COARSEST_STRIDE);
+}
+
+void progressive_restart_at(ProgressiveRenderer *progressive, int stride) {
+  progressive->stride = stride;
+  progressive->next_tile = 0;
+  progressive->refine = false;
+}
+
+bool progressive_done(const ProgressiveRenderer *progressive) {
+  return progressive->stride == 0;
+}
+
+/* Packs what a pass at stride traced of tiles [first_tile, end_tile), as
+ * vector_color_to_rgb_color would. Runs of tiles in one tile row are
+ * packed as a single rect, so each row of pixels is visited once rather
+ * than once per tile. */
+static void pack_tiles(Camera *camera, HdrImage *hdr, uint32_t *framebuffer,
+                       int stride, int first_tile, int end_tile) {
+  int run_x = 0, run_y = 0, run_end = 0, run_height = 0;
+  for (int tile = first_tile; tile <= end_tile; tile++) {
+    int x = 0, y = 0, width = 0, height = 0;
+    if (tile < end_tile) {
+      raytracer_tile_rect(camera, tile, &x, &y, &width, &height);
+      /* Blocks wider than a pixel can spill into the first row and
+       * column, which no tile's rect covers. */
+      if (stride > 1 && x == 1) {
+        x = 0;
+        width++;
+      }
+      if (stride > 1 && y == 1) {
+        y = 0;
+        height++;
+      }
+      if (width == 0 || height == 0) {
+        continue;
+      }
+      if (run_height > 0 && y == run_y && height == run_height) {
+        run_x = x < run_x ? x : run_x;
+        run_end = x + width > run_end ? x + width : run_end;
+        continue;
+      }
+    }
+
+    if (run_height > 0) {
+      hdr_image_tonemap_rect(hdr, framebuffer, run_x, run_y, run_end - run_x,
+                             run_height, 1.0f, HDR_TONEMAP_CLAMP);
+    }
+    run_x = x;
+    run_y = y;
+    run_end = x + width;
+    run_height = height;
+  }
+}
+
+bool progressive_render(ProgressiveRenderer *progressive, Scene *scene,
+                        Camera *camera, HdrImage *hdr,
+                        uint32_t *framebuffer) {
+  if (progressive_done(progressive)) {
+    return false;
+  }
+
+  double start = timer_now_ms();
+  int tiles_count = raytracer_tiles_count(camera);
+  /* Small batches keep the overshoot past the budget short while still
+   * leaving idle threads a tile to steal. */
+  int batch = raytracer_thread_count() * PROGRESSIVE_TILES_PER_THREAD;
+
+  bool traced = false;
+
+  if (progressive->stride == RENDER_COARSEST_STRIDE &&
+      !progressive->refine) {
+    raytracer_render_pass_hdr(scene, camera, hdr, progressive->stride,
+                              false, 0, tiles_count);
+    pack_tiles(camera, hdr, framebuffer, progressive->stride, 0,
+               tiles_count);
+    progressive->stride /= 2;
+    progressive->next_tile = 0;
+    progressive->refine = true;
+    traced = true;
+  }
+
+  /* At least one batch per call, so refinement finishes on any budget.
+   * Each pass's tiles are packed together once it ends or time is up. */
+  int first_tile = progressive->next_tile;
+  while (progressive->stride > 0 &&
+         (!traced || timer_now_ms() - start < progressive->budget_ms)) {
+    traced = true;
+    int count = tiles_count - progressive->next_tile;
+    if (count > batch) {
+      count = batch;
+    }
+
+    raytracer_render_pass_hdr(scene, camera, hdr, progressive->stride,
+                              progressive->refine, progressive->next_tile,
+                              count);
+    progressive->next_tile += count;
+
+    if (progressive->next_tile == tiles_count) {
+      pack_tiles(camera, hdr, framebuffer, progressive->stride, first_tile,
+                 tiles_count);
+      progressive->stride /= 2;
+      progressive->next_tile = 0;
+      progressive->refine = true;
+      first_tile = 0;
+    }
+  }
+  if (progressive->next_tile > first_tile) {
+    pack_tiles(camera, hdr, framebuffer, progressive->stride, first_tile,
+               progressive->next_tile);
+  }
+
+  return true;
+}
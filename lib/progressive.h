@@ -0,0 +1,64 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "camera.h"
+#include "hdr.h"
+#include "scene.h"
+
+/**
+ * @file progressive.h
+ * @brief Progressive refinement spread over successive frames.
+ *
+ * After a restart the image is traced at stride 8, then refined at
+ * strides 4, 2 and 1, each pass tracing only the samples the previous
+ * passes did not. Passes are split into tiles so that one call does no
+ * more work than fits the frame budget; the stride 8 pass is always
+ * finished in the call that starts it, so a frame never mixes two camera
+ * poses.
+ *
+ * Passes trace into a linear float image. Before a call returns, only
+ * the tiles it traced are packed into the framebuffer, a tile row at a
+ * time, so pixels other renderers left in the framebuffer stay until
+ * refinement reaches them.
+ */
+
+typedef struct {
+  int stride;     /**< Stride of the pass in progress, 0 once finished */
+  int next_tile;  /**< First tile of the current pass not yet traced */
+  bool refine;    /**< The pass in progress skips the coarser samples */
+  double budget_ms;
+} ProgressiveRenderer;
+
+void progressive_init(ProgressiveRenderer *progressive, double budget_ms);
+
+/**
+ * @brief Start again from the coarsest pass, e.g. after the camera moved.
+ */
+void progressive_restart(ProgressiveRenderer *progressive);
+
+/**
+ * @brief Start again from a full pass at stride over a framebuffer that
+ *        already shows the current pose, e.g. a temporal reprojection.
+ *
+ * Unlike the first pass after progressive_restart, this pass is spread
+ * over frames like the refining ones.
+ */
+void progressive_restart_at(ProgressiveRenderer *progressive, int stride);
+
+bool progressive_done(const ProgressiveRenderer *progressive);
+
+/**
+ * @brief Trace as many tiles as fit the budget.
+ *
+ * @param hdr Camera width x height, filled like framebuffer before the
+ *            first call; keeps the traced samples between calls
+ * @return true if the framebuffer changed
+ */
+bool progressive_render(ProgressiveRenderer *progressive, Scene *scene,
+                        Camera *camera, HdrImage *hdr,
+                        uint32_t *framebuffer);
+
+#endif /* PROGRESSIVE_H */
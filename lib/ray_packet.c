@@ -0,0 +1,396 @@
+#include <math.h>
+#include <stddef.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "ray_packet.h"
+#include "vector_3d.h"
+
+/*
+ * All three kernels evaluate the quadratic with the same operations in
+ * the same order as calculate_sphere_intersection, including its
+ * "/ 2 * quadratic_a" grouping, so lanes are bit-identical to the
+ * scalar path. The per-sphere terms that do not depend on the ray
+ * (origin_to_center and quadratic_c) are computed once per sphere, or
+ * taken precomputed, and broadcast.
+ */
+
+void ray_packet_init(RayPacket *packet, const Camera *camera,
+                     const Vector3D *directions) {
+  for (int i = 0; i < RAY_PACKET_SIZE; i++) {
+    packet->direction_x[i] = directions[i].x;
+    packet->direction_y[i] = directions[i].y;
+    packet->direction_z[i] = directions[i].z;
+    packet->closest_t[i] = camera->ray_t_max;
+    packet->closest_sphere[i] = -1;
+  }
+}
+
+#if defined(__SSE2__)
+
+static inline __m128 select_ps(__m128 mask, __m128 if_true, __m128 if_false) {
+  return _mm_or_ps(_mm_and_ps(mask, if_true), _mm_andnot_ps(mask, if_false));
+}
+
+/* nearer on four lanes, for the SSE2 kernel and secondary packets. */
+static inline __m128 nearer4(__m128 t, __m128 closest_t, __m128 index,
+                             __m128 closest_sphere) {
+  __m128 tie = _mm_and_ps(
+      _mm_cmpeq_ps(t, closest_t),
+      _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_castps_si128(closest_sphere),
+                                       _mm_castps_si128(index))));
+  return _mm_or_ps(_mm_cmplt_ps(t, closest_t), tie);
+}
+
+#endif
+
+#if defined(__AVX2__)
+
+/* t is nearer than the lane's current hit, or ties it on a lower sphere
+ * index. Lanes without a hit hold index -1 and never win a tie. */
+static inline __m256 nearer(__m256 t, __m256 closest_t, __m256i index,
+                            __m256i closest_sphere) {
+  __m256 tie = _mm256_and_ps(
+      _mm256_cmp_ps(t, closest_t, _CMP_EQ_OQ),
+      _mm256_castsi256_ps(_mm256_cmpgt_epi32(closest_sphere, index)));
+  return _mm256_or_ps(_mm256_cmp_ps(t, closest_t, _CMP_LT_OQ), tie);
+}
+
+static inline void intersect_packet(RayPacket *packet, const Camera *camera,
+                                    const Sphere *spheres,
+                                    const SphereTerms *terms,
+                                    const int *indices, int count) {
+  const __m256 dx = _mm256_load_ps(packet->direction_x);
+  const __m256 dy = _mm256_load_ps(packet->direction_y);
+  const __m256 dz = _mm256_load_ps(packet->direction_z);
+
+  const __m256 t_min = _mm256_set1_ps(camera->ray_t_min);
+  const __m256 t_max = _mm256_set1_ps(camera->ray_t_max);
+  const __m256 two = _mm256_set1_ps(2.0f);
+  const __m256 four = _mm256_set1_ps(4.0f);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+
+  const __m256 quadratic_a = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+      _mm256_mul_ps(dz, dz));
+  const __m256 four_a = _mm256_mul_ps(four, quadratic_a);
+
+  __m256 closest_t = _mm256_load_ps(packet->closest_t);
+  __m256i closest_sphere =
+      _mm256_load_si256((const __m256i *)packet->closest_sphere);
+
+  for (int k = 0; k < count; k++) {
+    int i = indices ? indices[k] : k;
+    SphereTerms sphere =
+        terms ? terms[i] : calculate_sphere_terms(camera, &spheres[i]);
+    Vector3D origin_to_center = sphere.origin_to_center;
+    float quadratic_c = sphere.quadratic_c;
+
+    __m256 quadratic_b = _mm256_mul_ps(
+        _mm256_add_ps(
+            _mm256_add_ps(
+                _mm256_mul_ps(_mm256_set1_ps(origin_to_center.x), dx),
+                _mm256_mul_ps(_mm256_set1_ps(origin_to_center.y), dy)),
+            _mm256_mul_ps(_mm256_set1_ps(origin_to_center.z), dz)),
+        two);
+
+    __m256 discriminant =
+        _mm256_sub_ps(_mm256_mul_ps(quadratic_b, quadratic_b),
+                      _mm256_mul_ps(four_a, _mm256_set1_ps(quadratic_c)));
+    __m256 missed = _mm256_cmp_ps(discriminant, zero, _CMP_LT_OQ);
+    if (_mm256_movemask_ps(missed) == 0xFF) {
+      continue;
+    }
+
+    __m256 root = _mm256_sqrt_ps(discriminant);
+    __m256 negative_b = _mm256_xor_ps(quadratic_b, sign);
+    __m256 t1 = _mm256_mul_ps(
+        _mm256_div_ps(_mm256_add_ps(negative_b, root), two), quadratic_a);
+    __m256 t2 = _mm256_mul_ps(
+        _mm256_div_ps(_mm256_sub_ps(negative_b, root), two), quadratic_a);
+    t1 = _mm256_blendv_ps(t1, t_max, missed);
+    t2 = _mm256_blendv_ps(t2, t_max, missed);
+
+    const __m256i index = _mm256_set1_epi32(i);
+
+    __m256 take = _mm256_and_ps(
+        _mm256_and_ps(_mm256_cmp_ps(t_min, t1, _CMP_LE_OQ),
+                      _mm256_cmp_ps(t_max, t1, _CMP_GE_OQ)),
+        nearer(t1, closest_t, index, closest_sphere));
+    closest_t = _mm256_blendv_ps(closest_t, t1, take);
+    closest_sphere = _mm256_blendv_epi8(closest_sphere, index,
+                                        _mm256_castps_si256(take));
+
+    take = _mm256_and_ps(
+        _mm256_and_ps(_mm256_cmp_ps(t_min, t2, _CMP_LE_OQ),
+                      _mm256_cmp_ps(t_max, t2, _CMP_GE_OQ)),
+        nearer(t2, closest_t, index, closest_sphere));
+    closest_t = _mm256_blendv_ps(closest_t, t2, take);
+    closest_sphere = _mm256_blendv_epi8(closest_sphere, index,
+                                        _mm256_castps_si256(take));
+  }
+
+  _mm256_store_ps(packet->closest_t, closest_t);
+  _mm256_store_si256((__m256i *)packet->closest_sphere, closest_sphere);
+}
+
+#elif defined(__SSE2__)
+
+static inline void intersect_packet(RayPacket *packet, const Camera *camera,
+                                    const Sphere *spheres,
+                                    const SphereTerms *terms,
+                                    const int *indices, int count) {
+  const __m128 dx = _mm_load_ps(packet->direction_x);
+  const __m128 dy = _mm_load_ps(packet->direction_y);
+  const __m128 dz = _mm_load_ps(packet->direction_z);
+
+  const __m128 t_min = _mm_set1_ps(camera->ray_t_min);
+  const __m128 t_max = _mm_set1_ps(camera->ray_t_max);
+  const __m128 two = _mm_set1_ps(2.0f);
+  const __m128 four = _mm_set1_ps(4.0f);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 sign = _mm_set1_ps(-0.0f);
+
+  const __m128 quadratic_a = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+  const __m128 four_a = _mm_mul_ps(four, quadratic_a);
+
+  __m128 closest_t = _mm_load_ps(packet->closest_t);
+  __m128 closest_sphere =
+      _mm_castsi128_ps(_mm_load_si128((const __m128i *)packet->closest_sphere));
+
+  for (int k = 0; k < count; k++) {
+    int i = indices ? indices[k] : k;
+    SphereTerms sphere =
+        terms ? terms[i] : calculate_sphere_terms(camera, &spheres[i]);
+    Vector3D origin_to_center = sphere.origin_to_center;
+    float quadratic_c = sphere.quadratic_c;
+
+    __m128 quadratic_b = _mm_mul_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(origin_to_center.x), dx),
+                              _mm_mul_ps(_mm_set1_ps(origin_to_center.y), dy)),
+                   _mm_mul_ps(_mm_set1_ps(origin_to_center.z), dz)),
+        two);
+
+    __m128 discriminant =
+        _mm_sub_ps(_mm_mul_ps(quadratic_b, quadratic_b),
+                   _mm_mul_ps(four_a, _mm_set1_ps(quadratic_c)));
+    __m128 missed = _mm_cmplt_ps(discriminant, zero);
+    if (_mm_movemask_ps(missed) == 0xF) {
+      continue;
+    }
+
+    __m128 root = _mm_sqrt_ps(discriminant);
+    __m128 negative_b = _mm_xor_ps(quadratic_b, sign);
+    __m128 t1 =
+        _mm_mul_ps(_mm_div_ps(_mm_add_ps(negative_b, root), two), quadratic_a);
+    __m128 t2 =
+        _mm_mul_ps(_mm_div_ps(_mm_sub_ps(negative_b, root), two), quadratic_a);
+    t1 = select_ps(missed, t_max, t1);
+    t2 = select_ps(missed, t_max, t2);
+
+    const __m128 index = _mm_castsi128_ps(_mm_set1_epi32(i));
+
+    __m128 take =
+        _mm_and_ps(_mm_and_ps(_mm_cmple_ps(t_min, t1), _mm_cmpge_ps(t_max, t1)),
+                   nearer4(t1, closest_t, index, closest_sphere));
+    closest_t = select_ps(take, t1, closest_t);
+    closest_sphere = select_ps(take, index, closest_sphere);
+
+    take =
+        _mm_and_ps(_mm_and_ps(_mm_cmple_ps(t_min, t2), _mm_cmpge_ps(t_max, t2)),
+                   nearer4(t2, closest_t, index, closest_sphere));
+    closest_t = select_ps(take, t2, closest_t);
+    closest_sphere = select_ps(take, index, closest_sphere);
+  }
+
+  _mm_store_ps(packet->closest_t, closest_t);
+  _mm_store_si128((__m128i *)packet->closest_sphere,
+                  _mm_castps_si128(closest_sphere));
+}
+
+#else
+
+static inline void intersect_packet(RayPacket *packet, const Camera *camera,
+                                    const Sphere *spheres,
+                                    const SphereTerms *terms,
+                                    const int *indices, int count) {
+  for (int k = 0; k < count; k++) {
+    int i = indices ? indices[k] : k;
+    SphereTerms sphere =
+        terms ? terms[i] : calculate_sphere_terms(camera, &spheres[i]);
+    for (int lane = 0; lane < RAY_PACKET_SIZE; lane++) {
+      Vector3D ray_direction =
+          vector_3d_init(packet->direction_x[lane], packet->direction_y[lane],
+                         packet->direction_z[lane]);
+      SphereIntersections sphere_intersections =
+          calculate_sphere_intersection_terms(camera, sphere, ray_direction);
+
+      if (in_camera_range(*camera, sphere_intersections.t1) &&
+          sphere_hit_is_nearer(sphere_intersections.t1, i,
+                               packet->closest_t[lane],
+                               packet->closest_sphere[lane])) {
+        packet->closest_t[lane] = sphere_intersections.t1;
+        packet->closest_sphere[lane] = i;
+      }
+
+      if (in_camera_range(*camera, sphere_intersections.t2) &&
+          sphere_hit_is_nearer(sphere_intersections.t2, i,
+                               packet->closest_t[lane],
+                               packet->closest_sphere[lane])) {
+        packet->closest_t[lane] = sphere_intersections.t2;
+        packet->closest_sphere[lane] = i;
+      }
+    }
+  }
+}
+
+#endif
+
+void ray_packet_intersect_spheres(RayPacket *packet, const Camera *camera,
+                                  const Sphere *spheres, const int *indices,
+                                  int count) {
+  intersect_packet(packet, camera, spheres, NULL, indices, count);
+}
+
+void ray_packet_intersect_terms(RayPacket *packet, const Camera *camera,
+                                const SphereTerms *terms, const int *indices,
+                                int count) {
+  intersect_packet(packet, camera, NULL, terms, indices, count);
+}
+
+/*
+ * Secondary packets follow sphere_nearest_hit instead: its half_b form
+ * of the quadratic, with the ray's own origin. quadratic_a only depends
+ * on the ray, so it is computed once per packet.
+ */
+
+void secondary_ray_packet_init(SecondaryRayPacket *packet,
+                               const Vector3D *origins,
+                               const Vector3D *directions, int count) {
+  for (int lane = 0; lane < SECONDARY_RAY_PACKET_SIZE; lane++) {
+    int ray = lane < count ? lane : 0;
+    packet->origin_x[lane] = origins[ray].x;
+    packet->origin_y[lane] = origins[ray].y;
+    packet->origin_z[lane] = origins[ray].z;
+    packet->direction_x[lane] = directions[ray].x;
+    packet->direction_y[lane] = directions[ray].y;
+    packet->direction_z[lane] = directions[ray].z;
+    packet->quadratic_a[lane] =
+        vector_3d_dot_product(directions[ray], directions[ray]);
+    packet->closest_t[lane] = lane < count ? INFINITY : -INFINITY;
+    packet->closest_sphere[lane] = -1;
+  }
+}
+
+#if defined(__SSE2__)
+
+_Static_assert(SECONDARY_RAY_PACKET_SIZE == 4,
+               "secondary packets fill one SSE register");
+
+void secondary_ray_packet_intersect(SecondaryRayPacket *packet,
+                                    const Sphere *spheres,
+                                    const int *indices, int count,
+                                    float t_min, int lanes) {
+  const __m128 ox = _mm_load_ps(packet->origin_x);
+  const __m128 oy = _mm_load_ps(packet->origin_y);
+  const __m128 oz = _mm_load_ps(packet->origin_z);
+  const __m128 dx = _mm_load_ps(packet->direction_x);
+  const __m128 dy = _mm_load_ps(packet->direction_y);
+  const __m128 dz = _mm_load_ps(packet->direction_z);
+  const __m128 quadratic_a = _mm_load_ps(packet->quadratic_a);
+
+  const __m128 active = _mm_castsi128_ps(_mm_cmpeq_epi32(
+      _mm_and_si128(_mm_set1_epi32(lanes), _mm_setr_epi32(1, 2, 4, 8)),
+      _mm_setr_epi32(1, 2, 4, 8)));
+  const __m128 minimum = _mm_set1_ps(t_min);
+  const __m128 infinity = _mm_set1_ps(INFINITY);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 sign = _mm_set1_ps(-0.0f);
+
+  __m128 closest_t = _mm_load_ps(packet->closest_t);
+  __m128 closest_sphere =
+      _mm_castsi128_ps(_mm_load_si128((const __m128i *)packet->closest_sphere));
+
+  for (int k = 0; k < count; k++) {
+    int i = indices ? indices[k] : k;
+    const Sphere *sphere = &spheres[i];
+
+    __m128 ocx = _mm_sub_ps(ox, _mm_set1_ps(sphere->center.x));
+    __m128 ocy = _mm_sub_ps(oy, _mm_set1_ps(sphere->center.y));
+    __m128 ocz = _mm_sub_ps(oz, _mm_set1_ps(sphere->center.z));
+    __m128 half_b = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)),
+        _mm_mul_ps(ocz, dz));
+    __m128 quadratic_c = _mm_sub_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)),
+                   _mm_mul_ps(ocz, ocz)),
+        _mm_set1_ps(sphere->radius * sphere->radius));
+
+    __m128 discriminant = _mm_sub_ps(_mm_mul_ps(half_b, half_b),
+                                     _mm_mul_ps(quadratic_a, quadratic_c));
+    __m128 hit = _mm_andnot_ps(_mm_cmplt_ps(discriminant, zero), active);
+    if (_mm_movemask_ps(hit) == 0) {
+      continue;
+    }
+
+    __m128 root = _mm_sqrt_ps(discriminant);
+    __m128 negative_b = _mm_xor_ps(half_b, sign);
+    __m128 t1 = _mm_div_ps(_mm_sub_ps(negative_b, root), quadratic_a);
+    __m128 t2 = _mm_div_ps(_mm_add_ps(negative_b, root), quadratic_a);
+    __m128 t = select_ps(
+        _mm_and_ps(_mm_cmpgt_ps(t1, minimum), _mm_cmplt_ps(t1, infinity)),
+        t1,
+        select_ps(_mm_and_ps(_mm_cmpgt_ps(t2, minimum),
+                             _mm_cmplt_ps(t2, infinity)),
+                  t2, infinity));
+
+    const __m128 index = _mm_castsi128_ps(_mm_set1_epi32(i));
+    __m128 take =
+        _mm_and_ps(_mm_and_ps(hit, _mm_cmplt_ps(t, infinity)),
+                   nearer4(t, closest_t, index, closest_sphere));
+    closest_t = select_ps(take, t, closest_t);
+    closest_sphere = select_ps(take, index, closest_sphere);
+  }
+
+  _mm_store_ps(packet->closest_t, closest_t);
+  _mm_store_si128((__m128i *)packet->closest_sphere,
+                  _mm_castps_si128(closest_sphere));
+}
+
+#else
+
+void secondary_ray_packet_intersect(SecondaryRayPacket *packet,
+                                    const Sphere *spheres,
+                                    const int *indices, int count,
+                                    float t_min, int lanes) {
+  for (int lane = 0; lane < SECONDARY_RAY_PACKET_SIZE; lane++) {
+    if (!(lanes & (1 << lane))) {
+      continue;
+    }
+
+    Vector3D origin = vector_3d_init(packet->origin_x[lane],
+                                     packet->origin_y[lane],
+                                     packet->origin_z[lane]);
+    Vector3D direction = vector_3d_init(packet->direction_x[lane],
+                                        packet->direction_y[lane],
+                                        packet->direction_z[lane]);
+    for (int k = 0; k < count; k++) {
+      int i = indices ? indices[k] : k;
+      float t =
+          sphere_nearest_hit(&spheres[i], origin, direction, t_min, INFINITY);
+      if (t < INFINITY && sphere_hit_is_nearer(t, i, packet->closest_t[lane],
+                                               packet->closest_sphere[lane])) {
+        packet->closest_t[lane] = t;
+        packet->closest_sphere[lane] = i;
+      }
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "camera.h"
+#include "sphere.h"
+
+/**
+ * @file ray_packet.h
+ * @brief Intersect a packet of rays sharing one origin, or of rays
+ *        starting anywhere, against spheres.
+ *
+ * The packet width follows the instruction set the file is compiled
+ * for: 8 lanes with AVX2, 4 lanes with SSE2, and a 4 lane scalar loop
+ * otherwise. Every lane gives exactly the result the scalar
+ * calculate_sphere_intersection path gives for the same ray.
+ *
+ * Secondary packets, of rays with their own origins such as
+ * reflections, are 4 lanes wide with SSE2 or AVX2 and give exactly the
+ * result of sphere_nearest_hit.
+ */
+
+#if defined(__AVX2__)
+#define RAY_PACKET_SIZE 8
+#else
+#define RAY_PACKET_SIZE 4
+#endif
+
+#define SECONDARY_RAY_PACKET_SIZE 4
+
+/**
+ * @struct RayPacket
+ * @brief Structure-of-arrays ray directions plus the running nearest hit.
+ *
+ * closest_sphere holds an index into the sphere array, or -1 while the
+ * lane has not hit anything.
+ */
+typedef struct {
+  _Alignas(32) float direction_x[RAY_PACKET_SIZE];
+  _Alignas(32) float direction_y[RAY_PACKET_SIZE];
+  _Alignas(32) float direction_z[RAY_PACKET_SIZE];
+  _Alignas(32) float closest_t[RAY_PACKET_SIZE];
+  _Alignas(32) int closest_sphere[RAY_PACKET_SIZE];
+} RayPacket;
+
+/**
+ * @brief Set lane directions and reset every lane to "no hit".
+ *
+ * @param packet Packet to fill
+ * @param camera Camera whose ray_t_max is the initial nearest distance
+ * @param directions RAY_PACKET_SIZE ray directions
+ */
+void ray_packet_init(RayPacket *packet, const Camera *camera,
+                     const Vector3D *directions);
+
+/**
+ * @brief Intersect all lanes against a list of spheres.
+ *
+ * @param packet Packet whose nearest hits are updated
+ * @param camera Ray origin and accepted ray range
+ * @param spheres Scene sphere array
+ * @param indices Indices into spheres to test, or NULL for [0, count)
+ * @param count Number of spheres to test
+ *
+ * Lanes keep the nearest hit inside the camera's ray range, ordered by
+ * sphere_hit_is_nearer, so the result does not depend on the order the
+ * spheres are visited in.
+ */
+void ray_packet_intersect_spheres(RayPacket *packet, const Camera *camera,
+                                  const Sphere *spheres, const int *indices,
+                                  int count);
+
+/**
+ * @brief ray_packet_intersect_spheres with every sphere's terms
+ *        precomputed for the camera, as by calculate_sphere_terms.
+ *
+ * @param terms Per sphere of the scene, indexed like the sphere array
+ */
+void ray_packet_intersect_terms(RayPacket *packet, const Camera *camera,
+                                const SphereTerms *terms, const int *indices,
+                                int count);
+
+/**
+ * @struct SecondaryRayPacket
+ * @brief Structure-of-arrays rays with their own origins, the per-ray
+ *        term of the quadratic and the running nearest hit.
+ *
+ * closest_t is a true ray parameter. Lanes past the packet's ray count
+ * repeat its first ray with closest_t -INFINITY, so they never take a
+ * hit or enter a box.
+ */
+typedef struct {
+  _Alignas(16) float origin_x[SECONDARY_RAY_PACKET_SIZE];
+  _Alignas(16) float origin_y[SECONDARY_RAY_PACKET_SIZE];
+  _Alignas(16) float origin_z[SECONDARY_RAY_PACKET_SIZE];
+  _Alignas(16) float direction_x[SECONDARY_RAY_PACKET_SIZE];
+  _Alignas(16) float direction_y[SECONDARY_RAY_PACKET_SIZE];
+  _Alignas(16) float direction_z[SECONDARY_RAY_PACKET_SIZE];
+  _Alignas(16) float quadratic_a[SECONDARY_RAY_PACKET_SIZE];
+  _Alignas(16) float closest_t[SECONDARY_RAY_PACKET_SIZE];
+  _Alignas(16) int closest_sphere[SECONDARY_RAY_PACKET_SIZE];
+} SecondaryRayPacket;
+
+/**
+ * @brief Set up to SECONDARY_RAY_PACKET_SIZE rays and reset them to
+ *        "no hit" at any distance.
+ *
+ * @param count Number of rays, at least 1
+ */
+void secondary_ray_packet_init(SecondaryRayPacket *packet,
+                               const Vector3D *origins,
+                               const Vector3D *directions, int count);
+
+/**
+ * @brief Intersect some lanes against a list of spheres.
+ *
+ * @param spheres Scene sphere array
+ * @param indices Indices into spheres to test, or NULL for [0, count)
+ * @param count Number of spheres to test
+ * @param t_min Smallest true ray parameter accepted
+ * @param lanes Bit l set to test lane l
+ *
+ * Lanes keep the nearest hit beyond t_min, ordered by
+ * sphere_hit_is_nearer.
+ */
+void secondary_ray_packet_intersect(SecondaryRayPacket *packet,
+                                    const Sphere *spheres,
+                                    const int *indices, int count,
+                                    float t_min, int lanes);
+
+#endif /* RAY_PACKET_H */
@@ -3,12 +3,21 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "bvh.h"
 #include "camera.h"
+#include "constants.h"
+#include "hdr.h"
 #include "light.h"
+#include "light_tree.h"
+#include "ray_packet.h"
 #include "raytracer.h"
 #include "scene.h"
 #include "sphere.h"
+#include "thread_pool.h"
+#include "tile_bins.h"
 #include "vector_3d.h"
 #include "vector_color.h"
 
@@ -18,18 +27,61 @@ typedef struct {
   bool hit_sphere;
 } Intersection;
 
-static inline void put_pixel(int x, int y, VectorColor color, Camera *camera,
-                             uint32_t *framebuffer) {
-  int screen_x = (camera->width / 2) - x;
-  int screen_y = (camera->height / 2) - y;
+/* Per-worker counters sit on their own cache line so that workers do not
+ * contend while a frame is rendering; they are summed once per frame. */
+typedef struct {
+  _Alignas(64) RenderCounters counters;
+} WorkerCounters;
 
-  if (screen_x < 0 || screen_x >= camera->width || screen_y < 0 ||
-      screen_y >= camera->height) {
+static ThreadPool *render_pool = NULL;
+static WorkerCounters *worker_counters = NULL;
+static RenderCounters frame_counters = {0};
+static RenderCounters total_counters = {0};
+static TileBins *primary_bins = NULL;
+
+/* Exactly one of the two is set. HDR pixels are stored unconverted and
+ * packed by hdr_image_tonemap after the frame. Pixel 0 of the target is
+ * screen pixel (origin_x, origin_y) and rows are stride pixels apart, so a
+ * target can also be a single tile's pixels. */
+typedef struct {
+  uint32_t *framebuffer;
+  HdrImage *hdr;
+  RayHit *hits; /* Per pixel, or NULL; stride 1 full frame passes only */
+  /* With hits, or NULL: per pixel hitting a sphere that is not a light
+   * source, the point and unit normal it is lit from. */
+  Vector3D *points;
+  Vector3D *normals;
+  VectorColor *colors; /* With hits, or NULL: sphere or background colour */
+  int origin_x;
+  int origin_y;
+  int stride; /* 0 for the camera width */
+} RenderTarget;
+
+/* Canvas columns [x, x + length) of row y, clipped to the screen. */
+static inline void put_span(int x, int y, int length, VectorColor color,
+                            Camera *camera, const RenderTarget *target) {
+  int right = (camera->width / 2) - x;
+  int left = right - (length - 1);
+  int screen_y = (camera->height / 2) - y;
+  left = left > 0 ? left : 0;
+  right = right < (int)camera->width - 1 ? right : (int)camera->width - 1;
+  if (left > right || screen_y < 0 || screen_y >= camera->height) {
     return;
   }
 
-  framebuffer[screen_y * (int)camera->width + screen_x] =
-      vector_color_to_rgb_color(color);
+  size_t first = (size_t)(screen_y - target->origin_y) * target->stride +
+                 (size_t)(left - target->origin_x);
+  size_t end = first + (size_t)(right - left + 1);
+  if (target->hdr) {
+    for (size_t pixel = first; pixel < end; pixel++) {
+      hdr_image_set(target->hdr, pixel, color);
+    }
+  } else {
+    uint32_t rgb = vector_color_to_rgb_color(color);
+    for (size_t pixel = first; pixel < end; pixel++) {
+      target->framebuffer[pixel] = rgb;
+    }
+  }
 }
 
 static inline Vector3D canvas_to_viewport(int x, int y, Camera *camera) {
@@ -38,15 +90,43 @@ static inline Vector3D canvas_to_viewport(int x, int y, Camera *camera) {
                         camera->viewport_distance);
 }
 
-static inline Intersection closest_intersection(Camera *camera, Scene *scene,
-                                                Vector3D ray_direction) {
+/* The spheres of one tile's bin, with the frame's sphere terms. */
+typedef struct {
+  const SphereTerms *terms;
+  const int *indices;
+  int count;
+} TileSpheres;
+
+/* Tests the tile's spheres if it has a bin, and the BVH otherwise. */
+static inline Intersection closest_intersection(
+    Camera *camera, Scene *scene, const TileSpheres *tile_spheres,
+    Vector3D ray_direction, RenderCounters *counters) {
   Intersection result = {.closest_t = camera->ray_t_max,
                          .closest_sphere = NULL,
                          .hit_sphere = false};
 
-  for (int i = 0; i < scene->spheres_count; i++) {
-    SphereIntersections sphere_intersections = calculate_sphere_intersection(
-        camera, &scene->spheres[i], ray_direction);
+  if (!tile_spheres && scene->bvh) {
+    int closest_sphere = -1;
+    counters->sphere_tests +=
+        bvh_intersect_ray(scene->bvh, camera, scene->spheres, ray_direction,
+                          &result.closest_t, &closest_sphere);
+    if (closest_sphere >= 0) {
+      result.closest_sphere = &scene->spheres[closest_sphere];
+      result.hit_sphere = true;
+      counters->hits++;
+    }
+    return result;
+  }
+
+  int count = tile_spheres ? tile_spheres->count : scene->spheres_count;
+  counters->sphere_tests += count;
+  for (int k = 0; k < count; k++) {
+    int i = tile_spheres ? tile_spheres->indices[k] : k;
+    SphereTerms terms =
+        tile_spheres ? tile_spheres->terms[i]
+                     : calculate_sphere_terms(camera, &scene->spheres[i]);
+    SphereIntersections sphere_intersections =
+        calculate_sphere_intersection_terms(camera, terms, ray_direction);
 
     if (in_camera_range(*camera, sphere_intersections.t1) &&
         sphere_intersections.t1 < result.closest_t) {
@@ -63,92 +143,1182 @@ static inline Intersection closest_intersection(Camera *camera, Scene *scene,
     }
   }
 
+  counters->hits += result.hit_sphere;
   return result;
 }
 
-static inline float compute_lighting(Scene *scene, Vector3D intersection_point,
-                                     Vector3D sphere_surface_normal) {
-  float intensity = 0.0f;
+static inline RayHit intersection_to_hit(Scene *scene,
+                                         Intersection intersection) {
+  return (RayHit){.t = intersection.closest_t,
+                  .sphere = intersection.hit_sphere
+                                ? (int)(intersection.closest_sphere -
+                                        scene->spheres)
+                                : -1};
+}
 
-  for (int i = 0; i < scene->lights_count; i++) {
-    Light light = scene->lights[i];
-    if (light.type == AMBIENT) {
-      intensity += light.intensity;
-    } else {
-      Vector3D light_direction;
+static inline Intersection hit_to_intersection(Scene *scene, RayHit hit) {
+  return (Intersection){
+      .closest_t = hit.t,
+      .closest_sphere = hit.sphere >= 0 ? &scene->spheres[hit.sphere] : NULL,
+      .hit_sphere = hit.sphere >= 0};
+}
 
-      if (light.type == POINT) {
-        light_direction =
-            vector_3d_subtract(light.position, intersection_point);
-      } else {
-        light_direction = light.position;
+/* The cached occluder is kept when the ray turns out to be unblocked:
+ * the next pixel is as likely to be shadowed by it again. */
+static inline bool light_occluded(Scene *scene, Vector3D origin,
+                                  Vector3D direction, float distance,
+                                  int light, ShadowCache *shadows,
+                                  RenderCounters *counters) {
+  int *cached = &shadows->occluder[light % SHADOW_CACHE_SIZE];
+  counters->shadow_rays++;
+
+  if (*cached >= 0) {
+    counters->sphere_tests++;
+    if (sphere_blocks_ray(&scene->spheres[*cached], origin, direction,
+                          SHADOW_RAY_T_MIN, distance)) {
+      return true;
+    }
+  }
+
+  int occluder = -1;
+  if (scene->bvh) {
+    counters->sphere_tests += bvh_intersect_shadow_ray(
+        scene->bvh, scene->spheres, origin, direction, SHADOW_RAY_T_MIN,
+        distance, &occluder);
+  } else {
+    for (int i = 0; i < scene->spheres_count && occluder < 0; i++) {
+      if (!scene->spheres[i].is_light_source) {
+        counters->sphere_tests++;
+        if (sphere_blocks_ray(&scene->spheres[i], origin, direction,
+                              SHADOW_RAY_T_MIN, distance)) {
+          occluder = i;
+        }
       }
+    }
+  }
+
+  if (occluder < 0) {
+    return false;
+  }
+  *cached = occluder;
+  return true;
+}
+
+/* Lighting is evaluated at intersection_point, found from the scaled hit
+ * distance as it always has been; shadow rays start from surface_point,
+ * the true hit, so that they leave from the sphere surface.
+ *
+ * Returns what one point or directional light adds; shadow_slot picks its
+ * entry in the shadow cache. The normal has unit length, so a point light
+ * adds at most its intensity over its distance, which the light tree
+ * relies on. */
+static inline float light_contribution(Scene *scene, Light light,
+                                       int shadow_slot,
+                                       Vector3D intersection_point,
+                                       Vector3D sphere_surface_normal,
+                                       Vector3D surface_point,
+                                       ShadowCache *shadows,
+                                       RenderCounters *counters) {
+  Vector3D light_direction;
 
-      float n_dot_l = vector_3d_dot_product(
-          sphere_surface_normal, vector_3d_normalize(light_direction));
+  if (light.type == POINT) {
+    light_direction = vector_3d_subtract(light.position, intersection_point);
+  } else {
+    light_direction = light.position;
+  }
+
+  float n_dot_l = vector_3d_dot_product(sphere_surface_normal,
+                                        vector_3d_normalize(light_direction));
+  if (!(n_dot_l > 0)) {
+    return 0.0f;
+  }
 
-      if (n_dot_l > 0) {
-        intensity += light.intensity *
-                     (n_dot_l / (vector_3d_magnitude(sphere_surface_normal) *
-                                 vector_3d_magnitude(light_direction)));
+  if (scene->shadows) {
+    Vector3D shadow_direction =
+        light.type == POINT ? vector_3d_subtract(light.position, surface_point)
+                            : light_direction;
+    float distance = light.type == POINT
+                         ? vector_3d_magnitude(shadow_direction)
+                         : INFINITY;
+    if (light_occluded(scene, surface_point,
+                       vector_3d_normalize(shadow_direction), distance,
+                       shadow_slot, shadows, counters)) {
+      return 0.0f;
+    }
+  }
+
+  return light.intensity *
+         (n_dot_l / (vector_3d_magnitude(sphere_surface_normal) *
+                     vector_3d_magnitude(light_direction)));
+}
+
+/* Walks the light tree, evaluating a cluster as one light once the error
+ * estimate of light_tree.h is below the cutoff at intersection_point.
+ * Clusters take shadow cache slots after the scene's lights. */
+static inline float clustered_lighting(Scene *scene, const LightTree *tree,
+                                       Vector3D intersection_point,
+                                       Vector3D sphere_surface_normal,
+                                       Vector3D surface_point,
+                                       ShadowCache *shadows,
+                                       RenderCounters *counters) {
+  const BVH *bvh = tree->bvh;
+  float cutoff_squared = tree->cutoff * tree->cutoff;
+  float intensity = 0.0f;
+  int stack[BVH_STACK_SIZE];
+  int stack_size = 0;
+  stack[stack_size++] = 0;
+
+  while (stack_size > 0) {
+    int index = stack[--stack_size];
+    const BVHNode *node = &bvh->nodes[index];
+    float bound = tree->bound[index];
+    if (bound == 0.0f) {
+      continue;
+    }
+
+    Vector3D size = vector_3d_subtract(node->bounds_max, node->bounds_min);
+    Vector3D offset =
+        vector_3d_subtract(tree->centroid[index], intersection_point);
+    float distance_squared = vector_3d_dot_product(offset, offset);
+    if (bound * bound * vector_3d_dot_product(size, size) <
+        cutoff_squared * distance_squared * distance_squared) {
+      counters->lighting_evaluations++;
+      intensity += light_contribution(
+          scene, (Light){tree->intensity[index], POINT, tree->centroid[index]},
+          scene->lights_count + index, intersection_point,
+          sphere_surface_normal, surface_point, shadows, counters);
+    } else if (node->count > 0) {
+      counters->lighting_evaluations += node->count;
+      for (int i = node->offset; i < node->offset + node->count; i++) {
+        int light = tree->point_lights[bvh->sphere_indices[i]];
+        intensity += light_contribution(scene, scene->lights[light], light,
+                                        intersection_point,
+                                        sphere_surface_normal, surface_point,
+                                        shadows, counters);
       }
+    } else {
+      stack[stack_size++] = node->offset;
+      stack[stack_size++] = index + 1;
     }
   }
 
   return intensity;
 }
 
-static inline VectorColor trace_ray(Camera *camera, Scene *scene,
-                                    Vector3D ray_direction) {
-  Intersection intersection =
-      closest_intersection(camera, scene, ray_direction);
+/* With a light tree the ambient lights come summed, and point lights are
+ * evaluated by cluster. */
+static inline float compute_lighting(Scene *scene, Vector3D intersection_point,
+                                     Vector3D sphere_surface_normal,
+                                     Vector3D surface_point,
+                                     ShadowCache *shadows,
+                                     RenderCounters *counters) {
+  const LightTree *tree = scene->light_tree;
+  if (!tree) {
+    float intensity = 0.0f;
+    counters->lighting_evaluations += scene->lights_count;
+    for (int i = 0; i < scene->lights_count; i++) {
+      if (scene->lights[i].type == AMBIENT) {
+        intensity += scene->lights[i].intensity;
+      } else {
+        intensity += light_contribution(scene, scene->lights[i], i,
+                                        intersection_point,
+                                        sphere_surface_normal, surface_point,
+                                        shadows, counters);
+      }
+    }
+    return intensity;
+  }
+
+  float intensity = tree->ambient;
+  counters->lighting_evaluations += tree->global_count;
+  for (int i = 0; i < tree->global_count; i++) {
+    int light = tree->global_lights[i];
+    intensity += light_contribution(scene, scene->lights[light], light,
+                                    intersection_point, sphere_surface_normal,
+                                    surface_point, shadows, counters);
+  }
+
+  if (tree->bvh) {
+    intensity += clustered_lighting(scene, tree, intersection_point,
+                                    sphere_surface_normal, surface_point,
+                                    shadows, counters);
+  }
+  return intensity;
+}
 
+static inline VectorColor shade_intersection(Camera *camera, Scene *scene,
+                                             Vector3D ray_direction,
+                                             Intersection intersection,
+                                             ShadowCache *shadows,
+                                             RenderCounters *counters) {
   if (!intersection.hit_sphere) {
     return scene->default_background_color;
   }
 
-  Vector3D intersection_point = vector_3d_add(
-      camera->position,
-      vector_3d_multiply_scalar(ray_direction, intersection.closest_t));
-  Vector3D sphere_surface_normal = vector_3d_normalize(vector_3d_subtract(
-      intersection_point, intersection.closest_sphere->center));
+  if (intersection.closest_sphere->is_light_source) {
+    return intersection.closest_sphere->color;
+  }
+
+  Vector3D intersection_point, sphere_surface_normal, surface_point;
+  raytracer_hit_point(camera, intersection.closest_sphere, ray_direction,
+                      intersection.closest_t, &intersection_point,
+                      &sphere_surface_normal, &surface_point);
 
   float intensity =
-      intersection.closest_sphere->is_light_source
-          ? 1
-          : compute_lighting(scene, intersection_point, sphere_surface_normal);
+      compute_lighting(scene, intersection_point, sphere_surface_normal,
+                       surface_point, shadows, counters);
 
   return vector_color_multiply_scalar(intersection.closest_sphere->color,
                                       intensity);
 }
 
-void main_raytracer(Scene *scene, Camera *camera, uint32_t *framebuffer,
-                    bool low_resolution) {
-  int half_width = camera->width / 2;
-  int half_height = camera->height / 2;
+/* Primary hits lit together, up to a tile column at a time. */
+#define SHADE_BATCH_SIZE RENDER_TILE_SIZE
+
+_Static_assert(SHADE_BATCH_SIZE % RAY_PACKET_SIZE == 0,
+               "batches hold whole packets");
+
+typedef struct {
+  int pixel[SHADE_BATCH_SIZE]; /* Index into the caller's colours */
+  Vector3D intersection_point[SHADE_BATCH_SIZE];
+  Vector3D normal[SHADE_BATCH_SIZE];
+  Vector3D surface_point[SHADE_BATCH_SIZE];
+  float intensity[SHADE_BATCH_SIZE];
+  int count;
+} LitPoints;
+
+/* Sets blocked[k] when shadow ray k of one light is blocked, as
+ * light_occluded would for each ray. The cached occluder is tried on
+ * every ray first, and the rest go through the BVH together. */
+static void shadow_packet_occluded(Scene *scene, const Vector3D *origins,
+                                   const Vector3D *directions,
+                                   const float *distances, int count,
+                                   int light, ShadowCache *shadows,
+                                   bool *blocked, RenderCounters *counters) {
+  if (!scene->bvh) {
+    for (int k = 0; k < count; k++) {
+      blocked[k] = light_occluded(scene, origins[k], directions[k],
+                                  distances[k], light, shadows, counters);
+    }
+    return;
+  }
+
+  int *cached = &shadows->occluder[light % SHADOW_CACHE_SIZE];
+  Vector3D open_origins[BVH_PACKET_SIZE];
+  Vector3D open_directions[BVH_PACKET_SIZE];
+  float open_distances[BVH_PACKET_SIZE];
+  int open_rays[BVH_PACKET_SIZE];
+  int open_count = 0;
+
+  counters->shadow_rays += count;
+  for (int k = 0; k < count; k++) {
+    blocked[k] = false;
+    if (*cached >= 0) {
+      counters->sphere_tests++;
+      blocked[k] = sphere_blocks_ray(&scene->spheres[*cached], origins[k],
+                                     directions[k], SHADOW_RAY_T_MIN,
+                                     distances[k]);
+    }
+    if (!blocked[k]) {
+      open_origins[open_count] = origins[k];
+      open_directions[open_count] = directions[k];
+      open_distances[open_count] = distances[k];
+      open_rays[open_count++] = k;
+    }
+  }
+  if (open_count == 0) {
+    return;
+  }
 
-  int iterator = low_resolution ? 8 : 1;
+  int occluder[BVH_PACKET_SIZE];
+  counters->sphere_tests += bvh_intersect_shadow_packet(
+      scene->bvh, scene->spheres, open_origins, open_directions, open_count,
+      SHADOW_RAY_T_MIN, open_distances, occluder);
+  for (int k = 0; k < open_count; k++) {
+    if (occluder[k] >= 0) {
+      blocked[open_rays[k]] = true;
+      *cached = occluder[k];
+    }
+  }
+}
+
+/* Shadow rays of one light waiting to be traced as a packet. */
+typedef struct {
+  Vector3D origins[BVH_PACKET_SIZE];
+  Vector3D directions[BVH_PACKET_SIZE];
+  float distances[BVH_PACKET_SIZE];
+  float contributions[BVH_PACKET_SIZE]; /* Added if unblocked */
+  int points[BVH_PACKET_SIZE];
+  int count;
+} ShadowQueue;
+
+static void shadow_queue_flush(Scene *scene, ShadowQueue *queue, int light,
+                               LitPoints *points, ShadowCache *shadows,
+                               RenderCounters *counters) {
+  bool blocked[BVH_PACKET_SIZE];
+  shadow_packet_occluded(scene, queue->origins, queue->directions,
+                         queue->distances, queue->count, light, shadows,
+                         blocked, counters);
+  for (int k = 0; k < queue->count; k++) {
+    if (!blocked[k]) {
+      points->intensity[queue->points[k]] += queue->contributions[k];
+    }
+  }
+  queue->count = 0;
+}
+
+/* Adds one point or directional light to every lit point, computing each
+ * term as light_contribution does, with the shadow rays traced
+ * BVH_PACKET_SIZE at a time. */
+static void light_points(Scene *scene, Light light, int light_index,
+                         LitPoints *points, ShadowCache *shadows,
+                         RenderCounters *counters) {
+  ShadowQueue queue;
+  queue.count = 0;
+
+  for (int p = 0; p < points->count; p++) {
+    Vector3D light_direction =
+        light.type == POINT
+            ? vector_3d_subtract(light.position, points->intersection_point[p])
+            : light.position;
+    float n_dot_l = vector_3d_dot_product(
+        points->normal[p], vector_3d_normalize(light_direction));
+    if (!(n_dot_l > 0)) {
+      continue;
+    }
+
+    float contribution =
+        light.intensity * (n_dot_l / (vector_3d_magnitude(points->normal[p]) *
+                                      vector_3d_magnitude(light_direction)));
+    if (!scene->shadows) {
+      points->intensity[p] += contribution;
+      continue;
+    }
+
+    Vector3D shadow_direction =
+        light.type == POINT
+            ? vector_3d_subtract(light.position, points->surface_point[p])
+            : light_direction;
+    int k = queue.count++;
+    queue.origins[k] = points->surface_point[p];
+    queue.directions[k] = vector_3d_normalize(shadow_direction);
+    queue.distances[k] = light.type == POINT
+                             ? vector_3d_magnitude(shadow_direction)
+                             : INFINITY;
+    queue.contributions[k] = contribution;
+    queue.points[k] = p;
+    if (queue.count == BVH_PACKET_SIZE) {
+      shadow_queue_flush(scene, &queue, light_index, points, shadows,
+                         counters);
+    }
+  }
+
+  if (queue.count > 0) {
+    shadow_queue_flush(scene, &queue, light_index, points, shadows, counters);
+  }
+}
 
-  for (int x = -half_width; x < half_width; x += iterator) {
-    for (int y = -half_height; y < half_height; y += iterator) {
+/* compute_lighting for every point of the batch, with the lights that
+ * every point evaluates taken one at a time over all of them, so that
+ * their shadow rays go through the BVH in packets. Light tree clusters
+ * differ from point to point and are still walked per point, after the
+ * other lights as in compute_lighting. Each point sums its lights in the
+ * same order, so the intensities are the same. */
+static void light_batch(Scene *scene, LitPoints *points,
+                        ShadowCache *shadows, RenderCounters *counters) {
+  const LightTree *tree = scene->light_tree;
+  for (int p = 0; p < points->count; p++) {
+    points->intensity[p] = tree ? tree->ambient : 0.0f;
+  }
+
+  int lights_count = tree ? tree->global_count : scene->lights_count;
+  counters->lighting_evaluations += (uint64_t)lights_count * points->count;
+  for (int k = 0; k < lights_count; k++) {
+    int i = tree ? tree->global_lights[k] : k;
+    if (scene->lights[i].type == AMBIENT) {
+      for (int p = 0; p < points->count; p++) {
+        points->intensity[p] += scene->lights[i].intensity;
+      }
+    } else {
+      light_points(scene, scene->lights[i], i, points, shadows, counters);
+    }
+  }
+
+  if (tree && tree->bvh) {
+    for (int p = 0; p < points->count; p++) {
+      points->intensity[p] += clustered_lighting(
+          scene, tree, points->intersection_point[p], points->normal[p],
+          points->surface_point[p], shadows, counters);
+    }
+  }
+}
+
+/* shade_intersection for up to SHADE_BATCH_SIZE primary hits. With
+ * points set, points[k] and normals[k] are where hit k is lit from, for
+ * the hits on spheres that are not light sources. Without shadows there
+ * are no rays to batch, and unless points are wanted each hit is shaded
+ * alone. */
+static void shade_batch(Scene *scene, Camera *camera,
+                        const Vector3D *directions, const RayHit *hits,
+                        int count, VectorColor *colors, Vector3D *points_out,
+                        Vector3D *normals_out, ShadowCache *shadows,
+                        RenderCounters *counters) {
+  if (!scene->shadows && !points_out) {
+    for (int k = 0; k < count; k++) {
+      colors[k] = shade_intersection(camera, scene, directions[k],
+                                     hit_to_intersection(scene, hits[k]),
+                                     shadows, counters);
+    }
+    return;
+  }
+
+  LitPoints points;
+  points.count = 0;
+  for (int k = 0; k < count; k++) {
+    if (hits[k].sphere < 0) {
+      colors[k] = scene->default_background_color;
+      continue;
+    }
+
+    const Sphere *sphere = &scene->spheres[hits[k].sphere];
+    if (sphere->is_light_source) {
+      colors[k] = sphere->color;
+      continue;
+    }
+
+    int p = points.count++;
+    points.pixel[p] = k;
+    raytracer_hit_point(camera, sphere, directions[k], hits[k].t,
+                        &points.intersection_point[p], &points.normal[p],
+                        &points.surface_point[p]);
+  }
+
+  light_batch(scene, &points, shadows, counters);
+  for (int p = 0; p < points.count; p++) {
+    int k = points.pixel[p];
+    colors[k] = vector_color_multiply_scalar(
+        scene->spheres[hits[k].sphere].color, points.intensity[p]);
+    if (points_out) {
+      points_out[k] = points.intersection_point[p];
+      normals_out[k] = points.normal[p];
+    }
+  }
+}
+
+static inline Vector3D primary_ray_direction(int x, int y, Camera *camera) {
+  Vector3D viewport = canvas_to_viewport(x, y, camera);
+
+  return vector_3d_add(
+      vector_3d_add(vector_3d_multiply_scalar(camera->forward, viewport.z),
+                    vector_3d_multiply_scalar(camera->right, viewport.x)),
+      vector_3d_multiply_scalar(camera->up, viewport.y));
+}
+
+/* Returns the number of spheres tested against each lane. */
+static int intersect_packet(Scene *scene, Camera *camera,
+                            const TileSpheres *tile_spheres,
+                            RayPacket *packet) {
+  if (tile_spheres) {
+    ray_packet_intersect_terms(packet, camera, tile_spheres->terms,
+                               tile_spheres->indices, tile_spheres->count);
+    return tile_spheres->count;
+  }
+  if (scene->bvh) {
+    return bvh_intersect_packet(scene->bvh, camera, scene->spheres, packet);
+  }
+  ray_packet_intersect_spheres(packet, camera, scene->spheres, NULL,
+                               scene->spheres_count);
+  return scene->spheres_count;
+}
+
+/* Colours of a pass, with hits for the target's per pixel buffers, a few
+ * columns at a time. Writing each sample's iterator x iterator block out
+ * a row at a time touches each row once per group rather than once per
+ * column, and fills adjacent pixels together. */
+#define KEPT_COLUMNS 8
+
+typedef struct {
+  int x; /* First column */
+  int y_end;
+  int iterator;
+  int columns;
+  /* Per column: the samples are rows y_first + k * y_step, k < count. */
+  int y_first[KEPT_COLUMNS];
+  int y_step[KEPT_COLUMNS];
+  int count[KEPT_COLUMNS];
+  VectorColor colors[KEPT_COLUMNS][SHADE_BATCH_SIZE];
+  RayHit hits[KEPT_COLUMNS][SHADE_BATCH_SIZE];
+  Vector3D points[KEPT_COLUMNS][SHADE_BATCH_SIZE];
+  Vector3D normals[KEPT_COLUMNS][SHADE_BATCH_SIZE];
+} KeptColumns;
+
+/* Per pixel buffers of a stride 1 target for canvas pixel (x, y). */
+static void put_hit(int x, int y, RayHit hit, Vector3D point,
+                    Vector3D normal, Scene *scene, Camera *camera,
+                    const RenderTarget *target) {
+  int screen_x = (camera->width / 2) - x;
+  int screen_y = (camera->height / 2) - y;
+  if (screen_x < 0 || screen_x >= camera->width || screen_y < 0 ||
+      screen_y >= camera->height) {
+    return;
+  }
+
+  int pixel = screen_y * (int)camera->width + screen_x;
+  target->hits[pixel] = hit;
+  if (target->colors) {
+    target->colors[pixel] = hit.sphere < 0
+                                ? scene->default_background_color
+                                : scene->spheres[hit.sphere].color;
+  }
+  if (target->points) {
+    target->points[pixel] = point;
+    target->normals[pixel] = normal;
+  }
+}
+
+static void put_kept(KeptColumns *kept, Scene *scene, Camera *camera,
+                     const RenderTarget *target) {
+  int iterator = kept->iterator;
+  int next[KEPT_COLUMNS] = {0};
+  int y_begin = kept->y_first[0];
+  for (int c = 1; c < kept->columns; c++) {
+    if (kept->y_first[c] < y_begin) {
+      y_begin = kept->y_first[c];
+    }
+  }
+
+  /* Every sample row is y_begin plus a multiple of iterator. */
+  for (int y = y_begin; y < kept->y_end; y += iterator) {
+    bool sampled[KEPT_COLUMNS];
+    for (int c = 0; c < kept->columns; c++) {
+      int k = next[c];
+      sampled[c] = k < kept->count[c] &&
+                   kept->y_first[c] + k * kept->y_step[c] == y;
+    }
+
+    for (int dy = 0; dy < iterator; dy++) {
+      for (int c = 0; c < kept->columns; c++) {
+        if (sampled[c]) {
+          put_span(kept->x + c * iterator, y + dy, iterator,
+                   kept->colors[c][next[c]], camera, target);
+        }
+      }
+    }
+
+    for (int c = 0; c < kept->columns; c++) {
+      if (!sampled[c]) {
+        continue;
+      }
+      int k = next[c]++;
+      if (target->hits) {
+        put_hit(kept->x + c * iterator, y, kept->hits[c][k],
+                kept->points[c][k], kept->normals[c][k], scene, camera,
+                target);
+      }
+    }
+  }
+  kept->columns = 0;
+}
 
-      Vector3D viewport = canvas_to_viewport(x, y, camera);
+/* Rays are traced in packets of RAY_PACKET_SIZE vertically adjacent
+ * samples of one column; a short packet at the end of a column repeats
+ * its last ray in the unused lanes. Packets test the tile's spheres if
+ * it has a bin, and the BVH otherwise. Each column's hits are then shaded
+ * together.
+ *
+ * With refine set, samples that the pass at twice this stride already
+ * traced (both coordinates on the coarser grid) are skipped. */
+static void render_region(Scene *scene, Camera *camera,
+                          const RenderTarget *target,
+                          const TileSpheres *tile_spheres, int x_begin,
+                          int x_end, int y_begin, int y_end, int iterator,
+                          bool refine, RenderCounters *counters) {
+  RayPacket packet;
+  Vector3D directions[SHADE_BATCH_SIZE];
+  RayHit hits[SHADE_BATCH_SIZE];
+  KeptColumns kept;
+  kept.columns = 0;
+  ShadowCache shadows;
+  raytracer_shadow_cache_init(&shadows);
 
-      Vector3D ray_direction = vector_3d_add(
-          vector_3d_add(vector_3d_multiply_scalar(camera->forward, viewport.z),
-                        vector_3d_multiply_scalar(camera->right, viewport.x)),
-          vector_3d_multiply_scalar(camera->up, viewport.y));
+  for (int x = x_begin; x < x_end; x += iterator) {
+    int y_first = y_begin;
+    int y_step = iterator;
+    if (refine && (x - x_begin) % (2 * iterator) == 0) {
+      y_first += iterator;
+      y_step *= 2;
+    }
 
-      VectorColor color = trace_ray(camera, scene, ray_direction);
-      if (low_resolution) {
-        for (int dx = 0; dx < iterator; dx++) {
-          for (int dy = 0; dy < iterator; dy++) {
-            put_pixel(x + dx, y + dy, color, camera, framebuffer);
+    for (int y_batch = y_first; y_batch < y_end;
+         y_batch += y_step * SHADE_BATCH_SIZE) {
+      int count = 0;
+      for (int y = y_batch; y < y_end && count < SHADE_BATCH_SIZE;
+           y += y_step * RAY_PACKET_SIZE) {
+        Vector3D *packet_directions = &directions[count];
+        int lanes = 0;
+        for (int lane = 0; lane < RAY_PACKET_SIZE; lane++) {
+          int lane_y = y + lane * y_step;
+          if (lane_y < y_end) {
+            packet_directions[lane] = primary_ray_direction(x, lane_y, camera);
+            lanes++;
+          } else {
+            packet_directions[lane] = packet_directions[lanes - 1];
           }
         }
-      } else {
-        put_pixel(x, y, color, camera, framebuffer);
+
+        ray_packet_init(&packet, camera, packet_directions);
+        int spheres_tested =
+            intersect_packet(scene, camera, tile_spheres, &packet);
+
+        counters->primary_rays += lanes;
+        counters->sphere_tests += (uint64_t)spheres_tested * lanes;
+
+        for (int lane = 0; lane < lanes; lane++) {
+          counters->hits += packet.closest_sphere[lane] >= 0;
+          hits[count + lane] = (RayHit){.t = packet.closest_t[lane],
+                                        .sphere = packet.closest_sphere[lane]};
+        }
+        count += lanes;
+      }
+
+      /* Regions are at most a tile high, so a column is a single batch,
+       * kept for writing out with its neighbours. */
+      int c = kept.columns;
+      shade_batch(scene, camera, directions, hits, count, kept.colors[c],
+                  target->points ? kept.points[c] : NULL, kept.normals[c],
+                  &shadows, counters);
+      if (c == 0) {
+        kept.x = x;
+        kept.y_end = y_end;
+        kept.iterator = iterator;
+      }
+      kept.y_first[c] = y_first;
+      kept.y_step[c] = y_step;
+      kept.count[c] = count;
+      if (target->hits) {
+        memcpy(kept.hits[c], hits, sizeof(RayHit) * (size_t)count);
       }
+      if (++kept.columns == KEPT_COLUMNS) {
+        put_kept(&kept, scene, camera, target);
+      }
+    }
+  }
+
+  if (kept.columns > 0) {
+    put_kept(&kept, scene, camera, target);
+  }
+}
+
+/* Fills tile_spheres with a tile's bin and returns it, or returns NULL
+ * when the tile should use the BVH. A crowded bin, as when a distant scene
+ * covers a few tiles, costs more to test whole than the BVH with its early
+ * exit at the nearest hit. */
+static const TileSpheres *tile_spheres_of(const TileBins *bins,
+                                          const Scene *scene, int tile,
+                                          TileSpheres *tile_spheres) {
+  if (!bins || tile < 0) {
+    return NULL;
+  }
+
+  *tile_spheres = (TileSpheres){
+      .terms = bins->terms,
+      .indices = &bins->indices[bins->offsets[tile]],
+      .count = bins->offsets[tile + 1] - bins->offsets[tile]};
+  if (tile_spheres->count > TILE_BINS_MAX_SPHERES && scene->bvh) {
+    return NULL;
+  }
+  return tile_spheres;
+}
+
+/* The bins if the last build was for this scene and camera. Builds only
+ * happen between raytracer_run calls, so tasks can read them freely. */
+static const TileBins *current_bins(Scene *scene, Camera *camera) {
+  return primary_bins && tile_bins_match(primary_bins, scene, camera)
+             ? primary_bins
+             : NULL;
+}
+
+/* Tile whose rays pass through screen pixel (x, y), or -1 outside the
+ * tiles and the pixel of margin their bins cover. */
+static int pixel_tile(Camera *camera, int screen_x, int screen_y) {
+  int half_width = camera->width / 2;
+  int half_height = camera->height / 2;
+  int tiles_x = (2 * half_width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  int tiles_y = (2 * half_height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  int x = 2 * half_width - screen_x; /* Canvas x + half_width */
+  int y = 2 * half_height - screen_y;
+  if (x < -1 || x > 2 * half_width || y < -1 || y > 2 * half_height) {
+    return -1;
+  }
+
+  int column = x < 0 ? 0 : x / RENDER_TILE_SIZE;
+  int row = y < 0 ? 0 : y / RENDER_TILE_SIZE;
+  column = column < tiles_x ? column : tiles_x - 1;
+  row = row < tiles_y ? row : tiles_y - 1;
+  return row * tiles_x + column;
+}
+
+typedef struct {
+  Scene *scene;
+  Camera *camera;
+  RenderTarget target;
+  const TileBins *bins; /* Of this frame, or NULL to use the BVH */
+  int iterator;
+  bool refine;
+  int first_tile;
+  int half_width;
+  int half_height;
+  int tiles_x;
+} TileJob;
+
+/* Tiles are laid out in canvas coordinates and RENDER_TILE_SIZE is a
+ * multiple of every pass stride, so every block is traced by exactly one
+ * tile and the output does not depend on scheduling. Renders columns_count
+ * of the tile's columns from first_column. */
+static void render_tile_columns(TileJob *job, int tile, int first_column,
+                                int columns_count, RenderCounters *counters) {
+  int tile_x = -job->half_width + (tile % job->tiles_x) * RENDER_TILE_SIZE;
+  int y_begin = -job->half_height + (tile / job->tiles_x) * RENDER_TILE_SIZE;
+
+  int x_begin = tile_x + first_column;
+  int x_end = x_begin + columns_count;
+  int y_end = y_begin + RENDER_TILE_SIZE;
+  if (x_end > tile_x + RENDER_TILE_SIZE) {
+    x_end = tile_x + RENDER_TILE_SIZE;
+  }
+  if (x_end > job->half_width) {
+    x_end = job->half_width;
+  }
+  if (y_end > job->half_height) {
+    y_end = job->half_height;
+  }
+
+  TileSpheres tile_spheres;
+  render_region(job->scene, job->camera, &job->target,
+                tile_spheres_of(job->bins, job->scene, tile, &tile_spheres),
+                x_begin, x_end, y_begin, y_end, job->iterator, job->refine,
+                counters);
+}
+
+static void render_tile_task(void *context, int task_index,
+                             RenderCounters *counters) {
+  TileJob *job = context;
+  render_tile_columns(job, job->first_tile + task_index, 0, RENDER_TILE_SIZE,
+                      counters);
+}
+
+typedef struct {
+  RenderTask task;
+  void *context;
+} RenderJob;
+
+static void render_job_task(void *context, int task_index, int worker_index) {
+  RenderJob *job = context;
+  job->task(job->context, task_index,
+            &worker_counters[worker_index].counters);
+}
+
+void raytracer_init(int thread_count) {
+  raytracer_quit();
+  render_pool = thread_pool_create(thread_count);
+  if (!render_pool) {
+    return;
+  }
+
+  worker_counters = aligned_alloc(
+      _Alignof(WorkerCounters),
+      sizeof(WorkerCounters) * thread_pool_thread_count(render_pool));
+  if (!worker_counters) {
+    raytracer_quit();
+  }
+}
+
+void raytracer_quit(void) {
+  thread_pool_destroy(render_pool);
+  render_pool = NULL;
+  free(worker_counters);
+  worker_counters = NULL;
+  tile_bins_destroy(primary_bins);
+  primary_bins = NULL;
+}
+
+int raytracer_thread_count(void) {
+  return render_pool ? thread_pool_thread_count(render_pool) : 1;
+}
+
+int raytracer_tiles_count(Camera *camera) {
+  int half_width = camera->width / 2;
+  int half_height = camera->height / 2;
+  int tiles_x = (2 * half_width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  int tiles_y = (2 * half_height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  return tiles_x * tiles_y;
+}
+
+/* Canvas x maps to screen column half_width - x, and likewise for y. */
+void raytracer_tile_rect(Camera *camera, int tile, int *x, int *y,
+                         int *width, int *height) {
+  int half_width = camera->width / 2;
+  int half_height = camera->height / 2;
+  int tiles_x = (2 * half_width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  int x_begin = -half_width + (tile % tiles_x) * RENDER_TILE_SIZE;
+  int y_begin = -half_height + (tile / tiles_x) * RENDER_TILE_SIZE;
+  int x_end = x_begin + RENDER_TILE_SIZE < half_width
+                  ? x_begin + RENDER_TILE_SIZE
+                  : half_width;
+  int y_end = y_begin + RENDER_TILE_SIZE < half_height
+                  ? y_begin + RENDER_TILE_SIZE
+                  : half_height;
+
+  int first_column = half_width - x_end + 1;
+  int last_column = half_width - x_begin < (int)camera->width - 1
+                        ? half_width - x_begin
+                        : (int)camera->width - 1;
+  int first_row = half_height - y_end + 1;
+  int last_row = half_height - y_begin < (int)camera->height - 1
+                     ? half_height - y_begin
+                     : (int)camera->height - 1;
+
+  *x = first_column;
+  *y = first_row;
+  *width = last_column >= first_column ? last_column - first_column + 1 : 0;
+  *height = last_row >= first_row ? last_row - first_row + 1 : 0;
+}
+
+void raytracer_run(int task_count, RenderTask task, void *context) {
+  frame_counters = (RenderCounters){0};
+
+  if (!render_pool) {
+    for (int i = 0; i < task_count; i++) {
+      task(context, i, &frame_counters);
+    }
+    raytracer_counters_add(&total_counters, &frame_counters);
+    return;
+  }
+
+  int thread_count = thread_pool_thread_count(render_pool);
+  for (int i = 0; i < thread_count; i++) {
+    worker_counters[i].counters = (RenderCounters){0};
+  }
+
+  RenderJob job = {.task = task, .context = context};
+  thread_pool_run(render_pool, task_count, render_job_task, &job);
+
+  for (int i = 0; i < thread_count; i++) {
+    raytracer_counters_add(&frame_counters, &worker_counters[i].counters);
+  }
+  raytracer_counters_add(&total_counters, &frame_counters);
+}
+
+void raytracer_prepare_frame(Scene *scene, Camera *camera) {
+  if (!primary_bins) {
+    primary_bins = tile_bins_create();
+    if (!primary_bins) {
+      return;
+    }
+  }
+  /* On failure the bins match nothing, leaving the BVH to do the work. */
+  tile_bins_build(primary_bins, scene, camera);
+}
+
+/* A pass from tile 0 starts a frame and rebuilds the bins; later passes
+ * of the frame, such as progressive refinement's batches, reuse them
+ * while the scene and camera are unchanged. */
+static const TileBins *frame_bins(Scene *scene, Camera *camera,
+                                  int first_tile) {
+  if (first_tile == 0 || !current_bins(scene, camera)) {
+    raytracer_prepare_frame(scene, camera);
+  }
+  return current_bins(scene, camera);
+}
+
+static void render_pass(Scene *scene, Camera *camera, RenderTarget target,
+                        int stride, bool refine, int first_tile,
+                        int tiles_count) {
+  int half_width = camera->width / 2;
+  int half_height = camera->height / 2;
+  if (target.stride == 0) {
+    target.stride = camera->width;
+  }
+
+  TileJob job = {.scene = scene,
+                 .camera = camera,
+                 .target = target,
+                 .bins = frame_bins(scene, camera, first_tile),
+                 .iterator = stride,
+                 .refine = refine,
+                 .first_tile = first_tile,
+                 .half_width = half_width,
+                 .half_height = half_height,
+                 .tiles_x = (2 * half_width + RENDER_TILE_SIZE - 1) /
+                            RENDER_TILE_SIZE};
+
+  raytracer_run(tiles_count, render_tile_task, &job);
+}
+
+void raytracer_render_pass(Scene *scene, Camera *camera,
+                           uint32_t *framebuffer, int stride, bool refine,
+                           int first_tile, int tiles_count) {
+  render_pass(scene, camera, (RenderTarget){.framebuffer = framebuffer},
+              stride, refine, first_tile, tiles_count);
+}
+
+void raytracer_render_pass_hdr(Scene *scene, Camera *camera, HdrImage *hdr,
+                               int stride, bool refine, int first_tile,
+                               int tiles_count) {
+  render_pass(scene, camera, (RenderTarget){.hdr = hdr}, stride, refine,
+              first_tile, tiles_count);
+}
+
+void raytracer_render_tile(Scene *scene, Camera *camera, int tile,
+                           uint32_t *pixels, RenderCounters *counters) {
+  raytracer_render_tile_columns(scene, camera, tile, 0, RENDER_TILE_SIZE,
+                                pixels, counters);
+}
+
+void raytracer_render_tile_columns(Scene *scene, Camera *camera, int tile,
+                                   int first_column, int columns_count,
+                                   uint32_t *pixels,
+                                   RenderCounters *counters) {
+  int x, y, width, height;
+  raytracer_tile_rect(camera, tile, &x, &y, &width, &height);
+
+  int half_width = camera->width / 2;
+  int half_height = camera->height / 2;
+  TileJob job = {.scene = scene,
+                 .camera = camera,
+                 .bins = current_bins(scene, camera),
+                 .target = (RenderTarget){.framebuffer = pixels,
+                                          .origin_x = x,
+                                          .origin_y = y,
+                                          .stride = width},
+                 .iterator = 1,
+                 .half_width = half_width,
+                 .half_height = half_height,
+                 .tiles_x = (2 * half_width + RENDER_TILE_SIZE - 1) /
+                            RENDER_TILE_SIZE};
+  render_tile_columns(&job, tile, first_column, columns_count, counters);
+}
+
+void main_raytracer(Scene *scene, Camera *camera, uint32_t *framebuffer,
+                    bool low_resolution) {
+  raytracer_render_pass(scene, camera, framebuffer,
+                        low_resolution ? RENDER_COARSEST_STRIDE : 1, false, 0,
+                        raytracer_tiles_count(camera));
+}
+
+void raytracer_render_hits(Scene *scene, Camera *camera,
+                           uint32_t *framebuffer, RayHit *hits,
+                           Vector3D *points, Vector3D *normals,
+                           VectorColor *colors) {
+  render_pass(scene, camera,
+              (RenderTarget){.framebuffer = framebuffer,
+                             .hits = hits,
+                             .points = points,
+                             .normals = normals,
+                             .colors = colors},
+              1, false, 0, raytracer_tiles_count(camera));
+}
+
+void main_raytracer_hdr(Scene *scene, Camera *camera, HdrImage *hdr,
+                        RayHit *hits, bool low_resolution) {
+  render_pass(scene, camera,
+              (RenderTarget){.hdr = hdr,
+                             .hits = low_resolution ? NULL : hits},
+              low_resolution ? RENDER_COARSEST_STRIDE : 1, false, 0,
+              raytracer_tiles_count(camera));
+}
+
+RenderCounters raytracer_frame_counters(void) { return frame_counters; }
+
+RenderCounters raytracer_total_counters(void) { return total_counters; }
+
+void raytracer_counters_add(RenderCounters *total,
+                            const RenderCounters *counters) {
+  total->primary_rays += counters->primary_rays;
+  total->sphere_tests += counters->sphere_tests;
+  total->shadow_rays += counters->shadow_rays;
+  total->hits += counters->hits;
+  total->lighting_evaluations += counters->lighting_evaluations;
+  total->reflection_rays += counters->reflection_rays;
+}
+
+RenderCounters raytracer_counters_subtract(RenderCounters a,
+                                           RenderCounters b) {
+  return (RenderCounters){
+      .primary_rays = a.primary_rays - b.primary_rays,
+      .sphere_tests = a.sphere_tests - b.sphere_tests,
+      .shadow_rays = a.shadow_rays - b.shadow_rays,
+      .hits = a.hits - b.hits,
+      .lighting_evaluations = a.lighting_evaluations - b.lighting_evaluations,
+      .reflection_rays = a.reflection_rays - b.reflection_rays};
+}
+
+Vector3D raytracer_pixel_ray(Camera *camera, int screen_x, int screen_y) {
+  return primary_ray_direction((int)camera->width / 2 - screen_x,
+                               (int)camera->height / 2 - screen_y, camera);
+}
+
+RayHit raytracer_trace(Scene *scene, Camera *camera, int screen_x,
+                       int screen_y, RenderCounters *counters) {
+  TileSpheres tile_spheres;
+  const TileSpheres *bin =
+      tile_spheres_of(current_bins(scene, camera), scene,
+                      pixel_tile(camera, screen_x, screen_y), &tile_spheres);
+
+  counters->primary_rays++;
+  return intersection_to_hit(
+      scene, closest_intersection(camera, scene, bin,
+                                  raytracer_pixel_ray(camera, screen_x,
+                                                      screen_y),
+                                  counters));
+}
+
+void raytracer_trace_pixels(Scene *scene, Camera *camera,
+                            const int *screen_x, const int *screen_y,
+                            int count, Vector3D *directions, RayHit *hits,
+                            RenderCounters *counters) {
+  const TileBins *bins = current_bins(scene, camera);
+  RayPacket packet;
+  Vector3D lanes_directions[RAY_PACKET_SIZE];
+
+  for (int i = 0; i < count; i++) {
+    directions[i] = raytracer_pixel_ray(camera, screen_x[i], screen_y[i]);
+  }
+
+  /* A packet holds consecutive pixels of one tile, so it has one bin. */
+  int first = 0;
+  while (first < count) {
+    int tile = pixel_tile(camera, screen_x[first], screen_y[first]);
+    int lanes = 1;
+    while (lanes < RAY_PACKET_SIZE && first + lanes < count &&
+           pixel_tile(camera, screen_x[first + lanes],
+                      screen_y[first + lanes]) == tile) {
+      lanes++;
+    }
+    for (int lane = 0; lane < RAY_PACKET_SIZE; lane++) {
+      lanes_directions[lane] =
+          directions[first + (lane < lanes ? lane : lanes - 1)];
     }
+
+    TileSpheres tile_spheres;
+    ray_packet_init(&packet, camera, lanes_directions);
+    int spheres_tested = intersect_packet(
+        scene, camera, tile_spheres_of(bins, scene, tile, &tile_spheres),
+        &packet);
+
+    counters->primary_rays += lanes;
+    counters->sphere_tests += (uint64_t)spheres_tested * lanes;
+    for (int lane = 0; lane < lanes; lane++) {
+      counters->hits += packet.closest_sphere[lane] >= 0;
+      hits[first + lane] = (RayHit){.t = packet.closest_t[lane],
+                                    .sphere = packet.closest_sphere[lane]};
+    }
+    first += lanes;
+  }
+}
+
+RayHit raytracer_trace_sphere(Scene *scene, Camera *camera,
+                              Vector3D ray_direction, int sphere,
+                              RenderCounters *counters) {
+  RayHit hit = {.t = camera->ray_t_max, .sphere = -1};
+  SphereIntersections sphere_intersections = calculate_sphere_intersection(
+      camera, &scene->spheres[sphere], ray_direction);
+  counters->sphere_tests++;
+
+  if (in_camera_range(*camera, sphere_intersections.t1) &&
+      sphere_intersections.t1 < hit.t) {
+    hit = (RayHit){.t = sphere_intersections.t1, .sphere = sphere};
+  }
+  if (in_camera_range(*camera, sphere_intersections.t2) &&
+      sphere_intersections.t2 < hit.t) {
+    hit = (RayHit){.t = sphere_intersections.t2, .sphere = sphere};
+  }
+
+  return hit;
+}
+
+void raytracer_trace_from(Scene *scene, const Vector3D *origins,
+                          const Vector3D *directions, int count,
+                          RayHit *hits, RenderCounters *counters) {
+  SecondaryRayPacket packet;
+  secondary_ray_packet_init(&packet, origins, directions, count);
+  counters->reflection_rays += count;
+
+  if (scene->bvh) {
+    counters->sphere_tests += bvh_intersect_closest_packet(
+        scene->bvh, scene->spheres, &packet, REFLECTION_RAY_T_MIN);
+  } else {
+    counters->sphere_tests += (uint64_t)scene->spheres_count * count;
+    secondary_ray_packet_intersect(&packet, scene->spheres, NULL,
+                                   scene->spheres_count,
+                                   REFLECTION_RAY_T_MIN, (1 << count) - 1);
+  }
+
+  for (int lane = 0; lane < count; lane++) {
+    hits[lane] = (RayHit){.t = packet.closest_t[lane],
+                          .sphere = packet.closest_sphere[lane]};
   }
 }
+
+void raytracer_shadow_cache_init(ShadowCache *shadows) {
+  for (int i = 0; i < SHADOW_CACHE_SIZE; i++) {
+    shadows->occluder[i] = -1;
+  }
+}
+
+VectorColor raytracer_shade(Scene *scene, Camera *camera,
+                            Vector3D ray_direction, RayHit hit,
+                            ShadowCache *shadows, RenderCounters *counters) {
+  return shade_intersection(camera, scene, ray_direction,
+                            hit_to_intersection(scene, hit), shadows,
+                            counters);
+}
+
+void raytracer_shade_pixels(Scene *scene, Camera *camera,
+                            const Vector3D *directions, const RayHit *hits,
+                            int count, VectorColor *colors,
+                            ShadowCache *shadows, RenderCounters *counters) {
+  for (int first = 0; first < count; first += SHADE_BATCH_SIZE) {
+    int batch = count - first < SHADE_BATCH_SIZE ? count - first
+                                                 : SHADE_BATCH_SIZE;
+    shade_batch(scene, camera, &directions[first], &hits[first], batch,
+                &colors[first], NULL, NULL, shadows, counters);
+  }
+}
+
+void raytracer_light_points(Scene *scene, const Vector3D *points,
+                            const Vector3D *normals,
+                            const Vector3D *surface_points, int count,
+                            float *intensities, ShadowCache *shadows,
+                            RenderCounters *counters) {
+  LitPoints batch;
+  for (int first = 0; first < count; first += SHADE_BATCH_SIZE) {
+    batch.count = count - first < SHADE_BATCH_SIZE ? count - first
+                                                   : SHADE_BATCH_SIZE;
+    for (int p = 0; p < batch.count; p++) {
+      batch.intersection_point[p] = points[first + p];
+      batch.normal[p] = normals[first + p];
+      batch.surface_point[p] = surface_points[first + p];
+    }
+
+    light_batch(scene, &batch, shadows, counters);
+    for (int p = 0; p < batch.count; p++) {
+      intensities[first + p] = batch.intensity[p];
+    }
+  }
+}
+
+VectorColor raytracer_shade_point(Scene *scene, int sphere, Vector3D point,
+                                  ShadowCache *shadows,
+                                  RenderCounters *counters) {
+  const Sphere *hit_sphere = &scene->spheres[sphere];
+  if (hit_sphere->is_light_source) {
+    return hit_sphere->color;
+  }
+
+  Vector3D normal =
+      vector_3d_normalize(vector_3d_subtract(point, hit_sphere->center));
+  float intensity =
+      compute_lighting(scene, point, normal, point, shadows, counters);
+  return vector_color_multiply_scalar(hit_sphere->color, intensity);
+}
@@ -4,8 +4,331 @@
 #include <stdint.h>
 
 #include "camera.h"
+#include "constants.h"
+#include "hdr.h"
 #include "scene.h"
+#include "sphere.h"
+#include "vector_3d.h"
+#include "vector_color.h"
+
+/**
+ * @struct RenderCounters
+ * @brief Work done by one main_raytracer call.
+ */
+typedef struct {
+  uint64_t primary_rays;         /**< Camera rays traced */
+  uint64_t sphere_tests;         /**< Ray-sphere intersection tests */
+  uint64_t shadow_rays;          /**< Light visibility queries */
+  uint64_t hits;                 /**< Camera rays that hit a sphere */
+  uint64_t lighting_evaluations; /**< Lights evaluated at shaded points */
+  uint64_t reflection_rays;      /**< Mirror reflection rays traced */
+} RenderCounters;
+
+/**
+ * @struct ShadowCache
+ * @brief Last sphere found blocking each light.
+ *
+ * Neighbouring pixels are mostly shadowed by the same sphere, so a shadow
+ * ray tests it before traversing the BVH. Each render task keeps its own
+ * cache. Lights share slots modulo SHADOW_CACHE_SIZE; a stale entry only
+ * costs one extra test.
+ */
+typedef struct {
+  int occluder[SHADOW_CACHE_SIZE]; /**< Sphere index, -1 for none */
+} ShadowCache;
+
+/**
+ * @struct RayHit
+ * @brief Nearest hit of one camera ray.
+ */
+typedef struct {
+  float t;    /**< Ray parameter as reported by calculate_sphere_intersection */
+  int sphere; /**< Index into the scene spheres, -1 for a miss */
+} RayHit;
+
+/** True ray parameter of a primary hit, from its reported t. */
+static inline float raytracer_true_t(Vector3D ray_direction, float t) {
+  float quadratic_a = vector_3d_dot_product(ray_direction, ray_direction);
+  return t / (quadratic_a * quadratic_a);
+}
+
+/**
+ * @brief Where a primary hit on a lit sphere is shaded.
+ *
+ * Lighting is evaluated at point, found from the reported t, with the
+ * sphere's unit normal there. Shadow rays start from surface_point, the
+ * true hit, so that they leave from the sphere surface.
+ */
+static inline void raytracer_hit_point(const Camera *camera,
+                                       const Sphere *sphere,
+                                       Vector3D ray_direction, float t,
+                                       Vector3D *point, Vector3D *normal,
+                                       Vector3D *surface_point) {
+  *point = vector_3d_add(camera->position,
+                         vector_3d_multiply_scalar(ray_direction, t));
+  *normal = vector_3d_normalize(vector_3d_subtract(*point, sphere->center));
+  *surface_point = vector_3d_add(
+      camera->position,
+      vector_3d_multiply_scalar(ray_direction,
+                                raytracer_true_t(ray_direction, t)));
+}
+
+/**
+ * @brief One task of a raytracer_run call.
+ *
+ * @param counters Counters of the render thread running the task
+ */
+typedef void (*RenderTask)(void *context, int task_index,
+                           RenderCounters *counters);
+
+/**
+ * @brief Start the render thread pool.
+ *
+ * @param thread_count Number of render threads; 0 uses every online CPU
+ *
+ * Until this is called main_raytracer renders on the calling thread.
+ * The framebuffer is identical for every thread count.
+ */
+void raytracer_init(int thread_count);
+
+/**
+ * @brief Stop the render thread pool.
+ */
+void raytracer_quit(void);
+
+int raytracer_thread_count(void);
 
 void main_raytracer(Scene *scene, Camera *camera, uint32_t *framebuffer, bool low_resolution);
 
+/**
+ * @brief main_raytracer into linear float pixels, left for
+ *        hdr_image_tonemap to pack.
+ *
+ * hdr must be camera width x height. Like the framebuffer, its first row
+ * and column are not written.
+ *
+ * @param hits Out, or NULL: nearest hit per pixel, at full resolution only
+ */
+void main_raytracer_hdr(Scene *scene, Camera *camera, HdrImage *hdr,
+                        RayHit *hits, bool low_resolution);
+
+/**
+ * @brief main_raytracer at full resolution that also keeps every pixel's
+ *        nearest hit and what it is shaded from.
+ *
+ * Each output is camera width x height, in rows of screen pixels.
+ *
+ * @param hits Out: nearest hit per pixel
+ * @param points Out, or NULL: for pixels on spheres that are not light
+ *        sources, the point lighting is evaluated at
+ * @param normals Out, with points: the unit normal there
+ * @param colors Out, or NULL: the sphere or background colour per pixel
+ */
+void raytracer_render_hits(Scene *scene, Camera *camera,
+                           uint32_t *framebuffer, RayHit *hits,
+                           Vector3D *points, Vector3D *normals,
+                           VectorColor *colors);
+
+/**
+ * @brief Number of RENDER_TILE_SIZE tiles covering the camera image.
+ */
+int raytracer_tiles_count(Camera *camera);
+
+/**
+ * @brief Screen pixels a full resolution pass writes for one tile:
+ *        columns [x, x + width) of rows [y, y + height).
+ *
+ * Either size is 0 when the tile only covers the unwritten first row or
+ * column.
+ */
+void raytracer_tile_rect(Camera *camera, int tile, int *x, int *y,
+                         int *width, int *height);
+
+/**
+ * @brief Trace one pass over tiles [first_tile, first_tile + tiles_count).
+ *
+ * @param stride Trace every stride-th pixel in x and y and fill the
+ *               stride x stride block it starts
+ * @param refine Skip the samples already traced by the pass at twice this
+ *               stride
+ *
+ * A pass at RENDER_COARSEST_STRIDE followed by refining passes at half
+ * the stride down to 1 writes exactly the full resolution frame.
+ *
+ * A pass from tile 0 starts a frame: it bins the spheres by the tiles
+ * they can cover (tile_bins.h), and later passes reuse the bins while the
+ * scene and camera are unchanged.
+ */
+void raytracer_render_pass(Scene *scene, Camera *camera,
+                           uint32_t *framebuffer, int stride, bool refine,
+                           int first_tile, int tiles_count);
+
+/**
+ * @brief raytracer_render_pass into linear float pixels, left for
+ *        hdr_image_tonemap_rect to pack the tiles traced.
+ */
+void raytracer_render_pass_hdr(Scene *scene, Camera *camera, HdrImage *hdr,
+                               int stride, bool refine, int first_tile,
+                               int tiles_count);
+
+/**
+ * @brief Trace one tile at full resolution into a buffer of its own.
+ *
+ * pixels receives the tile's raytracer_tile_rect, row by row, so frames
+ * can be rendered without a framebuffer of their size. Unlike the other
+ * render calls this runs on the calling thread; call it from a
+ * raytracer_run task to spread tiles over the render threads. Its rays
+ * test the tile's bin after raytracer_prepare_frame.
+ *
+ * @param pixels At least RENDER_TILE_SIZE x RENDER_TILE_SIZE pixels
+ */
+void raytracer_render_tile(Scene *scene, Camera *camera, int tile,
+                           uint32_t *pixels, RenderCounters *counters);
+
+/**
+ * @brief raytracer_render_tile for columns_count of the tile's columns
+ *        from first_column, counted in tracing order from 0.
+ *
+ * The columns traced are the same whatever the split, so raytracer_run
+ * tasks can share one tile's pixels by rendering different columns.
+ */
+void raytracer_render_tile_columns(Scene *scene, Camera *camera, int tile,
+                                   int first_column, int columns_count,
+                                   uint32_t *pixels,
+                                   RenderCounters *counters);
+
+/**
+ * @brief Counters of the most recent main_raytracer or
+ *        raytracer_render_pass call.
+ *
+ * Each render thread counts into its own slot; the slots are summed when
+ * the frame completes.
+ */
+RenderCounters raytracer_frame_counters(void);
+
+/**
+ * @brief Counters summed over every render call since startup.
+ *
+ * Unlike raytracer_frame_counters this covers every pass of a displayed
+ * frame; the difference between two readings is the work in between.
+ */
+RenderCounters raytracer_total_counters(void);
+
+void raytracer_counters_add(RenderCounters *total,
+                            const RenderCounters *counters);
+
+RenderCounters raytracer_counters_subtract(RenderCounters a,
+                                           RenderCounters b);
+
+/**
+ * @brief Run task_count tasks on the render threads and wait for them.
+ *
+ * The counters the tasks add to become the frame counters, as for
+ * raytracer_render_pass.
+ */
+void raytracer_run(int task_count, RenderTask task, void *context);
+
+/**
+ * @brief Direction of the primary ray through a framebuffer pixel.
+ */
+Vector3D raytracer_pixel_ray(Camera *camera, int screen_x, int screen_y);
+
+/**
+ * @brief Bin the spheres by the tiles they can cover, for a frame traced
+ *        through raytracer_trace, raytracer_trace_pixels or
+ *        raytracer_render_tile.
+ *
+ * Call it before the frame's raytracer_run, whenever the scene or camera
+ * changed; until then those calls test the BVH. Render passes from tile 0
+ * do it themselves.
+ */
+void raytracer_prepare_frame(Scene *scene, Camera *camera);
+
+/**
+ * @brief Nearest hit of the primary ray through a framebuffer pixel, as a
+ *        full frame would find it.
+ */
+RayHit raytracer_trace(Scene *scene, Camera *camera, int screen_x,
+                       int screen_y, RenderCounters *counters);
+
+/**
+ * @brief Nearest hits of the primary rays through count framebuffer
+ *        pixels, traced in packets as full frames trace them.
+ *
+ * Gives the hits raytracer_trace gives. A packet holds consecutive pixels
+ * of one render tile, so pass neighbouring pixels together, such as runs
+ * down a column.
+ *
+ * @param directions Out: each pixel's raytracer_pixel_ray
+ */
+void raytracer_trace_pixels(Scene *scene, Camera *camera,
+                            const int *screen_x, const int *screen_y,
+                            int count, Vector3D *directions, RayHit *hits,
+                            RenderCounters *counters);
+
+/**
+ * @brief Nearest hit of one primary ray with a single sphere.
+ */
+RayHit raytracer_trace_sphere(Scene *scene, Camera *camera,
+                              Vector3D ray_direction, int sphere,
+                              RenderCounters *counters);
+
+/**
+ * @brief Nearest hits of up to SECONDARY_RAY_PACKET_SIZE rays starting
+ *        anywhere, such as reflections.
+ *
+ * The rays are traversed together, so they should be alike. Unlike
+ * raytracer_trace, hit t is the true ray parameter. Hits closer than
+ * REFLECTION_RAY_T_MIN are ignored so that a ray does not hit the surface
+ * it leaves from. Counted as reflection rays.
+ */
+void raytracer_trace_from(Scene *scene, const Vector3D *origins,
+                          const Vector3D *directions, int count,
+                          RayHit *hits, RenderCounters *counters);
+
+void raytracer_shadow_cache_init(ShadowCache *shadows);
+
+/**
+ * @brief Colour of a primary ray hit, or the background for a miss.
+ *
+ * Shadow rays, when the scene has shadows, are added to counters.
+ */
+VectorColor raytracer_shade(Scene *scene, Camera *camera,
+                            Vector3D ray_direction, RayHit hit,
+                            ShadowCache *shadows, RenderCounters *counters);
+
+/**
+ * @brief raytracer_shade for count primary hits, such as those
+ *        raytracer_trace_pixels returns.
+ *
+ * The hits are lit one light at a time, so their shadow rays are traced
+ * in packets; pass neighbouring pixels together. The colours are the ones
+ * raytracer_shade gives.
+ */
+void raytracer_shade_pixels(Scene *scene, Camera *camera,
+                            const Vector3D *directions, const RayHit *hits,
+                            int count, VectorColor *colors,
+                            ShadowCache *shadows, RenderCounters *counters);
+
+/**
+ * @brief Light reaching count primary hits from their raytracer_hit_point
+ *        terms, as raytracer_shade sums it.
+ *
+ * A hit's colour is its sphere's colour times its intensity. The points
+ * are lit one light at a time as in raytracer_shade_pixels, so pass
+ * neighbouring pixels together.
+ */
+void raytracer_light_points(Scene *scene, const Vector3D *points,
+                            const Vector3D *normals,
+                            const Vector3D *surface_points, int count,
+                            float *intensities, ShadowCache *shadows,
+                            RenderCounters *counters);
+
+/**
+ * @brief Colour of a point on a sphere, lit by every scene light.
+ */
+VectorColor raytracer_shade_point(Scene *scene, int sphere, Vector3D point,
+                                  ShadowCache *shadows,
+                                  RenderCounters *counters);
+
 #endif /* RAYTRACER_H */
@@ -0,0 +1,240 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adaptive.h"
+#include "progressive.h"
+#include "render_thread.h"
+#include "timer.h"
+
+#define RENDER_THREAD_BUFFERS 3
+
+struct RenderThread {
+  RenderThreadConfig config;
+  pthread_t thread;
+  size_t pixel_count;
+
+  uint32_t *work; /* Rendered into; render thread only */
+  HdrImage *hdr;  /* Progressive samples before packing into work */
+  uint32_t *buffers[RENDER_THREAD_BUFFERS];
+  int back;          /* Being filled; render thread only */
+  int ready;         /* Newest completed frame */
+  int front;         /* Being presented; presenting thread only */
+  bool ready_is_new; /* ready has not been acquired yet */
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  Camera camera; /* Newest posted pose */
+  unsigned long camera_version;
+  bool shutting_down;
+  RenderCounters counters; /* Since the last acquire */
+  double trace_ms;
+};
+
+/* One step of what SDL_AppIterate used to do per frame: a full moving
+ * frame by reprojection, subdivision, foveation or dynamic resolution, or
+ * one budget of progressive refinement. */
+static void render_step(RenderThread *render_thread,
+                        ProgressiveRenderer *progressive, Camera *camera,
+                        bool moved) {
+  const RenderThreadConfig *config = &render_thread->config;
+
+  if (moved && (config->temporal || config->adaptive || config->foveated ||
+                config->dynamic)) {
+    if (config->temporal) {
+      temporal_render(config->temporal, config->scene, camera,
+                      render_thread->work);
+    } else if (config->adaptive) {
+      adaptive_render(config->scene, camera, render_thread->work);
+    } else if (config->foveated) {
+      foveated_render(config->scene, camera, render_thread->work,
+                      config->foveated);
+    } else {
+      dynamic_resolution_render(config->dynamic, config->scene, camera,
+                                render_thread->work);
+    }
+    progressive_restart_at(progressive, 1);
+    return;
+  }
+
+  if (moved) {
+    progressive_restart(progressive);
+  }
+  progressive_render(progressive, config->scene, camera, render_thread->hdr,
+                     render_thread->work);
+}
+
+static void publish(RenderThread *render_thread, RenderCounters counters,
+                    double trace_ms) {
+  memcpy(render_thread->buffers[render_thread->back], render_thread->work,
+         sizeof(uint32_t) * render_thread->pixel_count);
+
+  pthread_mutex_lock(&render_thread->lock);
+  int completed = render_thread->back;
+  render_thread->back = render_thread->ready;
+  render_thread->ready = completed;
+  render_thread->ready_is_new = true;
+  raytracer_counters_add(&render_thread->counters, &counters);
+  render_thread->trace_ms += trace_ms;
+  pthread_mutex_unlock(&render_thread->lock);
+}
+
+static void *render_main(void *argument) {
+  RenderThread *render_thread = argument;
+
+  ProgressiveRenderer progressive;
+  progressive_init(&progressive, render_thread->config.frame_budget_ms);
+
+  pthread_mutex_lock(&render_thread->lock);
+  Camera camera = render_thread->camera;
+  unsigned long version = render_thread->camera_version;
+  pthread_mutex_unlock(&render_thread->lock);
+
+  for (;;) {
+    pthread_mutex_lock(&render_thread->lock);
+    while (!render_thread->shutting_down &&
+           render_thread->camera_version == version &&
+           progressive_done(&progressive)) {
+      pthread_cond_wait(&render_thread->wake, &render_thread->lock);
+    }
+    if (render_thread->shutting_down) {
+      pthread_mutex_unlock(&render_thread->lock);
+      break;
+    }
+
+    bool moved = render_thread->camera_version != version;
+    if (moved) {
+      camera = render_thread->camera;
+      version = render_thread->camera_version;
+    }
+    pthread_mutex_unlock(&render_thread->lock);
+
+    double start = timer_now_ms();
+    RenderCounters counters_start = raytracer_total_counters();
+    render_step(render_thread, &progressive, &camera, moved);
+    publish(render_thread,
+            raytracer_counters_subtract(raytracer_total_counters(),
+                                        counters_start),
+            timer_now_ms() - start);
+  }
+
+  return NULL;
+}
+
+static void free_buffers(RenderThread *render_thread) {
+  free(render_thread->work);
+  hdr_image_destroy(render_thread->hdr);
+  for (int i = 0; i < RENDER_THREAD_BUFFERS; i++) {
+    free(render_thread->buffers[i]);
+  }
+}
+
+RenderThread *render_thread_create(const RenderThreadConfig *config,
+                                   const Camera *camera) {
+  RenderThread *render_thread = calloc(1, sizeof(RenderThread));
+  if (!render_thread) {
+    return NULL;
+  }
+
+  render_thread->config = *config;
+  render_thread->pixel_count = (size_t)config->width * config->height;
+  render_thread->work =
+      malloc(sizeof(uint32_t) * render_thread->pixel_count);
+  render_thread->hdr = hdr_image_create(config->width, config->height);
+  bool allocated = render_thread->work && render_thread->hdr;
+  for (int i = 0; i < RENDER_THREAD_BUFFERS; i++) {
+    render_thread->buffers[i] =
+        malloc(sizeof(uint32_t) * render_thread->pixel_count);
+    allocated = allocated && render_thread->buffers[i];
+  }
+  if (!allocated) {
+    free_buffers(render_thread);
+    free(render_thread);
+    return NULL;
+  }
+
+  /* Passes at full resolution never write the first row and column, and
+   * coarser ones only write them in hdr before packing, so one clear of
+   * each suffices. */
+  hdr_image_fill(render_thread->hdr, config->scene->default_background_color);
+  uint32_t background =
+      vector_color_to_rgb_color(config->scene->default_background_color);
+  for (size_t i = 0; i < render_thread->pixel_count; i++) {
+    render_thread->work[i] = background;
+  }
+  for (int i = 0; i < RENDER_THREAD_BUFFERS; i++) {
+    memcpy(render_thread->buffers[i], render_thread->work,
+           sizeof(uint32_t) * render_thread->pixel_count);
+  }
+  render_thread->back = 0;
+  render_thread->ready = 1;
+  render_thread->front = 2;
+  render_thread->ready_is_new = true; /* The cleared frame */
+  render_thread->camera = *camera;
+
+  pthread_mutex_init(&render_thread->lock, NULL);
+  pthread_cond_init(&render_thread->wake, NULL);
+
+  if (pthread_create(&render_thread->thread, NULL, render_main,
+                     render_thread) != 0) {
+    pthread_mutex_destroy(&render_thread->lock);
+    pthread_cond_destroy(&render_thread->wake);
+    free_buffers(render_thread);
+    free(render_thread);
+    return NULL;
+  }
+
+  return render_thread;
+}
+
+void render_thread_destroy(RenderThread *render_thread) {
+  if (!render_thread) {
+    return;
+  }
+
+  pthread_mutex_lock(&render_thread->lock);
+  render_thread->shutting_down = true;
+  pthread_cond_signal(&render_thread->wake);
+  pthread_mutex_unlock(&render_thread->lock);
+
+  pthread_join(render_thread->thread, NULL);
+
+  pthread_mutex_destroy(&render_thread->lock);
+  pthread_cond_destroy(&render_thread->wake);
+  free_buffers(render_thread);
+  free(render_thread);
+}
+
+void render_thread_set_camera(RenderThread *render_thread,
+                              const Camera *camera) {
+  pthread_mutex_lock(&render_thread->lock);
+  render_thread->camera = *camera;
+  render_thread->camera_version++;
+  pthread_cond_signal(&render_thread->wake);
+  pthread_mutex_unlock(&render_thread->lock);
+}
+
+bool render_thread_acquire(RenderThread *render_thread,
+                           uint32_t **framebuffer, RenderCounters *counters,
+                           double *trace_ms) {
+  pthread_mutex_lock(&render_thread->lock);
+  bool fresh = render_thread->ready_is_new;
+  if (fresh) {
+    int presented = render_thread->front;
+    render_thread->front = render_thread->ready;
+    render_thread->ready = presented;
+    render_thread->ready_is_new = false;
+  }
+
+  *framebuffer = render_thread->buffers[render_thread->front];
+  *counters = render_thread->counters;
+  *trace_ms = render_thread->trace_ms;
+  render_thread->counters = (RenderCounters){0};
+  render_thread->trace_ms = 0.0;
+  pthread_mutex_unlock(&render_thread->lock);
+
+  return fresh;
+}
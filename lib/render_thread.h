@@ -0,0 +1,84 @@
+#ifndef RENDER_THREAD_H
+#define RENDER_THREAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "camera.h"
+#include "dynamic_resolution.h"
+#include "foveated.h"
+#include "raytracer.h"
+#include "scene.h"
+#include "temporal.h"
+
+/**
+ * @file render_thread.h
+ * @brief Rendering on a dedicated thread, decoupled from presentation.
+ *
+ * The render thread owns all tracing. It renders into a private
+ * framebuffer in steps of one frame budget, progressive passes by way of
+ * a linear float image (progressive.h), and after each step copies the
+ * result into a triple buffer: one buffer being filled, one holding the
+ * newest completed frame, and one being presented. The presenting thread
+ * only posts camera poses and takes the newest frame, so neither side
+ * ever waits for the other to finish its work.
+ *
+ * A posted camera is picked up at the next step, so in-flight work for an
+ * older pose is dropped after at most one budget (or one coarse pass, or
+ * one temporal, adaptive, foveated or dynamic resolution frame). With
+ * nothing left to refine the thread sleeps until the next pose.
+ */
+
+typedef struct {
+  Scene *scene;
+  int width;
+  int height;
+  double frame_budget_ms;
+  TemporalCache *temporal; /**< Reproject while moving, or NULL */
+  bool adaptive;           /**< Subdivide while moving, without temporal */
+  /** Vary the ray rate over moving frames, without temporal or adaptive,
+   *  or NULL */
+  const FoveatedConfig *foveated;
+  /** Scale moving frames to a frame time, without any of the above, or
+   *  NULL */
+  DynamicResolution *dynamic;
+} RenderThreadConfig;
+
+typedef struct RenderThread RenderThread;
+
+/**
+ * @brief Start rendering from camera.
+ *
+ * The scene, temporal cache, foveation config and dynamic resolution
+ * governor must outlive the render thread.
+ *
+ * @return Render thread, or NULL on allocation or thread creation failure
+ */
+RenderThread *render_thread_create(const RenderThreadConfig *config,
+                                   const Camera *camera);
+
+/**
+ * @brief Stop and join the thread after its current step and free it.
+ */
+void render_thread_destroy(RenderThread *render_thread);
+
+/**
+ * @brief Post a camera pose, superseding the one being rendered.
+ */
+void render_thread_set_camera(RenderThread *render_thread,
+                              const Camera *camera);
+
+/**
+ * @brief Take the newest completed frame, if any is newer than the last.
+ *
+ * @param framebuffer Out: the frame to present, width * height ARGB8888
+ *                    pixels; valid until the next call
+ * @param counters Out: render work since the previous call
+ * @param trace_ms Out: render thread time since the previous call
+ * @return true if framebuffer holds a frame not presented before
+ */
+bool render_thread_acquire(RenderThread *render_thread,
+                           uint32_t **framebuffer, RenderCounters *counters,
+                           double *trace_ms);
+
+#endif /* RENDER_THREAD_H */
@@ -0,0 +1,124 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "scene.h"
+
+Scene *scene_create_demo(void) {
+  Scene *scene = calloc(1, sizeof(Scene));
+  if (!scene) {
+    return NULL;
+  }
+
+  scene->spheres_count = 5;
+  scene->spheres = malloc(sizeof(Sphere) * scene->spheres_count);
+  scene->lights_count = 3;
+  scene->lights = malloc(sizeof(Light) * scene->lights_count);
+
+  if (!scene->spheres || !scene->lights) {
+    scene_destroy(scene);
+    return NULL;
+  }
+
+  scene->spheres[0] =
+      (Sphere){vector_3d_init(0, -1, 3), 1, vector_color_red(), false, 500,
+               0.2f};
+  scene->spheres[1] =
+      (Sphere){vector_3d_init(2, 0, 4), 1, vector_color_blue(), false, 500,
+               0.3f};
+  scene->spheres[2] =
+      (Sphere){vector_3d_init(2, 1, 0), 0.05, vector_color_white(), true, -1,
+               0.0f};
+  scene->spheres[3] =
+      (Sphere){vector_3d_init(-2, 0, 4), 1, vector_color_green(), false, 500,
+               0.4f};
+  scene->spheres[4] = (Sphere){vector_3d_init(0, -5001, 0), 5000,
+                               vector_color_yellow(), false, 1000, 0.5f};
+
+  scene->lights[0] = (Light){0.2f, AMBIENT, vector_3d_init(0, 0, 0)};
+  scene->lights[1] = (Light){0.6f, POINT, vector_3d_init(2, 1, 0)};
+  scene->lights[2] = (Light){0.2f, DIRECTIONAL, vector_3d_init(1, 4, 4)};
+
+  scene->default_background_color = vector_color_black();
+
+  scene->bvh = bvh_build(scene->spheres, scene->spheres_count);
+  if (!scene->bvh || !scene_build_light_tree(scene)) {
+    scene_destroy(scene);
+    return NULL;
+  }
+
+  return scene;
+}
+
+bool scene_build_light_tree(Scene *scene) {
+  light_tree_destroy(scene->light_tree);
+  scene->light_tree =
+      light_tree_build(scene->lights, scene->lights_count,
+                       scene->light_cutoff);
+  return scene->light_tree != NULL;
+}
+
+void scene_set_sphere(Scene *scene, int index, Sphere sphere) {
+  SceneChanges *changes = &scene->changes;
+  Sphere *old = &scene->spheres[index];
+
+  if (changes->spheres_count < SCENE_MAX_EDITS) {
+    float old_radius = fabsf(old->radius);
+    float new_radius = fabsf(sphere.radius);
+    Vector3D old_extent = vector_3d_init(old_radius, old_radius, old_radius);
+    Vector3D new_extent = vector_3d_init(new_radius, new_radius, new_radius);
+    Vector3D old_min = vector_3d_subtract(old->center, old_extent);
+    Vector3D old_max = vector_3d_add(old->center, old_extent);
+    Vector3D new_min = vector_3d_subtract(sphere.center, new_extent);
+    Vector3D new_max = vector_3d_add(sphere.center, new_extent);
+
+    changes->sphere_min[changes->spheres_count] =
+        vector_3d_init(fminf(old_min.x, new_min.x), fminf(old_min.y, new_min.y),
+                       fminf(old_min.z, new_min.z));
+    changes->sphere_max[changes->spheres_count] =
+        vector_3d_init(fmaxf(old_max.x, new_max.x), fmaxf(old_max.y, new_max.y),
+                       fmaxf(old_max.z, new_max.z));
+  }
+  changes->spheres_count++;
+
+  *old = sphere;
+  scene->spheres_version++;
+  if (scene->bvh) {
+    bvh_refit(scene->bvh, scene->spheres);
+  }
+}
+
+void scene_set_light(Scene *scene, int index, Light light) {
+  SceneChanges *changes = &scene->changes;
+  if (changes->lights_count < SCENE_MAX_EDITS) {
+    changes->light_before[changes->lights_count] = scene->lights[index];
+    changes->light_after[changes->lights_count] = light;
+  }
+  changes->lights_count++;
+
+  scene->lights[index] = light;
+  /* Should the rebuild fail, every light is evaluated everywhere. */
+  scene_build_light_tree(scene);
+}
+
+void scene_clear_changes(Scene *scene) {
+  scene->changes = (SceneChanges){0};
+}
+
+void scene_destroy(Scene *scene) {
+  if (!scene) {
+    return;
+  }
+
+  bvh_destroy(scene->bvh);
+  light_tree_destroy(scene->light_tree);
+  if (scene->mapping) {
+    munmap(scene->mapping, scene->mapping_size);
+  } else {
+    free(scene->spheres);
+    free(scene->lights);
+  }
+  free(scene);
+}
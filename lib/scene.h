@@ -1,18 +1,81 @@
 #ifndef SCENE_H
 #define SCENE_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "bvh.h"
+#include "constants.h"
 #include "light.h"
+#include "light_tree.h"
 #include "sphere.h"
 #include "vector_color.h"
 
+/**
+ * @struct SceneChanges
+ * @brief Edits since the last scene_clear_changes, for incremental
+ *        rendering.
+ */
+typedef struct {
+  Vector3D sphere_min[SCENE_MAX_EDITS]; /**< World bounds of each sphere */
+  Vector3D sphere_max[SCENE_MAX_EDITS]; /**< edit, old and new together */
+  int spheres_count; /**< Above SCENE_MAX_EDITS when too many to track */
+  Light light_before[SCENE_MAX_EDITS]; /**< Each light edit, the light */
+  Light light_after[SCENE_MAX_EDITS];  /**< before and after it */
+  int lights_count; /**< Above SCENE_MAX_EDITS when too many to track */
+} SceneChanges;
+
 typedef struct {
   Sphere *spheres;
   int spheres_count;
+  unsigned int spheres_version; /**< Bumped by every scene_set_sphere */
   Light *lights;
   int lights_count;
   VectorColor default_background_color;
+  BVH *bvh; /**< Built over spheres, or NULL to test every sphere */
+  LightTree *light_tree; /**< Built over lights, or NULL to evaluate
+                              every light everywhere */
+  float light_cutoff; /**< Error allowed per light cluster, 0 to
+                           evaluate every light */
+  bool shadows; /**< Point and directional lights cast shadows */
+  SceneChanges changes;
+  void *mapping;       /**< Mapped scene file holding the arrays, or NULL */
+  size_t mapping_size;
 } Scene;
 
+/**
+ * @brief Create the built-in demo scene (five spheres, three lights).
+ *
+ * @return Scene with its BVH and light tree built, or NULL on allocation
+ *         failure
+ */
+Scene *scene_create_demo(void);
+
+/**
+ * @brief Rebuild the light tree after the lights or light_cutoff changed.
+ *
+ * @return false on allocation failure, leaving the scene without a grid
+ */
+bool scene_build_light_tree(Scene *scene);
+
+/**
+ * @brief Replace a sphere, recording the change and refitting the BVH.
+ */
+void scene_set_sphere(Scene *scene, int index, Sphere sphere);
+
+/**
+ * @brief Replace a light, recording the change and rebuilding the light
+ *        grid.
+ */
+void scene_set_light(Scene *scene, int index, Light light);
+
+void scene_clear_changes(Scene *scene);
+
+/**
+ * @brief Free a scene, its arrays, its BVH and its light tree, or unmap
+ *        its scene file.
+ */
+void scene_destroy(Scene *scene);
+
 #endif /* SCENE_H */
@@ -0,0 +1,435 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bvh.h"
+#include "constants.h"
+#include "line_file.h"
+#include "scene_file.h"
+
+#define SCENE_FILE_BYTE_ORDER 0x01020304u
+#define SCENE_FILE_ALIGNMENT 64
+#define SCENE_FILE_MAX_VALUES 9
+
+typedef struct {
+  Scene *scene;
+  int spheres_capacity;
+  int lights_capacity;
+  bool has_camera;
+  Vector3D camera_position;
+  float camera_yaw;
+  float camera_pitch;
+  float camera_roll;
+} SceneBuilder;
+
+static void apply_camera_pose(Camera *camera, Vector3D position, float yaw,
+                              float pitch, float roll) {
+  if (!camera) {
+    return;
+  }
+
+  camera->position = position;
+  camera->yaw = yaw;
+  camera->pitch = pitch;
+  camera->roll = roll;
+  camera_update_orientation(camera);
+}
+
+/* ------------------------------------------------------------------------
+ * Text form
+ * ------------------------------------------------------------------------ */
+
+static bool builder_add_sphere(SceneBuilder *builder, Sphere sphere) {
+  Scene *scene = builder->scene;
+  if (scene->spheres_count == builder->spheres_capacity) {
+    int capacity = builder->spheres_capacity ? 2 * builder->spheres_capacity
+                                             : 16;
+    Sphere *spheres = realloc(scene->spheres, sizeof(Sphere) * capacity);
+    if (!spheres) {
+      return false;
+    }
+    scene->spheres = spheres;
+    builder->spheres_capacity = capacity;
+  }
+
+  scene->spheres[scene->spheres_count++] = sphere;
+  return true;
+}
+
+static bool builder_add_light(SceneBuilder *builder, Light light) {
+  Scene *scene = builder->scene;
+  if (scene->lights_count == builder->lights_capacity) {
+    int capacity = builder->lights_capacity ? 2 * builder->lights_capacity
+                                            : 4;
+    Light *lights = realloc(scene->lights, sizeof(Light) * capacity);
+    if (!lights) {
+      return false;
+    }
+    scene->lights = lights;
+    builder->lights_capacity = capacity;
+  }
+
+  scene->lights[scene->lights_count++] = light;
+  return true;
+}
+
+/* Parses every remaining number of text; returns how many, or -1 if
+ * anything else follows them. */
+static int parse_values(const char *text, float *values) {
+  int count = 0;
+
+  for (;;) {
+    while (*text == ' ' || *text == '\t' || *text == '\r' || *text == '\n') {
+      text++;
+    }
+    if (*text == '\0') {
+      return count;
+    }
+    if (count == SCENE_FILE_MAX_VALUES) {
+      return -1;
+    }
+
+    char *end;
+    values[count] = strtof(text, &end);
+    if (end == text) {
+      return -1;
+    }
+    count++;
+    text = end;
+  }
+}
+
+static bool parse_line(void *context, const char *keyword,
+                       const char *values) {
+  SceneBuilder *builder = context;
+  float v[SCENE_FILE_MAX_VALUES];
+  int count = parse_values(values, v);
+  const float radians = (float)(MATH_PI / 180.0);
+  bool added = true;
+
+  if (strcmp(keyword, "background") == 0 && count == 3) {
+    builder->scene->default_background_color =
+        vector_color_init(v[0], v[1], v[2]);
+  } else if (strcmp(keyword, "camera") == 0 && (count == 3 || count == 6)) {
+    builder->has_camera = true;
+    builder->camera_position = vector_3d_init(v[0], v[1], v[2]);
+    builder->camera_yaw = count == 6 ? v[3] * radians : 0.0f;
+    builder->camera_pitch = count == 6 ? v[4] * radians : 0.0f;
+    builder->camera_roll = count == 6 ? v[5] * radians : 0.0f;
+  } else if (strcmp(keyword, "sphere") == 0 && (count == 8 || count == 9)) {
+    added = builder_add_sphere(
+        builder, (Sphere){vector_3d_init(v[0], v[1], v[2]), v[3],
+                          vector_color_init(v[4], v[5], v[6]), false, v[7],
+                          count == 9 ? v[8] : 0.0f});
+  } else if (strcmp(keyword, "emitter") == 0 && count == 7) {
+    added = builder_add_sphere(
+        builder, (Sphere){vector_3d_init(v[0], v[1], v[2]), v[3],
+                          vector_color_init(v[4], v[5], v[6]), true, -1,
+                          0.0f});
+  } else if (strcmp(keyword, "shadows") == 0 && count == 0) {
+    builder->scene->shadows = true;
+  } else if (strcmp(keyword, "light_cutoff") == 0 && count == 1 &&
+             v[0] >= 0.0f) {
+    builder->scene->light_cutoff = v[0];
+  } else if (strcmp(keyword, "ambient") == 0 && count == 1) {
+    added = builder_add_light(
+        builder, (Light){v[0], AMBIENT, vector_3d_init(0, 0, 0)});
+  } else if (strcmp(keyword, "point") == 0 && count == 4) {
+    added = builder_add_light(
+        builder, (Light){v[0], POINT, vector_3d_init(v[1], v[2], v[3])});
+  } else if (strcmp(keyword, "directional") == 0 && count == 4) {
+    added = builder_add_light(
+        builder,
+        (Light){v[0], DIRECTIONAL, vector_3d_init(v[1], v[2], v[3])});
+  } else {
+    errno = EINVAL;
+    return false;
+  }
+
+  if (!added) {
+    errno = ENOMEM;
+  }
+  return added;
+}
+
+Scene *scene_load_text(const char *path, Camera *camera, int *error_line) {
+  if (error_line) {
+    *error_line = 0;
+  }
+
+  SceneBuilder builder = {.scene = calloc(1, sizeof(Scene))};
+  if (!builder.scene) {
+    return NULL;
+  }
+
+  bool ok = line_file_read(path, parse_line, &builder, error_line);
+  if (ok && builder.scene->spheres_count == 0) {
+    ok = false;
+    errno = EINVAL;
+  }
+
+  if (ok) {
+    builder.scene->bvh =
+        bvh_build(builder.scene->spheres, builder.scene->spheres_count);
+    if (!builder.scene->bvh || !scene_build_light_tree(builder.scene)) {
+      ok = false;
+      errno = ENOMEM;
+    }
+  }
+
+  if (!ok) {
+    int error = errno;
+    scene_destroy(builder.scene);
+    errno = error;
+    return NULL;
+  }
+
+  if (builder.has_camera) {
+    apply_camera_pose(camera, builder.camera_position, builder.camera_yaw,
+                      builder.camera_pitch, builder.camera_roll);
+  }
+  return builder.scene;
+}
+
+/* ------------------------------------------------------------------------
+ * Binary form
+ * ------------------------------------------------------------------------ */
+
+static uint64_t align_offset(uint64_t offset) {
+  return (offset + SCENE_FILE_ALIGNMENT - 1) &
+         ~(uint64_t)(SCENE_FILE_ALIGNMENT - 1);
+}
+
+static bool section_fits(uint64_t offset, uint64_t count, uint64_t size,
+                         uint64_t file_size) {
+  return offset % SCENE_FILE_ALIGNMENT == 0 && offset <= file_size &&
+         count <= INT_MAX && count * size <= file_size - offset;
+}
+
+static bool header_is_valid(const SceneFileHeader *header, size_t size) {
+  return memcmp(header->magic, SCENE_FILE_MAGIC, sizeof(header->magic)) ==
+             0 &&
+         header->version == SCENE_FILE_VERSION &&
+         header->byte_order == SCENE_FILE_BYTE_ORDER &&
+         header->sphere_size == sizeof(Sphere) &&
+         header->light_size == sizeof(Light) &&
+         header->node_size == sizeof(BVHNode) && header->spheres_count > 0 &&
+         section_fits(header->spheres_offset, header->spheres_count,
+                      sizeof(Sphere), size) &&
+         section_fits(header->lights_offset, header->lights_count,
+                      sizeof(Light), size) &&
+         (header->nodes_offset == 0 ||
+          (section_fits(header->nodes_offset, header->nodes_count,
+                        sizeof(BVHNode), size) &&
+           header->nodes_count > 0 &&
+           section_fits(header->indices_offset, header->spheres_count,
+                        sizeof(int), size)));
+}
+
+/* What header_is_valid cannot see: the light types, and a BVH the
+ * traversals can walk without leaving the arrays. One pass over each. */
+static bool sections_are_valid(const SceneFileHeader *header,
+                               char *mapping) {
+  const Light *lights = (const Light *)(mapping + header->lights_offset);
+  for (uint64_t i = 0; i < header->lights_count; i++) {
+    if (lights[i].type != AMBIENT && lights[i].type != POINT &&
+        lights[i].type != DIRECTIONAL) {
+      return false;
+    }
+  }
+
+  if (header->nodes_offset == 0) {
+    return true;
+  }
+  BVH bvh = {.nodes = (BVHNode *)(mapping + header->nodes_offset),
+             .nodes_count = (int)header->nodes_count,
+             .sphere_indices = (int *)(mapping + header->indices_offset),
+             .spheres_count = (int)header->spheres_count};
+  return bvh_is_valid(&bvh);
+}
+
+Scene *scene_load_binary(const char *path, Camera *camera) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    close(fd);
+    return NULL;
+  }
+  size_t size = (size_t)status.st_size;
+  if (size < sizeof(SceneFileHeader)) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  /* Private and writable, so the scene can be edited in memory without
+   * touching the file. */
+  char *mapping =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return NULL;
+  }
+
+  const SceneFileHeader *header = (const SceneFileHeader *)mapping;
+  Scene *scene = NULL;
+  if (!header_is_valid(header, size) ||
+      !sections_are_valid(header, mapping)) {
+    errno = EINVAL;
+  } else {
+    scene = calloc(1, sizeof(Scene));
+  }
+  if (!scene) {
+    int error = errno;
+    munmap(mapping, size);
+    errno = error;
+    return NULL;
+  }
+
+  scene->mapping = mapping;
+  scene->mapping_size = size;
+  scene->spheres = (Sphere *)(mapping + header->spheres_offset);
+  scene->spheres_count = (int)header->spheres_count;
+  scene->lights = (Light *)(mapping + header->lights_offset);
+  scene->lights_count = (int)header->lights_count;
+  scene->default_background_color = header->background;
+  scene->shadows = (header->flags & SCENE_FILE_SHADOWS) != 0;
+  scene->light_cutoff = header->light_cutoff;
+
+  if (header->nodes_offset) {
+    scene->bvh = calloc(1, sizeof(BVH));
+    if (scene->bvh) {
+      *scene->bvh = (BVH){
+          .nodes = (BVHNode *)(mapping + header->nodes_offset),
+          .nodes_count = (int)header->nodes_count,
+          .sphere_indices = (int *)(mapping + header->indices_offset),
+          .spheres_count = scene->spheres_count,
+          .borrowed = true};
+    }
+  } else {
+    scene->bvh = bvh_build(scene->spheres, scene->spheres_count);
+  }
+  if (!scene->bvh || !scene_build_light_tree(scene)) {
+    scene_destroy(scene);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  if (header->flags & SCENE_FILE_HAS_CAMERA) {
+    apply_camera_pose(camera, header->camera_position, header->camera_yaw,
+                      header->camera_pitch, header->camera_roll);
+  }
+  return scene;
+}
+
+static bool write_section(FILE *file, uint64_t offset, const void *data,
+                          size_t size) {
+  static const char padding[SCENE_FILE_ALIGNMENT];
+  long position = ftell(file);
+  if (position < 0 || (uint64_t)position > offset) {
+    return false;
+  }
+
+  size_t padding_size = (size_t)(offset - (uint64_t)position);
+  return fwrite(padding, 1, padding_size, file) == padding_size &&
+         (size == 0 || fwrite(data, 1, size, file) == size);
+}
+
+bool scene_save_binary(const Scene *scene, const Camera *camera,
+                       const char *path) {
+  SceneFileHeader header = {
+      .magic = SCENE_FILE_MAGIC,
+      .version = SCENE_FILE_VERSION,
+      .byte_order = SCENE_FILE_BYTE_ORDER,
+      .sphere_size = sizeof(Sphere),
+      .light_size = sizeof(Light),
+      .node_size = sizeof(BVHNode),
+      .spheres_count = (uint64_t)scene->spheres_count,
+      .lights_count = (uint64_t)scene->lights_count,
+      .flags = scene->shadows ? SCENE_FILE_SHADOWS : 0,
+      .background = scene->default_background_color,
+      .light_cutoff = scene->light_cutoff};
+
+  header.spheres_offset = align_offset(sizeof(SceneFileHeader));
+  header.lights_offset = align_offset(
+      header.spheres_offset + sizeof(Sphere) * header.spheres_count);
+  uint64_t end = header.lights_offset + sizeof(Light) * header.lights_count;
+  if (scene->bvh) {
+    header.nodes_offset = align_offset(end);
+    header.nodes_count = (uint64_t)scene->bvh->nodes_count;
+    header.indices_offset = align_offset(
+        header.nodes_offset + sizeof(BVHNode) * header.nodes_count);
+  }
+
+  if (camera) {
+    header.flags |= SCENE_FILE_HAS_CAMERA;
+    header.camera_position = camera->position;
+    header.camera_yaw = camera->yaw;
+    header.camera_pitch = camera->pitch;
+    header.camera_roll = camera->roll;
+  }
+
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    return false;
+  }
+
+  bool ok =
+      fwrite(&header, sizeof(header), 1, file) == 1 &&
+      write_section(file, header.spheres_offset, scene->spheres,
+                    sizeof(Sphere) * header.spheres_count) &&
+      write_section(file, header.lights_offset, scene->lights,
+                    sizeof(Light) * header.lights_count);
+  if (ok && scene->bvh) {
+    ok = write_section(file, header.nodes_offset, scene->bvh->nodes,
+                       sizeof(BVHNode) * header.nodes_count) &&
+         write_section(file, header.indices_offset,
+                       scene->bvh->sphere_indices,
+                       sizeof(int) * header.spheres_count);
+  }
+  if (!ok) {
+    errno = EIO;
+  }
+
+  if (fclose(file) != 0) {
+    ok = false;
+  }
+  return ok;
+}
+
+/* ------------------------------------------------------------------------
+ * Either form
+ * ------------------------------------------------------------------------ */
+
+Scene *scene_load(const char *path, Camera *camera, int *error_line) {
+  if (error_line) {
+    *error_line = 0;
+  }
+
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    return NULL;
+  }
+
+  char magic[8] = {0};
+  size_t read = fread(magic, 1, sizeof(magic), file);
+  fclose(file);
+
+  if (read == sizeof(magic) &&
+      memcmp(magic, SCENE_FILE_MAGIC, sizeof(magic)) == 0) {
+    return scene_load_binary(path, camera);
+  }
+  return scene_load_text(path, camera, error_line);
+}
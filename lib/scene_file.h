@@ -0,0 +1,104 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "camera.h"
+#include "scene.h"
+
+/**
+ * @file scene_file.h
+ * @brief Load and save scenes as text or memory-mapped binary files.
+ *
+ * The text form has one item per line; `#` starts a comment and angles
+ * are in degrees:
+ *
+ *     background R G B
+ *     shadows
+ *     light_cutoff CUTOFF
+ *     camera X Y Z [YAW PITCH ROLL]
+ *     sphere X Y Z RADIUS R G B SPECULAR [REFLECTIVE]
+ *     emitter X Y Z RADIUS R G B
+ *     ambient INTENSITY
+ *     point INTENSITY X Y Z
+ *     directional INTENSITY X Y Z
+ *
+ * REFLECTIVE (default 0) is the share of a sphere's colour taken from
+ * its mirror reflection when reflections are rendered. An emitter is a
+ * sphere drawn at full brightness, like a light source; it casts no
+ * shadow. `shadows` turns on shadows from point and
+ * directional lights. With `light_cutoff`, distant point lights are
+ * evaluated by cluster wherever that changes the lighting by about CUTOFF
+ * or less (see light_tree.h); the default 0 evaluates every light.
+ *
+ * The binary form is a SceneFileHeader followed by the sphere, light, BVH
+ * node and BVH index arrays in their in-memory layout. It is mapped
+ * copy-on-write and the Scene arrays point straight into the mapping, so
+ * loading costs page faults instead of parsing. Binary files are only
+ * portable between builds with the same struct layout and byte order,
+ * which the header records. Loading checks the sections against the file
+ * size, the light types, and the BVH's structure and indices in one pass
+ * over each, so a damaged file fails with EINVAL instead of sending the
+ * traversals out of bounds. Sphere values are not checked.
+ */
+
+#define SCENE_FILE_MAGIC "RTSCENE"
+#define SCENE_FILE_VERSION 3
+#define SCENE_FILE_HAS_CAMERA 1u
+#define SCENE_FILE_SHADOWS 2u
+
+/**
+ * @struct SceneFileHeader
+ * @brief Start of a binary scene file. Section offsets are multiples of
+ *        64 bytes from the start of the file.
+ */
+typedef struct {
+  char magic[8];           /**< SCENE_FILE_MAGIC */
+  uint32_t version;        /**< SCENE_FILE_VERSION */
+  uint32_t byte_order;     /**< 0x01020304 as written by the saving host */
+  uint32_t sphere_size;    /**< sizeof(Sphere) */
+  uint32_t light_size;     /**< sizeof(Light) */
+  uint32_t node_size;      /**< sizeof(BVHNode) */
+  uint32_t flags;          /**< SCENE_FILE_HAS_CAMERA, SCENE_FILE_SHADOWS */
+  uint64_t spheres_offset;
+  uint64_t spheres_count;
+  uint64_t lights_offset;
+  uint64_t lights_count;
+  uint64_t nodes_offset;   /**< 0 when the file has no BVH */
+  uint64_t nodes_count;
+  uint64_t indices_offset; /**< spheres_count BVH sphere indices */
+  VectorColor background;
+  Vector3D camera_position;
+  float camera_yaw;        /**< Radians */
+  float camera_pitch;
+  float camera_roll;
+  float light_cutoff;
+} SceneFileHeader;
+
+/**
+ * @brief Load a text or binary scene file, told apart by the magic.
+ *
+ * @param camera If not NULL, receives the camera pose the file sets
+ * @param error_line If not NULL, set to the offending line of an invalid
+ *                   text file, or 0
+ * @return Scene with its BVH, or NULL with errno set (EINVAL for an
+ *         invalid file)
+ */
+Scene *scene_load(const char *path, Camera *camera, int *error_line);
+
+Scene *scene_load_text(const char *path, Camera *camera, int *error_line);
+
+Scene *scene_load_binary(const char *path, Camera *camera);
+
+/**
+ * @brief Write scene, its BVH and optionally a camera pose as a binary
+ *        scene file.
+ *
+ * @param camera Pose to store, or NULL
+ * @return false with errno set on failure
+ */
+bool scene_save_binary(const Scene *scene, const Camera *camera,
+                       const char *path);
+
+#endif /* SCENE_FILE_H */
@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "scene_generator.h"
+
+#define GENERATOR_SPACING 1.0f
+#define GENERATOR_CLUSTER_SIZE 1000
+#define GENERATOR_LAYERS 8
+#define GENERATOR_AMBIENT 0.1f
+
+static const char *const distribution_names[SCENE_DISTRIBUTIONS_COUNT] = {
+    "uniform", "clustered", "layered"};
+
+typedef struct {
+  uint64_t state;
+} Random;
+
+static uint64_t random_next(Random *random) {
+  uint64_t z = (random->state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+/* Uniform in [0, 1). */
+static float random_float(Random *random) {
+  return (float)(random_next(random) >> 40) * (1.0f / 16777216.0f);
+}
+
+static float random_range(Random *random, float min, float max) {
+  return min + (max - min) * random_float(random);
+}
+
+/* Standard normal, approximated by the sum of 12 uniforms, whose variance
+ * is 1. Unlike the Box-Muller transform it needs no logf or cosf, whose
+ * rounding differs between C libraries. */
+static float random_gaussian(Random *random) {
+  float sum = -6.0f;
+  for (int i = 0; i < 12; i++) {
+    sum += random_float(random);
+  }
+  return sum;
+}
+
+/* Cube root of value >= 1 by Newton's method from the power of two above
+ * it, in place of cbrtf for the same reason. */
+static float cube_root(float value) {
+  float root = 1.0f;
+  while (root * root * root < value) {
+    root *= 2.0f;
+  }
+  for (int i = 0; i < 8; i++) {
+    root -= (root - value / (root * root)) / 3.0f;
+  }
+  return root;
+}
+
+typedef struct {
+  Vector3D min;
+  Vector3D max;
+} Box;
+
+static Vector3D random_point(Random *random, Box box) {
+  return vector_3d_init(random_range(random, box.min.x, box.max.x),
+                        random_range(random, box.min.y, box.max.y),
+                        random_range(random, box.min.z, box.max.z));
+}
+
+static Sphere random_sphere(Random *random, Vector3D center) {
+  Sphere sphere = {center, random_range(random, 0.05f, 0.3f),
+                   vector_color_init(random_float(random),
+                                     random_float(random),
+                                     random_float(random)),
+                   false, random_range(random, 10.0f, 1000.0f), 0.0f};
+  /* The glossier half of the spheres also reflect. */
+  sphere.reflective = sphere.specular > 500.0f ? 0.3f : 0.0f;
+  return sphere;
+}
+
+static void generate_spheres(Random *random, SceneDistribution distribution,
+                             Box box, Sphere *spheres, int count) {
+  if (distribution == SCENE_UNIFORM) {
+    for (int i = 0; i < count; i++) {
+      spheres[i] = random_sphere(random, random_point(random, box));
+    }
+    return;
+  }
+
+  if (distribution == SCENE_LAYERED) {
+    float depth = box.max.z - box.min.z;
+    for (int i = 0; i < count; i++) {
+      Vector3D center = random_point(random, box);
+      center.z = box.min.z + depth * (i % GENERATOR_LAYERS) /
+                                 (GENERATOR_LAYERS - 1);
+      spheres[i] = random_sphere(random, center);
+    }
+    return;
+  }
+
+  int clusters = (count + GENERATOR_CLUSTER_SIZE - 1) /
+                 GENERATOR_CLUSTER_SIZE;
+  Vector3D *centers = malloc(sizeof(Vector3D) * clusters);
+  /* Falls back to uniform rather than failing a whole benchmark. */
+  if (!centers) {
+    generate_spheres(random, SCENE_UNIFORM, box, spheres, count);
+    return;
+  }
+
+  for (int i = 0; i < clusters; i++) {
+    centers[i] = random_point(random, box);
+  }
+
+  /* A cluster keeps the density of the whole box, packed into one cell. */
+  float sigma =
+      GENERATOR_SPACING * cube_root((float)GENERATOR_CLUSTER_SIZE) / 4.0f;
+  for (int i = 0; i < count; i++) {
+    Vector3D offset = vector_3d_init(random_gaussian(random),
+                                     random_gaussian(random),
+                                     random_gaussian(random));
+    spheres[i] = random_sphere(
+        random, vector_3d_add(centers[i % clusters],
+                              vector_3d_multiply_scalar(offset, sigma)));
+  }
+  free(centers);
+}
+
+Scene *scene_generate(SceneDistribution distribution, int spheres_count,
+                      int lights_count, uint64_t seed) {
+  if (spheres_count < 1 || lights_count < 1 || distribution < 0 ||
+      distribution >= SCENE_DISTRIBUTIONS_COUNT) {
+    return NULL;
+  }
+
+  Scene *scene = calloc(1, sizeof(Scene));
+  if (!scene) {
+    return NULL;
+  }
+
+  scene->spheres_count = spheres_count;
+  scene->spheres = malloc(sizeof(Sphere) * (size_t)spheres_count);
+  scene->lights_count = lights_count;
+  scene->lights = malloc(sizeof(Light) * (size_t)lights_count);
+  if (!scene->spheres || !scene->lights) {
+    scene_destroy(scene);
+    return NULL;
+  }
+
+  Random random = {seed};
+  float side = GENERATOR_SPACING * cube_root((float)spheres_count);
+  Box box = {vector_3d_init(-side / 2, -1.0f, 0.0f),
+             vector_3d_init(side / 2, side / 2 - 1.0f, side)};
+
+  scene->spheres[0] = (Sphere){vector_3d_init(0, -5001, 0), 5000,
+                               vector_color_yellow(), false, 1000, 0.5f};
+  generate_spheres(&random, distribution, box, scene->spheres + 1,
+                   spheres_count - 1);
+
+  scene->lights[0] =
+      (Light){GENERATOR_AMBIENT, AMBIENT, vector_3d_init(0, 0, 0)};
+  Box light_box = {vector_3d_init(box.min.x, box.max.y, box.min.z - 3.0f),
+                   vector_3d_init(box.max.x, box.max.y + 3.0f, box.max.z)};
+  for (int i = 1; i < lights_count; i++) {
+    scene->lights[i] =
+        (Light){(1.0f - GENERATOR_AMBIENT) / (lights_count - 1), POINT,
+                random_point(&random, light_box)};
+  }
+
+  scene->default_background_color = vector_color_black();
+
+  scene->bvh = bvh_build(scene->spheres, scene->spheres_count);
+  if (!scene->bvh || !scene_build_light_tree(scene)) {
+    scene_destroy(scene);
+    return NULL;
+  }
+
+  return scene;
+}
+
+const char *scene_distribution_name(SceneDistribution distribution) {
+  return distribution_names[distribution];
+}
+
+bool scene_distribution_parse(const char *name,
+                              SceneDistribution *distribution) {
+  for (int i = 0; i < SCENE_DISTRIBUTIONS_COUNT; i++) {
+    if (strcmp(name, distribution_names[i]) == 0) {
+      *distribution = (SceneDistribution)i;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,48 @@
+#ifndef SCENE_GENERATOR_H
+#define SCENE_GENERATOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "scene.h"
+
+/**
+ * @file scene_generator.h
+ * @brief Seeded procedural scenes for stress tests and benchmarks.
+ *
+ * Spheres fill a box in front of the default camera whose side grows
+ * with the cube root of the sphere count, so the sphere density stays the
+ * same at every size. Only basic float arithmetic is used, no libm, so
+ * the same arguments give the same scene wherever floats are IEEE single
+ * precision and not contracted into fused multiply-adds, as with GCC in
+ * ISO C mode.
+ */
+
+typedef enum {
+  SCENE_UNIFORM,   /**< Spheres spread evenly over the box */
+  SCENE_CLUSTERED, /**< Gaussian clusters of about 1000 spheres */
+  SCENE_LAYERED,   /**< Spheres on evenly spaced planes facing the camera */
+  SCENE_DISTRIBUTIONS_COUNT
+} SceneDistribution;
+
+/**
+ * @brief Generate a scene.
+ *
+ * @param spheres_count Total spheres, including a floor sphere; at least 1
+ * @param lights_count Total lights: one ambient light, the rest point
+ *                     lights sharing the remaining intensity; at least 1
+ * @return Scene with its BVH built, or NULL on allocation failure or
+ *         invalid counts
+ */
+Scene *scene_generate(SceneDistribution distribution, int spheres_count,
+                      int lights_count, uint64_t seed);
+
+const char *scene_distribution_name(SceneDistribution distribution);
+
+/**
+ * @brief Look up a distribution by its name.
+ */
+bool scene_distribution_parse(const char *name,
+                              SceneDistribution *distribution);
+
+#endif /* SCENE_GENERATOR_H */
@@ -3,18 +3,12 @@
 #include "vector_3d.h"
 #include <math.h>
 
-SphereIntersections calculate_sphere_intersection(Camera *camera,
-                                                  Sphere *sphere,
-                                                  Vector3D ray_direction) {
-  Vector3D origin_to_center =
-      vector_3d_subtract(camera->position, sphere->center);
-
+SphereIntersections calculate_sphere_intersection_terms(
+    const Camera *camera, SphereTerms terms, Vector3D ray_direction) {
   float quadratic_a = vector_3d_dot_product(ray_direction, ray_direction);
   float quadratic_b =
-      vector_3d_dot_product(origin_to_center, ray_direction) * 2;
-  float quadratic_c =
-      vector_3d_dot_product(origin_to_center, origin_to_center) -
-      (sphere->radius * sphere->radius);
+      vector_3d_dot_product(terms.origin_to_center, ray_direction) * 2;
+  float quadratic_c = terms.quadratic_c;
 
   float discriminant =
       (quadratic_b * quadratic_b) - (4 * quadratic_a * quadratic_c);
@@ -29,3 +23,40 @@ SphereIntersections calculate_sphere_intersection(Camera *camera,
 
   return (SphereIntersections){t1, t2};
 }
+
+SphereIntersections calculate_sphere_intersection(Camera *camera,
+                                                  Sphere *sphere,
+                                                  Vector3D ray_direction) {
+  return calculate_sphere_intersection_terms(
+      camera, calculate_sphere_terms(camera, sphere), ray_direction);
+}
+
+float sphere_nearest_hit(const Sphere *sphere, Vector3D origin,
+                         Vector3D direction, float t_min, float t_max) {
+  Vector3D origin_to_center = vector_3d_subtract(origin, sphere->center);
+
+  float quadratic_a = vector_3d_dot_product(direction, direction);
+  float half_b = vector_3d_dot_product(origin_to_center, direction);
+  float quadratic_c =
+      vector_3d_dot_product(origin_to_center, origin_to_center) -
+      (sphere->radius * sphere->radius);
+
+  float discriminant = half_b * half_b - quadratic_a * quadratic_c;
+  if (discriminant < 0) {
+    return t_max;
+  }
+
+  float root = sqrtf(discriminant);
+  float t1 = (-half_b - root) / quadratic_a;
+  float t2 = (-half_b + root) / quadratic_a;
+
+  if (t1 > t_min && t1 < t_max) {
+    return t1;
+  }
+  return t2 > t_min && t2 < t_max ? t2 : t_max;
+}
+
+bool sphere_blocks_ray(const Sphere *sphere, Vector3D origin,
+                       Vector3D direction, float t_min, float t_max) {
+  return sphere_nearest_hit(sphere, origin, direction, t_min, t_max) < t_max;
+}
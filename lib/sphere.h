@@ -13,6 +13,7 @@ typedef struct {
   VectorColor color;
   bool is_light_source;
   float specular;
+  float reflective; /**< Share of the colour taken from the reflection */
 } Sphere;
 
 typedef struct {
@@ -20,8 +21,63 @@ typedef struct {
   float t2;
 } SphereIntersections;
 
+/**
+ * The terms of the intersection quadratic that depend only on the ray
+ * origin, the same for every ray from the camera.
+ */
+typedef struct {
+  Vector3D origin_to_center;
+  float quadratic_c;
+} SphereTerms;
+
 SphereIntersections calculate_sphere_intersection(Camera *camera,
                                                   Sphere *sphere,
                                                   Vector3D ray_direction);
 
+static inline SphereTerms calculate_sphere_terms(const Camera *camera,
+                                                 const Sphere *sphere) {
+  Vector3D origin_to_center =
+      vector_3d_subtract(camera->position, sphere->center);
+
+  return (SphereTerms){
+      .origin_to_center = origin_to_center,
+      .quadratic_c =
+          vector_3d_dot_product(origin_to_center, origin_to_center) -
+          (sphere->radius * sphere->radius)};
+}
+
+/**
+ * calculate_sphere_intersection with the sphere's terms already computed;
+ * gives bit-identical results.
+ */
+SphereIntersections calculate_sphere_intersection_terms(
+    const Camera *camera, SphereTerms terms, Vector3D ray_direction);
+
+/**
+ * Whether origin + t * direction meets the sphere for some t in
+ * (t_min, t_max). Unlike calculate_sphere_intersection, t is the true ray
+ * parameter, and the ray may start anywhere.
+ */
+bool sphere_blocks_ray(const Sphere *sphere, Vector3D origin,
+                       Vector3D direction, float t_min, float t_max);
+
+/**
+ * Nearest t in (t_min, t_max) at which origin + t * direction meets the
+ * sphere, or t_max if there is none. t is the true ray parameter.
+ */
+float sphere_nearest_hit(const Sphere *sphere, Vector3D origin,
+                         Vector3D direction, float t_min, float t_max);
+
+/**
+ * Hit ordering shared by every intersection path: a hit replaces the
+ * current one when it is strictly nearer, or equally near on a sphere
+ * with a lower index. closest_sphere is -1 when there is no hit yet.
+ * Scanning spheres in index order therefore gives the same winner as any
+ * other visiting order, such as a BVH traversal.
+ */
+static inline bool sphere_hit_is_nearer(float t, int sphere,
+                                        float closest_t, int closest_sphere) {
+  return t < closest_t || (t == closest_t && sphere < closest_sphere);
+}
+
 #endif /* SPHERE_H */
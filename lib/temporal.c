@@ -0,0 +1,377 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "raytracer.h"
+#include "temporal.h"
+#include "vector_3d.h"
+
+#define REPROJECTION_EMPTY UINT64_MAX
+
+typedef struct {
+  TemporalCache *cache;
+  Scene *scene;
+  Camera *camera;
+  uint32_t *framebuffer;
+} TemporalJob;
+
+static bool history_alloc(TemporalHistory *history, size_t pixel_count) {
+  history->t = malloc(sizeof(float) * pixel_count);
+  history->sphere = malloc(sizeof(int) * pixel_count);
+  history->color = malloc(sizeof(uint32_t) * pixel_count);
+  history->age = malloc(sizeof(uint8_t) * pixel_count);
+  return history->t && history->sphere && history->color && history->age;
+}
+
+static void history_free(TemporalHistory *history) {
+  free(history->t);
+  free(history->sphere);
+  free(history->color);
+  free(history->age);
+}
+
+TemporalCache *temporal_create(int width, int height) {
+  TemporalCache *cache = calloc(1, sizeof(TemporalCache));
+  if (!cache) {
+    return NULL;
+  }
+
+  size_t pixel_count = (size_t)width * height;
+  cache->width = width;
+  cache->height = height;
+  cache->reprojection = malloc(sizeof(uint64_t) * pixel_count);
+  if (!history_alloc(&cache->history, pixel_count) ||
+      !history_alloc(&cache->next, pixel_count) || !cache->reprojection) {
+    temporal_destroy(cache);
+    return NULL;
+  }
+
+  return cache;
+}
+
+void temporal_destroy(TemporalCache *cache) {
+  if (!cache) {
+    return;
+  }
+
+  history_free(&cache->history);
+  history_free(&cache->next);
+  free(cache->reprojection);
+  free(cache);
+}
+
+void temporal_invalidate(TemporalCache *cache) { cache->valid = false; }
+
+static int band_count(const TemporalCache *cache) {
+  return (cache->height + TEMPORAL_BAND_HEIGHT - 1) / TEMPORAL_BAND_HEIGHT;
+}
+
+static int band_end(const TemporalCache *cache, int band) {
+  int end = (band + 1) * TEMPORAL_BAND_HEIGHT;
+  return end < cache->height ? end : cache->height;
+}
+
+/* Depths are positive, so their bit patterns order like the floats and the
+ * nearest hit is the smallest key. Misses reproject at infinite depth and
+ * so lose to any hit. */
+static inline uint64_t reprojection_key(float depth, int pixel) {
+  uint32_t bits;
+  memcpy(&bits, &depth, sizeof(bits));
+  return (uint64_t)bits << 32 | (uint32_t)pixel;
+}
+
+static inline float reprojection_depth(uint64_t key) {
+  uint32_t bits = (uint32_t)(key >> 32);
+  float depth;
+  memcpy(&depth, &bits, sizeof(depth));
+  return depth;
+}
+
+static inline bool reprojection_is_hit(uint64_t key) {
+  return key != REPROJECTION_EMPTY && isfinite(reprojection_depth(key));
+}
+
+static inline int reprojection_source(uint64_t key) {
+  return (int)(uint32_t)key;
+}
+
+/* Traced pixels start at different ages so that they do not all expire in
+ * the same frame. */
+static inline uint8_t staggered_age(int pixel) {
+  return (uint8_t)(((uint32_t)pixel * 2654435761u >> 16) % TEMPORAL_MAX_AGE);
+}
+
+static void clear_band(void *context, int band, RenderCounters *counters) {
+  (void)counters;
+  TemporalJob *job = context;
+  TemporalCache *cache = job->cache;
+
+  size_t begin = (size_t)band * TEMPORAL_BAND_HEIGHT * cache->width;
+  size_t end = (size_t)band_end(cache, band) * cache->width;
+  for (size_t i = begin; i < end; i++) {
+    atomic_store_explicit(&cache->reprojection[i], REPROJECTION_EMPTY,
+                          memory_order_relaxed);
+  }
+}
+
+static void scatter_band(void *context, int band, RenderCounters *counters) {
+  (void)counters;
+  TemporalJob *job = context;
+  TemporalCache *cache = job->cache;
+  Camera *previous = &cache->camera;
+  Camera *camera = job->camera;
+
+  int half_width = cache->width / 2;
+  int half_height = cache->height / 2;
+  float pixels_per_unit_x = camera->width / camera->viewport_width;
+  float pixels_per_unit_y = camera->height / camera->viewport_height;
+
+  int y_begin = band * TEMPORAL_BAND_HEIGHT;
+  int y_end = band_end(cache, band);
+  for (int y = y_begin > 0 ? y_begin : 1; y < y_end; y++) {
+    for (int x = 1; x < cache->width; x++) {
+      int pixel = y * cache->width + x;
+      Vector3D ray_direction = raytracer_pixel_ray(previous, x, y);
+
+      /* A hit projects through its point; a miss through its direction,
+       * which only the camera rotation moves. */
+      Vector3D relative = ray_direction;
+      if (cache->history.sphere[pixel] >= 0) {
+        Vector3D point = vector_3d_add(
+            previous->position,
+            vector_3d_multiply_scalar(
+                ray_direction,
+                raytracer_true_t(ray_direction, cache->history.t[pixel])));
+        relative = vector_3d_subtract(point, camera->position);
+      }
+
+      float depth = vector_3d_dot_product(relative, camera->forward);
+      if (!(depth > 0)) {
+        continue;
+      }
+
+      float scale = camera->viewport_distance / depth;
+      float canvas_x = vector_3d_dot_product(relative, camera->right) *
+                       scale * pixels_per_unit_x;
+      float canvas_y = vector_3d_dot_product(relative, camera->up) * scale *
+                       pixels_per_unit_y;
+      if (!(fabsf(canvas_x) < cache->width &&
+            fabsf(canvas_y) < cache->height)) {
+        continue;
+      }
+
+      int target_x = half_width - (int)floorf(canvas_x + 0.5f);
+      int target_y = half_height - (int)floorf(canvas_y + 0.5f);
+      if (target_x < 1 || target_x >= cache->width || target_y < 1 ||
+          target_y >= cache->height) {
+        continue;
+      }
+
+      if (cache->history.sphere[pixel] < 0) {
+        depth = INFINITY;
+      }
+
+      _Atomic uint64_t *slot =
+          &cache->reprojection[target_y * cache->width + target_x];
+      uint64_t key = reprojection_key(depth, pixel);
+      uint64_t current = atomic_load_explicit(slot, memory_order_relaxed);
+      while (key < current &&
+             !atomic_compare_exchange_weak_explicit(
+                 slot, &current, key, memory_order_relaxed,
+                 memory_order_relaxed)) {
+      }
+    }
+  }
+}
+
+/* The hit reprojected onto the pixel, else the nearest hit reprojected
+ * onto one of its four neighbours, which fills the gaps forward
+ * projection leaves where surfaces grow on screen. */
+static uint64_t candidate_hit(const TemporalCache *cache, int x, int y) {
+  uint64_t key = atomic_load_explicit(
+      &cache->reprojection[y * cache->width + x], memory_order_relaxed);
+  if (reprojection_is_hit(key)) {
+    return key;
+  }
+
+  key = REPROJECTION_EMPTY;
+  const int neighbours[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+  for (int i = 0; i < 4; i++) {
+    int nx = x + neighbours[i][0];
+    int ny = y + neighbours[i][1];
+    if (nx < 1 || nx >= cache->width || ny < 1 || ny >= cache->height) {
+      continue;
+    }
+
+    uint64_t neighbour = atomic_load_explicit(
+        &cache->reprojection[ny * cache->width + nx], memory_order_relaxed);
+    if (reprojection_is_hit(neighbour) && neighbour < key) {
+      key = neighbour;
+    }
+  }
+
+  return key;
+}
+
+/* Whether a sphere that reprojected in front of depth near the pixel now
+ * covers it ahead of hit. A sphere that was off screen or hidden enters
+ * through a hole and is traced there, so only the spheres reprojected
+ * within TEMPORAL_OCCLUDER_RADIUS pixels need testing. */
+static bool nearby_sphere_occludes(TemporalCache *cache, Scene *scene,
+                                   Camera *camera, Vector3D ray_direction,
+                                   int x, int y, float depth, RayHit hit,
+                                   RenderCounters *counters) {
+  int tested = -1;
+
+  for (int dy = -TEMPORAL_OCCLUDER_RADIUS; dy <= TEMPORAL_OCCLUDER_RADIUS;
+       dy++) {
+    for (int dx = -TEMPORAL_OCCLUDER_RADIUS; dx <= TEMPORAL_OCCLUDER_RADIUS;
+         dx++) {
+      int nx = x + dx;
+      int ny = y + dy;
+      if (nx < 1 || nx >= cache->width || ny < 1 || ny >= cache->height) {
+        continue;
+      }
+
+      uint64_t key = atomic_load_explicit(
+          &cache->reprojection[ny * cache->width + nx], memory_order_relaxed);
+      if (!reprojection_is_hit(key) || !(reprojection_depth(key) < depth)) {
+        continue;
+      }
+
+      int sphere = cache->history.sphere[reprojection_source(key)];
+      if (sphere == tested || sphere == hit.sphere) {
+        continue;
+      }
+      tested = sphere;
+
+      RayHit occluder = raytracer_trace_sphere(scene, camera, ray_direction,
+                                               sphere, counters);
+      if (occluder.sphere >= 0 && occluder.t < hit.t) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+/* A candidate sphere is accepted if the new ray still hits it at about the
+ * depth its old point reprojected to, and no sphere nearer than that point
+ * now covers the pixel. */
+static bool validate_hit(TemporalCache *cache, Scene *scene, Camera *camera,
+                         Vector3D ray_direction, int x, int y, uint64_t key,
+                         RayHit *hit, RenderCounters *counters) {
+  int sphere = cache->history.sphere[reprojection_source(key)];
+  *hit = raytracer_trace_sphere(scene, camera, ray_direction, sphere,
+                                counters);
+  if (hit->sphere < 0) {
+    return false;
+  }
+
+  float depth =
+      raytracer_true_t(ray_direction, hit->t) * camera->viewport_distance;
+  float expected = reprojection_depth(key);
+  return fabsf(depth - expected) <= TEMPORAL_DEPTH_TOLERANCE * expected &&
+         !nearby_sphere_occludes(cache, scene, camera, ray_direction, x, y,
+                                 expected, *hit, counters);
+}
+
+/* Reused hits are re-shaded, which is exact for the sphere found; reused
+ * misses keep their colour. */
+static void resolve_band(void *context, int band, RenderCounters *counters) {
+  TemporalJob *job = context;
+  TemporalCache *cache = job->cache;
+  Scene *scene = job->scene;
+  Camera *camera = job->camera;
+
+  ShadowCache shadows;
+  raytracer_shadow_cache_init(&shadows);
+
+  int y_begin = band * TEMPORAL_BAND_HEIGHT;
+  int y_end = band_end(cache, band);
+  for (int y = y_begin > 0 ? y_begin : 1; y < y_end; y++) {
+    for (int x = 1; x < cache->width; x++) {
+      int pixel = y * cache->width + x;
+      Vector3D ray_direction = raytracer_pixel_ray(camera, x, y);
+      uint64_t own = atomic_load_explicit(&cache->reprojection[pixel],
+                                          memory_order_relaxed);
+      uint64_t key = candidate_hit(cache, x, y);
+
+      RayHit hit = {.t = camera->ray_t_max, .sphere = -1};
+      uint32_t color = 0;
+      int age = 0;
+      bool reused = false;
+      bool sky = own != REPROJECTION_EMPTY && !reprojection_is_hit(own);
+
+      if (key != REPROJECTION_EMPTY) {
+        age = cache->history.age[reprojection_source(key)] + 1;
+        reused = age < TEMPORAL_MAX_AGE &&
+                 validate_hit(cache, scene, camera, ray_direction, x, y, key,
+                              &hit, counters);
+        if (reused) {
+          color = vector_color_to_rgb_color(
+              raytracer_shade(scene, camera, ray_direction, hit,
+                              &shadows, counters));
+        }
+        /* A ray that hits the candidate sphere, even at the wrong depth,
+         * is not sky. */
+        sky = sky && age < TEMPORAL_MAX_AGE && hit.sphere < 0;
+      }
+
+      if (!reused && sky) {
+        age = cache->history.age[reprojection_source(own)] + 1;
+        reused = age < TEMPORAL_MAX_AGE &&
+                 !nearby_sphere_occludes(cache, scene, camera, ray_direction,
+                                         x, y, INFINITY, hit, counters);
+        color = cache->history.color[reprojection_source(own)];
+      }
+
+      if (!reused) {
+        hit = raytracer_trace(scene, camera, x, y, counters);
+        color = vector_color_to_rgb_color(
+            raytracer_shade(scene, camera, ray_direction, hit,
+                            &shadows, counters));
+        age = cache->valid ? 0 : staggered_age(pixel);
+      }
+
+      cache->next.t[pixel] = hit.t;
+      cache->next.sphere[pixel] = hit.sphere;
+      cache->next.color[pixel] = color;
+      cache->next.age[pixel] = (uint8_t)age;
+      job->framebuffer[pixel] = color;
+    }
+  }
+}
+
+void temporal_render(TemporalCache *cache, Scene *scene, Camera *camera,
+                     uint32_t *framebuffer) {
+  TemporalJob job = {.cache = cache,
+                     .scene = scene,
+                     .camera = camera,
+                     .framebuffer = framebuffer};
+  int bands = band_count(cache);
+
+  raytracer_run(bands, clear_band, &job);
+  if (cache->valid) {
+    raytracer_run(bands, scatter_band, &job);
+  }
+  raytracer_prepare_frame(scene, camera);
+  raytracer_run(bands, resolve_band, &job);
+
+  /* Every resolved pixel traced either one primary ray or nothing. */
+  RenderCounters counters = raytracer_frame_counters();
+  int pixels = (cache->width - 1) * (cache->height - 1);
+  cache->traced_pixels = (int)counters.primary_rays;
+  cache->reused_pixels = pixels - cache->traced_pixels;
+
+  TemporalHistory history = cache->history;
+  cache->history = cache->next;
+  cache->next = history;
+  cache->camera = *camera;
+  cache->valid = true;
+}
@@ -0,0 +1,75 @@
+#ifndef TEMPORAL_H
+#define TEMPORAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "camera.h"
+#include "scene.h"
+
+/**
+ * @file temporal.h
+ * @brief Full resolution frames during camera motion from the last frame.
+ *
+ * Every pixel of the last frame keeps its hit distance, sphere and
+ * colour. A new frame forward-projects those hits through the new camera
+ * pose, keeping the nearest one per pixel. A pixel that received a hit,
+ * or whose neighbour did, only intersects the ray with that one sphere:
+ * if the ray still hits it at about the projected depth, the pixel is
+ * re-shaded from that hit. Pixels that reprojected a miss keep the old
+ * colour. Pixels without a candidate, failing the check or reused for
+ * TEMPORAL_MAX_AGE frames are traced from scratch.
+ *
+ * The result is approximate: a sphere that was hidden or off screen last
+ * frame is only found where nothing reprojects over it. Progressive
+ * refinement restores the exact image once the camera stops.
+ */
+
+/**
+ * @struct TemporalHistory
+ * @brief Per-pixel state of one frame.
+ */
+typedef struct {
+  float *t;        /**< Hit ray parameter */
+  int *sphere;     /**< Sphere index, -1 for a miss */
+  uint32_t *color; /**< Colour written to the framebuffer */
+  uint8_t *age;    /**< Frames since the pixel was last traced */
+} TemporalHistory;
+
+typedef struct {
+  int width;
+  int height;
+  Camera camera; /**< Pose of history */
+  bool valid;    /**< history holds a frame rendered from camera */
+  TemporalHistory history;
+  TemporalHistory next;
+  /** Per pixel: projected depth bits << 32 | source pixel, or UINT64_MAX */
+  _Atomic uint64_t *reprojection;
+  int reused_pixels;  /**< Pixels of the last frame kept from history */
+  int traced_pixels;  /**< Pixels of the last frame traced from scratch */
+} TemporalCache;
+
+/**
+ * @brief Allocate a cache for width x height frames.
+ *
+ * @return Empty cache, or NULL on allocation failure
+ */
+TemporalCache *temporal_create(int width, int height);
+
+void temporal_destroy(TemporalCache *cache);
+
+/**
+ * @brief Forget the history, e.g. after the scene changed.
+ */
+void temporal_invalidate(TemporalCache *cache);
+
+/**
+ * @brief Render a full resolution frame, reusing the previous one.
+ *
+ * Writes the same pixels main_raytracer writes. The camera image must
+ * have the cache size. Without a valid history every pixel is traced.
+ */
+void temporal_render(TemporalCache *cache, Scene *scene, Camera *camera,
+                     uint32_t *framebuffer);
+
+#endif /* TEMPORAL_H */
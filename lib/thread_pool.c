@@ -0,0 +1,237 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+
+typedef struct {
+  pthread_mutex_t lock;
+  int head;
+  int tail;
+} TaskQueue;
+
+typedef struct {
+  ThreadPool *pool;
+  int index;
+} Worker;
+
+struct ThreadPool {
+  int thread_count;
+  pthread_t *threads;
+  Worker *workers;
+  TaskQueue *queues;
+
+  pthread_mutex_t lock;
+  pthread_cond_t job_ready;
+  pthread_cond_t job_done;
+  unsigned long generation;
+  int busy_workers;
+  bool shutting_down;
+
+  ThreadPoolTask task;
+  void *context;
+};
+
+int thread_pool_default_thread_count(void) {
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (int)count : 1;
+}
+
+static bool queue_pop_front(TaskQueue *queue, int *task_index) {
+  bool found = false;
+
+  pthread_mutex_lock(&queue->lock);
+  if (queue->head < queue->tail) {
+    *task_index = queue->head++;
+    found = true;
+  }
+  pthread_mutex_unlock(&queue->lock);
+
+  return found;
+}
+
+static bool queue_steal_back(TaskQueue *queue, int *task_index) {
+  bool found = false;
+
+  pthread_mutex_lock(&queue->lock);
+  if (queue->head < queue->tail) {
+    *task_index = --queue->tail;
+    found = true;
+  }
+  pthread_mutex_unlock(&queue->lock);
+
+  return found;
+}
+
+static bool next_task(ThreadPool *pool, int worker_index, int *task_index) {
+  if (queue_pop_front(&pool->queues[worker_index], task_index)) {
+    return true;
+  }
+
+  for (int i = 1; i < pool->thread_count; i++) {
+    int victim = (worker_index + i) % pool->thread_count;
+    if (queue_steal_back(&pool->queues[victim], task_index)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void drain_tasks(ThreadPool *pool, int worker_index) {
+  int task_index;
+  while (next_task(pool, worker_index, &task_index)) {
+    pool->task(pool->context, task_index, worker_index);
+  }
+}
+
+static void finish_job(ThreadPool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->busy_workers--;
+  if (pool->busy_workers == 0) {
+    pthread_cond_signal(&pool->job_done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static void *worker_main(void *argument) {
+  Worker *worker = argument;
+  ThreadPool *pool = worker->pool;
+  unsigned long seen_generation = 0;
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->generation == seen_generation && !pool->shutting_down) {
+      pthread_cond_wait(&pool->job_ready, &pool->lock);
+    }
+    if (pool->shutting_down) {
+      pthread_mutex_unlock(&pool->lock);
+      return NULL;
+    }
+    seen_generation = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    drain_tasks(pool, worker->index);
+    finish_job(pool);
+  }
+}
+
+ThreadPool *thread_pool_create(int thread_count) {
+  if (thread_count <= 0) {
+    thread_count = thread_pool_default_thread_count();
+  }
+
+  ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+  if (!pool) {
+    return NULL;
+  }
+
+  pool->thread_count = thread_count;
+  pool->threads = calloc(thread_count, sizeof(pthread_t));
+  pool->workers = calloc(thread_count, sizeof(Worker));
+  pool->queues = calloc(thread_count, sizeof(TaskQueue));
+
+  if (!pool->threads || !pool->workers || !pool->queues) {
+    free(pool->threads);
+    free(pool->workers);
+    free(pool->queues);
+    free(pool);
+    return NULL;
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->job_ready, NULL);
+  pthread_cond_init(&pool->job_done, NULL);
+
+  for (int i = 0; i < thread_count; i++) {
+    pthread_mutex_init(&pool->queues[i].lock, NULL);
+    pool->workers[i] = (Worker){pool, i};
+  }
+
+  /* Worker 0 is whichever thread calls thread_pool_run. */
+  for (int i = 1; i < thread_count; i++) {
+    if (pthread_create(&pool->threads[i], NULL, worker_main,
+                       &pool->workers[i]) != 0) {
+      pool->thread_count = i;
+      thread_pool_destroy(pool);
+      return NULL;
+    }
+  }
+
+  return pool;
+}
+
+void thread_pool_destroy(ThreadPool *pool) {
+  if (!pool) {
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->shutting_down = true;
+  pthread_cond_broadcast(&pool->job_ready);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 1; i < pool->thread_count; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  for (int i = 0; i < pool->thread_count; i++) {
+    pthread_mutex_destroy(&pool->queues[i].lock);
+  }
+
+  pthread_cond_destroy(&pool->job_done);
+  pthread_cond_destroy(&pool->job_ready);
+  pthread_mutex_destroy(&pool->lock);
+
+  free(pool->threads);
+  free(pool->workers);
+  free(pool->queues);
+  free(pool);
+}
+
+int thread_pool_thread_count(const ThreadPool *pool) {
+  return pool->thread_count;
+}
+
+void thread_pool_run(ThreadPool *pool, int task_count, ThreadPoolTask task,
+                     void *context) {
+  if (task_count <= 0) {
+    return;
+  }
+
+  if (pool->thread_count == 1) {
+    for (int i = 0; i < task_count; i++) {
+      task(context, i, 0);
+    }
+    return;
+  }
+
+  /* Neighbouring tasks go to the same worker so that, until stealing
+   * starts, each worker walks a contiguous part of the job. */
+  for (int i = 0; i < pool->thread_count; i++) {
+    pool->queues[i].head =
+        (int)((long long)task_count * i / pool->thread_count);
+    pool->queues[i].tail =
+        (int)((long long)task_count * (i + 1) / pool->thread_count);
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->task = task;
+  pool->context = context;
+  pool->busy_workers = pool->thread_count;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->job_ready);
+  pthread_mutex_unlock(&pool->lock);
+
+  drain_tasks(pool, 0);
+
+  pthread_mutex_lock(&pool->lock);
+  pool->busy_workers--;
+  while (pool->busy_workers > 0) {
+    pthread_cond_wait(&pool->job_done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
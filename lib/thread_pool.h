@@ -0,0 +1,56 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/**
+ * @file thread_pool.h
+ * @brief Fixed-size worker pool with a work-stealing task scheduler.
+ *
+ * A job is a range of task indices [0, task_count). Each worker starts
+ * with a contiguous slice of the range and pops tasks from the front of
+ * its own slice; a worker whose slice runs dry steals from the back of
+ * another worker's slice. The calling thread takes part as worker 0, so
+ * a pool of one thread runs every task inline.
+ */
+
+/**
+ * @brief Task callback.
+ *
+ * @param context User pointer passed to thread_pool_run
+ * @param task_index Index of the task in [0, task_count)
+ * @param worker_index Index of the worker running it, in [0, thread_count)
+ */
+typedef void (*ThreadPoolTask)(void *context, int task_index,
+                               int worker_index);
+
+typedef struct ThreadPool ThreadPool;
+
+/**
+ * @brief Number of online CPUs, or 1 if it cannot be determined.
+ */
+int thread_pool_default_thread_count(void);
+
+/**
+ * @brief Create a pool.
+ *
+ * @param thread_count Total workers including the caller; 0 selects
+ *                     thread_pool_default_thread_count()
+ * @return Pool, or NULL on allocation or thread creation failure
+ */
+ThreadPool *thread_pool_create(int thread_count);
+
+/**
+ * @brief Stop and join all workers and free the pool.
+ */
+void thread_pool_destroy(ThreadPool *pool);
+
+int thread_pool_thread_count(const ThreadPool *pool);
+
+/**
+ * @brief Run tasks [0, task_count) and block until all have finished.
+ *
+ * Must not be called concurrently on the same pool.
+ */
+void thread_pool_run(ThreadPool *pool, int task_count, ThreadPoolTask task,
+                     void *context);
+
+#endif /* THREAD_POOL_H */
@@ -0,0 +1,213 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "tile_bins.h"
+#include "vector_3d.h"
+
+#define HALF_PI (MATH_PI / 2.0)
+
+TileBins *tile_bins_create(void) { return calloc(1, sizeof(TileBins)); }
+
+void tile_bins_destroy(TileBins *bins) {
+  if (!bins) {
+    return;
+  }
+
+  free(bins->terms);
+  free(bins->bounds);
+  free(bins->offsets);
+  free(bins->indices);
+  free(bins);
+}
+
+/* Canvas coordinates [*low, *high] along one screen axis at which rays
+ * from the camera can meet a sphere. lateral is the sphere centre's
+ * coordinate along the axis and depth along the view direction, both
+ * relative to the camera. A ray can only meet the sphere if its
+ * projection onto the plane of the two meets the sphere's, a disk, ahead
+ * of the camera, so its angle from the view direction lies between the
+ * disk's tangents. Returns false when that range is behind the camera. */
+static bool project_axis(double lateral, double depth, double radius,
+                         double canvas_per_tangent, double *low,
+                         double *high) {
+  double distance_squared = lateral * lateral + depth * depth;
+  if (distance_squared <= radius * radius) {
+    *low = -INFINITY;
+    *high = INFINITY;
+    return true;
+  }
+
+  double center = atan2(lateral, depth);
+  double spread = asin(radius / sqrt(distance_squared));
+  double first = center - spread;
+  double last = center + spread;
+  if (last <= -HALF_PI || first >= HALF_PI) {
+    return false;
+  }
+
+  *low = first <= -HALF_PI ? -INFINITY : tan(first) * canvas_per_tangent;
+  *high = last >= HALF_PI ? INFINITY : tan(last) * canvas_per_tangent;
+  return true;
+}
+
+/* Tiles overlapping canvas coordinates [low, high] widened by a pixel,
+ * out of tiles_count covering [-half_size, half_size). */
+static void tile_range(double low, double high, int half_size,
+                       int tiles_count, int *first, int *last) {
+  low = fmax(low - 1.0, -half_size);
+  high = fmin(high + 1.0, half_size);
+  *first = (int)floor((low + half_size) / RENDER_TILE_SIZE);
+  *last = (int)floor((high + half_size) / RENDER_TILE_SIZE);
+  if (*last >= tiles_count) {
+    *last = tiles_count - 1;
+  }
+}
+
+/* Realloc array to count elements of size bytes if capacity is short;
+ * NULL on failure, leaving array allocated. */
+static void *reserve(void *array, size_t capacity, size_t count,
+                     size_t size) {
+  if (count <= capacity && array) {
+    return array;
+  }
+  return realloc(array, (count > 0 ? count : 1) * size);
+}
+
+/* Tiles each sphere overlaps, counted into offsets[tile + 1]. */
+static void bound_spheres(TileBins *bins, const Scene *scene,
+                          const Camera *camera, int tiles_x, int tiles_y) {
+  int half_width = camera->width / 2;
+  int half_height = camera->height / 2;
+  double width_scale = (double)camera->viewport_distance * camera->width /
+                       camera->viewport_width;
+  double height_scale = (double)camera->viewport_distance *
+                        camera->height / camera->viewport_height;
+
+  for (int i = 0; i < scene->spheres_count; i++) {
+    const Sphere *sphere = &scene->spheres[i];
+    SphereTerms terms = calculate_sphere_terms(camera, sphere);
+    bins->terms[i] = terms;
+
+    /* The centre in the camera's right, up and forward basis. */
+    Vector3D to_center = vector_3d_multiply_scalar(terms.origin_to_center,
+                                                   -1.0f);
+    double x = vector_3d_dot_product(to_center, camera->right);
+    double y = vector_3d_dot_product(to_center, camera->up);
+    double z = vector_3d_dot_product(to_center, camera->forward);
+
+    /* Rounding in the intersection test grows with the distance, and can
+     * report grazing hits just outside the sphere. */
+    double radius_squared = (double)sphere->radius * sphere->radius;
+    double radius =
+        sqrt(radius_squared + TILE_BINS_MARGIN *
+                                  (x * x + y * y + z * z + radius_squared));
+
+    int *bounds = bins->bounds[i];
+    double left, right, bottom, top;
+    if (!project_axis(x, z, radius, width_scale, &left, &right) ||
+        !project_axis(y, z, radius, height_scale, &bottom, &top)) {
+      bounds[0] = bounds[2] = 0;
+      bounds[1] = bounds[3] = -1;
+      continue;
+    }
+
+    tile_range(left, right, half_width, tiles_x, &bounds[0], &bounds[1]);
+    tile_range(bottom, top, half_height, tiles_y, &bounds[2], &bounds[3]);
+    for (int row = bounds[2]; row <= bounds[3]; row++) {
+      for (int column = bounds[0]; column <= bounds[1]; column++) {
+        bins->offsets[row * tiles_x + column + 1]++;
+      }
+    }
+  }
+}
+
+bool tile_bins_build(TileBins *bins, const Scene *scene,
+                     const Camera *camera) {
+  bins->scene = NULL;
+  if (camera->ray_t_min < 0.0f) {
+    return false;
+  }
+
+  int half_width = camera->width / 2;
+  int half_height = camera->height / 2;
+  int tiles_x = (2 * half_width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  int tiles_y = (2 * half_height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  int tiles_count = tiles_x * tiles_y;
+  size_t spheres_count = (size_t)scene->spheres_count;
+
+  SphereTerms *terms = reserve(bins->terms, bins->terms_capacity,
+                               spheres_count, sizeof(SphereTerms));
+  if (terms) {
+    bins->terms = terms;
+  }
+  int(*bounds)[4] = reserve(bins->bounds, bins->terms_capacity,
+                            spheres_count, sizeof(*bins->bounds));
+  if (bounds) {
+    bins->bounds = bounds;
+  }
+  if (!terms || !bounds) {
+    return false;
+  }
+  if (spheres_count > bins->terms_capacity) {
+    bins->terms_capacity = spheres_count;
+  }
+
+  int *offsets = reserve(bins->offsets, bins->offsets_capacity,
+                         (size_t)tiles_count + 1, sizeof(int));
+  if (!offsets) {
+    return false;
+  }
+  bins->offsets = offsets;
+  if ((size_t)tiles_count + 1 > bins->offsets_capacity) {
+    bins->offsets_capacity = (size_t)tiles_count + 1;
+  }
+
+  memset(offsets, 0, sizeof(int) * ((size_t)tiles_count + 1));
+  bound_spheres(bins, scene, camera, tiles_x, tiles_y);
+  for (int tile = 0; tile < tiles_count; tile++) {
+    offsets[tile + 1] += offsets[tile];
+  }
+
+  size_t indices_count = (size_t)offsets[tiles_count];
+  int *indices = reserve(bins->indices, bins->indices_capacity,
+                         indices_count, sizeof(int));
+  if (!indices) {
+    return false;
+  }
+  bins->indices = indices;
+  if (indices_count > bins->indices_capacity) {
+    bins->indices_capacity = indices_count;
+  }
+
+  /* offsets[tile] serves as the tile's write position, ending at the
+   * next tile's start, and is shifted back afterwards. */
+  for (int i = 0; i < scene->spheres_count; i++) {
+    const int *sphere_bounds = bins->bounds[i];
+    for (int row = sphere_bounds[2]; row <= sphere_bounds[3]; row++) {
+      for (int column = sphere_bounds[0]; column <= sphere_bounds[1];
+           column++) {
+        indices[offsets[row * tiles_x + column]++] = i;
+      }
+    }
+  }
+  memmove(&offsets[1], offsets, sizeof(int) * (size_t)tiles_count);
+  offsets[0] = 0;
+
+  bins->tiles_count = tiles_count;
+  bins->scene = scene;
+  bins->spheres = scene->spheres;
+  bins->spheres_count = scene->spheres_count;
+  bins->spheres_version = scene->spheres_version;
+  bins->camera = *camera;
+  return true;
+}
+
+bool tile_bins_match(const TileBins *bins, const Scene *scene,
+                     const Camera *camera) {
+  return bins->scene == scene && bins->spheres == scene->spheres &&
+         bins->spheres_count == scene->spheres_count &&
+         bins->spheres_version == scene->spheres_version &&
+         memcmp(&bins->camera, camera, sizeof(Camera)) == 0;
+}
@@ -0,0 +1,75 @@
+#ifndef TILE_BINS_H
+#define TILE_BINS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "camera.h"
+#include "scene.h"
+#include "sphere.h"
+
+/**
+ * @file tile_bins.h
+ * @brief Per-frame setup for primary rays: camera-relative sphere terms
+ *        and, for every render tile, the spheres that can cover it.
+ *
+ * Every primary ray starts at the camera, so each sphere's
+ * origin_to_center and quadratic_c are computed once per frame instead
+ * of once per ray or packet. Each sphere's bounds are projected onto the
+ * screen, and its index is added to the list of every tile the
+ * projection overlaps. A tile's rays then only need to test its list.
+ *
+ * The projection is conservative: the sphere is widened to cover rounding
+ * in the intersection test and its screen bounds by a pixel, so testing a
+ * tile's list gives exactly the hits testing every sphere gives. Tiles
+ * are numbered as in raytracer_tiles_count.
+ */
+
+typedef struct {
+  SphereTerms *terms; /**< Per sphere, for the camera position */
+  int *offsets;       /**< Tile t's spheres are indices[offsets[t]] up to
+                           indices[offsets[t + 1]], in index order */
+  int *indices;
+  int (*bounds)[4]; /**< Per sphere: first and last tile column and row,
+                         or an empty range */
+  int tiles_count;
+  size_t terms_capacity;
+  size_t offsets_capacity;
+  size_t indices_capacity;
+
+  /* What the bins were built for. */
+  const Scene *scene;
+  const Sphere *spheres;
+  int spheres_count;
+  unsigned int spheres_version;
+  Camera camera;
+} TileBins;
+
+/**
+ * @brief Allocate empty bins; tile_bins_build fills them.
+ *
+ * @return Bins, or NULL on allocation failure
+ */
+TileBins *tile_bins_create(void);
+
+void tile_bins_destroy(TileBins *bins);
+
+/**
+ * @brief Compute the sphere terms and tile lists for scene seen by camera.
+ *
+ * Arrays are reused between frames and grow as needed.
+ *
+ * @return false on allocation failure, or when the camera accepts hits
+ *         behind it (ray_t_min < 0), which the projection cannot bound
+ */
+bool tile_bins_build(TileBins *bins, const Scene *scene,
+                     const Camera *camera);
+
+/**
+ * @brief Whether the last successful build was for this scene, with its
+ *        spheres unchanged, and this camera.
+ */
+bool tile_bins_match(const TileBins *bins, const Scene *scene,
+                     const Camera *camera);
+
+#endif /* TILE_BINS_H */
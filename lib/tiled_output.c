@@ -0,0 +1,122 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "raytracer.h"
+#include "tiled_output.h"
+#include "vector_color.h"
+
+typedef struct {
+  Scene *scene;
+  Camera *camera;
+  uint8_t *rows; /* Top row of the image in the mapping */
+  size_t row_size;
+  int first_tile;
+} BandJob;
+
+static inline void put_rgb(uint8_t *out, uint32_t pixel) {
+  out[0] = (uint8_t)(pixel >> 16);
+  out[1] = (uint8_t)(pixel >> 8);
+  out[2] = (uint8_t)pixel;
+}
+
+static void render_band_tile(void *context, int task_index,
+                             RenderCounters *counters) {
+  BandJob *job = context;
+  int tile = job->first_tile + task_index;
+  uint32_t pixels[RENDER_TILE_SIZE * RENDER_TILE_SIZE];
+  raytracer_render_tile(job->scene, job->camera, tile, pixels, counters);
+
+  int x, y, width, height;
+  raytracer_tile_rect(job->camera, tile, &x, &y, &width, &height);
+  for (int row = 0; row < height; row++) {
+    uint8_t *out = job->rows + (size_t)(y + row) * job->row_size +
+                   3 * (size_t)x;
+    for (int column = 0; column < width; column++) {
+      put_rgb(&out[3 * column], pixels[row * width + column]);
+    }
+  }
+}
+
+bool tiled_output_render(Scene *scene, Camera *camera, const char *path,
+                         int *tiles_count) {
+  int width = camera->width;
+  int height = camera->height;
+  char header[64];
+  size_t header_size = (size_t)snprintf(header, sizeof(header),
+                                        "P6\n%d %d\n255\n", width, height);
+  size_t row_size = 3 * (size_t)width;
+  size_t file_size = header_size + row_size * (size_t)height;
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    return false;
+  }
+  int error = posix_fallocate(fd, 0, (off_t)file_size);
+  uint8_t *map = error == 0 ? mmap(NULL, file_size, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED, fd, 0)
+                            : MAP_FAILED;
+  if (map == MAP_FAILED) {
+    error = error != 0 ? error : errno;
+    close(fd);
+    errno = error;
+    return false;
+  }
+
+  memcpy(map, header, header_size);
+  BandJob job = {.scene = scene,
+                 .camera = camera,
+                 .rows = map + header_size,
+                 .row_size = row_size};
+
+  /* The first row and column are never traced; give them the background
+   * as a framebuffer cleared before rendering would have. */
+  uint8_t background[3];
+  put_rgb(background,
+          vector_color_to_rgb_color(scene->default_background_color));
+  for (int x = 0; x < width; x++) {
+    memcpy(&job.rows[3 * (size_t)x], background, 3);
+  }
+
+  raytracer_prepare_frame(scene, camera);
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  int tiles_x = (2 * (width / 2) + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  int count = raytracer_tiles_count(camera);
+  for (job.first_tile = 0; job.first_tile < count;
+       job.first_tile += tiles_x) {
+    raytracer_run(tiles_x, render_band_tile, &job);
+
+    int x, y, band_width, band_height;
+    raytracer_tile_rect(camera, job.first_tile, &x, &y, &band_width,
+                        &band_height);
+    for (int row = y; row < y + band_height; row++) {
+      memcpy(&job.rows[(size_t)row * row_size], background, 3);
+    }
+
+    /* Dirty pages of a shared mapping stay in the page cache when they
+     * are unmapped, so this only bounds what the process keeps resident.
+     * Pages shared with the next band are read back when it writes them. */
+    size_t begin = header_size + (size_t)y * row_size;
+    size_t end = header_size + (size_t)(y + band_height) * row_size;
+    begin -= begin % page_size;
+    if (band_height > 0) {
+      madvise(map + begin, end - begin, MADV_DONTNEED);
+    }
+  }
+
+  munmap(map, file_size);
+  if (close(fd) != 0) {
+    return false;
+  }
+  if (tiles_count) {
+    *tiles_count = count;
+  }
+  return true;
+}
@@ -0,0 +1,35 @@
+#ifndef TILED_OUTPUT_H
+#define TILED_OUTPUT_H
+
+#include <stdbool.h>
+
+#include "camera.h"
+#include "scene.h"
+
+/**
+ * @file tiled_output.h
+ * @brief Frames rendered tile by tile straight into a memory-mapped file.
+ *
+ * For images too large for a framebuffer, such as 32768 x 32768 posters.
+ * The output file is a binary PPM (P6), sized up front and mapped. Tiles
+ * are traced one row of tiles (a band) at a time: every render thread
+ * traces a tile into a tile-sized buffer on its stack and converts it into
+ * the mapping, and once a band is finished its pages are dropped from the
+ * process and left to the page cache to write back. Peak memory is one
+ * band of the file plus a tile per thread, whatever the image size, and
+ * the pixels are the same as those of a full frame render.
+ */
+
+/**
+ * @brief Render the frame into a PPM file at path.
+ *
+ * Disk space for the whole file is reserved before tracing, so a full
+ * disk is reported here rather than as a fault while writing.
+ *
+ * @param tiles_count Out, or NULL: tiles traced
+ * @return false with errno set when the file cannot be created or mapped
+ */
+bool tiled_output_render(Scene *scene, Camera *camera, const char *path,
+                         int *tiles_count);
+
+#endif /* TILED_OUTPUT_H */
@@ -0,0 +1,11 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <time.h>
+
+#include "timer.h"
+
+double timer_now_ms(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
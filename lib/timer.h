@@ -0,0 +1,11 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+/**
+ * @brief Monotonic wall clock in milliseconds.
+ *
+ * Only differences between two readings are meaningful.
+ */
+double timer_now_ms(void);
+
+#endif /* TIMER_H */
@@ -1,6 +1,7 @@
 #ifndef VECTOR_3D_H
 #define VECTOR_3D_H
 
+#include <math.h>
 #include <stdbool.h>
 
 /**
@@ -14,7 +15,8 @@
  *  - lighting calculations
  *  - physics-style math
  *
- * All functions return new vectors and never modify inputs.
+ * All functions return new vectors and never modify inputs. They are
+ * defined here so that every caller can inline them.
  */
 
 /**
@@ -45,14 +47,18 @@ typedef struct {
  * @param z Z component
  * @return Initialized vector
  */
-Vector3D vector_3d_init(float x, float y, float z);
+static inline Vector3D vector_3d_init(float x, float y, float z) {
+  return (Vector3D){x, y, z};
+}
 
 /**
  * @brief Return the zero vector (0,0,0).
  *
  * @return Zero vector
  */
-Vector3D vector_3d_zero(void);
+static inline Vector3D vector_3d_zero(void) {
+  return vector_3d_init(0.0f, 0.0f, 0.0f);
+}
 
 /* -------------------------------------------------------------------------
  * Basic arithmetic
@@ -65,7 +71,9 @@ Vector3D vector_3d_zero(void);
  * @param b Second vector
  * @return a + b
  */
-Vector3D vector_3d_add(Vector3D a, Vector3D b);
+static inline Vector3D vector_3d_add(Vector3D a, Vector3D b) {
+  return vector_3d_init(a.x + b.x, a.y + b.y, a.z + b.z);
+}
 
 /**
  * @brief Subtract two vectors.
@@ -74,7 +82,9 @@ Vector3D vector_3d_add(Vector3D a, Vector3D b);
  * @param b Second vector
  * @return a - b
  */
-Vector3D vector_3d_subtract(Vector3D a, Vector3D b);
+static inline Vector3D vector_3d_subtract(Vector3D a, Vector3D b) {
+  return vector_3d_init(a.x - b.x, a.y - b.y, a.z - b.z);
+}
 
 /**
  * @brief Negate a vector.
@@ -82,7 +92,9 @@ Vector3D vector_3d_subtract(Vector3D a, Vector3D b);
  * @param v Vector to negate
  * @return -v
  */
-Vector3D vector_3d_negate(Vector3D v);
+static inline Vector3D vector_3d_negate(Vector3D v) {
+  return vector_3d_init(-v.x, -v.y, -v.z);
+}
 
 /* -------------------------------------------------------------------------
  * Dot & cross products
@@ -106,7 +118,9 @@ Vector3D vector_3d_negate(Vector3D v);
  *  - angle between vectors
  *  - projections
  */
-float vector_3d_dot_product(Vector3D a, Vector3D b);
+static inline float vector_3d_dot_product(Vector3D a, Vector3D b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
 
 /**
  * @brief Compute the cross product of two vectors.
@@ -123,7 +137,11 @@ float vector_3d_dot_product(Vector3D a, Vector3D b);
  *
  * Direction follows the right-hand rule.
  */
-Vector3D vector_3d_cross_product(Vector3D a, Vector3D b);
+static inline Vector3D vector_3d_cross_product(Vector3D a,
+                                               Vector3D b) {
+  return vector_3d_init(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+                        a.x * b.y - a.y * b.x);
+}
 
 /* -------------------------------------------------------------------------
  * Comparison
@@ -141,7 +159,15 @@ Vector3D vector_3d_cross_product(Vector3D a, Vector3D b);
  * - If epsilon == 0, performs exact floating-point comparison.
  * - If epsilon > 0, performs component-wise comparison within tolerance.
  */
-bool vector_3d_equal(Vector3D a, Vector3D b, float epsilon);
+static inline bool vector_3d_equal(Vector3D a, Vector3D b,
+                                   float epsilon) {
+  if (epsilon == 0.0f) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+  }
+
+  return fabsf(a.x - b.x) <= epsilon && fabsf(a.y - b.y) <= epsilon &&
+         fabsf(a.z - b.z) <= epsilon;
+}
 
 /* -------------------------------------------------------------------------
  * Magnitude & scaling
@@ -158,7 +184,9 @@ bool vector_3d_equal(Vector3D a, Vector3D b, float epsilon);
  * |v| = \sqrt{x^2 + y^2 + z^2}
  * \f]
  */
-float vector_3d_magnitude(Vector3D v);
+static inline float vector_3d_magnitude(Vector3D v) {
+  return sqrtf(v.x * v.x + v.y * v.y + v.z * v.z);
+}
 
 /**
  * @brief Multiply a vector by a scalar.
@@ -167,7 +195,10 @@ float vector_3d_magnitude(Vector3D v);
  * @param k Scalar value
  * @return v * k
  */
-Vector3D vector_3d_multiply_scalar(Vector3D v, float k);
+static inline Vector3D vector_3d_multiply_scalar(Vector3D v,
+                                                 float k) {
+  return vector_3d_init(v.x * k, v.y * k, v.z * k);
+}
 
 /**
  * @brief Normalize a vector.
@@ -178,7 +209,15 @@ Vector3D vector_3d_multiply_scalar(Vector3D v, float k);
  * @note
  * If v is the zero vector, returns (0,0,0).
  */
-Vector3D vector_3d_normalize(Vector3D v);
+static inline Vector3D vector_3d_normalize(Vector3D v) {
+  float mag = vector_3d_magnitude(v);
+
+  if (mag == 0.0f) {
+    return vector_3d_zero();
+  }
+
+  return vector_3d_multiply_scalar(v, 1.0f / mag);
+}
 
 /* -------------------------------------------------------------------------
  * Reflection
@@ -201,6 +240,10 @@ Vector3D vector_3d_normalize(Vector3D v);
  *  - mirror reflections
  *  - specular lighting
  */
-Vector3D vector_3d_reflect(Vector3D v, Vector3D normal);
+static inline Vector3D vector_3d_reflect(Vector3D v,
+                                         Vector3D normal) {
+  float dot = vector_3d_dot_product(v, normal);
+  return vector_3d_subtract(v, vector_3d_multiply_scalar(normal, 2.0f * dot));
+}
 
 #endif /* VECTOR_3D_H */
@@ -0,0 +1,431 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "vector_3d.h"
+#include "vector_batch.h"
+
+/* The wider versions are compiled with GCC target attributes, so the
+ * file needs no -m flags and the build runs on any x86 CPU. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VECTOR_BATCH_X86 1
+#include <immintrin.h>
+#else
+#define VECTOR_BATCH_X86 0
+#endif
+
+static const char *level_names[SIMD_LEVELS_COUNT] = {"scalar", "sse4.1",
+                                                     "avx2", "avx512"};
+
+/* ------------------------------------------------------------------------
+ * Scalar, also used for the elements left after the last full register
+ * ------------------------------------------------------------------------ */
+
+static void normalize_scalar(float *x, float *y, float *z, size_t begin,
+                             size_t end) {
+  for (size_t i = begin; i < end; i++) {
+    Vector3D v = vector_3d_normalize(vector_3d_init(x[i], y[i], z[i]));
+    x[i] = v.x;
+    y[i] = v.y;
+    z[i] = v.z;
+  }
+}
+
+static void reflect_scalar(float *x, float *y, float *z, const float *nx,
+                           const float *ny, const float *nz, size_t begin,
+                           size_t end) {
+  for (size_t i = begin; i < end; i++) {
+    Vector3D v = vector_3d_reflect(vector_3d_init(x[i], y[i], z[i]),
+                                   vector_3d_init(nx[i], ny[i], nz[i]));
+    x[i] = v.x;
+    y[i] = v.y;
+    z[i] = v.z;
+  }
+}
+
+/* The vector max takes 0 for NaN like the comparison here does, so all
+ * versions agree bit for bit. */
+static inline uint32_t pack_channel(float c, float exposure, bool reinhard) {
+  c = c * exposure;
+  c = c > 0.0f ? c : 0.0f;
+  if (reinhard) {
+    c = c / (1.0f + c);
+  }
+  c = c < 1.0f ? c : 1.0f;
+  return (uint32_t)(uint8_t)(c * 255.0f);
+}
+
+static void pack_scalar(const float *red, const float *green,
+                        const float *blue, size_t begin, size_t end,
+                        float exposure, bool reinhard, uint32_t *argb) {
+  for (size_t i = begin; i < end; i++) {
+    argb[i] = (0xFFu << 24) | pack_channel(red[i], exposure, reinhard) << 16 |
+              pack_channel(green[i], exposure, reinhard) << 8 |
+              pack_channel(blue[i], exposure, reinhard);
+  }
+}
+
+static void normalize_level_scalar(float *x, float *y, float *z,
+                                   size_t count) {
+  normalize_scalar(x, y, z, 0, count);
+}
+
+static void reflect_level_scalar(float *x, float *y, float *z,
+                                 const float *nx, const float *ny,
+                                 const float *nz, size_t count) {
+  reflect_scalar(x, y, z, nx, ny, nz, 0, count);
+}
+
+static void pack_level_scalar(const float *red, const float *green,
+                              const float *blue, size_t count,
+                              float exposure, bool reinhard, uint32_t *argb) {
+  pack_scalar(red, green, blue, 0, count, exposure, reinhard, argb);
+}
+
+#if VECTOR_BATCH_X86
+
+/* ------------------------------------------------------------------------
+ * SSE4.1, 4 lanes
+ * ------------------------------------------------------------------------ */
+
+__attribute__((target("sse4.1"))) static void
+normalize_sse41(float *x, float *y, float *z, size_t count) {
+  size_t end = count - count % 4;
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 zero = _mm_setzero_ps();
+
+  for (size_t i = 0; i < end; i += 4) {
+    __m128 vx = _mm_loadu_ps(&x[i]);
+    __m128 vy = _mm_loadu_ps(&y[i]);
+    __m128 vz = _mm_loadu_ps(&z[i]);
+    __m128 magnitude = _mm_sqrt_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)),
+                   _mm_mul_ps(vz, vz)));
+    __m128 inverse = _mm_div_ps(one, magnitude);
+    /* True for NaN too, which the scalar version also divides by. */
+    __m128 nonzero = _mm_cmpneq_ps(magnitude, zero);
+    _mm_storeu_ps(&x[i],
+                  _mm_blendv_ps(zero, _mm_mul_ps(vx, inverse), nonzero));
+    _mm_storeu_ps(&y[i],
+                  _mm_blendv_ps(zero, _mm_mul_ps(vy, inverse), nonzero));
+    _mm_storeu_ps(&z[i],
+                  _mm_blendv_ps(zero, _mm_mul_ps(vz, inverse), nonzero));
+  }
+
+  normalize_scalar(x, y, z, end, count);
+}
+
+__attribute__((target("sse4.1"))) static void
+reflect_sse41(float *x, float *y, float *z, const float *nx, const float *ny,
+              const float *nz, size_t count) {
+  size_t end = count - count % 4;
+  const __m128 two = _mm_set1_ps(2.0f);
+
+  for (size_t i = 0; i < end; i += 4) {
+    __m128 vx = _mm_loadu_ps(&x[i]);
+    __m128 vy = _mm_loadu_ps(&y[i]);
+    __m128 vz = _mm_loadu_ps(&z[i]);
+    __m128 mx = _mm_loadu_ps(&nx[i]);
+    __m128 my = _mm_loadu_ps(&ny[i]);
+    __m128 mz = _mm_loadu_ps(&nz[i]);
+    __m128 dot =
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, mx), _mm_mul_ps(vy, my)),
+                   _mm_mul_ps(vz, mz));
+    __m128 k = _mm_mul_ps(two, dot);
+    _mm_storeu_ps(&x[i], _mm_sub_ps(vx, _mm_mul_ps(mx, k)));
+    _mm_storeu_ps(&y[i], _mm_sub_ps(vy, _mm_mul_ps(my, k)));
+    _mm_storeu_ps(&z[i], _mm_sub_ps(vz, _mm_mul_ps(mz, k)));
+  }
+
+  reflect_scalar(x, y, z, nx, ny, nz, end, count);
+}
+
+__attribute__((target("sse4.1"))) static inline __m128i
+pack_lanes_sse41(const float *channel, __m128 exposure, bool reinhard) {
+  const __m128 one = _mm_set1_ps(1.0f);
+  __m128 c = _mm_mul_ps(_mm_loadu_ps(channel), exposure);
+  c = _mm_max_ps(c, _mm_setzero_ps());
+  if (reinhard) {
+    c = _mm_div_ps(c, _mm_add_ps(one, c));
+  }
+  c = _mm_min_ps(c, one);
+  return _mm_cvttps_epi32(_mm_mul_ps(c, _mm_set1_ps(255.0f)));
+}
+
+__attribute__((target("sse4.1"))) static void
+pack_sse41(const float *red, const float *green, const float *blue,
+           size_t count, float exposure, bool reinhard, uint32_t *argb) {
+  size_t end = count - count % 4;
+  const __m128 scale = _mm_set1_ps(exposure);
+  const __m128i alpha = _mm_set1_epi32((int)0xFF000000u);
+
+  for (size_t i = 0; i < end; i += 4) {
+    __m128i r = pack_lanes_sse41(&red[i], scale, reinhard);
+    __m128i g = pack_lanes_sse41(&green[i], scale, reinhard);
+    __m128i b = pack_lanes_sse41(&blue[i], scale, reinhard);
+    __m128i packed =
+        _mm_or_si128(_mm_or_si128(alpha, _mm_slli_epi32(r, 16)),
+                     _mm_or_si128(_mm_slli_epi32(g, 8), b));
+    _mm_storeu_si128((__m128i *)&argb[i], packed);
+  }
+
+  pack_scalar(red, green, blue, end, count, exposure, reinhard, argb);
+}
+
+/* ------------------------------------------------------------------------
+ * AVX2, 8 lanes
+ * ------------------------------------------------------------------------ */
+
+__attribute__((target("avx2"))) static void
+normalize_avx2(float *x, float *y, float *z, size_t count) {
+  size_t end = count - count % 8;
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 zero = _mm256_setzero_ps();
+
+  for (size_t i = 0; i < end; i += 8) {
+    __m256 vx = _mm256_loadu_ps(&x[i]);
+    __m256 vy = _mm256_loadu_ps(&y[i]);
+    __m256 vz = _mm256_loadu_ps(&z[i]);
+    __m256 magnitude = _mm256_sqrt_ps(_mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)),
+        _mm256_mul_ps(vz, vz)));
+    __m256 inverse = _mm256_div_ps(one, magnitude);
+    __m256 nonzero = _mm256_cmp_ps(magnitude, zero, _CMP_NEQ_UQ);
+    _mm256_storeu_ps(&x[i],
+                     _mm256_and_ps(_mm256_mul_ps(vx, inverse), nonzero));
+    _mm256_storeu_ps(&y[i],
+                     _mm256_and_ps(_mm256_mul_ps(vy, inverse), nonzero));
+    _mm256_storeu_ps(&z[i],
+                     _mm256_and_ps(_mm256_mul_ps(vz, inverse), nonzero));
+  }
+
+  normalize_scalar(x, y, z, end, count);
+}
+
+__attribute__((target("avx2"))) static void
+reflect_avx2(float *x, float *y, float *z, const float *nx, const float *ny,
+             const float *nz, size_t count) {
+  size_t end = count - count % 8;
+  const __m256 two = _mm256_set1_ps(2.0f);
+
+  for (size_t i = 0; i < end; i += 8) {
+    __m256 vx = _mm256_loadu_ps(&x[i]);
+    __m256 vy = _mm256_loadu_ps(&y[i]);
+    __m256 vz = _mm256_loadu_ps(&z[i]);
+    __m256 mx = _mm256_loadu_ps(&nx[i]);
+    __m256 my = _mm256_loadu_ps(&ny[i]);
+    __m256 mz = _mm256_loadu_ps(&nz[i]);
+    __m256 dot = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(vx, mx), _mm256_mul_ps(vy, my)),
+        _mm256_mul_ps(vz, mz));
+    __m256 k = _mm256_mul_ps(two, dot);
+    _mm256_storeu_ps(&x[i], _mm256_sub_ps(vx, _mm256_mul_ps(mx, k)));
+    _mm256_storeu_ps(&y[i], _mm256_sub_ps(vy, _mm256_mul_ps(my, k)));
+    _mm256_storeu_ps(&z[i], _mm256_sub_ps(vz, _mm256_mul_ps(mz, k)));
+  }
+
+  reflect_scalar(x, y, z, nx, ny, nz, end, count);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+pack_lanes_avx2(const float *channel, __m256 exposure, bool reinhard) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  __m256 c = _mm256_mul_ps(_mm256_loadu_ps(channel), exposure);
+  c = _mm256_max_ps(c, _mm256_setzero_ps());
+  if (reinhard) {
+    c = _mm256_div_ps(c, _mm256_add_ps(one, c));
+  }
+  c = _mm256_min_ps(c, one);
+  return _mm256_cvttps_epi32(_mm256_mul_ps(c, _mm256_set1_ps(255.0f)));
+}
+
+__attribute__((target("avx2"))) static void
+pack_avx2(const float *red, const float *green, const float *blue,
+          size_t count, float exposure, bool reinhard, uint32_t *argb) {
+  size_t end = count - count % 8;
+  const __m256 scale = _mm256_set1_ps(exposure);
+  const __m256i alpha = _mm256_set1_epi32((int)0xFF000000u);
+
+  for (size_t i = 0; i < end; i += 8) {
+    __m256i r = pack_lanes_avx2(&red[i], scale, reinhard);
+    __m256i g = pack_lanes_avx2(&green[i], scale, reinhard);
+    __m256i b = pack_lanes_avx2(&blue[i], scale, reinhard);
+    __m256i packed = _mm256_or_si256(
+        _mm256_or_si256(alpha, _mm256_slli_epi32(r, 16)),
+        _mm256_or_si256(_mm256_slli_epi32(g, 8), b));
+    _mm256_storeu_si256((__m256i *)&argb[i], packed);
+  }
+
+  pack_scalar(red, green, blue, end, count, exposure, reinhard, argb);
+}
+
+/* ------------------------------------------------------------------------
+ * AVX-512, 16 lanes
+ * ------------------------------------------------------------------------ */
+
+__attribute__((target("avx512f"))) static void
+normalize_avx512(float *x, float *y, float *z, size_t count) {
+  size_t end = count - count % 16;
+  const __m512 one = _mm512_set1_ps(1.0f);
+  const __m512 zero = _mm512_setzero_ps();
+
+  for (size_t i = 0; i < end; i += 16) {
+    __m512 vx = _mm512_loadu_ps(&x[i]);
+    __m512 vy = _mm512_loadu_ps(&y[i]);
+    __m512 vz = _mm512_loadu_ps(&z[i]);
+    __m512 magnitude = _mm512_sqrt_ps(_mm512_add_ps(
+        _mm512_add_ps(_mm512_mul_ps(vx, vx), _mm512_mul_ps(vy, vy)),
+        _mm512_mul_ps(vz, vz)));
+    __m512 inverse = _mm512_div_ps(one, magnitude);
+    __mmask16 nonzero = _mm512_cmp_ps_mask(magnitude, zero, _CMP_NEQ_UQ);
+    _mm512_storeu_ps(&x[i], _mm512_maskz_mul_ps(nonzero, vx, inverse));
+    _mm512_storeu_ps(&y[i], _mm512_maskz_mul_ps(nonzero, vy, inverse));
+    _mm512_storeu_ps(&z[i], _mm512_maskz_mul_ps(nonzero, vz, inverse));
+  }
+
+  normalize_scalar(x, y, z, end, count);
+}
+
+__attribute__((target("avx512f"))) static void
+reflect_avx512(float *x, float *y, float *z, const float *nx,
+               const float *ny, const float *nz, size_t count) {
+  size_t end = count - count % 16;
+  const __m512 two = _mm512_set1_ps(2.0f);
+
+  for (size_t i = 0; i < end; i += 16) {
+    __m512 vx = _mm512_loadu_ps(&x[i]);
+    __m512 vy = _mm512_loadu_ps(&y[i]);
+    __m512 vz = _mm512_loadu_ps(&z[i]);
+    __m512 mx = _mm512_loadu_ps(&nx[i]);
+    __m512 my = _mm512_loadu_ps(&ny[i]);
+    __m512 mz = _mm512_loadu_ps(&nz[i]);
+    __m512 dot = _mm512_add_ps(
+        _mm512_add_ps(_mm512_mul_ps(vx, mx), _mm512_mul_ps(vy, my)),
+        _mm512_mul_ps(vz, mz));
+    __m512 k = _mm512_mul_ps(two, dot);
+    _mm512_storeu_ps(&x[i], _mm512_sub_ps(vx, _mm512_mul_ps(mx, k)));
+    _mm512_storeu_ps(&y[i], _mm512_sub_ps(vy, _mm512_mul_ps(my, k)));
+    _mm512_storeu_ps(&z[i], _mm512_sub_ps(vz, _mm512_mul_ps(mz, k)));
+  }
+
+  reflect_scalar(x, y, z, nx, ny, nz, end, count);
+}
+
+__attribute__((target("avx512f"))) static inline __m512i
+pack_lanes_avx512(const float *channel, __m512 exposure, bool reinhard) {
+  const __m512 one = _mm512_set1_ps(1.0f);
+  __m512 c = _mm512_mul_ps(_mm512_loadu_ps(channel), exposure);
+  c = _mm512_max_ps(c, _mm512_setzero_ps());
+  if (reinhard) {
+    c = _mm512_div_ps(c, _mm512_add_ps(one, c));
+  }
+  c = _mm512_min_ps(c, one);
+  return _mm512_cvttps_epi32(_mm512_mul_ps(c, _mm512_set1_ps(255.0f)));
+}
+
+__attribute__((target("avx512f"))) static void
+pack_avx512(const float *red, const float *green, const float *blue,
+            size_t count, float exposure, bool reinhard, uint32_t *argb) {
+  size_t end = count - count % 16;
+  const __m512 scale = _mm512_set1_ps(exposure);
+  const __m512i alpha = _mm512_set1_epi32((int)0xFF000000u);
+
+  for (size_t i = 0; i < end; i += 16) {
+    __m512i r = pack_lanes_avx512(&red[i], scale, reinhard);
+    __m512i g = pack_lanes_avx512(&green[i], scale, reinhard);
+    __m512i b = pack_lanes_avx512(&blue[i], scale, reinhard);
+    __m512i packed = _mm512_or_si512(
+        _mm512_or_si512(alpha, _mm512_slli_epi32(r, 16)),
+        _mm512_or_si512(_mm512_slli_epi32(g, 8), b));
+    _mm512_storeu_si512(&argb[i], packed);
+  }
+
+  pack_scalar(red, green, blue, end, count, exposure, reinhard, argb);
+}
+
+#endif /* VECTOR_BATCH_X86 */
+
+/* ------------------------------------------------------------------------
+ * Dispatch
+ * ------------------------------------------------------------------------ */
+
+typedef struct {
+  void (*normalize)(float *x, float *y, float *z, size_t count);
+  void (*reflect)(float *x, float *y, float *z, const float *nx,
+                  const float *ny, const float *nz, size_t count);
+  void (*pack)(const float *red, const float *green, const float *blue,
+               size_t count, float exposure, bool reinhard, uint32_t *argb);
+} Kernels;
+
+static const Kernels level_kernels[SIMD_LEVELS_COUNT] = {
+    {normalize_level_scalar, reflect_level_scalar, pack_level_scalar},
+#if VECTOR_BATCH_X86
+    {normalize_sse41, reflect_sse41, pack_sse41},
+    {normalize_avx2, reflect_avx2, pack_avx2},
+    {normalize_avx512, reflect_avx512, pack_avx512},
+#endif
+};
+
+static SimdLevel selected_level = SIMD_SCALAR;
+static Kernels kernels = {normalize_level_scalar, reflect_level_scalar,
+                          pack_level_scalar};
+
+SimdLevel vector_batch_detect(void) {
+#if VECTOR_BATCH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return SIMD_AVX512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return SIMD_AVX2;
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return SIMD_SSE41;
+  }
+#endif
+  return SIMD_SCALAR;
+}
+
+SimdLevel vector_batch_select(SimdLevel highest) {
+  SimdLevel supported = vector_batch_detect();
+  selected_level = highest < supported ? highest : supported;
+  if (selected_level < SIMD_SCALAR) {
+    selected_level = SIMD_SCALAR;
+  }
+  kernels = level_kernels[selected_level];
+  return selected_level;
+}
+
+SimdLevel vector_batch_level(void) { return selected_level; }
+
+const char *vector_batch_level_name(SimdLevel level) {
+  return level_names[level];
+}
+
+bool vector_batch_level_parse(const char *name, SimdLevel *level) {
+  for (int i = 0; i < SIMD_LEVELS_COUNT; i++) {
+    if (strcmp(name, level_names[i]) == 0) {
+      *level = (SimdLevel)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+void vector_batch_normalize(float *x, float *y, float *z, size_t count) {
+  kernels.normalize(x, y, z, count);
+}
+
+void vector_batch_reflect(float *x, float *y, float *z, const float *normal_x,
+                          const float *normal_y, const float *normal_z,
+                          size_t count) {
+  kernels.reflect(x, y, z, normal_x, normal_y, normal_z, count);
+}
+
+void vector_batch_pack_colors(const float *red, const float *green,
+                              const float *blue, size_t count,
+                              float exposure, bool reinhard,
+                              uint32_t *argb) {
+  kernels.pack(red, green, blue, count, exposure, reinhard, argb);
+}
@@ -0,0 +1,78 @@
+#ifndef VECTOR_BATCH_H
+#define VECTOR_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file vector_batch.h
+ * @brief vector_3d and vector_color kernels over whole arrays, with
+ *        scalar, SSE4.1, AVX2 and AVX-512 versions chosen at run time.
+ *
+ * Vectors are passed as separate x, y and z arrays and colours as
+ * separate red, green and blue arrays, so that a kernel handles 4, 8 or
+ * 16 elements per instruction. vector_batch_select picks the widest
+ * version the CPU supports once at startup, which lets one build use
+ * whatever each machine has; until then the scalar version runs. Every
+ * version computes exactly what the vector_3d and vector_color functions
+ * compute for a single element, so the results do not depend on the CPU.
+ */
+
+typedef enum {
+  SIMD_SCALAR,
+  SIMD_SSE41,
+  SIMD_AVX2,
+  SIMD_AVX512,
+  SIMD_LEVELS_COUNT
+} SimdLevel;
+
+/**
+ * @return Widest level both this CPU and this build support
+ */
+SimdLevel vector_batch_detect(void);
+
+/**
+ * @brief Use the widest supported level up to highest. Call before any
+ *        render thread starts.
+ *
+ * @return Level selected
+ */
+SimdLevel vector_batch_select(SimdLevel highest);
+
+SimdLevel vector_batch_level(void);
+
+/**
+ * @brief "scalar", "sse4.1", "avx2" or "avx512".
+ */
+const char *vector_batch_level_name(SimdLevel level);
+
+bool vector_batch_level_parse(const char *name, SimdLevel *level);
+
+/**
+ * @brief vector_3d_normalize of every vector, in place.
+ */
+void vector_batch_normalize(float *x, float *y, float *z, size_t count);
+
+/**
+ * @brief vector_3d_reflect of every vector about its unit normal, in
+ *        place.
+ */
+void vector_batch_reflect(float *x, float *y, float *z, const float *normal_x,
+                          const float *normal_y, const float *normal_z,
+                          size_t count);
+
+/**
+ * @brief Scale colours by exposure, map them to [0, 1] and pack them as
+ *        ARGB8888.
+ *
+ * Each channel becomes fminf(1, fmaxf(0, c * exposure)), with
+ * c / (1 + c) applied in between when reinhard is set, truncated to
+ * c * 255 as in vector_color_to_rgb_color.
+ */
+void vector_batch_pack_colors(const float *red, const float *green,
+                              const float *blue, size_t count,
+                              float exposure, bool reinhard,
+                              uint32_t *argb);
+
+#endif /* VECTOR_BATCH_H */
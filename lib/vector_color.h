@@ -1,6 +1,7 @@
 #ifndef VECTOR_COLOR_H
 #define VECTOR_COLOR_H
 
+#include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -10,23 +11,73 @@ typedef struct {
   float blue;
 } VectorColor;
 
-VectorColor vector_color_init(float red, float green, float blue);
+static inline VectorColor vector_color_init(float red, float green,
+                                            float blue) {
+  return (VectorColor){red, green, blue};
+}
 
-VectorColor vector_color_red(void);
-VectorColor vector_color_green(void);
-VectorColor vector_color_blue(void);
-VectorColor vector_color_cyan(void);
-VectorColor vector_color_magenta(void);
-VectorColor vector_color_yellow(void);
-VectorColor vector_color_black(void);
-VectorColor vector_color_white(void);
+static inline VectorColor vector_color_red(void) {
+  return vector_color_init(1.0f, 0.0f, 0.0f);
+}
+static inline VectorColor vector_color_green(void) {
+  return vector_color_init(0.0f, 1.0f, 0.0f);
+}
+static inline VectorColor vector_color_blue(void) {
+  return vector_color_init(0.0f, 0.0f, 1.0f);
+}
+static inline VectorColor vector_color_cyan(void) {
+  return vector_color_init(0.0f, 1.0f, 1.0f);
+}
+static inline VectorColor vector_color_magenta(void) {
+  return vector_color_init(1.0f, 0.0f, 1.0f);
+}
+static inline VectorColor vector_color_yellow(void) {
+  return vector_color_init(1.0f, 1.0f, 0.0f);
+}
+static inline VectorColor vector_color_black(void) {
+  return vector_color_init(0.0f, 0.0f, 0.0f);
+}
+static inline VectorColor vector_color_white(void) {
+  return vector_color_init(1.0f, 1.0f, 1.0f);
+}
 
-bool vector_color_equal(VectorColor a, VectorColor b, float epsilon);
+static inline bool vector_color_equal(VectorColor a, VectorColor b,
+                                      float epsilon) {
+  if (epsilon <= 0.0f) {
+    return a.red == b.red && a.green == b.green && a.blue == b.blue;
+  }
 
-VectorColor vector_color_multiply_scalar(VectorColor a, float k);
+  return fabsf(a.red - b.red) <= epsilon &&
+         fabsf(a.green - b.green) <= epsilon &&
+         fabsf(a.blue - b.blue) <= epsilon;
+}
 
-VectorColor vector_color_clamp(VectorColor v);
+static inline VectorColor vector_color_multiply_scalar(VectorColor a,
+                                                       float k) {
+  return vector_color_init(a.red * k, a.green * k, a.blue * k);
+}
 
-uint32_t vector_color_to_rgb_color(VectorColor v);
+/* Compares rather than fminf and fmaxf, which are libm calls without
+ * -ffast-math; NaN still clamps to 0. */
+static inline float vector_color_clamp_channel(float value) {
+  return value > 0.0f ? (value < 1.0f ? value : 1.0f) : 0.0f;
+}
+
+static inline VectorColor vector_color_clamp(VectorColor v) {
+  return vector_color_init(vector_color_clamp_channel(v.red),
+                           vector_color_clamp_channel(v.green),
+                           vector_color_clamp_channel(v.blue));
+}
+
+static inline uint32_t vector_color_to_rgb_color(VectorColor v) {
+  v = vector_color_clamp(v);
+
+  uint8_t r = (uint8_t)(v.red * 255.0f);
+  uint8_t g = (uint8_t)(v.green * 255.0f);
+  uint8_t b = (uint8_t)(v.blue * 255.0f);
+
+  /* ARGB: 0xAARRGGBB (opaque alpha) */
+  return (0xFFu << 24) | (r << 16) | (g << 8) | b;
+}
 
 #endif // VECTOR_COLOR_H
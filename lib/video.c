@@ -0,0 +1,220 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timer.h"
+#include "video.h"
+
+static const char *format_names[VIDEO_FORMATS_COUNT] = {"y4m", "argb"};
+
+struct VideoStream {
+  FILE *file;
+  VideoFormat format;
+  int width;
+  int height;
+  size_t pixel_count;
+  uint32_t *buffers[VIDEO_STREAM_BUFFERS];
+  uint8_t *planes; /* Y4M only: Y, U and V of one frame; writer only */
+  pthread_t thread;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake; /* Frame submitted, written or closing */
+  long submitted;      /* Frame n uses buffers[n % VIDEO_STREAM_BUFFERS] */
+  long written;
+  bool closing;
+  bool failed;
+  int error;
+  double write_ms;
+  double wait_ms;
+};
+
+bool video_format_parse(const char *name, VideoFormat *format) {
+  for (int i = 0; i < VIDEO_FORMATS_COUNT; i++) {
+    if (strcmp(name, format_names[i]) == 0) {
+      *format = (VideoFormat)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* BT.601 in integer form, as most encoders expect from Y4M. */
+static void argb_to_yuv444(const uint32_t *pixels, size_t count,
+                           uint8_t *planes) {
+  uint8_t *y_plane = planes;
+  uint8_t *u_plane = planes + count;
+  uint8_t *v_plane = planes + 2 * count;
+
+  for (size_t i = 0; i < count; i++) {
+    int r = (int)(pixels[i] >> 16 & 0xFF);
+    int g = (int)(pixels[i] >> 8 & 0xFF);
+    int b = (int)(pixels[i] & 0xFF);
+    y_plane[i] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+    u_plane[i] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+    v_plane[i] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+  }
+}
+
+static bool write_frame(VideoStream *stream, const uint32_t *framebuffer) {
+  if (stream->format == VIDEO_FORMAT_ARGB) {
+    return fwrite(framebuffer, sizeof(uint32_t), stream->pixel_count,
+                  stream->file) == stream->pixel_count;
+  }
+
+  argb_to_yuv444(framebuffer, stream->pixel_count, stream->planes);
+  return fputs("FRAME\n", stream->file) >= 0 &&
+         fwrite(stream->planes, 3, stream->pixel_count, stream->file) ==
+             stream->pixel_count;
+}
+
+static void *writer_main(void *argument) {
+  VideoStream *stream = argument;
+
+  pthread_mutex_lock(&stream->lock);
+  while (!stream->failed) {
+    while (stream->written == stream->submitted && !stream->closing) {
+      pthread_cond_wait(&stream->wake, &stream->lock);
+    }
+    if (stream->written == stream->submitted) {
+      break;
+    }
+    const uint32_t *framebuffer =
+        stream->buffers[stream->written % VIDEO_STREAM_BUFFERS];
+    pthread_mutex_unlock(&stream->lock);
+
+    double start = timer_now_ms();
+    errno = 0;
+    bool ok = write_frame(stream, framebuffer);
+    int error = errno ? errno : EIO;
+    double elapsed = timer_now_ms() - start;
+
+    pthread_mutex_lock(&stream->lock);
+    stream->write_ms += elapsed;
+    if (ok) {
+      stream->written++;
+    } else {
+      stream->failed = true;
+      stream->error = error;
+    }
+    pthread_cond_broadcast(&stream->wake);
+  }
+  pthread_mutex_unlock(&stream->lock);
+  return NULL;
+}
+
+static void free_stream(VideoStream *stream) {
+  for (int i = 0; i < VIDEO_STREAM_BUFFERS; i++) {
+    free(stream->buffers[i]);
+  }
+  free(stream->planes);
+  free(stream);
+}
+
+VideoStream *video_stream_create(FILE *file, VideoFormat format, int width,
+                                 int height, int fps) {
+  VideoStream *stream = calloc(1, sizeof(VideoStream));
+  if (!stream) {
+    return NULL;
+  }
+
+  stream->file = file;
+  stream->format = format;
+  stream->width = width;
+  stream->height = height;
+  stream->pixel_count = (size_t)width * height;
+
+  bool allocated = true;
+  for (int i = 0; i < VIDEO_STREAM_BUFFERS; i++) {
+    stream->buffers[i] = malloc(sizeof(uint32_t) * stream->pixel_count);
+    allocated &= stream->buffers[i] != NULL;
+  }
+  if (format == VIDEO_FORMAT_Y4M) {
+    stream->planes = malloc(3 * stream->pixel_count);
+    allocated &= stream->planes != NULL;
+  }
+  if (!allocated) {
+    free_stream(stream);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  if (format == VIDEO_FORMAT_Y4M &&
+      fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height,
+              fps) < 0) {
+    int error = errno;
+    free_stream(stream);
+    errno = error;
+    return NULL;
+  }
+
+  pthread_mutex_init(&stream->lock, NULL);
+  pthread_cond_init(&stream->wake, NULL);
+  int error = pthread_create(&stream->thread, NULL, writer_main, stream);
+  if (error != 0) {
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->wake);
+    free_stream(stream);
+    errno = error;
+    return NULL;
+  }
+
+  return stream;
+}
+
+uint32_t *video_stream_acquire(VideoStream *stream) {
+  double start = timer_now_ms();
+
+  pthread_mutex_lock(&stream->lock);
+  while (stream->submitted - stream->written >= VIDEO_STREAM_BUFFERS &&
+         !stream->failed) {
+    pthread_cond_wait(&stream->wake, &stream->lock);
+  }
+  uint32_t *framebuffer =
+      stream->failed
+          ? NULL
+          : stream->buffers[stream->submitted % VIDEO_STREAM_BUFFERS];
+  stream->wait_ms += timer_now_ms() - start;
+  pthread_mutex_unlock(&stream->lock);
+
+  return framebuffer;
+}
+
+void video_stream_submit(VideoStream *stream) {
+  pthread_mutex_lock(&stream->lock);
+  stream->submitted++;
+  pthread_cond_broadcast(&stream->wake);
+  pthread_mutex_unlock(&stream->lock);
+}
+
+bool video_stream_close(VideoStream *stream, VideoStreamStats *stats) {
+  pthread_mutex_lock(&stream->lock);
+  stream->closing = true;
+  pthread_cond_broadcast(&stream->wake);
+  pthread_mutex_unlock(&stream->lock);
+
+  pthread_join(stream->thread, NULL);
+  pthread_mutex_destroy(&stream->lock);
+  pthread_cond_destroy(&stream->wake);
+
+  bool ok = !stream->failed;
+  int error = stream->error;
+  if (ok && fflush(stream->file) != 0) {
+    ok = false;
+    error = errno;
+  }
+
+  if (stats) {
+    *stats = (VideoStreamStats){.frames = (int)stream->written,
+                                .write_ms = stream->write_ms,
+                                .wait_ms = stream->wait_ms};
+  }
+  free_stream(stream);
+
+  if (!ok) {
+    errno = error;
+  }
+  return ok;
+}
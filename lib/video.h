@@ -0,0 +1,76 @@
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @file video.h
+ * @brief Rendered frames streamed to a file or pipe on a writer thread.
+ *
+ * The stream owns VIDEO_STREAM_BUFFERS framebuffers. The renderer
+ * acquires a free one, renders straight into it and submits it; a writer
+ * thread encodes and writes submitted frames in order. While frame N is
+ * being written, frame N + 1 is traced into the other buffer, and no
+ * frame is copied on the way: raw ARGB is written from the framebuffer
+ * itself, and Y4M is converted once into the planes that are written.
+ */
+
+#define VIDEO_STREAM_BUFFERS 2
+
+typedef enum {
+  VIDEO_FORMAT_Y4M,  /**< YUV4MPEG2, 4:4:4 BT.601 limited range */
+  VIDEO_FORMAT_ARGB, /**< Headerless 32-bit pixels, as in memory */
+  VIDEO_FORMATS_COUNT
+} VideoFormat;
+
+typedef struct VideoStream VideoStream;
+
+/**
+ * @struct VideoStreamStats
+ * @brief Totals over a stream's lifetime.
+ */
+typedef struct {
+  int frames;     /**< Frames written */
+  double write_ms; /**< Writer thread encoding and writing */
+  double wait_ms;  /**< Renderer waiting for a free buffer */
+} VideoStreamStats;
+
+/**
+ * @brief Look up a format by name ("y4m" or "argb").
+ */
+bool video_format_parse(const char *name, VideoFormat *format);
+
+/**
+ * @brief Write the stream header and start the writer thread.
+ *
+ * @param fps Frame rate recorded in the Y4M header
+ * @return Stream, or NULL with errno set
+ */
+VideoStream *video_stream_create(FILE *file, VideoFormat format, int width,
+                                 int height, int fps);
+
+/**
+ * @brief Wait for a free width x height framebuffer to render into.
+ *
+ * Its previous contents are those of an earlier frame.
+ *
+ * @return Framebuffer, or NULL once a write has failed
+ */
+uint32_t *video_stream_acquire(VideoStream *stream);
+
+/**
+ * @brief Queue the acquired framebuffer for writing.
+ */
+void video_stream_submit(VideoStream *stream);
+
+/**
+ * @brief Write the queued frames, stop the writer and free the stream.
+ *
+ * @param stats Out, or NULL
+ * @return false with errno set when any write failed
+ */
+bool video_stream_close(VideoStream *stream, VideoStreamStats *stats);
+
+#endif /* VIDEO_H */
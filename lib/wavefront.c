@@ -0,0 +1,586 @@
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "vector_3d.h"
+#include "vector_batch.h"
+#include "wavefront.h"
+
+/* Sort key: direction octant (3 bits), |direction.x| and |direction.y|
+ * (4 bits each) and the Morton code of the origin's cell in the queue's
+ * bounding box (7 bits per axis). */
+#define WAVEFRONT_DIRECTION_BITS 4
+#define WAVEFRONT_CELL_BITS 7
+
+/* The key is sorted on in four passes of 8 bit digits. */
+#define WAVEFRONT_DIGIT_BITS 8
+#define WAVEFRONT_DIGITS (1 << WAVEFRONT_DIGIT_BITS)
+
+typedef struct {
+  Vector3D origin;
+  Vector3D direction; /* Unit length */
+  float weight;       /* Share of the pixel this ray's colour makes up */
+  int pixel;
+} WavefrontRay;
+
+/* What a primary pixel or a queued ray found. The emit step adds its
+ * colour to the pixel and decides whether next gets traced. */
+typedef struct {
+  VectorColor color;
+  float weight;
+  float reflective; /* 0 when the hit does not reflect any further */
+  int pixel;
+  WavefrontRay next;
+} Bounce;
+
+typedef struct {
+  Vector3D low;
+  Vector3D high;
+} OriginBox;
+
+struct Wavefront {
+  int width;
+  int height;
+  size_t capacity; /* A bounce never has more than one ray per pixel */
+  RayHit *hits;
+  Bounce *bounces;
+  WavefrontRay *rays; /* Queue of the bounce being traced */
+  WavefrontRay *sorted;
+  uint64_t *keys;
+  uint64_t *sorted_keys;
+  /* Per batch of WAVEFRONT_BATCH_SIZE bounces or rays */
+  int *reflective;   /* Bounces wanting a ray, then the first one's rank */
+  OriginBox *boxes;  /* Bounding box of the rays' origins */
+  int *digit_counts; /* Keys per radix digit, then each digit's offset */
+};
+
+typedef struct {
+  Wavefront *wavefront;
+  Scene *scene;
+  Camera *camera;
+  HdrImage *hdr;
+  int count;          /* Pixels or queued rays */
+  bool reflect_again; /* The bounce being traced is not the last one */
+  bool primary;       /* Emitting the primary pass's bounces */
+  int queue_limit;    /* Rays emit queues, taken in bounce order */
+} BounceJob;
+
+typedef struct {
+  Wavefront *wavefront;
+  int count;
+  int shift; /* Of the radix digit being sorted on */
+  Vector3D low;
+  Vector3D inverse_extent;
+} SortJob;
+
+Wavefront *wavefront_create(int width, int height) {
+  Wavefront *wavefront = calloc(1, sizeof(Wavefront));
+  if (!wavefront) {
+    return NULL;
+  }
+
+  size_t capacity = (size_t)width * height;
+  wavefront->width = width;
+  wavefront->height = height;
+  wavefront->capacity = capacity;
+  wavefront->hits = malloc(sizeof(RayHit) * capacity);
+  wavefront->bounces = malloc(sizeof(Bounce) * capacity);
+  wavefront->rays = malloc(sizeof(WavefrontRay) * capacity);
+  wavefront->sorted = malloc(sizeof(WavefrontRay) * capacity);
+  wavefront->keys = malloc(sizeof(uint64_t) * capacity);
+  wavefront->sorted_keys = malloc(sizeof(uint64_t) * capacity);
+  size_t batches = (capacity + WAVEFRONT_BATCH_SIZE - 1) / WAVEFRONT_BATCH_SIZE;
+  wavefront->reflective = malloc(sizeof(int) * batches);
+  wavefront->boxes = malloc(sizeof(OriginBox) * batches);
+  wavefront->digit_counts = malloc(sizeof(int) * WAVEFRONT_DIGITS * batches);
+  if (!wavefront->hits || !wavefront->bounces || !wavefront->rays ||
+      !wavefront->sorted || !wavefront->keys || !wavefront->sorted_keys ||
+      !wavefront->reflective || !wavefront->boxes ||
+      !wavefront->digit_counts) {
+    wavefront_destroy(wavefront);
+    return NULL;
+  }
+
+  return wavefront;
+}
+
+void wavefront_destroy(Wavefront *wavefront) {
+  if (!wavefront) {
+    return;
+  }
+
+  free(wavefront->hits);
+  free(wavefront->bounces);
+  free(wavefront->rays);
+  free(wavefront->sorted);
+  free(wavefront->keys);
+  free(wavefront->sorted_keys);
+  free(wavefront->reflective);
+  free(wavefront->boxes);
+  free(wavefront->digit_counts);
+  free(wavefront);
+}
+
+static bool reflects(const Sphere *sphere) {
+  return !sphere->is_light_source && sphere->reflective > 0.0f;
+}
+
+/* Reflections found by one batch, computed together by the vector_batch
+ * kernels once it has been queued. */
+#define WAVEFRONT_REFLECTIONS 256
+
+typedef struct {
+  int count;
+  bool unit_directions;
+  Bounce *bounces[WAVEFRONT_REFLECTIONS];
+  float x[WAVEFRONT_REFLECTIONS];
+  float y[WAVEFRONT_REFLECTIONS];
+  float z[WAVEFRONT_REFLECTIONS];
+  float normal_x[WAVEFRONT_REFLECTIONS];
+  float normal_y[WAVEFRONT_REFLECTIONS];
+  float normal_z[WAVEFRONT_REFLECTIONS];
+} Reflections;
+
+static void reflections_flush(Reflections *reflections) {
+  size_t count = (size_t)reflections->count;
+  if (!reflections->unit_directions) {
+    vector_batch_normalize(reflections->x, reflections->y, reflections->z,
+                           count);
+  }
+  vector_batch_normalize(reflections->normal_x, reflections->normal_y,
+                         reflections->normal_z, count);
+  vector_batch_reflect(reflections->x, reflections->y, reflections->z,
+                       reflections->normal_x, reflections->normal_y,
+                       reflections->normal_z, count);
+
+  for (size_t i = 0; i < count; i++) {
+    reflections->bounces[i]->next.direction = vector_3d_init(
+        reflections->x[i], reflections->y[i], reflections->z[i]);
+  }
+  reflections->count = 0;
+}
+
+/* Sets bounce->next to the reflection of direction at point, once the
+ * batch is flushed. */
+static void reflections_add(Reflections *reflections, Bounce *bounce,
+                            const Sphere *sphere, Vector3D point,
+                            Vector3D direction, int pixel) {
+  int i = reflections->count;
+  Vector3D normal = vector_3d_subtract(point, sphere->center);
+  bounce->next = (WavefrontRay){.origin = point, .pixel = pixel};
+  reflections->bounces[i] = bounce;
+  reflections->x[i] = direction.x;
+  reflections->y[i] = direction.y;
+  reflections->z[i] = direction.z;
+  reflections->normal_x[i] = normal.x;
+  reflections->normal_y[i] = normal.y;
+  reflections->normal_z[i] = normal.z;
+  if (++reflections->count == WAVEFRONT_REFLECTIONS) {
+    reflections_flush(reflections);
+  }
+}
+
+static int batches_of(int count) {
+  return (count + WAVEFRONT_BATCH_SIZE - 1) / WAVEFRONT_BATCH_SIZE;
+}
+
+static int batch_end(int batch, int count) {
+  int end = (batch + 1) * WAVEFRONT_BATCH_SIZE;
+  return end < count ? end : count;
+}
+
+/* The primary pass already wrote each pixel's own colour, so only
+ * reflective hits need a bounce. */
+static void primary_batch(void *context, int batch,
+                          RenderCounters *counters) {
+  (void)counters;
+  BounceJob *job = context;
+  Wavefront *wavefront = job->wavefront;
+  int begin = batch * WAVEFRONT_BATCH_SIZE;
+  int end = batch_end(batch, job->count);
+
+  /* Camera rays are normalized along with the normals. */
+  Reflections reflections = {.unit_directions = false};
+  int reflective = 0;
+
+  for (int pixel = begin; pixel < end; pixel++) {
+    Bounce *bounce = &wavefront->bounces[pixel];
+    RayHit hit = wavefront->hits[pixel];
+    bounce->reflective = 0.0f;
+    if (hit.sphere < 0 || !reflects(&job->scene->spheres[hit.sphere])) {
+      continue;
+    }
+
+    const Sphere *sphere = &job->scene->spheres[hit.sphere];
+    Vector3D direction = raytracer_pixel_ray(
+        job->camera, pixel % wavefront->width, pixel / wavefront->width);
+    Vector3D point = vector_3d_add(
+        job->camera->position,
+        vector_3d_multiply_scalar(direction,
+                                  raytracer_true_t(direction, hit.t)));
+
+    bounce->color = vector_color_init(
+        job->hdr->red[pixel], job->hdr->green[pixel], job->hdr->blue[pixel]);
+    bounce->weight = 1.0f;
+    bounce->reflective = sphere->reflective;
+    bounce->pixel = pixel;
+    reflections_add(&reflections, bounce, sphere, point, direction, pixel);
+    reflective++;
+  }
+  reflections_flush(&reflections);
+  wavefront->reflective[batch] = reflective;
+}
+
+static void trace_batch(void *context, int batch, RenderCounters *counters) {
+  BounceJob *job = context;
+  Wavefront *wavefront = job->wavefront;
+  Scene *scene = job->scene;
+  int begin = batch * WAVEFRONT_BATCH_SIZE;
+  int end = batch_end(batch, job->count);
+
+  ShadowCache shadows;
+  raytracer_shadow_cache_init(&shadows);
+
+  Vector3D origins[SECONDARY_RAY_PACKET_SIZE];
+  Vector3D directions[SECONDARY_RAY_PACKET_SIZE];
+  RayHit hits[SECONDARY_RAY_PACKET_SIZE];
+  Reflections reflections = {.unit_directions = true};
+  int reflective = 0;
+
+  for (int i = begin; i < end; i++) {
+    /* Neighbours in the sorted queue are traced as one packet. */
+    int lane = (i - begin) % SECONDARY_RAY_PACKET_SIZE;
+    if (lane == 0) {
+      int lanes = end - i < SECONDARY_RAY_PACKET_SIZE
+                      ? end - i
+                      : SECONDARY_RAY_PACKET_SIZE;
+      for (int j = 0; j < lanes; j++) {
+        origins[j] = wavefront->rays[i + j].origin;
+        directions[j] = wavefront->rays[i + j].direction;
+      }
+      raytracer_trace_from(scene, origins, directions, lanes, hits,
+                           counters);
+    }
+
+    const WavefrontRay *ray = &wavefront->rays[i];
+    Bounce *bounce = &wavefront->bounces[i];
+    RayHit hit = hits[lane];
+
+    bounce->weight = ray->weight;
+    bounce->reflective = 0.0f;
+    bounce->pixel = ray->pixel;
+    if (hit.sphere < 0) {
+      bounce->color = scene->default_background_color;
+      continue;
+    }
+
+    const Sphere *sphere = &scene->spheres[hit.sphere];
+    Vector3D point = vector_3d_add(
+        ray->origin, vector_3d_multiply_scalar(ray->direction, hit.t));
+    bounce->color =
+        raytracer_shade_point(scene, hit.sphere, point, &shadows, counters);
+    if (job->reflect_again && reflects(sphere)) {
+      bounce->reflective = sphere->reflective;
+      reflections_add(&reflections, bounce, sphere, point, ray->direction,
+                      ray->pixel);
+      reflective++;
+    }
+  }
+  reflections_flush(&reflections);
+  wavefront->reflective[batch] = reflective;
+}
+
+/* Gives each batch's first reflective bounce its rank among all of them,
+ * which is its ray's place in the next queue while the budget lasts.
+ * Returns the number of rays that will be queued. */
+static int rank_reflections(Wavefront *wavefront, int count, int *budget,
+                            bool *budget_exhausted) {
+  int reflective = 0;
+  for (int batch = 0; batch < batches_of(count); batch++) {
+    int batch_reflective = wavefront->reflective[batch];
+    wavefront->reflective[batch] = reflective;
+    reflective += batch_reflective;
+  }
+
+  int queued = reflective < *budget ? reflective : *budget;
+  if (reflective > queued) {
+    *budget_exhausted = true;
+  }
+  *budget -= queued;
+  return queued;
+}
+
+/* Adds each bounce's colour to its pixel and queues the rays ranked
+ * within the limit. Primary pixels are replaced rather than added to, as
+ * they already hold their own colour. A pixel has at most one bounce, so
+ * batches never write the same pixel. */
+static void emit_batch(void *context, int batch, RenderCounters *counters) {
+  (void)counters;
+  BounceJob *job = context;
+  Wavefront *wavefront = job->wavefront;
+  HdrImage *hdr = job->hdr;
+  int begin = batch * WAVEFRONT_BATCH_SIZE;
+  int end = batch_end(batch, job->count);
+  int rank = wavefront->reflective[batch];
+
+  for (int i = begin; i < end; i++) {
+    const Bounce *bounce = &wavefront->bounces[i];
+    if (job->primary && bounce->reflective == 0.0f) {
+      continue;
+    }
+
+    float share = bounce->weight;
+    if (bounce->reflective > 0.0f) {
+      if (rank < job->queue_limit) {
+        WavefrontRay *ray = &wavefront->rays[rank];
+        *ray = bounce->next;
+        ray->weight = bounce->weight * bounce->reflective;
+        share *= 1.0f - bounce->reflective;
+      }
+      rank++;
+    }
+
+    int pixel = bounce->pixel;
+    if (job->primary) {
+      hdr_image_set(hdr, pixel,
+                    vector_color_multiply_scalar(bounce->color, share));
+    } else {
+      hdr->red[pixel] += bounce->color.red * share;
+      hdr->green[pixel] += bounce->color.green * share;
+      hdr->blue[pixel] += bounce->color.blue * share;
+    }
+  }
+}
+
+/* Emits the bounces of job->count pixels or rays and returns the number
+ * of rays queued for the next bounce. */
+static int emit(BounceJob *job, bool primary, int *budget,
+                bool *budget_exhausted) {
+  job->primary = primary;
+  job->queue_limit = rank_reflections(job->wavefront, job->count, budget,
+                                      budget_exhausted);
+  raytracer_run(batches_of(job->count), emit_batch, job);
+  return job->queue_limit;
+}
+
+static uint32_t quantize(float value, float low, float inverse_extent,
+                         int bits) {
+  int level = (int)((value - low) * inverse_extent * (float)(1 << bits));
+  int top = (1 << bits) - 1;
+  return (uint32_t)(level < 0 ? 0 : (level > top ? top : level));
+}
+
+/* Moves bit i of a WAVEFRONT_CELL_BITS value to bit 3 * i. */
+static uint32_t spread_bits(uint32_t value) {
+  value = (value | value << 8) & 0x0000F00Fu;
+  value = (value | value << 4) & 0x000C30C3u;
+  return (value | value << 2) & 0x00249249u;
+}
+
+_Static_assert(WAVEFRONT_CELL_BITS <= 10, "spread_bits takes 10 bits");
+
+static uint32_t ray_key(const WavefrontRay *ray, Vector3D low,
+                        Vector3D inverse_extent) {
+  Vector3D d = ray->direction;
+  uint32_t octant = (d.x < 0.0f) | (d.y < 0.0f) << 1 | (d.z < 0.0f) << 2;
+  uint32_t direction =
+      quantize(fabsf(d.x), 0.0f, 1.0f, WAVEFRONT_DIRECTION_BITS)
+          << WAVEFRONT_DIRECTION_BITS |
+      quantize(fabsf(d.y), 0.0f, 1.0f, WAVEFRONT_DIRECTION_BITS);
+  uint32_t cell =
+      spread_bits(quantize(ray->origin.x, low.x, inverse_extent.x,
+                           WAVEFRONT_CELL_BITS)) |
+      spread_bits(quantize(ray->origin.y, low.y, inverse_extent.y,
+                           WAVEFRONT_CELL_BITS))
+          << 1 |
+      spread_bits(quantize(ray->origin.z, low.z, inverse_extent.z,
+                           WAVEFRONT_CELL_BITS))
+          << 2;
+
+  return octant << 29 | direction << 21 | cell;
+}
+
+static float inverse_or_zero(float extent) {
+  return extent > 0.0f ? 1.0f / extent : 0.0f;
+}
+
+static OriginBox origin_box_grow(OriginBox box, Vector3D low,
+                                 Vector3D high) {
+  return (OriginBox){
+      vector_3d_init(low.x < box.low.x ? low.x : box.low.x,
+                     low.y < box.low.y ? low.y : box.low.y,
+                     low.z < box.low.z ? low.z : box.low.z),
+      vector_3d_init(high.x > box.high.x ? high.x : box.high.x,
+                     high.y > box.high.y ? high.y : box.high.y,
+                     high.z > box.high.z ? high.z : box.high.z)};
+}
+
+static void box_batch(void *context, int batch, RenderCounters *counters) {
+  (void)counters;
+  SortJob *job = context;
+  const WavefrontRay *rays = job->wavefront->rays;
+  int begin = batch * WAVEFRONT_BATCH_SIZE;
+  int end = batch_end(batch, job->count);
+
+  OriginBox box = {rays[begin].origin, rays[begin].origin};
+  for (int i = begin + 1; i < end; i++) {
+    box = origin_box_grow(box, rays[i].origin, rays[i].origin);
+  }
+  job->wavefront->boxes[batch] = box;
+}
+
+static void count_digits(SortJob *job, int batch, const uint64_t *keys) {
+  int *counts = &job->wavefront->digit_counts[batch * WAVEFRONT_DIGITS];
+  for (int digit = 0; digit < WAVEFRONT_DIGITS; digit++) {
+    counts[digit] = 0;
+  }
+  int end = batch_end(batch, job->count);
+  for (int i = batch * WAVEFRONT_BATCH_SIZE; i < end; i++) {
+    counts[(keys[i] >> job->shift) & (WAVEFRONT_DIGITS - 1)]++;
+  }
+}
+
+/* Keys are (key << 32 | ray index), sorted on the key. */
+static void key_batch(void *context, int batch, RenderCounters *counters) {
+  (void)counters;
+  SortJob *job = context;
+  Wavefront *wavefront = job->wavefront;
+  int end = batch_end(batch, job->count);
+  for (int i = batch * WAVEFRONT_BATCH_SIZE; i < end; i++) {
+    wavefront->keys[i] = (uint64_t)ray_key(&wavefront->rays[i], job->low,
+                                           job->inverse_extent)
+                             << 32 |
+                         (uint32_t)i;
+  }
+  count_digits(job, batch, wavefront->keys);
+}
+
+static void count_batch(void *context, int batch, RenderCounters *counters) {
+  (void)counters;
+  SortJob *job = context;
+  count_digits(job, batch, job->wavefront->keys);
+}
+
+/* Turns the digit counts into the offset of each batch's first key with
+ * each digit, so that every batch scatters its keys in order. */
+static void offset_digits(Wavefront *wavefront, int count) {
+  int batches = batches_of(count);
+  int offset = 0;
+  for (int digit = 0; digit < WAVEFRONT_DIGITS; digit++) {
+    for (int batch = 0; batch < batches; batch++) {
+      int *counts = &wavefront->digit_counts[batch * WAVEFRONT_DIGITS];
+      int digit_count = counts[digit];
+      counts[digit] = offset;
+      offset += digit_count;
+    }
+  }
+}
+
+static void scatter_batch(void *context, int batch,
+                          RenderCounters *counters) {
+  (void)counters;
+  SortJob *job = context;
+  Wavefront *wavefront = job->wavefront;
+  int *offsets = &wavefront->digit_counts[batch * WAVEFRONT_DIGITS];
+  int end = batch_end(batch, job->count);
+  for (int i = batch * WAVEFRONT_BATCH_SIZE; i < end; i++) {
+    uint64_t key = wavefront->keys[i];
+    wavefront->sorted_keys[offsets[(key >> job->shift) &
+                                   (WAVEFRONT_DIGITS - 1)]++] = key;
+  }
+}
+
+static void gather_batch(void *context, int batch, RenderCounters *counters) {
+  (void)counters;
+  SortJob *job = context;
+  Wavefront *wavefront = job->wavefront;
+  int end = batch_end(batch, job->count);
+  for (int i = batch * WAVEFRONT_BATCH_SIZE; i < end; i++) {
+    wavefront->sorted[i] = wavefront->rays[(uint32_t)wavefront->keys[i]];
+  }
+}
+
+/* Least significant digit radix sort of the queue by ray_key. Each pass
+ * counts the digits of every batch in parallel, and each batch then
+ * scatters its keys from its own offsets, which keeps the sort stable
+ * and the order independent of the thread count. */
+static void sort_rays(Wavefront *wavefront, int count) {
+  SortJob job = {.wavefront = wavefront, .count = count};
+  int batches = batches_of(count);
+
+  raytracer_run(batches, box_batch, &job);
+  OriginBox box = wavefront->boxes[0];
+  for (int batch = 1; batch < batches; batch++) {
+    box = origin_box_grow(box, wavefront->boxes[batch].low,
+                          wavefront->boxes[batch].high);
+  }
+  job.low = box.low;
+  job.inverse_extent =
+      vector_3d_init(inverse_or_zero(box.high.x - box.low.x),
+                     inverse_or_zero(box.high.y - box.low.y),
+                     inverse_or_zero(box.high.z - box.low.z));
+
+  for (job.shift = 32; job.shift < 64; job.shift += WAVEFRONT_DIGIT_BITS) {
+    raytracer_run(batches, job.shift == 32 ? key_batch : count_batch, &job);
+    offset_digits(wavefront, count);
+    raytracer_run(batches, scatter_batch, &job);
+
+    uint64_t *swap = wavefront->keys;
+    wavefront->keys = wavefront->sorted_keys;
+    wavefront->sorted_keys = swap;
+  }
+
+  raytracer_run(batches, gather_batch, &job);
+  WavefrontRay *swap = wavefront->rays;
+  wavefront->rays = wavefront->sorted;
+  wavefront->sorted = swap;
+}
+
+WavefrontStats wavefront_render(Wavefront *wavefront, Scene *scene,
+                                Camera *camera, HdrImage *hdr,
+                                const WavefrontConfig *config) {
+  WavefrontStats stats = {0};
+
+  /* The first row and column are never traced. */
+  for (size_t i = 0; i < wavefront->capacity; i++) {
+    wavefront->hits[i] = (RayHit){.t = camera->ray_t_max, .sphere = -1};
+  }
+  main_raytracer_hdr(scene, camera, hdr, wavefront->hits, false);
+  stats.counters = raytracer_frame_counters();
+
+  int max_depth = config->max_depth < WAVEFRONT_MAX_DEPTH
+                      ? config->max_depth
+                      : WAVEFRONT_MAX_DEPTH;
+  if (max_depth <= 0) {
+    return stats;
+  }
+
+  BounceJob job = {.wavefront = wavefront,
+                   .scene = scene,
+                   .camera = camera,
+                   .hdr = hdr,
+                   .count = (int)wavefront->capacity};
+  raytracer_run(batches_of(job.count), primary_batch, &job);
+
+  int budget = config->ray_budget > 0 ? config->ray_budget : INT_MAX;
+  int count = emit(&job, true, &budget, &stats.budget_exhausted);
+
+  for (int depth = 0; depth < max_depth && count > 0; depth++) {
+    sort_rays(wavefront, count);
+
+    job.count = count;
+    job.reflect_again = depth + 1 < max_depth;
+    raytracer_run(batches_of(count), trace_batch, &job);
+
+    RenderCounters counters = raytracer_frame_counters();
+    raytracer_counters_add(&stats.counters, &counters);
+    stats.rays[depth] = count;
+
+    count = emit(&job, false, &budget, &stats.budget_exhausted);
+  }
+
+  return stats;
+}
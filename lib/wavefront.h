@@ -0,0 +1,62 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <stdbool.h>
+
+#include "camera.h"
+#include "constants.h"
+#include "hdr.h"
+#include "raytracer.h"
+#include "scene.h"
+
+/**
+ * @file wavefront.h
+ * @brief Mirror reflections traced breadth first, one bounce at a time.
+ *
+ * Following each pixel's reflections recursively would trace rays in
+ * pixel order and lose what neighbouring rays have in common. Instead the
+ * primary pass records every pixel's hit, and each reflective hit emits
+ * one reflection ray into a queue. The queue is sorted by direction and
+ * origin so that rays traced together visit the same BVH nodes and
+ * spheres, then traced in parallel batches, whose hits emit the queue of
+ * the next bounce. Sorting and emitting also run in parallel batches, in
+ * an order that does not depend on the thread count.
+ *
+ * A hit keeps (1 - reflective) of its own colour and takes the rest from
+ * what its reflection sees; the last bounce keeps its own colour. The ray
+ * budget caps the reflection rays of a frame, and a hit left without one
+ * also keeps its own colour.
+ */
+
+typedef struct {
+  int max_depth;  /**< Reflection bounces, at most WAVEFRONT_MAX_DEPTH */
+  int ray_budget; /**< Reflection rays per frame, 0 for no limit */
+} WavefrontConfig;
+
+typedef struct {
+  int rays[WAVEFRONT_MAX_DEPTH]; /**< Reflection rays traced per bounce */
+  bool budget_exhausted;         /**< Some hit was left without a ray */
+  RenderCounters counters;       /**< Primary pass and every bounce */
+} WavefrontStats;
+
+typedef struct Wavefront Wavefront;
+
+/**
+ * @return Renderer for width x height frames, or NULL on allocation
+ *         failure
+ */
+Wavefront *wavefront_create(int width, int height);
+
+void wavefront_destroy(Wavefront *wavefront);
+
+/**
+ * @brief Render a full resolution frame with reflections into hdr.
+ *
+ * hdr and camera must match the renderer's size. As with
+ * main_raytracer_hdr, the first row and column of hdr are not written.
+ */
+WavefrontStats wavefront_render(Wavefront *wavefront, Scene *scene,
+                                Camera *camera, HdrImage *hdr,
+                                const WavefrontConfig *config);
+
+#endif /* WAVEFRONT_H */
@@ -5,38 +5,62 @@
 #include <SDL3/SDL_main.h>
 #include <SDL3/SDL_scancode.h>
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "lib/camera.h"
+#include "lib/camera_path.h"
 #include "lib/constants.h"
-#include "lib/light.h"
+#include "lib/dynamic_resolution.h"
+#include "lib/frame_stats.h"
 #include "lib/raytracer.h"
+#include "lib/render_thread.h"
 #include "lib/scene.h"
-#include "lib/sphere.h"
-#include "lib/vector_3d.h"
+#include "lib/scene_file.h"
+#include "lib/temporal.h"
+#include "lib/timer.h"
+#include "lib/vector_batch.h"
 
 static SDL_Window *window = NULL;
 static SDL_Renderer *renderer = NULL;
 static SDL_Texture *texture = NULL;
 
-static uint32_t *framebuffer = NULL;
-
 static Camera *camera = NULL;
 static Scene *scene = NULL;
 
 static uint64_t last_ticks = 0;
 
-static int hd_rendered = false;
-static int show_hd = true;
-
-static inline void clear_framebuffer(VectorColor color) {
-  size_t count = (size_t)WINDOW_WIDTH * WINDOW_HEIGHT;
-  for (size_t i = 0; i < count; i++) {
-    framebuffer[i] = vector_color_to_rgb_color(color);
-  }
-}
+static const char *scene_path = NULL;
+static int window_width = WINDOW_WIDTH;
+static int window_height = WINDOW_HEIGHT;
+static int thread_count = RENDER_THREADS;
+static double frame_budget_ms = PROGRESSIVE_FRAME_BUDGET_MS;
+
+static bool use_temporal = false;
+static bool use_adaptive = false;
+static bool use_shadows = false;
+static bool use_foveated = false;
+static FoveatedConfig foveated_config;
+static TemporalCache *temporal = NULL;
+static double target_frame_ms = 0.0; /* 0 disables dynamic resolution */
+static DynamicResolution *dynamic = NULL;
+static RenderThread *render_thread = NULL;
+
+static bool show_overlay = false;
+static const char *stats_log_path = NULL;
+static FrameLog *stats_log = NULL;
+static bool stats_logging = false;
+static FrameStats stats;
+static double last_frame_start = 0.0;
+
+static const char *record_path = NULL;
+static const char *replay_path = NULL;
+static CameraRecorder *recorder = NULL;
+static CameraPath *camera_path = NULL;
+static int replay_frame = 0;
 
 static void initialize_camera(void) {
   camera = malloc(sizeof(Camera));
@@ -45,134 +69,208 @@ static void initialize_camera(void) {
     exit(1);
   }
 
-  camera->position = vector_3d_init(0.0f, 0.0f, -3.0f);
-
-  camera->width = WINDOW_WIDTH;
-  camera->height = WINDOW_HEIGHT;
-
-  camera->viewport_width = VIEWPORT_WIDTH;
-  camera->viewport_height = VIEWPORT_HEIGHT;
-  camera->viewport_distance = VIEWPORT_DISTANCE;
-
-  camera->ray_t_min = RAY_T_MIN;
-  camera->ray_t_max = RAY_T_MAX;
+  camera_init(camera, window_width, window_height);
+}
 
-  camera->yaw = 0.0f;
-  camera->pitch = 0.0f;
-  camera->roll = 0.0f;
+static void initialize_scene(void) {
+  if (!scene_path) {
+    scene = scene_create_demo();
+    if (!scene) {
+      SDL_Log("Out of memory (Scene)");
+      exit(1);
+    }
+  } else {
+    int error_line;
+    scene = scene_load(scene_path, camera, &error_line);
+    if (!scene && error_line > 0) {
+      SDL_Log("%s:%d: invalid line", scene_path, error_line);
+      exit(1);
+    }
+    if (!scene) {
+      SDL_Log("Cannot load %s: %s", scene_path, strerror(errno));
+      exit(1);
+    }
+  }
 
-  camera->pitch_range = MATH_PI / 3.0f; /* ±60° */
-  camera->roll_range = MATH_PI / 4.0f;  /* ±45° */
+  if (use_shadows) {
+    scene->shadows = true;
+  }
 
-  camera->move_speed = CAMERA_MOVE_SPEED;
-  camera->rotate_speed = CAMERA_ROTATE_SPEED;
+  if (scene->bvh->borrowed) {
+    SDL_Log("BVH: %d nodes over %d spheres mapped from %s",
+            scene->bvh->nodes_count, scene->spheres_count, scene_path);
+  } else {
+    SDL_Log("BVH: %d nodes over %d spheres built in %.3f ms",
+            scene->bvh->nodes_count, scene->spheres_count,
+            scene->bvh->build_time_ms);
+  }
+}
 
-  camera_update_orientation(camera);
+static void parse_arguments(int argc, char *argv[]) {
+  for (int i = 1; i < argc; i++) {
+    if (SDL_strcmp(argv[i], "--temporal") == 0) {
+      use_temporal = true;
+    } else if (SDL_strcmp(argv[i], "--adaptive") == 0) {
+      use_adaptive = true;
+    } else if (SDL_strcmp(argv[i], "--foveated") == 0) {
+      use_foveated = true;
+    } else if (SDL_strcmp(argv[i], "--shadows") == 0) {
+      use_shadows = true;
+    } else if (SDL_strcmp(argv[i], "--overlay") == 0) {
+      show_overlay = true;
+    } else if (i + 1 >= argc) {
+      break;
+    } else if (SDL_strcmp(argv[i], "--scene") == 0) {
+      scene_path = argv[++i];
+    } else if (SDL_strcmp(argv[i], "--width") == 0) {
+      int width = SDL_atoi(argv[++i]);
+      window_width = width > 0 ? width : WINDOW_WIDTH;
+    } else if (SDL_strcmp(argv[i], "--height") == 0) {
+      int height = SDL_atoi(argv[++i]);
+      window_height = height > 0 ? height : WINDOW_HEIGHT;
+    } else if (SDL_strcmp(argv[i], "--threads") == 0) {
+      thread_count = SDL_atoi(argv[++i]);
+    } else if (SDL_strcmp(argv[i], "--target-frame-time") == 0) {
+      target_frame_ms = SDL_atof(argv[++i]);
+    } else if (SDL_strcmp(argv[i], "--frame-budget") == 0) {
+      frame_budget_ms = SDL_atof(argv[++i]);
+    } else if (SDL_strcmp(argv[i], "--stats-log") == 0) {
+      stats_log_path = argv[++i];
+    } else if (SDL_strcmp(argv[i], "--record") == 0) {
+      record_path = argv[++i];
+    } else if (SDL_strcmp(argv[i], "--replay") == 0) {
+      replay_path = argv[++i];
+    }
+  }
 }
 
-static void initialize_scene(void) {
-  scene = malloc(sizeof(Scene));
-  if (!scene) {
-    SDL_Log("Out of memory (Scene)");
-    exit(1);
+/* The log file is created the first time logging is switched on and
+ * kept open, so switching it off and on again only pauses it. */
+static void toggle_stats_log(void) {
+  if (!stats_log) {
+    const char *path =
+        stats_log_path ? stats_log_path : STATS_LOG_DEFAULT_PATH;
+    stats_log = frame_log_open(path);
+    if (!stats_log) {
+      SDL_Log("Cannot write %s: %s", path, strerror(errno));
+      return;
+    }
   }
 
-  scene->spheres_count = 5;
-  scene->spheres = malloc(sizeof(Sphere) * scene->spheres_count);
+  stats_logging = !stats_logging;
+  SDL_Log("Frame stats log %s", stats_logging ? "on" : "off");
+}
 
-  if (!scene->spheres) {
-    SDL_Log("Out of memory (Sphere)");
-    exit(1);
+/* Text of the previous frame's stats, one SDL debug text line per line,
+ * over a black box. */
+static void draw_overlay(void) {
+  char text[512];
+  frame_stats_format(&stats, text, sizeof(text));
+
+  int lines = 1;
+  int columns = 0;
+  for (int i = 0, column = 0; text[i]; i++) {
+    if (text[i] == '\n') {
+      lines++;
+      column = 0;
+    } else if (++column > columns) {
+      columns = column;
+    }
   }
 
-  scene->spheres[0] =
-      (Sphere){vector_3d_init(0, -1, 3), 1, vector_color_red(), false, 500};
-  scene->spheres[1] =
-      (Sphere){vector_3d_init(2, 0, 4), 1, vector_color_blue(), false, 500};
-  scene->spheres[2] =
-      (Sphere){vector_3d_init(2, 1, 0), 0.05, vector_color_white(), true, -1};
-  scene->spheres[3] =
-      (Sphere){vector_3d_init(-2, 0, 4), 1, vector_color_green(), false, 500};
-  scene->spheres[4] = (Sphere){vector_3d_init(0, -5001, 0), 5000,
-                               vector_color_yellow(), false, 1000};
-
-  scene->lights_count = 3;
-  scene->lights = malloc(sizeof(Light) * scene->lights_count);
-  if (!scene->lights) {
-    SDL_Log("Out of memory (Light)");
-    exit(1);
+  const float line_height = SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE + 2;
+  SDL_SetRenderScale(renderer, OVERLAY_SCALE, OVERLAY_SCALE);
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+  SDL_RenderFillRect(
+      renderer,
+      &(SDL_FRect){0, 0,
+                   columns * SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE +
+                       2 * OVERLAY_MARGIN,
+                   lines * line_height + 2 * OVERLAY_MARGIN});
+
+  SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+  float y = OVERLAY_MARGIN;
+  for (char *line = strtok(text, "\n"); line; line = strtok(NULL, "\n")) {
+    SDL_RenderDebugText(renderer, OVERLAY_MARGIN, y, line);
+    y += line_height;
   }
 
-  scene->lights[0] = (Light){0.2f, AMBIENT, vector_3d_init(0, 0, 0)};
-  scene->lights[1] = (Light){0.6f, POINT, vector_3d_init(2, 1, 0)};
-  scene->lights[2] = (Light){0.2f, DIRECTIONAL, vector_3d_init(1, 4, 4)};
-
-  scene->default_background_color = vector_color_black();
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+  SDL_SetRenderScale(renderer, 1.0f, 1.0f);
 }
 
-static void handle_camera_input(Camera *camera, const bool *keys, float move,
-                                float rotate) {
+static uint32_t camera_controls(const bool *keys) {
+  uint32_t controls = 0;
+
   if (keys[SDL_SCANCODE_W]) {
-    camera_move_front(camera, move);
-    show_hd = false;
-    hd_rendered = false;
+    controls |= CAMERA_MOVE_FRONT;
   }
   if (keys[SDL_SCANCODE_S]) {
-    camera_move_back(camera, move);
-    show_hd = false;
-    hd_rendered = false;
+    controls |= CAMERA_MOVE_BACK;
   }
   if (keys[SDL_SCANCODE_A]) {
-    camera_move_left(camera, move);
-    show_hd = false;
-    hd_rendered = false;
+    controls |= CAMERA_MOVE_LEFT;
   }
   if (keys[SDL_SCANCODE_D]) {
-    camera_move_right(camera, move);
-    show_hd = false;
-    hd_rendered = false;
+    controls |= CAMERA_MOVE_RIGHT;
   }
   if (keys[SDL_SCANCODE_K]) {
-    camera_move_up(camera, move);
-    show_hd = false;
-    hd_rendered = false;
+    controls |= CAMERA_MOVE_UP;
   }
   if (keys[SDL_SCANCODE_J]) {
-    camera_move_down(camera, move);
-    show_hd = false;
-    hd_rendered = false;
+    controls |= CAMERA_MOVE_DOWN;
   }
 
   if (keys[SDL_SCANCODE_UP]) {
-    camera_pitch_up(camera, rotate);
-    show_hd = false;
-    hd_rendered = false;
+    controls |= CAMERA_PITCH_UP;
   }
   if (keys[SDL_SCANCODE_DOWN]) {
-    camera_pitch_down(camera, rotate);
-    show_hd = false;
-    hd_rendered = false;
+    controls |= CAMERA_PITCH_DOWN;
   }
   if (keys[SDL_SCANCODE_LEFT]) {
-    camera_yaw_left(camera, rotate);
-    show_hd = false;
-    hd_rendered = false;
+    controls |= CAMERA_YAW_LEFT;
   }
   if (keys[SDL_SCANCODE_RIGHT]) {
-    camera_yaw_right(camera, rotate);
-    show_hd = false;
-    hd_rendered = false;
+    controls |= CAMERA_YAW_RIGHT;
   }
   if (keys[SDL_SCANCODE_Q]) {
-    camera_roll_left(camera, rotate);
-    show_hd = false;
-    hd_rendered = false;
+    controls |= CAMERA_ROLL_LEFT;
   }
   if (keys[SDL_SCANCODE_E]) {
-    camera_roll_right(camera, rotate);
-    show_hd = false;
-    hd_rendered = false;
+    controls |= CAMERA_ROLL_RIGHT;
   }
+
+  return controls;
+}
+
+/* A replayed path replaces the keyboard and the clock, and a recording
+ * starts from the pose the replay or the scene file set. */
+static bool initialize_camera_path(void) {
+  if (replay_path) {
+    int error_line;
+    camera_path = camera_path_load(replay_path, &error_line);
+    if (!camera_path) {
+      if (error_line > 0) {
+        SDL_Log("%s:%d: invalid line", replay_path, error_line);
+      } else {
+        SDL_Log("Cannot load %s: %s", replay_path, strerror(errno));
+      }
+      return false;
+    }
+    camera_path_start(camera_path, camera);
+    SDL_Log("Replaying %d frames from %s", camera_path->frames_count,
+            replay_path);
+  }
+
+  if (record_path) {
+    recorder = camera_recorder_open(record_path, camera);
+    if (!recorder) {
+      SDL_Log("Cannot write %s: %s", record_path, strerror(errno));
+      return false;
+    }
+    SDL_Log("Recording the camera path to %s", record_path);
+  }
+  return true;
 }
 
 SDL_AppResult SDL_AppInit(void **appstate, int argc, char *argv[]) {
@@ -183,29 +281,71 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char *argv[]) {
     return SDL_APP_FAILURE;
   }
 
-  if (!SDL_CreateWindowAndRenderer("Raytracer", WINDOW_WIDTH, WINDOW_HEIGHT,
+  parse_arguments(argc, argv);
+
+  if (!SDL_CreateWindowAndRenderer("Raytracer", window_width, window_height,
                                    SDL_WINDOW_RESIZABLE, &window, &renderer)) {
     SDL_Log("Window creation failed: %s", SDL_GetError());
     return SDL_APP_FAILURE;
   }
 
-  SDL_SetRenderLogicalPresentation(renderer, WINDOW_WIDTH, WINDOW_HEIGHT,
+  SDL_SetRenderLogicalPresentation(renderer, window_width, window_height,
                                    SDL_LOGICAL_PRESENTATION_LETTERBOX);
 
   texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-                              SDL_TEXTUREACCESS_STREAMING, WINDOW_WIDTH,
-                              WINDOW_HEIGHT);
+                              SDL_TEXTUREACCESS_STREAMING, window_width,
+                              window_height);
 
-  framebuffer = malloc(sizeof(uint32_t) * WINDOW_WIDTH * WINDOW_HEIGHT);
-  if (!framebuffer) {
-    SDL_Log("Framebuffer allocation failed");
-    return SDL_APP_FAILURE;
-  }
+  /* Frames are paced by the display; the render thread is not. */
+  SDL_SetRenderVSync(renderer, 1);
 
   initialize_camera();
   initialize_scene();
+  if (!initialize_camera_path()) {
+    return SDL_APP_FAILURE;
+  }
 
-  clear_framebuffer(scene->default_background_color);
+  raytracer_init(thread_count);
+  SDL_Log("Rendering with %d thread(s), %s vector kernels",
+          raytracer_thread_count(),
+          vector_batch_level_name(vector_batch_select(SIMD_AVX512)));
+
+  if (use_temporal) {
+    temporal = temporal_create(window_width, window_height);
+    if (!temporal) {
+      SDL_Log("Out of memory (TemporalCache)");
+      return SDL_APP_FAILURE;
+    }
+  } else if (target_frame_ms > 0.0 && !use_adaptive && !use_foveated) {
+    dynamic =
+        dynamic_resolution_create(window_width, window_height, target_frame_ms);
+    if (!dynamic) {
+      SDL_Log("Out of memory (DynamicResolution)");
+      return SDL_APP_FAILURE;
+    }
+  }
+
+  if (stats_log_path) {
+    toggle_stats_log();
+  }
+
+  foveated_config = foveated_default_config();
+  camera_update_orientation(camera);
+  render_thread = render_thread_create(
+      &(RenderThreadConfig){.scene = scene,
+                            .width = window_width,
+                            .height = window_height,
+                            .frame_budget_ms = frame_budget_ms,
+                            .temporal = temporal,
+                            .adaptive = use_adaptive,
+                            .foveated = use_foveated ? &foveated_config
+                                                     : NULL,
+                            .dynamic = dynamic},
+      camera);
+  if (!render_thread) {
+    SDL_Log("Render thread creation failed");
+    return SDL_APP_FAILURE;
+  }
 
   last_ticks = SDL_GetTicks();
   return SDL_APP_CONTINUE;
@@ -215,61 +355,107 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
   if (event->type == SDL_EVENT_QUIT) {
     return SDL_APP_SUCCESS;
   }
+
+  if (event->type == SDL_EVENT_KEY_DOWN && !event->key.repeat) {
+    if (event->key.key == SDLK_F1) {
+      show_overlay = !show_overlay;
+    } else if (event->key.key == SDLK_F2) {
+      toggle_stats_log();
+    }
+  }
   return SDL_APP_CONTINUE;
 }
 
 SDL_AppResult SDL_AppIterate(void *appstate) {
+  double frame_start = timer_now_ms();
+
   uint64_t now = SDL_GetTicks();
   float delta_time = (now - last_ticks) / 1000.0f;
   last_ticks = now;
 
-  const bool *keys = SDL_GetKeyboardState(NULL);
-
-  bool moving = keys[SDL_SCANCODE_W] || keys[SDL_SCANCODE_S] ||
-                keys[SDL_SCANCODE_A] || keys[SDL_SCANCODE_D] ||
-                keys[SDL_SCANCODE_K] || keys[SDL_SCANCODE_J] ||
-                keys[SDL_SCANCODE_UP] || keys[SDL_SCANCODE_DOWN] ||
-                keys[SDL_SCANCODE_LEFT] || keys[SDL_SCANCODE_RIGHT] ||
-                keys[SDL_SCANCODE_Q] || keys[SDL_SCANCODE_E];
+  uint32_t controls;
+  if (camera_path) {
+    if (replay_frame == camera_path->frames_count) {
+      SDL_Log("Replayed %d frames", replay_frame);
+      return SDL_APP_SUCCESS;
+    }
+    controls = camera_path->frames[replay_frame].controls;
+    delta_time = camera_path->frames[replay_frame].delta_time;
+    replay_frame++;
+  } else {
+    controls = camera_controls(SDL_GetKeyboardState(NULL));
+  }
 
-  if (!moving) {
-    show_hd = true;
+  if (recorder &&
+      !camera_recorder_write(recorder, (double)now, delta_time, controls)) {
+    SDL_Log("Camera path: %s", strerror(errno));
+    camera_recorder_close(recorder);
+    recorder = NULL;
   }
 
-  handle_camera_input(camera, keys, camera->move_speed * delta_time,
-                      camera->rotate_speed * delta_time);
+  bool moved = camera_apply_controls(camera, controls, delta_time);
 
   camera_update_orientation(camera);
 
-  if (!show_hd || !hd_rendered) {
-
-    clear_framebuffer(scene->default_background_color);
+  /* Only the newest pose matters; the render thread drops older ones. */
+  if (moved) {
+    render_thread_set_camera(render_thread, camera);
+  }
 
-    main_raytracer(scene, camera, framebuffer, !show_hd);
+  uint32_t *framebuffer;
+  RenderCounters counters;
+  double trace_ms;
+  bool updated =
+      render_thread_acquire(render_thread, &framebuffer, &counters, &trace_ms);
 
-    if (show_hd) {
-      hd_rendered = true;
-    }
+  double upload_start = timer_now_ms();
+  if (updated) {
+    SDL_UpdateTexture(texture, NULL, framebuffer,
+                      window_width * sizeof(uint32_t));
   }
-
-  SDL_UpdateTexture(texture, NULL, framebuffer,
-                    WINDOW_WIDTH * sizeof(uint32_t));
+  double upload_end = timer_now_ms();
 
   SDL_RenderClear(renderer);
+  double clear_end = timer_now_ms();
+
   SDL_RenderTexture(renderer, texture, NULL, NULL);
+  if (show_overlay) {
+    draw_overlay();
+  }
   SDL_RenderPresent(renderer);
+  double present_end = timer_now_ms();
+
+  stats = (FrameStats){
+      .frame = stats.frame + 1,
+      .frame_ms = last_frame_start > 0.0 ? frame_start - last_frame_start
+                                         : present_end - frame_start,
+      .trace_ms = trace_ms,
+      .clear_ms = clear_end - upload_end,
+      .upload_ms = upload_end - upload_start,
+      .present_ms = present_end - clear_end,
+      .counters = counters};
+  last_frame_start = frame_start;
+
+  if (stats_logging && !frame_log_write(stats_log, &stats)) {
+    SDL_Log("Frame stats log: %s", strerror(errno));
+    stats_logging = false;
+  }
 
   return SDL_APP_CONTINUE;
 }
 
 void SDL_AppQuit(void *appstate, SDL_AppResult result) {
-  free(framebuffer);
-
-  if (scene) {
-    free(scene->spheres);
-    free(scene->lights);
-    free(scene);
+  frame_log_close(stats_log);
+  if (!camera_recorder_close(recorder)) {
+    SDL_Log("Cannot write %s: %s", record_path, strerror(errno));
   }
+  camera_path_destroy(camera_path);
+  render_thread_destroy(render_thread);
+  temporal_destroy(temporal);
+  dynamic_resolution_destroy(dynamic);
+  raytracer_quit();
+
+  scene_destroy(scene);
 
   free(camera);
 